@@ -0,0 +1,728 @@
+#pragma once
+
+#include "Simd.hpp"
+#include "AnimationCompression.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <assimp/scene.h>
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+
+#include <learnopengl/animdata.h>
+#include <learnopengl/assimp_glm_helpers.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <limits>
+
+namespace PBR{
+
+    // Keys of one kind (positions, rotations or scales) for every channel of a clip.
+    // Times and components are separate arrays and the channels are stored one after another,
+    // channel c owns the keys [first[c], first[c] + count[c])
+    struct KeyTrack
+    {
+        std::vector<float> times;
+        std::vector<float> x, y, z, w;
+
+        std::vector<uint32_t> first;
+        std::vector<uint32_t> count;
+    };
+
+    // Animation compiled at load time into a flat node array.
+    // Nodes are in topological order (a parent always comes before its children) and refer to their
+    // channel and bone by index, so evaluating a pose is one linear pass without names or lookups.
+    // The clip is immutable after construction and can be shared by any number of players.
+    class AnimationClip
+    {
+    public:
+        static constexpr int32_t NONE = -1;
+
+        // Bones found in the channels but missing from bone_info are appended to it, the same way
+        // learnopengl's Animation extends the bone map of the model
+        AnimationClip(const aiScene* scene, std::map<std::string, BoneInfo>& bone_info, int& bone_count, unsigned int animation_index = 0);
+        AnimationClip(const std::string& path, std::map<std::string, BoneInfo>& bone_info, int& bone_count, unsigned int animation_index = 0);
+
+        float get_duration() const { return _duration; }
+        float get_ticks_per_second() const { return _ticks_per_second; }
+
+        size_t get_node_count() const { return _parents.size(); }
+        size_t get_channel_count() const { return _channel_count; }
+        // Size of the bone matrix palette
+        size_t get_bone_count() const { return _bone_count; }
+
+        const std::vector<int32_t>& get_parents() const { return _parents; }
+        const std::vector<int32_t>& get_node_channels() const { return _node_channels; }
+        const std::vector<int32_t>& get_node_bones() const { return _node_bones; }
+        const std::vector<glm::mat4>& get_bind_locals() const { return _bind_locals; }
+        const std::vector<glm::mat4>& get_offsets() const { return _offsets; }
+
+        const KeyTrack& get_positions() const { return _positions; }
+        const KeyTrack& get_rotations() const { return _rotations; }
+        const KeyTrack& get_scales() const { return _scales; }
+
+        // Offline step: drops the keys that interpolation rebuilds within the tolerances and quantizes the rest.
+        // The float tracks are freed afterwards. Players must be created after the clip is compressed
+        CompressionReport compress(const CompressionSettings& settings = {});
+
+        bool is_compressed() const { return _compressed; }
+        const CompressedTrack& get_compressed_positions() const { return _compressed_positions; }
+        const CompressedTrack& get_compressed_rotations() const { return _compressed_rotations; }
+        const CompressedTrack& get_compressed_scales() const { return _compressed_scales; }
+
+    private:
+        float _duration{ 0.0f };
+        float _ticks_per_second{ 0.0f };
+        size_t _bone_count{ 0 };
+        size_t _channel_count{ 0 };
+
+        // Per node
+        std::vector<int32_t> _parents;
+        std::vector<int32_t> _node_channels;
+        std::vector<int32_t> _node_bones;
+        std::vector<glm::mat4> _bind_locals;
+        std::vector<glm::mat4> _offsets;
+
+        KeyTrack _positions;
+        KeyTrack _rotations;
+        KeyTrack _scales;
+
+        bool _compressed{ false };
+        CompressedTrack _compressed_positions;
+        CompressedTrack _compressed_rotations;
+        CompressedTrack _compressed_scales;
+
+        void _compile(const aiScene* scene, std::map<std::string, BoneInfo>& bone_info, int& bone_count, unsigned int animation_index);
+    };
+
+    // Playback state of one clip instance.
+    // Every channel keeps a cursor on its current key, so sampling a playing clip only looks at the
+    // next key or two; seeks and loops fall back to a binary search. Channels are interpolated
+    // PBR::simd::WIDTH at a time. The per frame update does not allocate.
+    class AnimationPlayer
+    {
+    public:
+        explicit AnimationPlayer(const AnimationClip& clip);
+
+        // Advances the time in seconds, wraps around the clip and evaluates the pose
+        void update(float delta_time);
+
+        // Time in ticks, wrapped into the clip from either side so negative speeds play backwards.
+        // Takes effect on the next update or evaluate
+        void set_time(float time);
+        float get_time() const { return _time; }
+
+        // Evaluates the pose at the current time into the internal palette
+        void evaluate() { evaluate(_bone_matrices.data()); }
+        // Evaluates into an external palette of get_bone_count() matrices, bones the clip does not animate are left untouched
+        void evaluate(glm::mat4* palette);
+
+        const AnimationClip& get_clip() const { return *_clip; }
+
+        const std::vector<glm::mat4>& get_bone_matrices() const { return _bone_matrices; }
+
+    private:
+        // Both keys of the current segment of every channel, padded to the SIMD width.
+        // The interpolated values are written over from
+        struct TrackSamples
+        {
+            std::vector<uint32_t> cursors;
+            std::vector<float> time0, time1;
+            std::vector<float> from[4];
+            std::vector<float> to[4];
+        };
+
+        const AnimationClip* _clip;
+        float _time{ 0.0f };
+
+        TrackSamples _positions;
+        TrackSamples _rotations;
+        TrackSamples _scales;
+
+        std::vector<glm::mat4> _globals;
+        std::vector<glm::mat4> _bone_matrices;
+
+        void _gather(const KeyTrack& track, TrackSamples& samples, int components);
+        void _gather(const CompressedTrack& track, TrackSamples& samples, bool rotations);
+        void _lerp(TrackSamples& samples);
+        void _slerp(TrackSamples& samples);
+    };
+
+    inline AnimationClip::AnimationClip(const aiScene* scene, std::map<std::string, BoneInfo>& bone_info, int& bone_count, unsigned int animation_index)
+    {
+        _compile(scene, bone_info, bone_count, animation_index);
+    }
+
+    inline AnimationClip::AnimationClip(const std::string& path, std::map<std::string, BoneInfo>& bone_info, int& bone_count, unsigned int animation_index)
+    {
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate);
+        if (!scene || !scene->mRootNode)
+            throw std::runtime_error{ "Failed to load the animation: " + path };
+
+        _compile(scene, bone_info, bone_count, animation_index);
+    }
+
+    inline void AnimationClip::_compile(const aiScene* scene, std::map<std::string, BoneInfo>& bone_info, int& bone_count, unsigned int animation_index)
+    {
+        if (animation_index >= scene->mNumAnimations)
+            throw std::runtime_error{ "The scene has no animation at the given index" };
+
+        const aiAnimation* animation = scene->mAnimations[animation_index];
+        _duration = static_cast<float>(animation->mDuration);
+        // Assimp leaves the tick rate at zero when the file does not specify it
+        _ticks_per_second = animation->mTicksPerSecond != 0.0 ? static_cast<float>(animation->mTicksPerSecond) : 25.0f;
+
+        auto begin_channel = [](KeyTrack& track) {
+            track.first.push_back(static_cast<uint32_t>(track.times.size()));
+        };
+        // Assimp always writes at least one key of each kind, but a hand built scene might not
+        auto end_channel = [](KeyTrack& track, const glm::vec4& fallback) {
+            if (track.times.size() == track.first.back())
+            {
+                track.times.push_back(0.0f);
+                track.x.push_back(fallback.x);
+                track.y.push_back(fallback.y);
+                track.z.push_back(fallback.z);
+                track.w.push_back(fallback.w);
+            }
+            track.count.push_back(static_cast<uint32_t>(track.times.size()) - track.first.back());
+        };
+        auto add_key = [](KeyTrack& track, double time, float x, float y, float z, float w) {
+            track.times.push_back(static_cast<float>(time));
+            track.x.push_back(x);
+            track.y.push_back(y);
+            track.z.push_back(z);
+            track.w.push_back(w);
+        };
+
+        // Names are only resolved here, once
+        std::unordered_map<std::string, int32_t> channel_indices;
+        for (unsigned int i = 0; i < animation->mNumChannels; i++)
+        {
+            const aiNodeAnim* source = animation->mChannels[i];
+
+            begin_channel(_positions);
+            for (unsigned int k = 0; k < source->mNumPositionKeys; k++)
+            {
+                const aiVectorKey& key = source->mPositionKeys[k];
+                add_key(_positions, key.mTime, key.mValue.x, key.mValue.y, key.mValue.z, 0.0f);
+            }
+            end_channel(_positions, glm::vec4{ 0.0f });
+
+            begin_channel(_rotations);
+            for (unsigned int k = 0; k < source->mNumRotationKeys; k++)
+            {
+                const aiQuatKey& key = source->mRotationKeys[k];
+                add_key(_rotations, key.mTime, key.mValue.x, key.mValue.y, key.mValue.z, key.mValue.w);
+            }
+            end_channel(_rotations, glm::vec4{ 0.0f, 0.0f, 0.0f, 1.0f });
+
+            begin_channel(_scales);
+            for (unsigned int k = 0; k < source->mNumScalingKeys; k++)
+            {
+                const aiVectorKey& key = source->mScalingKeys[k];
+                add_key(_scales, key.mTime, key.mValue.x, key.mValue.y, key.mValue.z, 0.0f);
+            }
+            end_channel(_scales, glm::vec4{ 1.0f, 1.0f, 1.0f, 0.0f });
+
+            std::string name = source->mNodeName.data;
+            if (bone_info.find(name) == bone_info.end())
+            {
+                bone_info[name].id = bone_count;
+                bone_count++;
+            }
+            channel_indices.emplace(std::move(name), static_cast<int32_t>(i));
+        }
+
+        // Depth first walk with an explicit stack, pre order keeps parents in front of their children
+        std::vector<std::pair<const aiNode*, int32_t>> stack{ { scene->mRootNode, NONE } };
+        while (!stack.empty())
+        {
+            auto [node, parent] = stack.back();
+            stack.pop_back();
+
+            const int32_t index = static_cast<int32_t>(_parents.size());
+            const std::string name = node->mName.data;
+
+            auto channel = channel_indices.find(name);
+            auto bone = bone_info.find(name);
+
+            _parents.push_back(parent);
+            _node_channels.push_back(channel != channel_indices.end() ? channel->second : NONE);
+            _node_bones.push_back(bone != bone_info.end() ? bone->second.id : NONE);
+            _bind_locals.push_back(AssimpGLMHelpers::ConvertMatrixToGLMFormat(node->mTransformation));
+            _offsets.push_back(bone != bone_info.end() ? bone->second.offset : glm::mat4{ 1.0f });
+
+            // Reversed so the first child is visited first
+            for (unsigned int i = node->mNumChildren; i-- > 0;)
+            {
+                stack.push_back({ node->mChildren[i], index });
+            }
+        }
+
+        _bone_count = static_cast<size_t>(bone_count);
+        _channel_count = animation->mNumChannels;
+    }
+
+    namespace detail{
+
+        // Start of the segment that contains time, relative to the first key of the channel.
+        // count must be at least two, times before the first key or after the last one clamp to the end segments
+        template<typename TTime>
+        inline uint32_t find_key(const TTime* times, uint32_t count, uint32_t cursor, float time)
+        {
+            const uint32_t last = count - 2;
+
+            // Playing forward moves at most a key or two per frame
+            if (cursor <= last && time >= times[cursor])
+            {
+                for (int step = 0; step < 2 && cursor < last && time >= times[cursor + 1]; step++)
+                {
+                    cursor++;
+                }
+                if (cursor == last || time < times[cursor + 1])
+                    return cursor;
+            }
+
+            // Seek, loop or a large time step
+            const TTime* next = std::upper_bound(times + 1, times + count - 1, time);
+            return static_cast<uint32_t>(next - times) - 1;
+        }
+
+        // Coefficients of Eberly's polynomial slerp ("A Fast and Accurate Algorithm for Computing SLERP").
+        // The weights are off by up to ~3e-5 for keys 180 degrees apart and far less for keys a frame apart
+        constexpr float SLERP_MU = 1.90110745351730037f;
+        constexpr float SLERP_U[8] = { 1.0f / (1 * 3), 1.0f / (2 * 5), 1.0f / (3 * 7), 1.0f / (4 * 9), 1.0f / (5 * 11), 1.0f / (6 * 13), 1.0f / (7 * 15), SLERP_MU / (8 * 17) };
+        constexpr float SLERP_V[8] = { 1.0f / 3, 2.0f / 5, 3.0f / 7, 4.0f / 9, 5.0f / 11, 6.0f / 13, 7.0f / 15, SLERP_MU * 8 / 17 };
+
+    }
+
+    inline CompressionReport AnimationClip::compress(const CompressionSettings& settings)
+    {
+        CompressionReport report;
+        if (_compressed)
+            return report;
+
+        const float duration = std::max(_duration, 1e-6f);
+        const float to_units = quantization::TIME_STEPS / duration;
+
+        auto compress_track = [&](const KeyTrack& track, CompressedTrack& output, bool rotations, float tolerance, float& max_error) {
+            auto value = [&](uint32_t key) {
+                return glm::vec4{ track.x[key], track.y[key], track.z[key], track.w[key] };
+            };
+            auto to_quat = [](const glm::vec4& v) {
+                return glm::quat{ v.w, v.x, v.y, v.z };
+            };
+            auto interpolate = [&](const glm::vec4& a, const glm::vec4& b, float t) {
+                if (!rotations)
+                    return glm::mix(a, b, t);
+
+                const glm::quat q = glm::normalize(glm::slerp(to_quat(a), to_quat(b), t));
+                return glm::vec4{ q.x, q.y, q.z, q.w };
+            };
+            auto distance = [&](const glm::vec4& a, const glm::vec4& b) {
+                if (!rotations)
+                    return glm::length(glm::vec3{ a } - glm::vec3{ b });
+
+                // The chord between unit quaternions keeps its precision for tiny angles where acos of the dot product does not
+                const float chord = glm::length(glm::dot(a, b) < 0.0f ? a + b : a - b);
+                return 4.0f * std::asin(std::min(chord * 0.5f, 1.0f));
+            };
+            auto quantized_time = [&](uint32_t key) {
+                return quantization::quantize(track.times[key] / duration, quantization::TIME_STEPS);
+            };
+
+            std::vector<uint32_t> kept;
+            const size_t channels = track.first.size();
+            for (size_t c = 0; c < channels; c++)
+            {
+                const uint32_t first = track.first[c];
+                const uint32_t count = track.count[c];
+
+                // Half the budget goes to key removal, the rest is left for quantization
+                const float budget = tolerance * 0.5f;
+
+                kept.clear();
+                kept.push_back(first);
+
+                bool constant = true;
+                for (uint32_t k = first + 1; k < first + count && constant; k++)
+                {
+                    constant = distance(value(first), value(k)) <= budget;
+                }
+
+                if (!constant)
+                {
+                    // Greedy: stretch each segment until one of the keys it skips would be off by more than the budget
+                    uint32_t anchor = first;
+                    for (uint32_t end = first + 2; end < first + count; end++)
+                    {
+                        const float span = track.times[end] - track.times[anchor];
+                        bool fits = span > 0.0f;
+                        for (uint32_t k = anchor + 1; k < end && fits; k++)
+                        {
+                            const float t = (track.times[k] - track.times[anchor]) / span;
+                            fits = distance(interpolate(value(anchor), value(end), t), value(k)) <= budget;
+                        }
+
+                        if (!fits)
+                        {
+                            kept.push_back(end - 1);
+                            anchor = end - 1;
+                        }
+                    }
+                    kept.push_back(first + count - 1);
+
+                    // Keys that land on the same 16 bit time would make an empty segment
+                    kept.erase(std::unique(kept.begin(), kept.end(), [&](uint32_t a, uint32_t b) { return quantized_time(a) == quantized_time(b); }), kept.end());
+                }
+
+                glm::vec3 min{ std::numeric_limits<float>::max() };
+                glm::vec3 max{ std::numeric_limits<float>::lowest() };
+                for (uint32_t key : kept)
+                {
+                    min = glm::min(min, glm::vec3{ value(key) });
+                    max = glm::max(max, glm::vec3{ value(key) });
+                }
+
+                output.first.push_back(static_cast<uint32_t>(output.times.size()));
+                output.count.push_back(static_cast<uint32_t>(kept.size()));
+                output.range_min.push_back(min);
+                output.range_extent.push_back(max - min);
+
+                for (uint32_t key : kept)
+                {
+                    uint16_t words[3];
+                    if (rotations)
+                        quantization::pack_quaternion(to_quat(value(key)), words);
+                    else
+                        quantization::pack_vector(glm::vec3{ value(key) }, min, max - min, words);
+
+                    output.times.push_back(quantized_time(key));
+                    output.words.insert(output.words.end(), words, words + 3);
+                }
+
+                // Measure what playback will see at every original key
+                const uint32_t out_first = output.first.back();
+                const uint32_t out_count = output.count.back();
+                auto decode = [&](uint32_t key) {
+                    if (rotations)
+                    {
+                        const glm::quat q = quantization::unpack_quaternion(&output.words[key * 3]);
+                        return glm::vec4{ q.x, q.y, q.z, q.w };
+                    }
+                    return glm::vec4{ quantization::unpack_vector(&output.words[key * 3], min, max - min), 0.0f };
+                };
+
+                for (uint32_t k = first; k < first + count; k++)
+                {
+                    glm::vec4 sample = decode(out_first);
+                    if (out_count > 1)
+                    {
+                        const float time = track.times[k] * to_units;
+                        const uint32_t key = out_first + detail::find_key(output.times.data() + out_first, out_count, 0, time);
+                        const float t = std::clamp((time - output.times[key]) / (output.times[key + 1] - output.times[key]), 0.0f, 1.0f);
+                        sample = interpolate(decode(key), decode(key + 1), t);
+                    }
+                    max_error = std::max(max_error, distance(sample, value(k)));
+                }
+
+                report.original_keys += count;
+                report.kept_keys += kept.size();
+            }
+
+            const size_t components = rotations ? 4 : 3;
+            report.original_bytes += track.times.size() * (sizeof(float) + components * sizeof(float)) + channels * 2 * sizeof(uint32_t);
+            report.compressed_bytes += output.times.size() * 4 * sizeof(uint16_t) + channels * 2 * sizeof(uint32_t);
+            if (!rotations)
+                report.compressed_bytes += channels * 2 * sizeof(glm::vec3);
+        };
+
+        compress_track(_positions, _compressed_positions, false, settings.position_tolerance, report.max_position_error);
+        compress_track(_rotations, _compressed_rotations, true, settings.rotation_tolerance, report.max_rotation_error);
+        compress_track(_scales, _compressed_scales, false, settings.scale_tolerance, report.max_scale_error);
+
+        _positions = {};
+        _rotations = {};
+        _scales = {};
+        _compressed = true;
+
+        return report;
+    }
+
+    inline AnimationPlayer::AnimationPlayer(const AnimationClip& clip)
+        : _clip{ &clip }, _globals(clip.get_node_count()), _bone_matrices(clip.get_bone_count(), glm::mat4{ 1.0f })
+    {
+        const size_t channels = clip.get_channel_count();
+        const size_t padded = (channels + simd::WIDTH - 1) / simd::WIDTH * simd::WIDTH;
+
+        for (TrackSamples* samples : { &_positions, &_rotations, &_scales })
+        {
+            samples->cursors.assign(channels, 0);
+            // Padding lanes interpolate the identity rotation with itself and stay finite
+            samples->time0.assign(padded, 0.0f);
+            samples->time1.assign(padded, 1.0f);
+            for (int c = 0; c < 4; c++)
+            {
+                samples->from[c].assign(padded, c == 3 ? 1.0f : 0.0f);
+                samples->to[c].assign(padded, c == 3 ? 1.0f : 0.0f);
+            }
+        }
+    }
+
+    inline void AnimationPlayer::set_time(float time)
+    {
+        const float duration = _clip->get_duration();
+        _time = std::fmod(time, duration);
+        if (_time < 0.0f)
+            _time += duration;
+        // A tiny negative time rounds up to the duration itself
+        if (_time >= duration)
+            _time = 0.0f;
+    }
+
+    inline void AnimationPlayer::update(float delta_time)
+    {
+        set_time(_time + _clip->get_ticks_per_second() * delta_time);
+
+        evaluate();
+    }
+
+    inline void AnimationPlayer::evaluate(glm::mat4* palette)
+    {
+        if (_clip->is_compressed())
+        {
+            _gather(_clip->get_compressed_positions(), _positions, false);
+            _gather(_clip->get_compressed_rotations(), _rotations, true);
+            _gather(_clip->get_compressed_scales(), _scales, false);
+        }
+        else
+        {
+            _gather(_clip->get_positions(), _positions, 3);
+            _gather(_clip->get_rotations(), _rotations, 4);
+            _gather(_clip->get_scales(), _scales, 3);
+        }
+
+        _lerp(_positions);
+        _slerp(_rotations);
+        _lerp(_scales);
+
+        const std::vector<int32_t>& parents = _clip->get_parents();
+        const std::vector<int32_t>& channels = _clip->get_node_channels();
+        const std::vector<int32_t>& bones = _clip->get_node_bones();
+        const std::vector<glm::mat4>& bind_locals = _clip->get_bind_locals();
+        const std::vector<glm::mat4>& offsets = _clip->get_offsets();
+
+        const std::vector<float>* position = _positions.from;
+        const std::vector<float>* rotation = _rotations.from;
+        const std::vector<float>* scale = _scales.from;
+
+        const size_t node_count = parents.size();
+        for (size_t i = 0; i < node_count; i++)
+        {
+            glm::mat4 local;
+            const int32_t channel = channels[i];
+            if (channel != AnimationClip::NONE)
+            {
+                // translation * rotation * scale without the matrix products
+                const glm::quat q{ rotation[3][channel], rotation[0][channel], rotation[1][channel], rotation[2][channel] };
+                local = glm::mat4_cast(q);
+                local[0] *= scale[0][channel];
+                local[1] *= scale[1][channel];
+                local[2] *= scale[2][channel];
+                local[3] = glm::vec4{ position[0][channel], position[1][channel], position[2][channel], 1.0f };
+            }
+            else
+            {
+                local = bind_locals[i];
+            }
+
+            const int32_t parent = parents[i];
+            _globals[i] = parent != AnimationClip::NONE ? _globals[parent] * local : local;
+
+            const int32_t bone = bones[i];
+            if (bone != AnimationClip::NONE)
+                palette[bone] = _globals[i] * offsets[i];
+        }
+    }
+
+    inline void AnimationPlayer::_gather(const KeyTrack& track, TrackSamples& samples, int components)
+    {
+        const std::vector<float>* values[4] = { &track.x, &track.y, &track.z, &track.w };
+
+        const size_t channels = track.first.size();
+        for (size_t c = 0; c < channels; c++)
+        {
+            const uint32_t first = track.first[c];
+            const uint32_t count = track.count[c];
+
+            uint32_t from = first;
+            uint32_t to = first;
+            if (count > 1)
+            {
+                uint32_t key = detail::find_key(track.times.data() + first, count, samples.cursors[c], _time);
+                samples.cursors[c] = key;
+                from = first + key;
+                to = from + 1;
+
+                samples.time0[c] = track.times[from];
+                samples.time1[c] = track.times[to];
+            }
+            else
+            {
+                // Constant channel, any factor gives the single key
+                samples.time0[c] = 0.0f;
+                samples.time1[c] = 1.0f;
+            }
+
+            for (int component = 0; component < components; component++)
+            {
+                samples.from[component][c] = (*values[component])[from];
+                samples.to[component][c] = (*values[component])[to];
+            }
+        }
+    }
+
+    inline void AnimationPlayer::_gather(const CompressedTrack& track, TrackSamples& samples, bool rotations)
+    {
+        // Keys are decoded only for the current segment, cursors and the search work on the 16 bit times
+        const float to_ticks = _clip->get_duration() / quantization::TIME_STEPS;
+        const float time = _time / to_ticks;
+
+        const size_t channels = track.first.size();
+        for (size_t c = 0; c < channels; c++)
+        {
+            const uint32_t first = track.first[c];
+            const uint32_t count = track.count[c];
+
+            uint32_t from = first;
+            uint32_t to = first;
+            if (count > 1)
+            {
+                uint32_t key = detail::find_key(track.times.data() + first, count, samples.cursors[c], time);
+                samples.cursors[c] = key;
+                from = first + key;
+                to = from + 1;
+
+                samples.time0[c] = track.times[from] * to_ticks;
+                samples.time1[c] = track.times[to] * to_ticks;
+            }
+            else
+            {
+                samples.time0[c] = 0.0f;
+                samples.time1[c] = 1.0f;
+            }
+
+            if (rotations)
+            {
+                const glm::quat a = quantization::unpack_quaternion(&track.words[from * 3]);
+                const glm::quat b = quantization::unpack_quaternion(&track.words[to * 3]);
+                samples.from[0][c] = a.x; samples.from[1][c] = a.y; samples.from[2][c] = a.z; samples.from[3][c] = a.w;
+                samples.to[0][c] = b.x; samples.to[1][c] = b.y; samples.to[2][c] = b.z; samples.to[3][c] = b.w;
+            }
+            else
+            {
+                const glm::vec3 a = quantization::unpack_vector(&track.words[from * 3], track.range_min[c], track.range_extent[c]);
+                const glm::vec3 b = quantization::unpack_vector(&track.words[to * 3], track.range_min[c], track.range_extent[c]);
+                for (int component = 0; component < 3; component++)
+                {
+                    samples.from[component][c] = a[component];
+                    samples.to[component][c] = b[component];
+                }
+            }
+        }
+    }
+
+    inline void AnimationPlayer::_lerp(TrackSamples& samples)
+    {
+        const simd::floatv time = simd::set1(_time);
+        const simd::floatv zero = simd::set1(0.0f);
+        const simd::floatv one = simd::set1(1.0f);
+
+        const size_t padded = samples.time0.size();
+        for (size_t i = 0; i < padded; i += simd::WIDTH)
+        {
+            const simd::floatv time0 = simd::load(&samples.time0[i]);
+            const simd::floatv time1 = simd::load(&samples.time1[i]);
+            const simd::floatv factor = simd::min(simd::max(simd::div(simd::sub(time, time0), simd::sub(time1, time0)), zero), one);
+
+            for (int component = 0; component < 3; component++)
+            {
+                const simd::floatv from = simd::load(&samples.from[component][i]);
+                const simd::floatv to = simd::load(&samples.to[component][i]);
+                simd::store(&samples.from[component][i], simd::fmadd(simd::sub(to, from), factor, from));
+            }
+        }
+    }
+
+    inline void AnimationPlayer::_slerp(TrackSamples& samples)
+    {
+        const simd::floatv time = simd::set1(_time);
+        const simd::floatv zero = simd::set1(0.0f);
+        const simd::floatv one = simd::set1(1.0f);
+
+        const size_t padded = samples.time0.size();
+        for (size_t i = 0; i < padded; i += simd::WIDTH)
+        {
+            const simd::floatv time0 = simd::load(&samples.time0[i]);
+            const simd::floatv time1 = simd::load(&samples.time1[i]);
+            const simd::floatv t = simd::min(simd::max(simd::div(simd::sub(time, time0), simd::sub(time1, time0)), zero), one);
+
+            simd::floatv from[4], to[4];
+            simd::floatv cosine = zero;
+            for (int component = 0; component < 4; component++)
+            {
+                from[component] = simd::load(&samples.from[component][i]);
+                to[component] = simd::load(&samples.to[component][i]);
+                cosine = simd::fmadd(from[component], to[component], cosine);
+            }
+
+            // Shortest arc, the same as glm::slerp
+            const simd::floatv sign = simd::select(simd::greater_equal(cosine, zero), one, simd::set1(-1.0f));
+            const simd::floatv x_minus_one = simd::sub(simd::abs(cosine), one);
+
+            const simd::floatv d = simd::sub(one, t);
+            const simd::floatv t_squared = simd::mul(t, t);
+            const simd::floatv d_squared = simd::mul(d, d);
+
+            simd::floatv series_t = one;
+            simd::floatv series_d = one;
+            for (int k = 7; k >= 0; k--)
+            {
+                const simd::floatv u = simd::set1(detail::SLERP_U[k]);
+                const simd::floatv v = simd::set1(detail::SLERP_V[k]);
+                const simd::floatv b_t = simd::mul(simd::sub(simd::mul(u, t_squared), v), x_minus_one);
+                const simd::floatv b_d = simd::mul(simd::sub(simd::mul(u, d_squared), v), x_minus_one);
+                series_t = simd::fmadd(b_t, series_t, one);
+                series_d = simd::fmadd(b_d, series_d, one);
+            }
+
+            const simd::floatv weight_to = simd::mul(sign, simd::mul(t, series_t));
+            const simd::floatv weight_from = simd::mul(d, series_d);
+
+            simd::floatv result[4];
+            simd::floatv length_squared = zero;
+            for (int component = 0; component < 4; component++)
+            {
+                result[component] = simd::fmadd(from[component], weight_from, simd::mul(to[component], weight_to));
+                length_squared = simd::fmadd(result[component], result[component], length_squared);
+            }
+
+            const simd::floatv inverse_length = simd::div(one, simd::sqrt(length_squared));
+            for (int component = 0; component < 4; component++)
+            {
+                simd::store(&samples.from[component][i], simd::mul(result[component], inverse_length));
+            }
+        }
+    }
+
+}
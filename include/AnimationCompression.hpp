@@ -0,0 +1,135 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+namespace PBR{
+
+    struct CompressionSettings
+    {
+        // Largest error a removed key may have when it is rebuilt from the keys around it
+        float position_tolerance = 0.0005f;
+        // Radians
+        float rotation_tolerance = 0.0005f;
+        float scale_tolerance = 0.0005f;
+    };
+
+    // Sizes and the largest error of the compressed clip, measured at every original key
+    struct CompressionReport
+    {
+        size_t original_keys{ 0 };
+        size_t kept_keys{ 0 };
+        size_t original_bytes{ 0 };
+        size_t compressed_bytes{ 0 };
+
+        float max_position_error{ 0.0f };
+        // Radians
+        float max_rotation_error{ 0.0f };
+        float max_scale_error{ 0.0f };
+
+        double get_ratio() const { return compressed_bytes != 0 ? static_cast<double>(original_bytes) / compressed_bytes : 0.0; }
+    };
+
+    // Keys of one kind after compression, laid out like KeyTrack.
+    // Times are in 1/65535 of the clip duration and every key is three 16 bit words: a vector quantized
+    // to the range of its channel, or a smallest three quaternion
+    struct CompressedTrack
+    {
+        std::vector<uint16_t> times;
+        std::vector<uint16_t> words;
+
+        // Per channel, unused by rotations
+        std::vector<glm::vec3> range_min;
+        std::vector<glm::vec3> range_extent;
+
+        std::vector<uint32_t> first;
+        std::vector<uint32_t> count;
+    };
+
+    namespace quantization{
+
+        constexpr float TIME_STEPS = 65535.0f;
+        constexpr float SQRT_2 = 1.41421356237309505f;
+
+        inline uint16_t quantize(float unit, float steps)
+        {
+            return static_cast<uint16_t>(std::lround(std::clamp(unit, 0.0f, 1.0f) * steps));
+        }
+
+        inline void pack_vector(const glm::vec3& value, const glm::vec3& min, const glm::vec3& extent, uint16_t* words)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                words[i] = extent[i] > 0.0f ? quantize((value[i] - min[i]) / extent[i], 65535.0f) : 0;
+            }
+        }
+
+        inline glm::vec3 unpack_vector(const uint16_t* words, const glm::vec3& min, const glm::vec3& extent)
+        {
+            constexpr float scale = 1.0f / 65535.0f;
+            return { min.x + extent.x * (words[0] * scale), min.y + extent.y * (words[1] * scale), min.z + extent.z * (words[2] * scale) };
+        }
+
+        // Smallest three: the largest component is dropped and rebuilt from the unit length,
+        // the other three lie in [-1/sqrt(2), 1/sqrt(2)] and get 15 bits each, the index of the dropped one 2 bits
+        inline void pack_quaternion(const glm::quat& rotation, uint16_t* words)
+        {
+            const glm::quat q = glm::normalize(rotation);
+            const float components[4] = { q.x, q.y, q.z, q.w };
+
+            int largest = 0;
+            for (int i = 1; i < 4; i++)
+            {
+                if (std::abs(components[i]) > std::abs(components[largest]))
+                    largest = i;
+            }
+
+            // q and -q are the same rotation, keeping the dropped component positive makes its sign implicit
+            const float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+
+            uint64_t bits = static_cast<uint64_t>(largest);
+            for (int i = 0; i < 4; i++)
+            {
+                if (i == largest)
+                    continue;
+
+                const float unit = (components[i] * sign * SQRT_2 + 1.0f) * 0.5f;
+                bits = (bits << 15) | quantize(unit, 32767.0f);
+            }
+
+            words[0] = static_cast<uint16_t>(bits >> 32);
+            words[1] = static_cast<uint16_t>(bits >> 16);
+            words[2] = static_cast<uint16_t>(bits);
+        }
+
+        inline glm::quat unpack_quaternion(const uint16_t* words)
+        {
+            const uint64_t bits = (static_cast<uint64_t>(words[0]) << 32) | (static_cast<uint64_t>(words[1]) << 16) | words[2];
+            const int largest = static_cast<int>(bits >> 45) & 3;
+
+            float components[4];
+            float sum = 0.0f;
+            int shift = 30;
+            for (int i = 0; i < 4; i++)
+            {
+                if (i == largest)
+                    continue;
+
+                const float unit = static_cast<float>((bits >> shift) & 0x7FFF) / 32767.0f;
+                components[i] = (unit * 2.0f - 1.0f) * (1.0f / SQRT_2);
+                sum += components[i] * components[i];
+                shift -= 15;
+            }
+            components[largest] = std::sqrt(std::max(0.0f, 1.0f - sum));
+
+            return glm::quat{ components[3], components[0], components[1], components[2] };
+        }
+
+    }
+
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "AnimationClip.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace PBR{
+
+    // Layout of the palette buffer, both are read as an array of vec4 by the skinning shaders
+    enum class PaletteFormat{
+        Matrices,           // 4 columns per bone, linear blend skinning
+        DualQuaternions,    // Real and dual part per bone, rigid bones only, keeps volume at twisting joints
+    };
+
+    // Unit dual quaternion of the rigid part of a bone matrix, scale is dropped
+    inline void to_dual_quaternion(const glm::mat4& matrix, glm::vec4* output)
+    {
+        const glm::mat3 rotation{ glm::normalize(glm::vec3{ matrix[0] }), glm::normalize(glm::vec3{ matrix[1] }), glm::normalize(glm::vec3{ matrix[2] }) };
+        const glm::quat real = glm::normalize(glm::quat_cast(rotation));
+        const glm::quat dual = glm::quat{ 0.0f, glm::vec3{ matrix[3] } } * real * 0.5f;
+
+        output[0] = glm::vec4{ real.x, real.y, real.z, real.w };
+        output[1] = glm::vec4{ dual.x, dual.y, dual.z, dual.w };
+    }
+
+    // Plays many instances of shared clips.
+    // Instances are evaluated in parallel on a ThreadPool and write their bone matrices into one
+    // contiguous palette buffer, instance after instance, which is uploaded to the GPU in one call.
+    class AnimationSystem
+    {
+    public:
+        AnimationSystem() = default;
+
+        AnimationSystem(const AnimationSystem&) = delete;
+        AnimationSystem& operator=(const AnimationSystem&) = delete;
+
+        // The clip must outlive the system, time is in ticks
+        uint32_t add_instance(const AnimationClip& clip, float time = 0.0f, float speed = 1.0f);
+
+        void set_time(uint32_t instance, float time) { _players[instance].set_time(time); }
+        void set_speed(uint32_t instance, float speed) { _speeds[instance] = speed; }
+        float get_time(uint32_t instance) const { return _players[instance].get_time(); }
+
+        // Dual quaternions are converted on the workers right after each instance is evaluated
+        void set_palette_format(PaletteFormat format) { _format = format; }
+        PaletteFormat get_palette_format() const { return _format; }
+
+        // Advances every instance by its own speed and evaluates all of them
+        void update(float delta_time, ThreadPool& pool);
+
+        size_t get_instance_count() const { return _players.size(); }
+
+        // Index of the first bone of the instance in the palette buffer
+        uint32_t get_palette_offset(uint32_t instance) const { return _palette_offsets[instance]; }
+        const std::vector<glm::mat4>& get_palettes() const { return _palettes; }
+        // Two vec4 per bone, filled only in the dual quaternion format
+        const std::vector<glm::vec4>& get_dual_quaternions() const { return _dual_quaternions; }
+
+        // Copies the palettes of this frame into the shader storage buffer and binds it to the binding point
+        void upload(unsigned int binding);
+        unsigned int get_buffer() const { return _buffer; }
+
+        // Must be called while the context is still alive
+        void release();
+
+    private:
+        // Instances handed to a worker at a time, large enough that the job handoff is amortized
+        static constexpr size_t BATCH_SIZE = 8;
+
+        std::vector<AnimationPlayer> _players;
+        std::vector<float> _speeds;
+        std::vector<uint32_t> _palette_offsets;
+        std::vector<glm::mat4> _palettes;
+        std::vector<glm::vec4> _dual_quaternions;
+        PaletteFormat _format{ PaletteFormat::Matrices };
+
+        unsigned int _buffer{ 0 };
+        size_t _buffer_size{ 0 };
+    };
+
+    inline uint32_t AnimationSystem::add_instance(const AnimationClip& clip, float time, float speed)
+    {
+        const uint32_t instance = static_cast<uint32_t>(_players.size());
+
+        _players.emplace_back(clip);
+        _players.back().set_time(time);
+        _speeds.push_back(speed);
+
+        _palette_offsets.push_back(static_cast<uint32_t>(_palettes.size()));
+        _palettes.resize(_palettes.size() + clip.get_bone_count(), glm::mat4{ 1.0f });
+
+        return instance;
+    }
+
+    inline void AnimationSystem::update(float delta_time, ThreadPool& pool)
+    {
+        if (_format == PaletteFormat::DualQuaternions)
+            _dual_quaternions.resize(_palettes.size() * 2);
+
+        const size_t batches = (_players.size() + BATCH_SIZE - 1) / BATCH_SIZE;
+
+        // Every instance owns its cursors, scratch buffers and palette range, so the jobs share nothing writable
+        pool.parallel_for(batches, [&](size_t batch) {
+            const size_t end = std::min(_players.size(), (batch + 1) * BATCH_SIZE);
+            for (size_t i = batch * BATCH_SIZE; i < end; i++)
+            {
+                AnimationPlayer& player = _players[i];
+                const float ticks = player.get_clip().get_ticks_per_second() * delta_time * _speeds[i];
+                player.set_time(player.get_time() + ticks);
+                player.evaluate(_palettes.data() + _palette_offsets[i]);
+
+                if (_format == PaletteFormat::DualQuaternions)
+                {
+                    const size_t first = _palette_offsets[i];
+                    const size_t last = first + player.get_clip().get_bone_count();
+                    for (size_t bone = first; bone < last; bone++)
+                    {
+                        to_dual_quaternion(_palettes[bone], _dual_quaternions.data() + bone * 2);
+                    }
+                }
+            }
+        });
+    }
+
+    inline void AnimationSystem::upload(unsigned int binding)
+    {
+        if (_buffer == 0)
+            glGenBuffers(1, &_buffer);
+
+        const bool dual_quaternions = _format == PaletteFormat::DualQuaternions;
+        const size_t size = dual_quaternions ? _dual_quaternions.size() * sizeof(glm::vec4) : _palettes.size() * sizeof(glm::mat4);
+        const void* data = dual_quaternions ? static_cast<const void*>(_dual_quaternions.data()) : static_cast<const void*>(_palettes.data());
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, _buffer);
+        // Orphaning the storage lets the driver hand out fresh memory while last frame's draws still read the old one
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(size, _buffer_size), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, _buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        _buffer_size = std::max(size, _buffer_size);
+    }
+
+    inline void AnimationSystem::release()
+    {
+        if (_buffer != 0)
+            glDeleteBuffers(1, &_buffer);
+
+        _buffer = 0;
+        _buffer_size = 0;
+    }
+
+}
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "FrustumCulling.hpp"
+#include "GpuTimer.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+namespace PBR{
+
+    // Cascaded shadow map of one directional light in a depth texture array, one layer per cascade.
+    // Each cascade covers the bounding sphere of its slice of the view frustum, so its size does not change
+    // when the camera turns. The sphere is padded and its center snapped to a coarse grid of whole texels,
+    // which keeps the cascade still, and free of shimmering, until the camera moved a fair bit.
+    // Static casters are rendered into a cache layer only when the snapped cascade moved, the light turned
+    // or the static scene changed. Every frame the cache is copied into the sampled layer and the dynamic casters go on top.
+    class CascadedShadowMap
+    {
+    public:
+        static constexpr int CASCADES = 4;
+
+        struct Cascade
+        {
+            glm::mat4 view{ 1.0f };
+            glm::mat4 projection{ 1.0f };
+            // World space to shadow map texture coordinates and depth
+            glm::mat4 shadow_matrix{ 1.0f };
+            // Caster volume, the light box stretched towards the light
+            Frustum bounds;
+
+            // View depth where the cascade ends
+            float split{ 0.0f };
+            float texel_size{ 0.0f };
+
+            // Snapped light space center and half size of the cache
+            glm::vec4 key{ 0.0f };
+            bool static_dirty{ true };
+
+            // Last frame
+            unsigned int static_casters{ 0 };
+            unsigned int dynamic_casters{ 0 };
+            bool static_rendered{ false };
+            unsigned int static_renders{ 0 };
+            GpuTimer timer;
+        };
+
+        explicit CascadedShadowMap(int resolution = 2048, float caster_distance = 50.0f)
+            : _resolution(resolution), _caster_distance(caster_distance) {}
+
+        CascadedShadowMap(const CascadedShadowMap&) = delete;
+        CascadedShadowMap& operator=(const CascadedShadowMap&) = delete;
+
+        // Fits the cascades to the camera, marks the static caches that moved or whose light turned.
+        // Direction is the one the light travels in
+        void update(const glm::mat4& camera_view, float fov_y, float aspect, float near_plane, float shadow_distance, const glm::vec3& light_direction);
+
+        // Static casters changed, every cache is rebuilt on the next render
+        void invalidate_static();
+
+        // Renders one cascade. draw_static is only called when the cache is rebuilt, draw_dynamic every frame.
+        // Both draw depth only with the matrices of get_cascade(cascade), the depth state is set up here
+        template<typename TStatic, typename TDynamic>
+        void render(int cascade, unsigned int static_casters, unsigned int dynamic_casters, TStatic&& draw_static, TDynamic&& draw_dynamic);
+
+        const Cascade& get_cascade(int cascade) const { return _cascades[cascade]; }
+        int get_resolution() const { return _resolution; }
+        unsigned int get_texture() const { return _texture; }
+
+        // Must be called while the context is still alive
+        void release();
+
+    private:
+        void _create();
+
+        int _resolution;
+        float _caster_distance;
+
+        // Fraction of the radius the cascade is padded by, the center only snaps every 2 * PADDING radii
+        static constexpr float PADDING = 0.1f;
+        static constexpr float SPLIT_LAMBDA = 0.75f;
+
+        Cascade _cascades[CASCADES];
+        // Of the last update, any turn of the light views the static casters from elsewhere
+        glm::vec3 _light_forward{ 0.0f };
+
+        unsigned int _texture{ 0 };
+        unsigned int _cache{ 0 };
+        unsigned int _framebuffers[CASCADES]{};
+        unsigned int _cache_framebuffers[CASCADES]{};
+        bool _dynamic_drawn[CASCADES]{};
+    };
+
+    inline void CascadedShadowMap::update(const glm::mat4& camera_view, float fov_y, float aspect, float near_plane, float shadow_distance, const glm::vec3& light_direction)
+    {
+        const glm::mat4 inverse_view = glm::inverse(camera_view);
+        const glm::vec3 camera_position{ inverse_view[3] };
+        const glm::vec3 camera_front = -glm::normalize(glm::vec3{ inverse_view[2] });
+
+        // Light basis, the same one glm::lookAt builds, so snapping in it is snapping to texels
+        const glm::vec3 forward = glm::normalize(light_direction);
+        const glm::vec3 up_hint = std::abs(forward.y) > 0.99f ? glm::vec3{ 1.0f, 0.0f, 0.0f } : glm::vec3{ 0.0f, 1.0f, 0.0f };
+        const glm::vec3 right = glm::normalize(glm::cross(forward, up_hint));
+        const glm::vec3 up = glm::cross(right, forward);
+        if (forward != _light_forward)
+        {
+            _light_forward = forward;
+            invalidate_static();
+        }
+
+        // Squared tangent of the frustum diagonal
+        const float tan_y = std::tan(fov_y * 0.5f);
+        const float k = tan_y * tan_y * (1.0f + aspect * aspect);
+
+        float split_near = near_plane;
+        for (int i = 0; i < CASCADES; i++)
+        {
+            Cascade& cascade = _cascades[i];
+
+            // Between logarithmic and uniform splits
+            const float t = static_cast<float>(i + 1) / CASCADES;
+            const float split_far = SPLIT_LAMBDA * near_plane * std::pow(shadow_distance / near_plane, t) + (1.0f - SPLIT_LAMBDA) * (near_plane + (shadow_distance - near_plane) * t);
+            cascade.split = split_far;
+
+            // Smallest sphere around the slice, centered on the view axis
+            float center_depth = 0.5f * (split_near + split_far) * (1.0f + k);
+            float radius;
+            if (center_depth >= split_far)
+            {
+                center_depth = split_far;
+                radius = split_far * std::sqrt(k);
+            }
+            else
+            {
+                radius = std::sqrt(split_far * split_far * k + (split_far - center_depth) * (split_far - center_depth));
+            }
+            split_near = split_far;
+
+            const float half_size = radius * (1.0f + PADDING);
+            cascade.texel_size = 2.0f * half_size / _resolution;
+
+            // Step of whole texels no longer than the padding on either side
+            const float step = std::max(1.0f, std::floor(2.0f * PADDING * radius / cascade.texel_size)) * cascade.texel_size;
+            const glm::vec3 center = camera_position + camera_front * center_depth;
+            const glm::vec3 light_center{
+                std::round(glm::dot(center, right) / step) * step,
+                std::round(glm::dot(center, up) / step) * step,
+                std::round(glm::dot(center, forward) / step) * step,
+            };
+
+            const glm::vec4 key{ light_center, half_size };
+            if (key != cascade.key)
+            {
+                cascade.key = key;
+                cascade.static_dirty = true;
+            }
+
+            const glm::vec3 snapped = right * light_center.x + up * light_center.y + forward * light_center.z;
+            const float depth_range = 2.0f * half_size + _caster_distance;
+            const glm::vec3 eye = snapped - forward * (half_size + _caster_distance);
+
+            cascade.view = glm::lookAt(eye, snapped, up);
+            cascade.projection = glm::ortho(-half_size, half_size, -half_size, half_size, 0.0f, depth_range);
+
+            // From clip space to [0, 1] texture coordinates and depth
+            const glm::mat4 bias = glm::scale(glm::translate(glm::mat4{ 1.0f }, glm::vec3{ 0.5f }), glm::vec3{ 0.5f });
+            cascade.shadow_matrix = bias * cascade.projection * cascade.view;
+
+            cascade.bounds.leftFace = { snapped - right * half_size, right };
+            cascade.bounds.rightFace = { snapped + right * half_size, -right };
+            cascade.bounds.bottomFace = { snapped - up * half_size, up };
+            cascade.bounds.topFace = { snapped + up * half_size, -up };
+            cascade.bounds.nearFace = { eye, forward };
+            cascade.bounds.farFace = { snapped + forward * half_size, -forward };
+        }
+    }
+
+    inline void CascadedShadowMap::invalidate_static()
+    {
+        for (Cascade& cascade : _cascades)
+        {
+            cascade.static_dirty = true;
+        }
+    }
+
+    template<typename TStatic, typename TDynamic>
+    inline void CascadedShadowMap::render(int index, unsigned int static_casters, unsigned int dynamic_casters, TStatic&& draw_static, TDynamic&& draw_dynamic)
+    {
+        if (_texture == 0)
+            _create();
+
+        Cascade& cascade = _cascades[index];
+        cascade.timer.begin();
+
+        glViewport(0, 0, _resolution, _resolution);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+
+        const bool rebuild = cascade.static_dirty;
+        if (rebuild)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, _cache_framebuffers[index]);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            draw_static();
+
+            cascade.static_dirty = false;
+            cascade.static_casters = static_casters;
+            cascade.static_renders++;
+        }
+        cascade.static_rendered = rebuild;
+
+        // The sampled layer already holds the cache when nothing changed and nothing dynamic was drawn over it
+        if (rebuild || _dynamic_drawn[index] || dynamic_casters > 0)
+        {
+            glCopyImageSubData(_cache, GL_TEXTURE_2D_ARRAY, 0, 0, 0, index, _texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, index, _resolution, _resolution, 1);
+        }
+
+        if (dynamic_casters > 0)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, _framebuffers[index]);
+            draw_dynamic();
+        }
+        _dynamic_drawn[index] = dynamic_casters > 0;
+        cascade.dynamic_casters = dynamic_casters;
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        cascade.timer.end();
+    }
+
+    inline void CascadedShadowMap::_create()
+    {
+        for (unsigned int* texture : { &_texture, &_cache })
+        {
+            glGenTextures(1, texture);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, *texture);
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, _resolution, _resolution, CASCADES);
+
+            // Hardware comparison with bilinear filtering, outside the map is lit
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+            const float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+            glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenFramebuffers(CASCADES, _framebuffers);
+        glGenFramebuffers(CASCADES, _cache_framebuffers);
+        for (int i = 0; i < CASCADES; i++)
+        {
+            for (auto [framebuffer, texture] : { std::pair{ _framebuffers[i], _texture }, std::pair{ _cache_framebuffers[i], _cache } })
+            {
+                glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, i);
+                glDrawBuffer(GL_NONE);
+                glReadBuffer(GL_NONE);
+
+                if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                    std::cerr << "Shadow cascade framebuffer " << i << " is not complete\n";
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        invalidate_static();
+    }
+
+    inline void CascadedShadowMap::release()
+    {
+        if (_texture != 0)
+        {
+            glDeleteTextures(1, &_texture);
+            glDeleteTextures(1, &_cache);
+            glDeleteFramebuffers(CASCADES, _framebuffers);
+            glDeleteFramebuffers(CASCADES, _cache_framebuffers);
+        }
+
+        _texture = 0;
+        _cache = 0;
+        for (int i = 0; i < CASCADES; i++)
+        {
+            _framebuffers[i] = 0;
+            _cache_framebuffers[i] = 0;
+            _dynamic_drawn[i] = false;
+        }
+
+        for (Cascade& cascade : _cascades)
+        {
+            cascade.timer.release();
+        }
+    }
+
+}
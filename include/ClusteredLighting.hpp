@@ -0,0 +1,358 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "Light.hpp"
+#include "Shader.hpp"
+#include "Simd.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <bit>
+
+namespace PBR{
+
+    // Shader storage layout of one light, four vec4 in std430
+    struct ClusterLight
+    {
+        glm::vec4 position_range;       // World space position, distance where the light is cut off
+        glm::vec4 color_type;           // Radiance, 0 for point lights and 1 for spot lights
+        glm::vec4 direction_outer;      // Spot direction, cosine of the outer cone
+        glm::vec4 attenuation_inner;    // constant, linear, quadratic, cosine of the inner cone
+    };
+
+    // Distance where the classical attenuation of the brightest channel falls below the threshold.
+    // The shader fades the light out towards it so the cut is not visible
+    inline float light_range(const glm::vec3& color, const glm::vec3& attenuation, float threshold = 1.0f / 256.0f)
+    {
+        constexpr float max_range = 1000.0f;
+
+        const float target = std::max({ color.r, color.g, color.b }) / threshold;
+        const float constant = attenuation.x - target;
+        if (constant >= 0.0f)
+            return 0.0f;
+
+        if (attenuation.z > 0.0f)
+            return std::min(max_range, (-attenuation.y + std::sqrt(attenuation.y * attenuation.y - 4.0f * attenuation.z * constant)) / (2.0f * attenuation.z));
+        if (attenuation.y > 0.0f)
+            return std::min(max_range, -constant / attenuation.y);
+        return max_range;
+    }
+
+    inline ClusterLight pack_light(const PointLight& light)
+    {
+        return {
+            glm::vec4{ light.position, light_range(light.diffuse, light.attenuationScalars) },
+            glm::vec4{ light.diffuse, 0.0f },
+            glm::vec4{ 0.0f, 0.0f, -1.0f, -1.0f },
+            glm::vec4{ light.attenuationScalars, -1.0f },
+        };
+    }
+
+    // The cone is bounded by the range sphere, tighter bounds are not worth it at the cluster sizes used here
+    inline ClusterLight pack_light(const SpotLight& light)
+    {
+        return {
+            glm::vec4{ light.position, light_range(light.diffuse, light.attenuationScalars) },
+            glm::vec4{ light.diffuse, 1.0f },
+            glm::vec4{ glm::normalize(light.direction), light.outerCutOff },
+            glm::vec4{ light.attenuationScalars, light.cutoff },
+        };
+    }
+
+    // Froxel grid over the view frustum: screen tiles in x and y, slices growing exponentially with depth,
+    // so every cluster is roughly as deep as it is wide.
+    // Lights are assigned on the CPU by testing their bounding spheres against the view space cluster boxes,
+    // a slice at a time with the SIMD kernels. The result is a (offset, count) range per cluster into one
+    // light index list, both uploaded with the lights as shader storage buffers.
+    class LightClusters
+    {
+    public:
+        static constexpr uint32_t TILES_X = 16;
+        static constexpr uint32_t TILES_Y = 9;
+        static constexpr uint32_t SLICES = 24;
+        static constexpr uint32_t CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+
+        LightClusters() = default;
+
+        LightClusters(const LightClusters&) = delete;
+        LightClusters& operator=(const LightClusters&) = delete;
+
+        // Rebuilds the cluster boxes only when the projection changed
+        void set_projection(const glm::mat4& projection, float near_plane, float far_plane);
+
+        void assign(const glm::mat4& view, const std::vector<ClusterLight>& lights);
+        // Reference version of assign, one cluster at a time
+        void assign_scalar(const glm::mat4& view, const std::vector<ClusterLight>& lights);
+
+        // Two values per cluster: offset into the index list and light count
+        const std::vector<uint32_t>& get_ranges() const { return _ranges; }
+        const std::vector<uint32_t>& get_indices() const { return _indices; }
+
+        // Copies the lights and the assignment of this frame into the shader storage buffers and binds them
+        void upload(const std::vector<ClusterLight>& lights, unsigned int light_binding, unsigned int range_binding, unsigned int index_binding);
+        // Uniforms that map a fragment to its cluster
+        void set_uniforms(const Shader& shader, const glm::vec2& framebuffer_size) const;
+
+        // Must be called while the context is still alive
+        void release();
+
+    private:
+        // Tiles of a slice, rounded up to the SIMD width. Padding boxes are empty and never overlap a light
+        static constexpr uint32_t SLICE_STRIDE = (TILES_X * TILES_Y + simd::WIDTH - 1) / simd::WIDTH * simd::WIDTH;
+
+        float _slice_depth(uint32_t slice) const { return _near * std::pow(_far / _near, static_cast<float>(slice) / SLICES); }
+        uint32_t _depth_slice(float depth) const;
+        // Sorts the (cluster, light) pairs into ranges, lights stay in order inside each cluster
+        void _build_lists();
+
+        glm::mat4 _projection{ 0.0f };
+        float _near{ 0.1f };
+        float _far{ 100.0f };
+
+        // View space boxes, structure of arrays with SLICE_STRIDE entries per slice
+        std::vector<float> _min_x, _min_y, _min_z;
+        std::vector<float> _max_x, _max_y, _max_z;
+
+        std::vector<uint32_t> _pair_clusters;
+        std::vector<uint32_t> _pair_lights;
+        std::vector<uint32_t> _ranges;
+        std::vector<uint32_t> _indices;
+
+        unsigned int _buffers[3]{ 0, 0, 0 };
+        size_t _buffer_sizes[3]{ 0, 0, 0 };
+    };
+
+    inline void LightClusters::set_projection(const glm::mat4& projection, float near_plane, float far_plane)
+    {
+        if (projection == _projection && near_plane == _near && far_plane == _far && !_min_x.empty())
+            return;
+
+        _projection = projection;
+        _near = near_plane;
+        _far = far_plane;
+
+        const size_t size = static_cast<size_t>(SLICE_STRIDE) * SLICES;
+        for (std::vector<float>* values : { &_min_x, &_min_y, &_min_z })
+        {
+            values->assign(size, 1e30f);
+        }
+        for (std::vector<float>* values : { &_max_x, &_max_y, &_max_z })
+        {
+            values->assign(size, -1e30f);
+        }
+
+        // Direction through a point of the near plane, scaled to unit view depth
+        const glm::mat4 inverse_projection = glm::inverse(projection);
+        auto tile_ray = [&](float x, float y) {
+            glm::vec4 point = inverse_projection * glm::vec4{ x * 2.0f - 1.0f, y * 2.0f - 1.0f, -1.0f, 1.0f };
+            glm::vec3 ray = glm::vec3{ point } / point.w;
+            return ray / -ray.z;
+        };
+
+        for (uint32_t slice = 0; slice < SLICES; slice++)
+        {
+            const float slice_near = _slice_depth(slice);
+            const float slice_far = _slice_depth(slice + 1);
+
+            for (uint32_t y = 0; y < TILES_Y; y++)
+            {
+                for (uint32_t x = 0; x < TILES_X; x++)
+                {
+                    const size_t cluster = static_cast<size_t>(slice) * SLICE_STRIDE + y * TILES_X + x;
+
+                    // The box of the frustum piece is the box of its eight corners
+                    for (float corner_y : { static_cast<float>(y) / TILES_Y, static_cast<float>(y + 1) / TILES_Y })
+                    {
+                        for (float corner_x : { static_cast<float>(x) / TILES_X, static_cast<float>(x + 1) / TILES_X })
+                        {
+                            const glm::vec3 ray = tile_ray(corner_x, corner_y);
+                            for (float depth : { slice_near, slice_far })
+                            {
+                                const glm::vec3 corner = ray * depth;
+                                _min_x[cluster] = std::min(_min_x[cluster], corner.x);
+                                _min_y[cluster] = std::min(_min_y[cluster], corner.y);
+                                _min_z[cluster] = std::min(_min_z[cluster], corner.z);
+                                _max_x[cluster] = std::max(_max_x[cluster], corner.x);
+                                _max_y[cluster] = std::max(_max_y[cluster], corner.y);
+                                _max_z[cluster] = std::max(_max_z[cluster], corner.z);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    inline uint32_t LightClusters::_depth_slice(float depth) const
+    {
+        if (depth <= _near)
+            return 0;
+
+        const float slice = std::log(depth / _near) / std::log(_far / _near) * SLICES;
+        return std::min(SLICES - 1, static_cast<uint32_t>(slice));
+    }
+
+    inline void LightClusters::assign(const glm::mat4& view, const std::vector<ClusterLight>& lights)
+    {
+        _pair_clusters.clear();
+        _pair_lights.clear();
+
+        for (uint32_t light = 0; light < lights.size(); light++)
+        {
+            const glm::vec3 center = glm::vec3{ view * glm::vec4{ glm::vec3{ lights[light].position_range }, 1.0f } };
+            const float radius = lights[light].position_range.w;
+            const float depth = -center.z;
+            if (radius <= 0.0f || depth + radius < _near || depth - radius > _far)
+                continue;
+
+            const uint32_t first_slice = _depth_slice(depth - radius);
+            const uint32_t last_slice = _depth_slice(depth + radius);
+
+            // Distance from the sphere center to each box, zero inside it
+            const simd::floatv cx = simd::set1(center.x);
+            const simd::floatv cy = simd::set1(center.y);
+            const simd::floatv cz = simd::set1(center.z);
+            const simd::floatv radius2 = simd::set1(radius * radius);
+            const simd::floatv zero = simd::set1(0.0f);
+
+            for (uint32_t slice = first_slice; slice <= last_slice; slice++)
+            {
+                const size_t first = static_cast<size_t>(slice) * SLICE_STRIDE;
+                for (uint32_t tile = 0; tile < SLICE_STRIDE; tile += simd::WIDTH)
+                {
+                    const size_t i = first + tile;
+                    const simd::floatv dx = simd::max(zero, simd::max(simd::sub(simd::load(&_min_x[i]), cx), simd::sub(cx, simd::load(&_max_x[i]))));
+                    const simd::floatv dy = simd::max(zero, simd::max(simd::sub(simd::load(&_min_y[i]), cy), simd::sub(cy, simd::load(&_max_y[i]))));
+                    const simd::floatv dz = simd::max(zero, simd::max(simd::sub(simd::load(&_min_z[i]), cz), simd::sub(cz, simd::load(&_max_z[i]))));
+                    const simd::floatv distance2 = simd::fmadd(dx, dx, simd::fmadd(dy, dy, simd::mul(dz, dz)));
+
+                    unsigned int bits = simd::movemask(simd::greater_equal(radius2, distance2));
+                    while (bits != 0)
+                    {
+                        const uint32_t lane = static_cast<uint32_t>(std::countr_zero(bits));
+                        bits &= bits - 1;
+
+                        _pair_clusters.push_back(slice * TILES_X * TILES_Y + tile + lane);
+                        _pair_lights.push_back(light);
+                    }
+                }
+            }
+        }
+
+        _build_lists();
+    }
+
+    inline void LightClusters::assign_scalar(const glm::mat4& view, const std::vector<ClusterLight>& lights)
+    {
+        _pair_clusters.clear();
+        _pair_lights.clear();
+
+        for (uint32_t light = 0; light < lights.size(); light++)
+        {
+            const glm::vec3 center = glm::vec3{ view * glm::vec4{ glm::vec3{ lights[light].position_range }, 1.0f } };
+            const float radius = lights[light].position_range.w;
+            if (radius <= 0.0f)
+                continue;
+
+            for (uint32_t slice = 0; slice < SLICES; slice++)
+            {
+                for (uint32_t tile = 0; tile < TILES_X * TILES_Y; tile++)
+                {
+                    const size_t i = static_cast<size_t>(slice) * SLICE_STRIDE + tile;
+                    const float dx = std::max(0.0f, std::max(_min_x[i] - center.x, center.x - _max_x[i]));
+                    const float dy = std::max(0.0f, std::max(_min_y[i] - center.y, center.y - _max_y[i]));
+                    const float dz = std::max(0.0f, std::max(_min_z[i] - center.z, center.z - _max_z[i]));
+
+                    if (dx * dx + dy * dy + dz * dz <= radius * radius)
+                    {
+                        _pair_clusters.push_back(slice * TILES_X * TILES_Y + tile);
+                        _pair_lights.push_back(light);
+                    }
+                }
+            }
+        }
+
+        _build_lists();
+    }
+
+    inline void LightClusters::_build_lists()
+    {
+        _ranges.assign(CLUSTER_COUNT * 2, 0);
+        for (uint32_t cluster : _pair_clusters)
+        {
+            _ranges[cluster * 2 + 1]++;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++)
+        {
+            _ranges[cluster * 2] = offset;
+            offset += _ranges[cluster * 2 + 1];
+        }
+
+        // Pairs come light by light, so filling in order keeps every cluster's lights sorted
+        _indices.resize(_pair_clusters.size());
+        std::vector<uint32_t> cursors(CLUSTER_COUNT);
+        for (uint32_t cluster = 0; cluster < CLUSTER_COUNT; cluster++)
+        {
+            cursors[cluster] = _ranges[cluster * 2];
+        }
+        for (size_t pair = 0; pair < _pair_clusters.size(); pair++)
+        {
+            _indices[cursors[_pair_clusters[pair]]++] = _pair_lights[pair];
+        }
+    }
+
+    inline void LightClusters::upload(const std::vector<ClusterLight>& lights, unsigned int light_binding, unsigned int range_binding, unsigned int index_binding)
+    {
+        const void* data[3] = { lights.data(), _ranges.data(), _indices.data() };
+        const size_t sizes[3] = { lights.size() * sizeof(ClusterLight), _ranges.size() * sizeof(uint32_t), _indices.size() * sizeof(uint32_t) };
+        const unsigned int bindings[3] = { light_binding, range_binding, index_binding };
+
+        for (int i = 0; i < 3; i++)
+        {
+            if (_buffers[i] == 0)
+                glGenBuffers(1, &_buffers[i]);
+
+            // Never empty, a buffer without storage cannot be bound. Orphaned like the bone palettes
+            _buffer_sizes[i] = std::max({ sizes[i], _buffer_sizes[i], sizeof(glm::vec4) });
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, _buffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, _buffer_sizes[i], nullptr, GL_STREAM_DRAW);
+            if (sizes[i] > 0)
+                glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizes[i], data[i]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindings[i], _buffers[i]);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    inline void LightClusters::set_uniforms(const Shader& shader, const glm::vec2& framebuffer_size) const
+    {
+        // slice = log(depth) * scale + bias, the inverse of _slice_depth
+        const float scale = SLICES / std::log(_far / _near);
+
+        shader.setBool("clusteredLighting", true);
+        shader.setUint("clusterTilesX", TILES_X);
+        shader.setUint("clusterTilesY", TILES_Y);
+        shader.setUint("clusterSlices", SLICES);
+        shader.setVec2("clusterScreenScale", glm::vec2{ TILES_X, TILES_Y } / framebuffer_size);
+        shader.setVec2("clusterDepthScaleBias", scale, -std::log(_near) * scale);
+    }
+
+    inline void LightClusters::release()
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            if (_buffers[i] != 0)
+                glDeleteBuffers(1, &_buffers[i]);
+
+            _buffers[i] = 0;
+            _buffer_sizes[i] = 0;
+        }
+    }
+
+}
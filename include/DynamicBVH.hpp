@@ -0,0 +1,582 @@
+#pragma once
+
+#include <learnopengl/entity.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace PBR{
+
+    struct Ray
+    {
+        glm::vec3 origin;
+        glm::vec3 direction;
+    };
+
+    // Slab test, inv_direction is 1 / direction. Returns the entry distance through t_entry.
+    // An axis the ray is parallel to has an infinite inverse and only checks that the origin is within the slab,
+    // (min - origin) * inf is NaN for an origin on the slab plane
+    inline bool intersect_ray_aabb(const glm::vec3& origin, const glm::vec3& inv_direction, const glm::vec3& min, const glm::vec3& max, float max_distance, float& t_entry)
+    {
+        float enter = 0.0f;
+        float exit = max_distance;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (std::isinf(inv_direction[axis]))
+            {
+                if (origin[axis] < min[axis] || origin[axis] > max[axis])
+                    return false;
+                continue;
+            }
+
+            const float t0 = (min[axis] - origin[axis]) * inv_direction[axis];
+            const float t1 = (max[axis] - origin[axis]) * inv_direction[axis];
+            enter = std::max(enter, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+
+        t_entry = enter;
+        return enter <= exit;
+    }
+
+    // Dynamic AABB tree over object bounds.
+    // Leaves store fattened boxes so small movements do not touch the tree, inserts pick the sibling
+    // with the smallest surface area increase and ancestors are refitted and rotated on the way up.
+    // Leaf indices are returned as proxies and stay valid until the leaf is removed, also across rebuilds.
+    class DynamicBVH
+    {
+    public:
+        static constexpr int NULL_NODE = -1;
+
+        explicit DynamicBVH(float margin = 0.1f) : _margin{ margin } {}
+
+        int insert(const AABB& aabb, uint32_t user_data);
+        void remove(int proxy);
+        // Returns true if the proxy left its fattened box and had to be reinserted
+        bool move(int proxy, const AABB& aabb);
+        void clear();
+
+        // Top down rebuild with a binned surface area heuristic, proxies are preserved
+        void rebuild_sah();
+
+        // Calls callback(user_data) for every leaf whose fattened box touches the frustum.
+        // Subtrees that are completely inside are reported without testing their nodes
+        template<typename TCallback>
+        void query(const Frustum& frustum, TCallback&& callback) const;
+
+        // Calls callback(user_data, entry_distance) for every leaf box hit by the ray.
+        // The callback returns the new maximum distance, returning the hit distance gives a closest hit query
+        template<typename TCallback>
+        void raycast(const Ray& ray, float max_distance, TCallback&& callback) const;
+
+        uint32_t get_user_data(int proxy) const { return _nodes[proxy].user_data; }
+        int get_height() const { return _root == NULL_NODE ? 0 : _nodes[_root].height; }
+        size_t get_leaf_count() const { return _leaf_count; }
+        size_t get_node_count() const { return _leaf_count == 0 ? 0 : _leaf_count * 2 - 1; }
+
+    private:
+        struct Node
+        {
+            glm::vec3 min;
+            glm::vec3 max;
+            // Doubles as the next link of the free list
+            int parent{ NULL_NODE };
+            int left{ NULL_NODE };
+            int right{ NULL_NODE };
+            // Leaves have a height of 0, free nodes -1
+            int height{ -1 };
+            uint32_t user_data{ 0 };
+
+            bool is_leaf() const { return left == NULL_NODE; }
+        };
+
+        std::vector<Node> _nodes;
+        int _root{ NULL_NODE };
+        int _free_list{ NULL_NODE };
+        size_t _leaf_count{ 0 };
+        float _margin;
+
+        // Traversal stack, kept around so queries do not allocate
+        mutable std::vector<int> _stack;
+
+        int _allocate();
+        void _free(int index);
+
+        void _insert_leaf(int leaf);
+        void _remove_leaf(int leaf);
+        void _refit(int index);
+        int _balance(int index);
+        void _set_children(int parent, int left, int right);
+
+        int _build_sah(std::vector<int>& leaves, size_t begin, size_t end);
+
+        static float _area(const glm::vec3& min, const glm::vec3& max)
+        {
+            glm::vec3 d = max - min;
+            return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+        }
+    };
+
+    inline int DynamicBVH::insert(const AABB &aabb, uint32_t user_data)
+    {
+        int proxy = _allocate();
+
+        _nodes[proxy].min = aabb.center - aabb.extents - glm::vec3{ _margin };
+        _nodes[proxy].max = aabb.center + aabb.extents + glm::vec3{ _margin };
+        _nodes[proxy].user_data = user_data;
+        _nodes[proxy].height = 0;
+
+        _insert_leaf(proxy);
+        _leaf_count++;
+        return proxy;
+    }
+
+    inline void DynamicBVH::remove(int proxy)
+    {
+        _remove_leaf(proxy);
+        _free(proxy);
+        _leaf_count--;
+    }
+
+    inline bool DynamicBVH::move(int proxy, const AABB &aabb)
+    {
+        const glm::vec3 min = aabb.center - aabb.extents;
+        const glm::vec3 max = aabb.center + aabb.extents;
+
+        Node& node = _nodes[proxy];
+        if (glm::all(glm::lessThanEqual(node.min, min)) && glm::all(glm::greaterThanEqual(node.max, max)))
+            return false;
+
+        _remove_leaf(proxy);
+
+        _nodes[proxy].min = min - glm::vec3{ _margin };
+        _nodes[proxy].max = max + glm::vec3{ _margin };
+
+        _insert_leaf(proxy);
+        return true;
+    }
+
+    inline void DynamicBVH::clear()
+    {
+        _nodes.clear();
+        _root = NULL_NODE;
+        _free_list = NULL_NODE;
+        _leaf_count = 0;
+    }
+
+    inline void DynamicBVH::rebuild_sah()
+    {
+        if (_root == NULL_NODE)
+            return;
+
+        std::vector<int> leaves;
+        leaves.reserve(_leaf_count);
+
+        for (int i = 0; i < static_cast<int>(_nodes.size()); i++)
+        {
+            if (_nodes[i].height < 0)
+                continue;
+
+            if (_nodes[i].is_leaf())
+                leaves.push_back(i);
+            else
+                _free(i);
+        }
+
+        _root = _build_sah(leaves, 0, leaves.size());
+        _nodes[_root].parent = NULL_NODE;
+    }
+
+    template<typename TCallback>
+    inline void DynamicBVH::query(const Frustum &frustum, TCallback &&callback) const
+    {
+        if (_root == NULL_NODE)
+            return;
+
+        const Plane* planes[6] = {
+            &frustum.leftFace, &frustum.rightFace, &frustum.topFace,
+            &frustum.bottomFace, &frustum.nearFace, &frustum.farFace
+        };
+
+        // Second entry is set once an ancestor was found fully inside
+        std::vector<int>& stack = _stack;
+        stack.clear();
+        stack.push_back(_root);
+        stack.push_back(0);
+
+        while (!stack.empty())
+        {
+            bool inside = stack.back() != 0;
+            stack.pop_back();
+            int index = stack.back();
+            stack.pop_back();
+
+            const Node& node = _nodes[index];
+
+            if (!inside)
+            {
+                const glm::vec3 center = (node.min + node.max) * 0.5f;
+                const glm::vec3 extents = (node.max - node.min) * 0.5f;
+
+                bool outside = false;
+                inside = true;
+                for (const Plane* plane : planes)
+                {
+                    float distance = plane->getSignedDistanceToPlane(center);
+                    float radius = glm::dot(extents, glm::abs(plane->normal));
+
+                    if (distance < -radius)
+                    {
+                        outside = true;
+                        break;
+                    }
+                    if (distance < radius)
+                        inside = false;
+                }
+
+                if (outside)
+                    continue;
+            }
+
+            if (node.is_leaf())
+            {
+                callback(node.user_data);
+                continue;
+            }
+
+            stack.push_back(node.left);
+            stack.push_back(inside ? 1 : 0);
+            stack.push_back(node.right);
+            stack.push_back(inside ? 1 : 0);
+        }
+    }
+
+    template<typename TCallback>
+    inline void DynamicBVH::raycast(const Ray &ray, float max_distance, TCallback &&callback) const
+    {
+        if (_root == NULL_NODE)
+            return;
+
+        const glm::vec3 inv_direction = 1.0f / ray.direction;
+
+        std::vector<int>& stack = _stack;
+        stack.clear();
+        stack.push_back(_root);
+
+        while (!stack.empty())
+        {
+            int index = stack.back();
+            stack.pop_back();
+
+            const Node& node = _nodes[index];
+
+            float entry;
+            if (!intersect_ray_aabb(ray.origin, inv_direction, node.min, node.max, max_distance, entry))
+                continue;
+
+            if (node.is_leaf())
+            {
+                max_distance = callback(node.user_data, entry);
+                continue;
+            }
+
+            stack.push_back(node.left);
+            stack.push_back(node.right);
+        }
+    }
+
+    inline int DynamicBVH::_allocate()
+    {
+        if (_free_list == NULL_NODE)
+        {
+            _nodes.emplace_back();
+            return static_cast<int>(_nodes.size()) - 1;
+        }
+
+        int index = _free_list;
+        _free_list = _nodes[index].parent;
+        _nodes[index] = Node{};
+        return index;
+    }
+
+    inline void DynamicBVH::_free(int index)
+    {
+        _nodes[index].parent = _free_list;
+        _nodes[index].height = -1;
+        _free_list = index;
+    }
+
+    inline void DynamicBVH::_insert_leaf(int leaf)
+    {
+        if (_root == NULL_NODE)
+        {
+            _root = leaf;
+            _nodes[leaf].parent = NULL_NODE;
+            return;
+        }
+
+        const glm::vec3 leaf_min = _nodes[leaf].min;
+        const glm::vec3 leaf_max = _nodes[leaf].max;
+
+        // Walk down towards the child whose area grows the least
+        int index = _root;
+        while (!_nodes[index].is_leaf())
+        {
+            const Node& node = _nodes[index];
+
+            float area = _area(node.min, node.max);
+            float combined_area = _area(glm::min(node.min, leaf_min), glm::max(node.max, leaf_max));
+
+            // Cost of making a new parent for this node and the leaf
+            float cost = 2.0f * combined_area;
+            // Minimum cost of pushing the leaf further down
+            float inheritance_cost = 2.0f * (combined_area - area);
+
+            auto descend_cost = [&](int child) {
+                const Node& c = _nodes[child];
+                float enlarged = _area(glm::min(c.min, leaf_min), glm::max(c.max, leaf_max));
+                return c.is_leaf() ? enlarged + inheritance_cost : enlarged - _area(c.min, c.max) + inheritance_cost;
+            };
+
+            float left_cost = descend_cost(node.left);
+            float right_cost = descend_cost(node.right);
+
+            if (cost < left_cost && cost < right_cost)
+                break;
+
+            index = left_cost < right_cost ? node.left : node.right;
+        }
+
+        int sibling = index;
+        int old_parent = _nodes[sibling].parent;
+        int new_parent = _allocate();
+
+        _nodes[new_parent].parent = old_parent;
+        _nodes[new_parent].height = _nodes[sibling].height + 1;
+        _set_children(new_parent, sibling, leaf);
+
+        if (old_parent == NULL_NODE)
+        {
+            _root = new_parent;
+        }
+        else if (_nodes[old_parent].left == sibling)
+        {
+            _nodes[old_parent].left = new_parent;
+        }
+        else
+        {
+            _nodes[old_parent].right = new_parent;
+        }
+
+        _refit(new_parent);
+    }
+
+    inline void DynamicBVH::_remove_leaf(int leaf)
+    {
+        if (leaf == _root)
+        {
+            _root = NULL_NODE;
+            return;
+        }
+
+        int parent = _nodes[leaf].parent;
+        int grand_parent = _nodes[parent].parent;
+        int sibling = _nodes[parent].left == leaf ? _nodes[parent].right : _nodes[parent].left;
+
+        _free(parent);
+        _nodes[sibling].parent = grand_parent;
+
+        if (grand_parent == NULL_NODE)
+        {
+            _root = sibling;
+            return;
+        }
+
+        if (_nodes[grand_parent].left == parent)
+            _nodes[grand_parent].left = sibling;
+        else
+            _nodes[grand_parent].right = sibling;
+
+        _refit(grand_parent);
+    }
+
+    inline void DynamicBVH::_refit(int index)
+    {
+        while (index != NULL_NODE)
+        {
+            index = _balance(index);
+
+            Node& node = _nodes[index];
+            const Node& left = _nodes[node.left];
+            const Node& right = _nodes[node.right];
+
+            node.height = 1 + std::max(left.height, right.height);
+            node.min = glm::min(left.min, right.min);
+            node.max = glm::max(left.max, right.max);
+
+            index = node.parent;
+        }
+    }
+
+    // Rotates the taller grandchild up if the subtree of a is unbalanced, returns the new subtree root
+    inline int DynamicBVH::_balance(int a)
+    {
+        if (_nodes[a].is_leaf() || _nodes[a].height < 2)
+            return a;
+
+        int b = _nodes[a].left;
+        int c = _nodes[a].right;
+        int balance = _nodes[c].height - _nodes[b].height;
+
+        if (balance >= -1 && balance <= 1)
+            return a;
+
+        // The taller child takes the place of a
+        int up = balance > 1 ? c : b;
+        int stay = balance > 1 ? b : c;
+        int f = _nodes[up].left;
+        int g = _nodes[up].right;
+
+        int parent = _nodes[a].parent;
+        _nodes[up].parent = parent;
+        if (parent == NULL_NODE)
+            _root = up;
+        else if (_nodes[parent].left == a)
+            _nodes[parent].left = up;
+        else
+            _nodes[parent].right = up;
+
+        // The taller grandchild stays below up, the shorter one moves under a
+        int tall = _nodes[f].height > _nodes[g].height ? f : g;
+        int short_child = tall == f ? g : f;
+
+        _set_children(a, stay, short_child);
+        _nodes[a].height = 1 + std::max(_nodes[stay].height, _nodes[short_child].height);
+
+        _set_children(up, a, tall);
+        _nodes[up].height = 1 + std::max(_nodes[a].height, _nodes[tall].height);
+
+        return up;
+    }
+
+    inline void DynamicBVH::_set_children(int parent, int left, int right)
+    {
+        Node& node = _nodes[parent];
+        node.left = left;
+        node.right = right;
+        node.min = glm::min(_nodes[left].min, _nodes[right].min);
+        node.max = glm::max(_nodes[left].max, _nodes[right].max);
+
+        _nodes[left].parent = parent;
+        _nodes[right].parent = parent;
+    }
+
+    inline int DynamicBVH::_build_sah(std::vector<int> &leaves, size_t begin, size_t end)
+    {
+        if (end - begin == 1)
+            return leaves[begin];
+
+        constexpr int BIN_COUNT = 12;
+
+        glm::vec3 centroid_min{ std::numeric_limits<float>::max() };
+        glm::vec3 centroid_max{ std::numeric_limits<float>::lowest() };
+        for (size_t i = begin; i < end; i++)
+        {
+            glm::vec3 centroid = (_nodes[leaves[i]].min + _nodes[leaves[i]].max) * 0.5f;
+            centroid_min = glm::min(centroid_min, centroid);
+            centroid_max = glm::max(centroid_max, centroid);
+        }
+
+        // Best split over all three axes
+        float best_cost = std::numeric_limits<float>::max();
+        int best_axis = -1;
+        int best_bin = 0;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroid_max[axis] - centroid_min[axis];
+            if (extent <= 0.0f)
+                continue;
+
+            struct Bin
+            {
+                glm::vec3 min{ std::numeric_limits<float>::max() };
+                glm::vec3 max{ std::numeric_limits<float>::lowest() };
+                int count{ 0 };
+            } bins[BIN_COUNT];
+
+            float scale = BIN_COUNT / extent;
+            for (size_t i = begin; i < end; i++)
+            {
+                const Node& leaf = _nodes[leaves[i]];
+                float centroid = (leaf.min[axis] + leaf.max[axis]) * 0.5f;
+                int bin = std::min(BIN_COUNT - 1, static_cast<int>((centroid - centroid_min[axis]) * scale));
+                bins[bin].min = glm::min(bins[bin].min, leaf.min);
+                bins[bin].max = glm::max(bins[bin].max, leaf.max);
+                bins[bin].count++;
+            }
+
+            // Sweep from the right to get the suffix areas, then from the left to evaluate each plane
+            float right_area[BIN_COUNT];
+            int right_count[BIN_COUNT];
+            Bin accumulated;
+            for (int bin = BIN_COUNT - 1; bin > 0; bin--)
+            {
+                accumulated.min = glm::min(accumulated.min, bins[bin].min);
+                accumulated.max = glm::max(accumulated.max, bins[bin].max);
+                accumulated.count += bins[bin].count;
+                right_area[bin] = accumulated.count ? _area(accumulated.min, accumulated.max) : 0.0f;
+                right_count[bin] = accumulated.count;
+            }
+
+            accumulated = Bin{};
+            for (int bin = 0; bin < BIN_COUNT - 1; bin++)
+            {
+                accumulated.min = glm::min(accumulated.min, bins[bin].min);
+                accumulated.max = glm::max(accumulated.max, bins[bin].max);
+                accumulated.count += bins[bin].count;
+
+                if (accumulated.count == 0 || right_count[bin + 1] == 0)
+                    continue;
+
+                float cost = accumulated.count * _area(accumulated.min, accumulated.max) + right_count[bin + 1] * right_area[bin + 1];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = bin;
+                }
+            }
+        }
+
+        size_t middle;
+        if (best_axis < 0)
+        {
+            // All centroids coincide, any split is as good as another
+            middle = begin + (end - begin) / 2;
+        }
+        else
+        {
+            float scale = BIN_COUNT / (centroid_max[best_axis] - centroid_min[best_axis]);
+            auto it = std::partition(leaves.begin() + begin, leaves.begin() + end, [&](int leaf) {
+                float centroid = (_nodes[leaf].min[best_axis] + _nodes[leaf].max[best_axis]) * 0.5f;
+                return std::min(BIN_COUNT - 1, static_cast<int>((centroid - centroid_min[best_axis]) * scale)) <= best_bin;
+            });
+            middle = static_cast<size_t>(it - leaves.begin());
+        }
+
+        int left = _build_sah(leaves, begin, middle);
+        int right = _build_sah(leaves, middle, end);
+
+        int node = _allocate();
+        _set_children(node, left, right);
+        _nodes[node].height = 1 + std::max(_nodes[left].height, _nodes[right].height);
+        return node;
+    }
+
+}
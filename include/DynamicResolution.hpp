@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+namespace PBR{
+
+    // Picks the render scale, per axis, from the GPU time of the scene passes.
+    // The time is smoothed so a single slow frame does not resize, and after every change the controller
+    // waits until the timer queries, which come back a few frames late, measured the new scale.
+    // The cost is taken as proportional to the pixel count, so the scale moves by the square root of
+    // the ratio between the target time and the measured one
+    class ResolutionController
+    {
+    public:
+        explicit ResolutionController(float budget_ms = 16.6f, float min_scale = 0.5f, float max_scale = 1.0f)
+            : _budget_ms(budget_ms), _min_scale(min_scale), _max_scale(max_scale) {}
+
+        // Returns the scale for the next frame
+        float update(double gpu_ms);
+
+        void set_budget(float budget_ms) { _budget_ms = budget_ms; }
+        void set_limits(float min_scale, float max_scale);
+        // Fixed scale, the controller starts over from it when enabled again
+        void set_scale(float scale) { _scale = std::clamp(scale, _min_scale, _max_scale); _settle = SETTLE_FRAMES; }
+
+        float get_budget() const { return _budget_ms; }
+        float get_scale() const { return _scale; }
+        float get_min_scale() const { return _min_scale; }
+        float get_max_scale() const { return _max_scale; }
+        double get_smoothed_ms() const { return _smoothed_ms; }
+
+    private:
+        // Frames the timer needs to report the new scale, the GpuTimer latency and some margin
+        static constexpr int SETTLE_FRAMES = 8;
+        static constexpr double SMOOTHING = 0.1;
+        // Aim below the budget, so noise does not push the frame over it
+        static constexpr double TARGET = 0.9;
+        // Inside this band around the target nothing changes
+        static constexpr double TOLERANCE = 0.08;
+        static constexpr float MAX_STEP = 0.1f;
+
+        float _budget_ms;
+        float _min_scale;
+        float _max_scale;
+
+        float _scale{ 1.0f };
+        double _smoothed_ms{ 0.0 };
+        int _settle{ SETTLE_FRAMES };
+    };
+
+    inline void ResolutionController::set_limits(float min_scale, float max_scale)
+    {
+        _min_scale = min_scale;
+        _max_scale = std::max(min_scale, max_scale);
+        _scale = std::clamp(_scale, _min_scale, _max_scale);
+    }
+
+    inline float ResolutionController::update(double gpu_ms)
+    {
+        if (gpu_ms <= 0.0)
+            return _scale;
+
+        _smoothed_ms = _smoothed_ms <= 0.0 ? gpu_ms : _smoothed_ms + (gpu_ms - _smoothed_ms) * SMOOTHING;
+
+        if (_settle > 0)
+        {
+            _settle--;
+            return _scale;
+        }
+
+        const double target_ms = _budget_ms * TARGET;
+        const double ratio = target_ms / _smoothed_ms;
+        if (std::abs(ratio - 1.0) < TOLERANCE)
+            return _scale;
+
+        const float step = std::clamp(_scale * static_cast<float>(std::sqrt(ratio)) - _scale, -MAX_STEP, MAX_STEP);
+        const float scale = std::clamp(_scale + step, _min_scale, _max_scale);
+        if (scale != _scale)
+        {
+            // The smoothed time belongs to the old scale, start from the expected one
+            _smoothed_ms *= (scale * scale) / (_scale * _scale);
+            _scale = scale;
+            _settle = SETTLE_FRAMES;
+        }
+
+        return _scale;
+    }
+
+}
@@ -0,0 +1,595 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "Shader.hpp"
+#include "GpuTimer.hpp"
+#include "stb_image.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PBR{
+
+    // Shaders and geometry the bakes draw with, owned by the renderer
+    struct EnvironmentBakeShaders
+    {
+        const Shader& equirectangular;
+        const Shader& irradiance;
+        const Shader& prefilter;
+        unsigned int cubeVAO;
+    };
+
+    // Image based lighting environments that are baked the first time they are selected.
+    // The HDR file is decoded on a worker thread, then every frame runs as many slices of the bake,
+    // the conversion, a band of rows of the irradiance or one prefilter mip, as fit the budget. A slice is
+    // one draw, the geometry shader of the bake shaders sends the cube to all six faces of the attached
+    // cube map and a scissor keeps an irradiance band to its rows.
+    // The cost of a slice is estimated from its sample count and a GPU time per sample that is measured
+    // as the bake runs. Once the bake is done the new environment fades in over the one shown before.
+    // The prefilter reads the mip chain of the converted environment, a sample whose pdf says it stands
+    // for a wide solid angle reads a lower mip, so a few hundred samples a texel are enough
+    class EnvironmentLibrary
+    {
+    public:
+        struct Maps
+        {
+            unsigned int cube_map{ 0 };
+            unsigned int irradiance_map{ 0 };
+            unsigned int prefilter_map{ 0 };
+        };
+
+        static constexpr int ENVIRONMENT_SIZE = 1024;
+        static constexpr int ENVIRONMENT_MIPS = 11;
+        static constexpr int IRRADIANCE_SIZE = 32;
+        static constexpr int PREFILTER_SIZE = 128;
+        static constexpr int PREFILTER_MIPS = 5;
+        // Samples a texel per prefilter mip, the wider lobes of the rougher mips need more.
+        // Mip 0 is a mirror and always takes one
+        static constexpr int DEFAULT_PREFILTER_SAMPLES[PREFILTER_MIPS] = { 1, 64, 128, 192, 256 };
+        // The bake before the source had mips, every sample read mip 0
+        static constexpr int REFERENCE_PREFILTER_SAMPLES = 1024;
+
+        // Prefilter bake against the reference one, GPU time and error relative to the mean of the reference
+        struct PrefilterComparison
+        {
+            double filtered_ms{ 0.0 };
+            double reference_ms{ 0.0 };
+            float error[PREFILTER_MIPS]{};
+        };
+
+        EnvironmentLibrary() = default;
+
+        EnvironmentLibrary(const EnvironmentLibrary&) = delete;
+        EnvironmentLibrary& operator=(const EnvironmentLibrary&) = delete;
+
+        // Only remembers the file, nothing is loaded until the environment is selected
+        size_t add(const std::string& name, const std::string& path);
+
+        // Starts the bake if needed, the environment is shown once it is ready
+        void select(size_t index);
+        // Selects and bakes in one go, for the environment shown at startup
+        void bake_now(size_t index, const EnvironmentBakeShaders& bake);
+
+        // Runs the bake slices of the selected environment and advances the fade.
+        // Changes the framebuffer, viewport and program. Returns true when the maps to bind changed
+        bool update(float delta_time, const EnvironmentBakeShaders& bake);
+
+        const Maps& get_current() const { return _environments[_current].maps; }
+        const Maps& get_previous() const { return _environments[_previous].maps; }
+        // Weight of the current environment, 1 once the fade is over
+        float get_blend() const { return _blend; }
+
+        size_t get_count() const { return _environments.size(); }
+        const std::string& get_name(size_t index) const { return _environments[index].name; }
+        bool is_ready(size_t index) const { return _environments[index].state == State::Ready; }
+        bool has_failed(size_t index) const { return _environments[index].state == State::Failed; }
+        // Part of the bake that is done, in [0, 1]
+        float get_progress(size_t index) const;
+        size_t get_selected() const { return _selected; }
+        size_t get_shown() const { return _current; }
+
+        void set_budget(float budget_ms) { _budget_ms = budget_ms; }
+        float get_budget() const { return _budget_ms; }
+        void set_fade_time(float seconds) { _fade_time = seconds; }
+        float get_fade_time() const { return _fade_time; }
+        // GPU time of the last measured bake frame
+        double get_bake_milliseconds() const { return _timer.get_milliseconds(); }
+
+        // Samples a texel of the bakes started from now on, mips above 0
+        void set_prefilter_samples(int mip, int samples) { _prefilter_samples[mip] = std::clamp(samples, 1, REFERENCE_PREFILTER_SAMPLES); }
+        int get_prefilter_samples(int mip) const { return _prefilter_samples[mip]; }
+
+        // Prefilters a ready environment again with the current sample counts and with the reference bake,
+        // into scratch maps, and compares them. Waits for the GPU, not for every frame
+        PrefilterComparison compare_prefilter(size_t index, const EnvironmentBakeShaders& bake);
+
+        // View from the origin through a cube map face, in the GL face order
+        static glm::mat4 capture_view(int face);
+        // Projection and face views of a layered bake, layer_offset is the first face in a cube map array
+        static void set_capture_uniforms(const Shader& shader, const glm::mat4& projection, int layer_offset = 0);
+        // Uses the prefilter shader for a mip of a prefilter map, source and target are face sizes
+        static void set_prefilter_uniforms(const Shader& shader, int mip, int mips, int source_size, int target_size, int samples, bool filtered = true);
+
+        // Must be called while the context is still alive
+        void release();
+
+    private:
+        enum class State { Unloaded, Decoding, Baking, Ready, Failed };
+
+        struct Decoded
+        {
+            std::shared_ptr<float> pixels;
+            int width{ 0 };
+            int height{ 0 };
+        };
+
+        struct Environment
+        {
+            std::string name;
+            std::string path;
+            State state{ State::Unloaded };
+            std::future<Decoded> decoded;
+            unsigned int equirectangular{ 0 };
+            Maps maps;
+            int next_slice{ 0 };
+        };
+
+        // Upload, conversion, the irradiance in bands of rows and one per prefilter mip.
+        // A whole irradiance map is about 97 million samples, a band stays well inside the budget
+        static constexpr int IRRADIANCE_BANDS = 8;
+        static constexpr int CONVERT_SLICE = 1;
+        static constexpr int IRRADIANCE_SLICE = CONVERT_SLICE + 1;
+        static constexpr int PREFILTER_SLICE = IRRADIANCE_SLICE + IRRADIANCE_BANDS;
+        static constexpr int SLICE_COUNT = PREFILTER_SLICE + PREFILTER_MIPS;
+
+        static Decoded _decode(const std::string& path);
+        // Texture samples of a slice, in millions
+        double _slice_cost(int slice) const;
+        // Renders the inside of the cube into all faces of a mip, with the program and inputs already set.
+        // With more than one band only the rows of the given one are drawn
+        void _draw_cube(unsigned int target, int mip, int size, unsigned int cubeVAO, int band = 0, int bands = 1);
+
+        // The first slice, false when the file is not decoded yet or could not be read
+        bool _upload(Environment& environment);
+        void _run_slice(Environment& environment, int slice, const EnvironmentBakeShaders& bake);
+        void _release(Environment& environment);
+
+        std::vector<Environment> _environments;
+        size_t _selected{ 0 };
+        size_t _current{ 0 };
+        size_t _previous{ 0 };
+        float _blend{ 1.0f };
+
+        float _budget_ms{ 2.0f };
+        float _fade_time{ 1.0f };
+        int _prefilter_samples[PREFILTER_MIPS]{ DEFAULT_PREFILTER_SAMPLES[0], DEFAULT_PREFILTER_SAMPLES[1],
+            DEFAULT_PREFILTER_SAMPLES[2], DEFAULT_PREFILTER_SAMPLES[3], DEFAULT_PREFILTER_SAMPLES[4] };
+
+        unsigned int _framebuffer{ 0 };
+
+        // The timer reports the bake frame LATENCY frames back, the samples of those frames are kept until then
+        GpuTimer _timer;
+        double _timed_samples[GpuTimer::LATENCY]{};
+        int _timed_frames{ 0 };
+        // Starting guess, about what a mid range GPU does
+        double _ms_per_msample{ 0.05 };
+    };
+
+    inline size_t EnvironmentLibrary::add(const std::string& name, const std::string& path)
+    {
+        Environment environment;
+        environment.name = name;
+        environment.path = path;
+        _environments.push_back(std::move(environment));
+        return _environments.size() - 1;
+    }
+
+    inline EnvironmentLibrary::Decoded EnvironmentLibrary::_decode(const std::string& path)
+    {
+        // The flag is global otherwise, and the main thread keeps loading textures
+        stbi_set_flip_vertically_on_load_thread(true);
+
+        Decoded decoded;
+        int components = 0;
+        float* data = stbi_loadf(path.c_str(), &decoded.width, &decoded.height, &components, 3);
+        if (data)
+            decoded.pixels = std::shared_ptr<float>(data, stbi_image_free);
+        else
+            std::cerr << "Failed to load HDR: " << path << ": " << stbi_failure_reason() << std::endl;
+
+        return decoded;
+    }
+
+    inline void EnvironmentLibrary::select(size_t index)
+    {
+        Environment& environment = _environments[index];
+        if (environment.state == State::Failed)
+            return;
+
+        _selected = index;
+        if (environment.state == State::Unloaded)
+        {
+            environment.decoded = std::async(std::launch::async, &EnvironmentLibrary::_decode, environment.path);
+            environment.state = State::Decoding;
+        }
+    }
+
+    inline void EnvironmentLibrary::bake_now(size_t index, const EnvironmentBakeShaders& bake)
+    {
+        select(index);
+
+        Environment& environment = _environments[index];
+        if (environment.state == State::Decoding)
+        {
+            environment.decoded.wait();
+            if (!_upload(environment))
+                return;
+        }
+        for (; environment.next_slice < SLICE_COUNT; environment.next_slice++)
+        {
+            _run_slice(environment, environment.next_slice, bake);
+        }
+        environment.state = State::Ready;
+
+        _current = index;
+        _previous = index;
+        _blend = 1.0f;
+    }
+
+    inline double EnvironmentLibrary::_slice_cost(int slice) const
+    {
+        if (slice < IRRADIANCE_SLICE)
+            return 6.0 * ENVIRONMENT_SIZE * ENVIRONMENT_SIZE / 1.0e6;
+
+        // The irradiance shader walks the hemisphere in 0.025 radian steps, about 15.8k samples a pixel
+        if (slice < PREFILTER_SLICE)
+            return 6.0 * IRRADIANCE_SIZE * IRRADIANCE_SIZE * 15.8e3 / IRRADIANCE_BANDS / 1.0e6;
+
+        const int mip = slice - PREFILTER_SLICE;
+        const int size = PREFILTER_SIZE >> mip;
+        return 6.0 * size * size * static_cast<double>(mip == 0 ? 1 : _prefilter_samples[mip]) / 1.0e6;
+    }
+
+    inline float EnvironmentLibrary::get_progress(size_t index) const
+    {
+        const Environment& environment = _environments[index];
+        if (environment.state == State::Ready)
+            return 1.0f;
+        return static_cast<float>(environment.next_slice) / SLICE_COUNT;
+    }
+
+    inline glm::mat4 EnvironmentLibrary::capture_view(int face)
+    {
+        static const glm::vec3 directions[] = {
+            { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+            { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+        };
+        static const glm::vec3 ups[] = {
+            { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f },
+            { 0.0f, 0.0f, -1.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+        };
+        return glm::lookAt(glm::vec3{ 0.0f }, directions[face], ups[face]);
+    }
+
+    inline void EnvironmentLibrary::set_capture_uniforms(const Shader& shader, const glm::mat4& projection, int layer_offset)
+    {
+        shader.use();
+        shader.setMat4("projection", projection);
+        for (int face = 0; face < 6; face++)
+        {
+            shader.setMat4("captureViews[" + std::to_string(face) + "]", capture_view(face));
+        }
+        shader.setInt("layerOffset", layer_offset);
+    }
+
+    inline void EnvironmentLibrary::set_prefilter_uniforms(const Shader& shader, int mip, int mips, int source_size, int target_size, int samples, bool filtered)
+    {
+        shader.use();
+        shader.setInt("environmentMap", 0);
+        shader.setFloat("roughness", static_cast<float>(mip) / static_cast<float>(mips - 1));
+        shader.setFloat("sourceResolution", static_cast<float>(source_size));
+        shader.setFloat("targetResolution", static_cast<float>(target_size));
+        shader.setUint("sampleCount", static_cast<unsigned int>(samples));
+        shader.setBool("filteredSampling", filtered);
+    }
+
+    inline bool EnvironmentLibrary::_upload(Environment& environment)
+    {
+        Decoded decoded = environment.decoded.get();
+        if (!decoded.pixels)
+        {
+            environment.state = State::Failed;
+            if (_selected == static_cast<size_t>(&environment - _environments.data()))
+                _selected = _current;
+            return false;
+        }
+
+        glGenTextures(1, &environment.equirectangular);
+        glBindTexture(GL_TEXTURE_2D, environment.equirectangular);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, decoded.width, decoded.height, 0, GL_RGB, GL_FLOAT, decoded.pixels.get());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        auto create_cube_map = [](unsigned int& texture, int size, int levels) {
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+            glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, GL_RGB16F, size, size);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        };
+        // The prefilter picks the mip by the solid angle of its samples
+        create_cube_map(environment.maps.cube_map, ENVIRONMENT_SIZE, ENVIRONMENT_MIPS);
+        create_cube_map(environment.maps.irradiance_map, IRRADIANCE_SIZE, 1);
+        // The roughness picks the mip, so they have to be filtered between
+        create_cube_map(environment.maps.prefilter_map, PREFILTER_SIZE, PREFILTER_MIPS);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        environment.state = State::Baking;
+        environment.next_slice = CONVERT_SLICE;
+        return true;
+    }
+
+    inline void EnvironmentLibrary::_run_slice(Environment& environment, int slice, const EnvironmentBakeShaders& bake)
+    {
+        // No depth attachment, the inside of the cube is all there is
+        if (_framebuffer == 0)
+            glGenFramebuffers(1, &_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+
+        static const glm::mat4 capture_projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
+
+        const Shader* shader;
+        unsigned int target;
+        int mip = 0, size, band = 0, bands = 1;
+        if (slice < IRRADIANCE_SLICE)
+        {
+            shader = &bake.equirectangular;
+            target = environment.maps.cube_map;
+            size = ENVIRONMENT_SIZE;
+
+            shader->use();
+            shader->setInt("equirectangularMap", 0);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, environment.equirectangular);
+        }
+        else
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, environment.maps.cube_map);
+
+            if (slice < PREFILTER_SLICE)
+            {
+                shader = &bake.irradiance;
+                target = environment.maps.irradiance_map;
+                size = IRRADIANCE_SIZE;
+                band = slice - IRRADIANCE_SLICE;
+                bands = IRRADIANCE_BANDS;
+                shader->use();
+            }
+            else
+            {
+                mip = slice - PREFILTER_SLICE;
+                shader = &bake.prefilter;
+                target = environment.maps.prefilter_map;
+                size = PREFILTER_SIZE >> mip;
+                set_prefilter_uniforms(*shader, mip, PREFILTER_MIPS, ENVIRONMENT_SIZE, size, _prefilter_samples[mip]);
+            }
+            shader->setInt("environmentMap", 0);
+        }
+
+        set_capture_uniforms(*shader, capture_projection);
+        _draw_cube(target, mip, size, bake.cubeVAO, band, bands);
+
+        // Only the conversion reads the equirectangular image, the prefilter reads the mips of its result
+        if (slice == CONVERT_SLICE)
+        {
+            glDeleteTextures(1, &environment.equirectangular);
+            environment.equirectangular = 0;
+
+            glBindTexture(GL_TEXTURE_CUBE_MAP, environment.maps.cube_map);
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    inline void EnvironmentLibrary::_draw_cube(unsigned int target, int mip, int size, unsigned int cubeVAO, int band, int bands)
+    {
+        // Layered attachment, every face is a layer gl_Layer can pick
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target, mip);
+        glViewport(0, 0, size, size);
+
+        // The scissor applies to every layer and to the clear, the other bands keep what they have
+        if (bands > 1)
+        {
+            const int first_row = size * band / bands;
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(0, first_row, size, size * (band + 1) / bands - first_row);
+        }
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        glBindVertexArray(cubeVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glBindVertexArray(0);
+
+        if (bands > 1)
+            glDisable(GL_SCISSOR_TEST);
+    }
+
+    inline EnvironmentLibrary::PrefilterComparison EnvironmentLibrary::compare_prefilter(size_t index, const EnvironmentBakeShaders& bake)
+    {
+        PrefilterComparison comparison;
+        const Environment& environment = _environments[index];
+        if (environment.state != State::Ready)
+            return comparison;
+
+        if (_framebuffer == 0)
+            glGenFramebuffers(1, &_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+
+        static const glm::mat4 capture_projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
+        glActiveTexture(GL_TEXTURE0);
+
+        // A blocking query of its own, the frame timer may be running
+        unsigned int query = 0;
+        glGenQueries(1, &query);
+
+        unsigned int maps[2]{};
+        double* times[2] = { &comparison.filtered_ms, &comparison.reference_ms };
+        glGenTextures(2, maps);
+        for (int pass = 0; pass < 2; pass++)
+        {
+            const bool filtered = pass == 0;
+            glBindTexture(GL_TEXTURE_CUBE_MAP, maps[pass]);
+            glTexStorage2D(GL_TEXTURE_CUBE_MAP, PREFILTER_MIPS, GL_RGB16F, PREFILTER_SIZE, PREFILTER_SIZE);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, environment.maps.cube_map);
+
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            for (int mip = 0; mip < PREFILTER_MIPS; mip++)
+            {
+                const int size = PREFILTER_SIZE >> mip;
+                set_prefilter_uniforms(bake.prefilter, mip, PREFILTER_MIPS, ENVIRONMENT_SIZE, size,
+                    filtered ? _prefilter_samples[mip] : REFERENCE_PREFILTER_SAMPLES, filtered);
+                set_capture_uniforms(bake.prefilter, capture_projection);
+                _draw_cube(maps[pass], mip, size, bake.cubeVAO);
+            }
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+            *times[pass] = static_cast<double>(nanoseconds) / 1.0e6;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // Root mean square difference over the reference mean, per mip
+        std::vector<float> filtered, reference;
+        for (int mip = 0; mip < PREFILTER_MIPS; mip++)
+        {
+            const int size = PREFILTER_SIZE >> mip;
+            const size_t count = static_cast<size_t>(size) * size * 6 * 3;
+            filtered.resize(count);
+            reference.resize(count);
+            glGetTextureImage(maps[0], mip, GL_RGB, GL_FLOAT, static_cast<GLsizei>(count * sizeof(float)), filtered.data());
+            glGetTextureImage(maps[1], mip, GL_RGB, GL_FLOAT, static_cast<GLsizei>(count * sizeof(float)), reference.data());
+
+            double squared = 0.0, mean = 0.0;
+            for (size_t i = 0; i < count; i++)
+            {
+                const double difference = filtered[i] - reference[i];
+                squared += difference * difference;
+                mean += reference[i];
+            }
+            mean /= count;
+            comparison.error[mip] = mean > 0.0 ? static_cast<float>(std::sqrt(squared / count) / mean) : 0.0f;
+        }
+
+        glDeleteTextures(2, maps);
+        glDeleteQueries(1, &query);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        return comparison;
+    }
+
+    inline bool EnvironmentLibrary::update(float delta_time, const EnvironmentBakeShaders& bake)
+    {
+        Environment& environment = _environments[_selected];
+
+        if (environment.state == State::Decoding)
+        {
+            // The upload is a frame of its own, it stalls on the copy of the image
+            if (environment.decoded.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                _upload(environment);
+        }
+        else if (environment.state == State::Baking)
+        {
+            _timer.begin();
+
+            // What the timer just reported belongs to the frame LATENCY timed frames back
+            const int slot = _timed_frames % GpuTimer::LATENCY;
+            if (_timed_frames >= GpuTimer::LATENCY && _timed_samples[slot] > 0.0 && _timer.get_milliseconds() > 0.0)
+                _ms_per_msample += (_timer.get_milliseconds() / _timed_samples[slot] - _ms_per_msample) * 0.25;
+
+            // At least one slice, so a budget below the cost of the heaviest slice still finishes
+            double samples = 0.0;
+            do
+            {
+                samples += _slice_cost(environment.next_slice);
+                _run_slice(environment, environment.next_slice, bake);
+                environment.next_slice++;
+            } while (environment.next_slice < SLICE_COUNT &&
+                (samples + _slice_cost(environment.next_slice)) * _ms_per_msample <= _budget_ms);
+
+            _timer.end();
+            _timed_samples[slot] = samples;
+            _timed_frames++;
+
+            if (environment.next_slice == SLICE_COUNT)
+                environment.state = State::Ready;
+        }
+
+        bool changed = false;
+        if (_selected != _current && environment.state == State::Ready)
+        {
+            _previous = _current;
+            _current = _selected;
+            _blend = _fade_time > 0.0f ? 0.0f : 1.0f;
+            changed = true;
+        }
+        else if (_blend < 1.0f)
+        {
+            _blend = std::min(_blend + delta_time / _fade_time, 1.0f);
+        }
+
+        return changed;
+    }
+
+    inline void EnvironmentLibrary::_release(Environment& environment)
+    {
+        // std::async futures join in their destructor, the decoded image is freed with them
+        if (environment.decoded.valid())
+            environment.decoded.wait();
+
+        if (environment.equirectangular != 0)
+            glDeleteTextures(1, &environment.equirectangular);
+        for (unsigned int* texture : { &environment.maps.cube_map, &environment.maps.irradiance_map, &environment.maps.prefilter_map })
+        {
+            if (*texture != 0)
+                glDeleteTextures(1, texture);
+            *texture = 0;
+        }
+
+        environment.equirectangular = 0;
+        environment.state = State::Unloaded;
+        environment.next_slice = 0;
+    }
+
+    inline void EnvironmentLibrary::release()
+    {
+        for (Environment& environment : _environments)
+        {
+            _release(environment);
+        }
+
+        if (_framebuffer != 0)
+            glDeleteFramebuffers(1, &_framebuffer);
+        _framebuffer = 0;
+
+        _timer.release();
+    }
+
+}
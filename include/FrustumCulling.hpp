@@ -0,0 +1,146 @@
+#pragma once
+
+#include "Simd.hpp"
+
+#include <learnopengl/entity.h>
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace PBR{
+
+    // World space AABBs stored as structure of arrays, padded so the culling kernel can always load full batches
+    class AABBStream
+    {
+    public:
+        void reserve(size_t count);
+        void clear(){ _count = 0; }
+        void push_back(const glm::vec3& center, const glm::vec3& extents);
+        void push_back(const AABB& aabb){ push_back(aabb.center, aabb.extents); }
+
+        size_t size() const { return _count; }
+
+        glm::vec3 get_center(size_t index) const { return { _cx[index], _cy[index], _cz[index] }; }
+        glm::vec3 get_extents(size_t index) const { return { _ex[index], _ey[index], _ez[index] }; }
+
+    private:
+        static constexpr size_t PADDING = 8;
+
+        size_t _count{ 0 };
+        std::vector<float> _cx, _cy, _cz;
+        std::vector<float> _ex, _ey, _ez;
+
+        void _resize(size_t size);
+
+        friend void cull_aabbs(const Frustum& frustum, const AABBStream& boxes, std::vector<uint64_t>& visibility);
+        friend void cull_aabbs_scalar(const Frustum& frustum, const AABBStream& boxes, std::vector<uint64_t>& visibility);
+    };
+
+    // Tests every box against the six planes, bit i of the mask is set if box i is on or in front of all of them
+    inline void cull_aabbs(const Frustum& frustum, const AABBStream& boxes, std::vector<uint64_t>& visibility);
+    // Reference implementation, one box and one plane at a time
+    inline void cull_aabbs_scalar(const Frustum& frustum, const AABBStream& boxes, std::vector<uint64_t>& visibility);
+
+    inline bool is_visible(const std::vector<uint64_t>& visibility, size_t index)
+    {
+        return (visibility[index >> 6] >> (index & 63)) & 1;
+    }
+
+    inline void AABBStream::reserve(size_t count)
+    {
+        size_t padded = (count + PADDING - 1) / PADDING * PADDING;
+        for (std::vector<float>* stream : { &_cx, &_cy, &_cz, &_ex, &_ey, &_ez })
+        {
+            stream->reserve(padded);
+        }
+    }
+
+    inline void AABBStream::push_back(const glm::vec3 &center, const glm::vec3 &extents)
+    {
+        if (_count == _cx.size())
+            _resize(_cx.size() + PADDING);
+
+        _cx[_count] = center.x;
+        _cy[_count] = center.y;
+        _cz[_count] = center.z;
+        _ex[_count] = extents.x;
+        _ey[_count] = extents.y;
+        _ez[_count] = extents.z;
+        _count++;
+    }
+
+    inline void AABBStream::_resize(size_t size)
+    {
+        for (std::vector<float>* stream : { &_cx, &_cy, &_cz, &_ex, &_ey, &_ez })
+        {
+            stream->resize(size, 0.0f);
+        }
+    }
+
+    inline void cull_aabbs(const Frustum &frustum, const AABBStream &boxes, std::vector<uint64_t> &visibility)
+    {
+        using namespace simd;
+
+        const Plane* planes[6] = {
+            &frustum.leftFace, &frustum.rightFace, &frustum.topFace,
+            &frustum.bottomFace, &frustum.nearFace, &frustum.farFace
+        };
+
+        // Plane coefficients are broadcast once, the absolute normal gives the projected box radius
+        floatv nx[6], ny[6], nz[6], ax[6], ay[6], az[6], distance[6];
+        for (int p = 0; p < 6; p++)
+        {
+            nx[p] = set1(planes[p]->normal.x);
+            ny[p] = set1(planes[p]->normal.y);
+            nz[p] = set1(planes[p]->normal.z);
+            ax[p] = set1(std::abs(planes[p]->normal.x));
+            ay[p] = set1(std::abs(planes[p]->normal.y));
+            az[p] = set1(std::abs(planes[p]->normal.z));
+            distance[p] = set1(planes[p]->distance);
+        }
+
+        const floatv zero = set1(0.0f);
+        const size_t count = boxes.size();
+        visibility.assign((count + 63) / 64, 0);
+
+        for (size_t first = 0; first < count; first += WIDTH)
+        {
+            const floatv cx = load(&boxes._cx[first]);
+            const floatv cy = load(&boxes._cy[first]);
+            const floatv cz = load(&boxes._cz[first]);
+            const floatv ex = load(&boxes._ex[first]);
+            const floatv ey = load(&boxes._ey[first]);
+            const floatv ez = load(&boxes._ez[first]);
+
+            // No early out, all six planes are cheaper than a branch per lane group
+            maskv inside = mask_true();
+            for (int p = 0; p < 6; p++)
+            {
+                floatv signed_distance = fmadd(nx[p], cx, fmadd(ny[p], cy, fmadd(nz[p], cz, sub(zero, distance[p]))));
+                floatv radius = fmadd(ax[p], ex, fmadd(ay[p], ey, mul(az[p], ez)));
+                inside = mask_and(inside, greater_equal(add(signed_distance, radius), zero));
+            }
+
+            visibility[first >> 6] |= uint64_t{ movemask(inside) } << (first & 63);
+        }
+
+        // Padding lanes of the last batch must not show up as visible
+        if (count & 63)
+            visibility.back() &= (uint64_t{ 1 } << (count & 63)) - 1;
+    }
+
+    inline void cull_aabbs_scalar(const Frustum &frustum, const AABBStream &boxes, std::vector<uint64_t> &visibility)
+    {
+        const size_t count = boxes.size();
+        visibility.assign((count + 63) / 64, 0);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const AABB aabb(boxes.get_center(i), boxes._ex[i], boxes._ey[i], boxes._ez[i]);
+            if (aabb.isOnFrustum(frustum))
+                visibility[i >> 6] |= uint64_t{ 1 } << (i & 63);
+        }
+    }
+
+}
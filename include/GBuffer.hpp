@@ -0,0 +1,154 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+namespace PBR{
+
+    // Render targets of the deferred path, written by the GBUFFER variants of the PBR shaders:
+    //   0: albedo as sampled from the texture, still gamma encoded     RGBA8
+    //   1: ambient occlusion, roughness, metallic in the ARM order     RGBA8
+    //   2: octahedral encoded world space normal                       RG16_SNORM
+    //   3: motion since the last frame in texture coordinates          RG16F
+    // and a depth stencil texture the lighting pass reconstructs positions from
+    class GBuffer
+    {
+    public:
+        GBuffer() = default;
+
+        GBuffer(const GBuffer&) = delete;
+        GBuffer& operator=(const GBuffer&) = delete;
+
+        // Reallocates the targets only when the size changed
+        void resize(int width, int height);
+
+        void bind() const { glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer); }
+        // Albedo, material, normal and depth on four texture units starting at first_unit
+        void bind_textures(unsigned int first_unit) const;
+        // Copies depth and stencil into the target so forward passes can be drawn over the lit image
+        void blit_depth(unsigned int target_framebuffer) const;
+        // Copies the motion vectors into a color attachment of the target, the lighting pass does not touch them
+        void blit_velocity(unsigned int target_framebuffer, GLenum target_attachment) const;
+
+        int get_width() const { return _width; }
+        int get_height() const { return _height; }
+
+        // Must be called while the context is still alive
+        void release();
+
+    private:
+        unsigned int _create_target(GLenum internal_format, GLenum format, GLenum type, GLenum attachment);
+
+        unsigned int _framebuffer{ 0 };
+        unsigned int _albedo{ 0 };
+        unsigned int _material{ 0 };
+        unsigned int _normal{ 0 };
+        unsigned int _velocity{ 0 };
+        unsigned int _depth{ 0 };
+
+        int _width{ 0 };
+        int _height{ 0 };
+    };
+
+    inline unsigned int GBuffer::_create_target(GLenum internal_format, GLenum format, GLenum type, GLenum attachment)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, _width, _height, 0, format, type, nullptr);
+
+        // Read one texel per pixel by the lighting pass
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+        return texture;
+    }
+
+    inline void GBuffer::resize(int width, int height)
+    {
+        if (width == _width && height == _height && _framebuffer != 0)
+            return;
+
+        release();
+        _width = width;
+        _height = height;
+
+        glGenFramebuffers(1, &_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+
+        _albedo = _create_target(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0);
+        _material = _create_target(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT1);
+        _normal = _create_target(GL_RG16_SNORM, GL_RG, GL_SHORT, GL_COLOR_ATTACHMENT2);
+        _velocity = _create_target(GL_RG16F, GL_RG, GL_HALF_FLOAT, GL_COLOR_ATTACHMENT3);
+        _depth = _create_target(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, GL_DEPTH_STENCIL_ATTACHMENT);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+        glDrawBuffers(4, draw_buffers);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "G-buffer framebuffer is not complete\n";
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    inline void GBuffer::bind_textures(unsigned int first_unit) const
+    {
+        const unsigned int targets[] = { _albedo, _material, _normal, _depth };
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + first_unit + i);
+            glBindTexture(GL_TEXTURE_2D, targets[i]);
+        }
+    }
+
+    inline void GBuffer::blit_depth(unsigned int target_framebuffer) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, _framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_framebuffer);
+        glBlitFramebuffer(0, 0, _width, _height, 0, 0, _width, _height, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, target_framebuffer);
+    }
+
+    inline void GBuffer::blit_velocity(unsigned int target_framebuffer, GLenum target_attachment) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, _framebuffer);
+        glReadBuffer(GL_COLOR_ATTACHMENT3);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target_framebuffer);
+
+        // Blits write every draw buffer, narrow it down to the one attachment and restore the rest after
+        GLint draw_buffers[2];
+        glGetIntegerv(GL_DRAW_BUFFER0, &draw_buffers[0]);
+        glGetIntegerv(GL_DRAW_BUFFER1, &draw_buffers[1]);
+        glDrawBuffer(target_attachment);
+
+        glBlitFramebuffer(0, 0, _width, _height, 0, 0, _width, _height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+        const GLenum restored[] = { static_cast<GLenum>(draw_buffers[0]), static_cast<GLenum>(draw_buffers[1]) };
+        glDrawBuffers(2, restored);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindFramebuffer(GL_FRAMEBUFFER, target_framebuffer);
+    }
+
+    inline void GBuffer::release()
+    {
+        for (unsigned int* texture : { &_albedo, &_material, &_normal, &_velocity, &_depth })
+        {
+            if (*texture != 0)
+                glDeleteTextures(1, texture);
+            *texture = 0;
+        }
+
+        if (_framebuffer != 0)
+            glDeleteFramebuffers(1, &_framebuffer);
+
+        _framebuffer = 0;
+        _width = 0;
+        _height = 0;
+    }
+
+}
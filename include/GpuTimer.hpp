@@ -0,0 +1,152 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+
+namespace PBR{
+
+    // GL_TIME_ELAPSED query ring. Results are read a few frames late so the CPU never waits on the GPU.
+    // Time elapsed queries cannot nest, only one timer may be running at a time
+    class GpuTimer
+    {
+    public:
+        GpuTimer() = default;
+
+        GpuTimer(const GpuTimer&) = delete;
+        GpuTimer& operator=(const GpuTimer&) = delete;
+
+        void begin();
+        void end();
+
+        // Must be called while the context is still alive
+        void release();
+
+        // Latest finished measurement
+        double get_milliseconds() const { return _milliseconds; }
+
+        // Timed frames between a begin and the one that reads its result
+        static constexpr int LATENCY = 3;
+
+    private:
+        unsigned int _queries[LATENCY]{};
+        bool _pending[LATENCY]{};
+        int _frame{ 0 };
+        double _milliseconds{ 0.0 };
+    };
+
+    inline void GpuTimer::release()
+    {
+        if (_queries[0] != 0)
+            glDeleteQueries(LATENCY, _queries);
+
+        for (int i = 0; i < LATENCY; i++)
+        {
+            _queries[i] = 0;
+            _pending[i] = false;
+        }
+    }
+
+    inline void GpuTimer::begin()
+    {
+        // Created on first use, the timer may be constructed before the context exists
+        if (_queries[0] == 0)
+            glGenQueries(LATENCY, _queries);
+
+        int slot = _frame % LATENCY;
+        if (_pending[slot])
+        {
+            int available = 0;
+            glGetQueryObjectiv(_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(_queries[slot], GL_QUERY_RESULT, &nanoseconds);
+                _milliseconds = static_cast<double>(nanoseconds) / 1.0e6;
+            }
+            _pending[slot] = false;
+        }
+
+        glBeginQuery(GL_TIME_ELAPSED, _queries[slot]);
+    }
+
+    inline void GpuTimer::end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        _pending[_frame % LATENCY] = true;
+        _frame++;
+    }
+
+    // Same ring as GpuTimer with a pair of GL_TIMESTAMP queries per frame, so it can span passes
+    // that run their own GpuTimer
+    class GpuSpanTimer
+    {
+    public:
+        GpuSpanTimer() = default;
+
+        GpuSpanTimer(const GpuSpanTimer&) = delete;
+        GpuSpanTimer& operator=(const GpuSpanTimer&) = delete;
+
+        void begin();
+        void end();
+
+        // Must be called while the context is still alive
+        void release();
+
+        // Latest finished measurement
+        double get_milliseconds() const { return _milliseconds; }
+
+    private:
+        static constexpr int LATENCY = 3;
+
+        unsigned int _queries[LATENCY * 2]{};
+        bool _pending[LATENCY]{};
+        int _frame{ 0 };
+        double _milliseconds{ 0.0 };
+    };
+
+    inline void GpuSpanTimer::release()
+    {
+        if (_queries[0] != 0)
+            glDeleteQueries(LATENCY * 2, _queries);
+
+        for (int i = 0; i < LATENCY; i++)
+        {
+            _queries[i * 2] = 0;
+            _queries[i * 2 + 1] = 0;
+            _pending[i] = false;
+        }
+    }
+
+    inline void GpuSpanTimer::begin()
+    {
+        if (_queries[0] == 0)
+            glGenQueries(LATENCY * 2, _queries);
+
+        int slot = _frame % LATENCY;
+        if (_pending[slot])
+        {
+            int available = 0;
+            glGetQueryObjectiv(_queries[slot * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 start = 0, stop = 0;
+                glGetQueryObjectui64v(_queries[slot * 2], GL_QUERY_RESULT, &start);
+                glGetQueryObjectui64v(_queries[slot * 2 + 1], GL_QUERY_RESULT, &stop);
+                _milliseconds = static_cast<double>(stop - start) / 1.0e6;
+            }
+            _pending[slot] = false;
+        }
+
+        glQueryCounter(_queries[slot * 2], GL_TIMESTAMP);
+    }
+
+    inline void GpuSpanTimer::end()
+    {
+        int slot = _frame % LATENCY;
+        glQueryCounter(_queries[slot * 2 + 1], GL_TIMESTAMP);
+        _pending[slot] = true;
+        _frame++;
+    }
+
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+namespace PBR{
+
+    // Floating point color target the scene is lit into, with a depth stencil buffer for the
+    // forward passes and the outline. A fullscreen pass tonemaps it into the window.
+    // R11F_G11F_B10F is half the bandwidth of RGBA16F, the price is no destination alpha.
+    // With dynamic resolution only the lower left corner is rendered, the size stays the window's.
+    // The optional second attachment holds the motion vectors of the temporal upsampling
+    class HdrTarget
+    {
+    public:
+        explicit HdrTarget(GLenum color_format = GL_R11F_G11F_B10F, bool velocity = false)
+            : _color_format(color_format), _has_velocity(velocity) {}
+
+        HdrTarget(const HdrTarget&) = delete;
+        HdrTarget& operator=(const HdrTarget&) = delete;
+
+        // Reallocates the targets only when the size changed
+        void resize(int width, int height);
+
+        void bind() const { glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer); }
+        void bind_color(unsigned int unit) const;
+
+        unsigned int get_framebuffer() const { return _framebuffer; }
+        unsigned int get_color() const { return _color; }
+        unsigned int get_velocity() const { return _velocity; }
+        int get_width() const { return _width; }
+        int get_height() const { return _height; }
+
+        // Must be called while the context is still alive
+        void release();
+
+    private:
+        GLenum _color_format;
+        bool _has_velocity;
+
+        unsigned int _framebuffer{ 0 };
+        unsigned int _color{ 0 };
+        unsigned int _velocity{ 0 };
+        unsigned int _depth_stencil{ 0 };
+
+        int _width{ 0 };
+        int _height{ 0 };
+    };
+
+    inline void HdrTarget::resize(int width, int height)
+    {
+        if (width == _width && height == _height && _framebuffer != 0)
+            return;
+
+        release();
+        _width = width;
+        _height = height;
+
+        glGenFramebuffers(1, &_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, _framebuffer);
+
+        glGenTextures(1, &_color);
+        glBindTexture(GL_TEXTURE_2D, _color);
+        glTexStorage2D(GL_TEXTURE_2D, 1, _color_format, _width, _height);
+        // Filtered by the upscale
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _color, 0);
+
+        if (_has_velocity)
+        {
+            // Read one texel per pixel, in texture coordinates of the whole screen
+            glGenTextures(1, &_velocity);
+            glBindTexture(GL_TEXTURE_2D, _velocity);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG16F, _width, _height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, _velocity, 0);
+
+            const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+            glDrawBuffers(2, draw_buffers);
+        }
+
+        // Never sampled, a renderbuffer is enough and the G-buffer depth can be blitted into it
+        glGenRenderbuffers(1, &_depth_stencil);
+        glBindRenderbuffer(GL_RENDERBUFFER, _depth_stencil);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, _width, _height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, _depth_stencil);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cerr << "HDR framebuffer is not complete\n";
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    inline void HdrTarget::bind_color(unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, _color);
+    }
+
+    inline void HdrTarget::release()
+    {
+        if (_color != 0)
+            glDeleteTextures(1, &_color);
+        if (_velocity != 0)
+            glDeleteTextures(1, &_velocity);
+        if (_depth_stencil != 0)
+            glDeleteRenderbuffers(1, &_depth_stencil);
+        if (_framebuffer != 0)
+            glDeleteFramebuffers(1, &_framebuffer);
+
+        _color = 0;
+        _velocity = 0;
+        _depth_stencil = 0;
+        _framebuffer = 0;
+        _width = 0;
+        _height = 0;
+    }
+
+}
@@ -1,8 +1,11 @@
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
+#include <glm/glm.hpp>
 
 #include <string>
 #include <vector>
+#include <limits>
+#include <cstdint>
 
 #include <glad/glad.h>
 #include <Shader.hpp>
@@ -17,46 +20,154 @@ struct Vertex{
     glm::vec3 bitangent;
 };
 
+constexpr int MAX_BONE_INFLUENCES = 4;
+
+// Bones that move a skinned vertex, kept in their own stream so static meshes do not pay for it.
+// Ids index the bone palette of the model, weights are unorm16 and sum to 65535
+struct SkinInfluence{
+    uint8_t bone_ids[MAX_BONE_INFLUENCES]{ };
+    uint16_t weights[MAX_BONE_INFLUENCES]{ };
+};
+
 struct Texture{
     unsigned int id;
     std::string type;
     std::string path;
 };
 
+// What a Mesh keeps in system memory after its buffers are uploaded to the GPU
+enum class GeometryRetention{
+    None,       // Drop every CPU-side copy, only the bounds are kept
+    Positions,  // Keep a position-only stream and the indices for picking and culling
+    Full,       // Keep the full vertex and index arrays
+};
+
+// Object space bounds, computed once at load time so they survive the geometry release
+struct Bounds{
+    glm::vec3 min{ std::numeric_limits<float>::max() };
+    glm::vec3 max{ std::numeric_limits<float>::lowest() };
+    glm::vec3 sphere_center{ 0.0f };
+    float sphere_radius{ 0.0f };
+
+    bool valid() const { return min.x <= max.x; }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extents() const { return (max - min) * 0.5f; }
+
+    void expand(const glm::vec3& point){
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    // Merges the other bounds, the sphere is re-centered on the merged box and grown to hold both spheres
+    void expand(const Bounds& other){
+        if(!other.valid()) return;
+        if(!valid()){
+            *this = other;
+            return;
+        }
+
+        expand(other.min);
+        expand(other.max);
+
+        const glm::vec3 center_before = sphere_center;
+        sphere_center = center();
+        sphere_radius = std::max(glm::length(center_before - sphere_center) + sphere_radius,
+                                 glm::length(other.sphere_center - sphere_center) + other.sphere_radius);
+    }
+};
+
 class Mesh
 {
 
 public:
-    Mesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, std::vector<Texture>& textures, bool activate_textures = true);
-    Mesh(std::vector<Vertex>&& vertices, std::vector<unsigned int>&& indices, std::vector<Texture>&& textures, bool activate_textures = true);
+    Mesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, std::vector<Texture>& textures, bool activate_textures = true, GeometryRetention retention = GeometryRetention::None);
+    Mesh(std::vector<Vertex>&& vertices, std::vector<unsigned int>&& indices, std::vector<Texture>&& textures, bool activate_textures = true, GeometryRetention retention = GeometryRetention::None);
+    // Skinned mesh, one influence per vertex
+    Mesh(std::vector<Vertex>&& vertices, std::vector<SkinInfluence>&& influences, std::vector<unsigned int>&& indices, std::vector<Texture>&& textures, bool activate_textures = true, GeometryRetention retention = GeometryRetention::None);
 
     Mesh(Mesh&&) = default;
     ~Mesh();
-    void draw(const PBR::Shader& shader);
+    void draw(const PBR::Shader& shader) const;
+    // Position only stream for depth passes, no textures are bound
+    void draw_depth() const;
+    // Instances are told apart with gl_InstanceID, no textures are bound
+    void draw_instanced(unsigned int instance_count) const;
+
+    const Bounds& get_bounds() const { return _bounds; }
+    // Empty unless the mesh was created with GeometryRetention::Positions
+    const std::vector<glm::vec3>& get_positions() const { return _positions; }
+    // Empty when the mesh was created with GeometryRetention::None
+    const std::vector<unsigned int>& get_indices() const { return _indices; }
+    // Empty unless the mesh was created with GeometryRetention::Full
+    const std::vector<Vertex>& get_vertices() const { return _vertices; }
+
+    // Skinned meshes feed bone ids and weights to attributes 5 and 6 of both the full and the depth only stream
+    bool is_skinned() const { return _skinned; }
+
+    // Buffers read by the compute skinning pass, the skin buffer is 0 for static meshes
+    unsigned int get_vertex_buffer() const { return ABO; }
+    unsigned int get_skin_buffer() const { return _skinned ? SBO : 0; }
+    unsigned int get_element_buffer() const { return EBO; }
+
+    unsigned int vertex_count() const { return _vertex_count; }
+    unsigned int index_count() const { return _index_count; }
+
+    // Bytes held in system memory by the geometry streams
+    size_t cpu_bytes() const;
+    // Bytes uploaded to the vertex and element buffers
+    size_t gpu_bytes() const;
 
 private:
+    // Zero bone weights for the SKINNED shaders when they draw a mesh without influences
+    void _bind_static_influence() const;
+
     std::vector<Vertex> _vertices;
+    std::vector<SkinInfluence> _influences;
     std::vector<unsigned int> _indices;
+    std::vector<glm::vec3> _positions;
     std::vector<Texture> _textures;
+    Bounds _bounds;
+    unsigned int _vertex_count;
+    unsigned int _index_count;
     unsigned int VAO; // Vertex array object: stores the buffers and vertex format
     unsigned int ABO; // Array buffer object: vertex attributes buffer
     unsigned int EBO; // Element array buffer object: vertex indices buffer
+    unsigned int PBO; // Position buffer object: tightly packed positions for depth only passes
+    unsigned int depth_VAO; // Vertex array object reading only the position buffer
+    unsigned int SBO; // Skin buffer object: bone ids and weights of skinned meshes
     bool activate_textures;
+    bool _skinned{ false };
+    GeometryRetention _retention;
     
 
     void _SetupMesh();
+    void _SetupSkinAttributes();
+    void _ComputeBounds();
+    void _ReleaseGeometry();
 };
 
-Mesh::Mesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, std::vector<Texture>& textures, bool activate_textures)
-    :_vertices{ std::move(vertices) }, _indices{ std::move(indices) }, _textures{ std::move(textures) }, activate_textures { activate_textures }
+Mesh::Mesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, std::vector<Texture>& textures, bool activate_textures, GeometryRetention retention)
+    :_vertices{ std::move(vertices) }, _indices{ std::move(indices) }, _textures{ std::move(textures) }, activate_textures { activate_textures }, _retention{ retention }
 {
+    this->_ComputeBounds();
     this->_SetupMesh();
+    this->_ReleaseGeometry();
 }
 
-Mesh::Mesh(std::vector<Vertex>&& vertices, std::vector<unsigned int>&& indices, std::vector<Texture>&& textures, bool activate_textures)
-    :_vertices{ std::move(vertices) }, _indices{ std::move(indices) }, _textures{ std::move(textures) }, activate_textures { activate_textures }
+Mesh::Mesh(std::vector<Vertex>&& vertices, std::vector<unsigned int>&& indices, std::vector<Texture>&& textures, bool activate_textures, GeometryRetention retention)
+    :_vertices{ std::move(vertices) }, _indices{ std::move(indices) }, _textures{ std::move(textures) }, activate_textures { activate_textures }, _retention{ retention }
 {
+    this->_ComputeBounds();
     this->_SetupMesh();
+    this->_ReleaseGeometry();
+}
+
+Mesh::Mesh(std::vector<Vertex>&& vertices, std::vector<SkinInfluence>&& influences, std::vector<unsigned int>&& indices, std::vector<Texture>&& textures, bool activate_textures, GeometryRetention retention)
+    :_vertices{ std::move(vertices) }, _influences{ std::move(influences) }, _indices{ std::move(indices) }, _textures{ std::move(textures) }, activate_textures { activate_textures }, _skinned{ true }, _retention{ retention }
+{
+    this->_ComputeBounds();
+    this->_SetupMesh();
+    this->_ReleaseGeometry();
 }
 
 
@@ -64,7 +175,7 @@ Mesh::~Mesh()
 {
 }
 
-inline void Mesh::draw(const PBR::Shader &shader)
+inline void Mesh::draw(const PBR::Shader &shader) const
 {
     if(activate_textures){
         unsigned int diffuse_num = 1;
@@ -74,7 +185,7 @@ inline void Mesh::draw(const PBR::Shader &shader)
             // Activate the i'th texture
             glActiveTexture(GL_TEXTURE0 + i);
 
-            std::string& texture_name = _textures[i].type;
+            const std::string& texture_name = _textures[i].type;
             std::string number;
 
             if(texture_name == "texture_diffuse"){
@@ -92,10 +203,49 @@ inline void Mesh::draw(const PBR::Shader &shader)
         }
     }
 
+    _bind_static_influence();
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, _index_count, GL_UNSIGNED_INT, nullptr);
+    glBindVertexArray(0);
+
+}
+
+inline void Mesh::_bind_static_influence() const
+{
+    if(_skinned) return;
+
+    // Attributes 5 and 6 are disabled and read the current values, which default to bone 1 with weight 1.
+    // No weight at all makes skinMatrix return the identity, so a static mesh of a skinned model stays in place
+    glVertexAttribI4ui(5, 0, 0, 0, 0);
+    glVertexAttrib4f(6, 0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+inline void Mesh::draw_depth() const
+{
+    _bind_static_influence();
+    glBindVertexArray(depth_VAO);
+    glDrawElements(GL_TRIANGLES, _index_count, GL_UNSIGNED_INT, nullptr);
+    glBindVertexArray(0);
+}
+
+inline void Mesh::draw_instanced(unsigned int instance_count) const
+{
     glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, _indices.size(), GL_UNSIGNED_INT, nullptr);
+    glDrawElementsInstanced(GL_TRIANGLES, _index_count, GL_UNSIGNED_INT, nullptr, instance_count);
     glBindVertexArray(0);
+}
+
+inline size_t Mesh::cpu_bytes() const
+{
+    return _vertices.capacity() * sizeof(decltype(_vertices)::value_type) +
+        _indices.capacity() * sizeof(decltype(_indices)::value_type) +
+        _positions.capacity() * sizeof(decltype(_positions)::value_type);
+}
 
+inline size_t Mesh::gpu_bytes() const
+{
+    const size_t vertex_bytes = sizeof(Vertex) + sizeof(glm::vec3) + (_skinned ? sizeof(SkinInfluence) : 0);
+    return static_cast<size_t>(_vertex_count) * vertex_bytes + static_cast<size_t>(_index_count) * sizeof(unsigned int);
 }
 
 inline void Mesh::_SetupMesh()
@@ -135,7 +285,96 @@ inline void Mesh::_SetupMesh()
     glEnableVertexAttribArray(4);
     glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(decltype(_vertices)::value_type),  reinterpret_cast<void *>(offsetof(Vertex, bitangent)));
 
+    if(_skinned){
+        glGenBuffers(1, &SBO);
+        glBindBuffer(GL_ARRAY_BUFFER, SBO);
+        glBufferData(GL_ARRAY_BUFFER, _influences.size() * sizeof(SkinInfluence), _influences.data(), GL_STATIC_DRAW);
+        _SetupSkinAttributes();
+    }
+
     glBindVertexArray(0);
+
+    // Depth passes only fetch positions, a packed stream keeps them from pulling the whole vertex through the cache
+    std::vector<glm::vec3> positions;
+    positions.reserve(_vertices.size());
+    for(const Vertex& vertex: _vertices){
+        positions.push_back(vertex.position);
+    }
+
+    glCreateVertexArrays(1, &depth_VAO);
+    glBindVertexArray(depth_VAO);
+
+    glGenBuffers(1, &PBO);
+    glBindBuffer(GL_ARRAY_BUFFER, PBO);
+    glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+
+    // The depth pass has to skin too, otherwise its depth would not match the color pass
+    if(_skinned){
+        glBindBuffer(GL_ARRAY_BUFFER, SBO);
+        _SetupSkinAttributes();
+    }
+
+    glBindVertexArray(0);
+}
+
+inline void Mesh::_SetupSkinAttributes()
+{
+    // bone ids, read as integers
+    glEnableVertexAttribArray(5);
+    glVertexAttribIPointer(5, MAX_BONE_INFLUENCES, GL_UNSIGNED_BYTE, sizeof(SkinInfluence), reinterpret_cast<void *>(offsetof(SkinInfluence, bone_ids)));
+
+    // bone weights, normalized to [0, 1]
+    glEnableVertexAttribArray(6);
+    glVertexAttribPointer(6, MAX_BONE_INFLUENCES, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(SkinInfluence), reinterpret_cast<void *>(offsetof(SkinInfluence, weights)));
+}
+
+inline void Mesh::_ComputeBounds()
+{
+    _vertex_count = static_cast<unsigned int>(_vertices.size());
+    _index_count = static_cast<unsigned int>(_indices.size());
+
+    for(const Vertex& vertex: _vertices){
+        _bounds.expand(vertex.position);
+    }
+
+    if(!_bounds.valid()) return;
+
+    // Sphere around the box center, tighter than the half diagonal of the box
+    _bounds.sphere_center = _bounds.center();
+    float radius_squared = 0.0f;
+    for(const Vertex& vertex: _vertices){
+        glm::vec3 offset = vertex.position - _bounds.sphere_center;
+        radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+    }
+    _bounds.sphere_radius = std::sqrt(radius_squared);
 }
 
+inline void Mesh::_ReleaseGeometry()
+{
+    // Swapping with an empty vector is the only way to be sure the capacity is given back
+    std::vector<SkinInfluence>{ }.swap(_influences);
 
+    switch (_retention)
+    {
+    case GeometryRetention::None:
+        std::vector<Vertex>{ }.swap(_vertices);
+        std::vector<unsigned int>{ }.swap(_indices);
+        break;
+    case GeometryRetention::Positions:
+        _positions.reserve(_vertices.size());
+        for(const Vertex& vertex: _vertices){
+            _positions.push_back(vertex.position);
+        }
+        std::vector<Vertex>{ }.swap(_vertices);
+        _indices.shrink_to_fit();
+        break;
+    case GeometryRetention::Full:
+    default:
+        break;
+    }
+}
@@ -5,8 +5,13 @@
 #include <assimp/postprocess.h>
 #include <assimp/material.h>
 
+#include <learnopengl/animdata.h>
+#include <learnopengl/assimp_glm_helpers.h>
+
 #include <filesystem>
 #include <unordered_map>
+#include <map>
+#include <array>
 
 #include <stb/stb_image.h>
 
@@ -23,33 +28,68 @@ class Model
 {
 
 public:
-    Model(const std::string& path, bool activate_textures = true);
+    Model(const std::string& path, bool activate_textures = true, GeometryRetention retention = GeometryRetention::None);
     void draw(const PBR::Shader& shader);
     ~Model();
     
     static unsigned int texture_from_file(const std::string& path);
 
+    const std::vector<Mesh>& get_meshes() const { return _meshes; }
+    // Union of the bounds of all meshes in model space
+    const Bounds& get_bounds() const { return _bounds; }
+    const std::string& get_name() const { return _name; }
+    GeometryRetention get_retention() const { return _retention; }
+
+    // True when any mesh is skinned. The bone map is what AnimationClip and Animator expect,
+    // bone ids are the palette indices stored in the meshes
+    bool is_skinned() const { return _bone_count > 0; }
+    const std::map<std::string, BoneInfo>& get_bone_info() const { return _bone_info; }
+    int get_bone_count() const { return _bone_count; }
+    unsigned int get_animation_count() const { return _animation_count; }
+    const std::string& get_path() const { return _path; }
+
+    // Resident geometry memory of the model
+    size_t cpu_bytes() const;
+    size_t gpu_bytes() const;
+
 private:
     std::vector<Mesh> _meshes;
     std::filesystem::path _directory;
+    std::string _path;
+    std::string _name;
     // This is a set for the loaded textures so we dont load the same texture twice
     std::unordered_map<size_t, Texture> _loaded_textures;
+    Bounds _bounds;
     bool activate_textures;
+    GeometryRetention _retention;
+
+    std::map<std::string, BoneInfo> _bone_info;
+    int _bone_count{ 0 };
+    unsigned int _animation_count{ 0 };
 
     void load_model(const std::string& path);
     void process_node(const aiScene *scene, aiNode *node);
     void process_mesh(const aiScene *scene, aiMesh *mesh);
+    std::vector<SkinInfluence> extract_influences(aiMesh *mesh);
     std::vector<Texture> load_material_textures(aiMaterial *mat, aiTextureType type, const std::string& typeName);
 };
 
-Model::Model(const std::string& path, bool activate_textures)
-    : activate_textures { activate_textures }
+Model::Model(const std::string& path, bool activate_textures, GeometryRetention retention)
+    : _path{ path }, _name{ std::filesystem::path{ path }.stem().string() }, activate_textures { activate_textures }, _retention{ retention }
 {
     load_model(path);
 
     for(const std::pair<size_t, Texture>& loaded_texture: _loaded_textures){
         std::cout << "Texture type: " << loaded_texture.second.type << ", Texture path: " << loaded_texture.second.path << "\n";
     }
+
+    for(const Mesh& mesh: _meshes){
+        _bounds.expand(mesh.get_bounds());
+    }
+
+    std::cout << "Model: " << _name << ", meshes: " << _meshes.size() 
+        << ", CPU geometry: " << cpu_bytes() / 1024 << " KiB"
+        << ", GPU geometry: " << gpu_bytes() / 1024 << " KiB\n";
 }
 
 inline void Model::draw(const PBR::Shader &shader)
@@ -59,6 +99,24 @@ inline void Model::draw(const PBR::Shader &shader)
     }
 }
 
+inline size_t Model::cpu_bytes() const
+{
+    size_t bytes = 0;
+    for(const Mesh& mesh: _meshes){
+        bytes += mesh.cpu_bytes();
+    }
+    return bytes;
+}
+
+inline size_t Model::gpu_bytes() const
+{
+    size_t bytes = 0;
+    for(const Mesh& mesh: _meshes){
+        bytes += mesh.gpu_bytes();
+    }
+    return bytes;
+}
+
 Model::~Model()
 {
 }
@@ -68,7 +126,8 @@ inline void Model::load_model(const std::string & path)
     // Importer takes care of the data structures itself
     // When the Assimp::Importer goes out of scope its destructor will clear all the data it initialized 
     Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+    // Assimp keeps the 4 largest weights of every vertex and renormalizes them
+    const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights);
 
     if(scene == nullptr | scene->mRootNode == nullptr | (scene->mFlags && AI_SCENE_FLAGS_INCOMPLETE)){
         std::cerr << "Error loading the Model:\n";
@@ -77,6 +136,7 @@ inline void Model::load_model(const std::string & path)
     }
 
     _directory = path.substr(0, path.find_last_of("/"));
+    _animation_count = scene->mNumAnimations;
 
     process_node(scene, scene->mRootNode);
 }
@@ -126,6 +186,7 @@ inline void Model::process_mesh(const aiScene *scene, aiMesh *mesh)
     }
 
     // Fill the indices buffer
+    indices.reserve(mesh->mNumFaces * 3);
     for(size_t i = 0; i < mesh->mNumFaces; i++){
         indices.push_back(mesh->mFaces[i].mIndices[0]);
         indices.push_back(mesh->mFaces[i].mIndices[1]);
@@ -149,10 +210,69 @@ inline void Model::process_mesh(const aiScene *scene, aiMesh *mesh)
     
     
     // This should use move constructor for the vectors and avoid copying the entire data
-    _meshes.emplace_back(std::move(vertices), std::move(indices), std::move(textures), activate_textures);
+    if(mesh->HasBones())
+        _meshes.emplace_back(std::move(vertices), extract_influences(mesh), std::move(indices), std::move(textures), activate_textures, _retention);
+    else
+        _meshes.emplace_back(std::move(vertices), std::move(indices), std::move(textures), activate_textures, _retention);
     
 }
 
+inline std::vector<SkinInfluence> Model::extract_influences(aiMesh *mesh)
+{
+    struct Influence{
+        int bone_id{ 0 };
+        float weight{ 0.0f };
+    };
+    std::vector<std::array<Influence, MAX_BONE_INFLUENCES>> influences{ mesh->mNumVertices };
+
+    for(unsigned int bone_index = 0; bone_index < mesh->mNumBones; bone_index++){
+        const aiBone* bone = mesh->mBones[bone_index];
+
+        // Bones are shared by every mesh of the model, the first mesh that uses one gives it its id
+        auto [bone_info, inserted] = _bone_info.try_emplace(bone->mName.C_Str());
+        if(inserted){
+            bone_info->second.id = _bone_count++;
+            bone_info->second.offset = AssimpGLMHelpers::ConvertMatrixToGLMFormat(bone->mOffsetMatrix);
+        }
+
+        const int bone_id = bone_info->second.id;
+        if(bone_id > std::numeric_limits<uint8_t>::max()){
+            std::cerr << "Model: " << _name << ", bone " << bone->mName.C_Str() << " does not fit in the 8 bit bone ids and is ignored\n";
+            continue;
+        }
+
+        // Keep the largest weights, the smallest one is replaced when a vertex has more than MAX_BONE_INFLUENCES
+        for(unsigned int i = 0; i < bone->mNumWeights; i++){
+            std::array<Influence, MAX_BONE_INFLUENCES>& vertex = influences[bone->mWeights[i].mVertexId];
+            Influence& smallest = *std::min_element(vertex.begin(), vertex.end(), [](const Influence& a, const Influence& b){ return a.weight < b.weight; });
+            if(bone->mWeights[i].mWeight > smallest.weight)
+                smallest = { bone_id, bone->mWeights[i].mWeight };
+        }
+    }
+
+    std::vector<SkinInfluence> packed{ mesh->mNumVertices };
+    for(size_t v = 0; v < influences.size(); v++){
+        float sum = 0.0f;
+        for(const Influence& influence: influences[v]){
+            sum += influence.weight;
+        }
+        if(sum <= 0.0f) continue;
+
+        // Quantize the normalized weights and hand the rounding error to the largest one, so they sum to exactly one
+        int total = 0;
+        int largest = 0;
+        for(int i = 0; i < MAX_BONE_INFLUENCES; i++){
+            packed[v].bone_ids[i] = static_cast<uint8_t>(influences[v][i].bone_id);
+            packed[v].weights[i] = static_cast<uint16_t>(std::lround(influences[v][i].weight / sum * 65535.0f));
+            total += packed[v].weights[i];
+            if(packed[v].weights[i] > packed[v].weights[largest]) largest = i;
+        }
+        packed[v].weights[largest] = static_cast<uint16_t>(packed[v].weights[largest] + 65535 - total);
+    }
+
+    return packed;
+}
+
 inline std::vector<Texture> Model::load_material_textures(aiMaterial *mat, aiTextureType type, const std::string &typeName)
 {   
     std::vector<Texture> textures;
@@ -0,0 +1,368 @@
+#pragma once
+
+#include "Simd.hpp"
+#include "ThreadPool.hpp"
+#include "Model.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+
+namespace PBR{
+
+    // Low polygon stand in for a model, only used to fill the occlusion depth buffer
+    struct OccluderMesh
+    {
+        std::vector<glm::vec3> positions;
+        std::vector<unsigned int> indices;
+    };
+
+    // The largest triangles of the model, up to max_triangles. Only source triangles are kept, none is moved,
+    // so the occluder never covers what the model does not, gaps like the slats of a chair stay open.
+    // The model must keep its positions (GeometryRetention::Positions or Full)
+    OccluderMesh simplify_occluder(const Model& model, size_t max_triangles = 512);
+
+    // Software depth buffer for occlusion queries.
+    // Occluder triangles are binned into screen tiles, the tiles are rasterized in parallel with SIMD rows,
+    // then occludees are tested with their screen space bounding rectangle and nearest depth.
+    class OcclusionCuller
+    {
+    public:
+        static constexpr int TILE_SIZE = 32;
+
+        OcclusionCuller(int width = 320, int height = 192);
+
+        void begin_frame(const glm::mat4& view_projection);
+        void add_occluder(const OccluderMesh& mesh, const glm::mat4& model);
+        void rasterize(ThreadPool& pool);
+
+        // Conservative, boxes crossing the near plane or leaving the screen are always visible
+        bool is_visible(const glm::vec3& min, const glm::vec3& max) const;
+
+        size_t get_triangle_count() const { return _triangles.size(); }
+        // Setup and rasterization of the current frame in milliseconds
+        double get_raster_time() const { return _raster_time; }
+
+        int get_width() const { return _width; }
+        int get_height() const { return _height; }
+        // Nearest occluder depth per pixel in [0, 1], rows from the bottom of the screen up
+        const std::vector<float>& get_depth() const { return _depth; }
+
+    private:
+        struct ScreenTriangle
+        {
+            // Pixel coordinates and depth
+            glm::vec3 v0, v1, v2;
+        };
+
+        int _width;
+        int _height;
+        int _tiles_x;
+        int _tiles_y;
+
+        glm::mat4 _view_projection{ 1.0f };
+
+        std::vector<ScreenTriangle> _triangles;
+        std::vector<glm::vec4> _clip_positions;
+        std::vector<std::vector<uint32_t>> _bins;
+
+        std::vector<float> _depth;
+        // Farthest depth of each tile, a box behind it is hidden without looking at the pixels
+        std::vector<float> _tile_max;
+
+        double _raster_time{ 0.0 };
+
+        void _rasterize_tile(size_t tile);
+    };
+
+    inline OccluderMesh simplify_occluder(const Model &model, size_t max_triangles)
+    {
+        struct SourceTriangle
+        {
+            const Mesh* mesh;
+            size_t first;
+            float area;
+        };
+
+        std::vector<SourceTriangle> triangles;
+        for (const Mesh& mesh : model.get_meshes())
+        {
+            const std::vector<glm::vec3>& positions = mesh.get_positions();
+            const std::vector<unsigned int>& indices = mesh.get_indices();
+
+            for (size_t i = 0; i + 2 < indices.size(); i += 3)
+            {
+                const glm::vec3& a = positions[indices[i]];
+                const glm::vec3& b = positions[indices[i + 1]];
+                const glm::vec3& c = positions[indices[i + 2]];
+                const float area = glm::length(glm::cross(b - a, c - a));
+                if (area > 0.0f)
+                    triangles.push_back({ &mesh, i, area });
+            }
+        }
+
+        // The large triangles hide the most
+        if (triangles.size() > max_triangles)
+        {
+            std::nth_element(triangles.begin(), triangles.begin() + max_triangles, triangles.end(),
+                [](const SourceTriangle& a, const SourceTriangle& b) { return a.area > b.area; });
+            triangles.resize(max_triangles);
+        }
+
+        OccluderMesh occluder;
+        std::unordered_map<const Mesh*, std::unordered_map<unsigned int, unsigned int>> remaps;
+        for (const SourceTriangle& triangle : triangles)
+        {
+            std::unordered_map<unsigned int, unsigned int>& remap = remaps[triangle.mesh];
+            for (size_t corner = 0; corner < 3; corner++)
+            {
+                const unsigned int source = triangle.mesh->get_indices()[triangle.first + corner];
+                auto [it, inserted] = remap.try_emplace(source, static_cast<unsigned int>(occluder.positions.size()));
+                if (inserted)
+                    occluder.positions.push_back(triangle.mesh->get_positions()[source]);
+                occluder.indices.push_back(it->second);
+            }
+        }
+
+        return occluder;
+    }
+
+    inline OcclusionCuller::OcclusionCuller(int width, int height)
+        : _width{ (width + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE },
+        _height{ (height + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE }
+    {
+        _tiles_x = _width / TILE_SIZE;
+        _tiles_y = _height / TILE_SIZE;
+
+        _bins.resize(static_cast<size_t>(_tiles_x) * _tiles_y);
+        _tile_max.resize(_bins.size(), 1.0f);
+        _depth.resize(static_cast<size_t>(_width) * _height, 1.0f);
+    }
+
+    inline void OcclusionCuller::begin_frame(const glm::mat4 &view_projection)
+    {
+        _view_projection = view_projection;
+        _triangles.clear();
+        _raster_time = 0.0;
+
+        for (std::vector<uint32_t>& bin : _bins)
+        {
+            bin.clear();
+        }
+    }
+
+    inline void OcclusionCuller::add_occluder(const OccluderMesh &mesh, const glm::mat4 &model)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        const glm::mat4 mvp = _view_projection * model;
+
+        _clip_positions.resize(mesh.positions.size());
+        for (size_t i = 0; i < mesh.positions.size(); i++)
+        {
+            _clip_positions[i] = mvp * glm::vec4{ mesh.positions[i], 1.0f };
+        }
+
+        const glm::vec3 viewport{ _width * 0.5f, _height * 0.5f, 0.5f };
+
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+        {
+            const glm::vec4& c0 = _clip_positions[mesh.indices[i]];
+            const glm::vec4& c1 = _clip_positions[mesh.indices[i + 1]];
+            const glm::vec4& c2 = _clip_positions[mesh.indices[i + 2]];
+
+            // Triangles crossing the near plane are dropped, having fewer occluders is always safe
+            if (c0.w <= 1e-4f || c1.w <= 1e-4f || c2.w <= 1e-4f)
+                continue;
+
+            const glm::vec3 v0 = (glm::vec3{ c0 } / c0.w + 1.0f) * viewport;
+            const glm::vec3 v1 = (glm::vec3{ c1 } / c1.w + 1.0f) * viewport;
+            const glm::vec3 v2 = (glm::vec3{ c2 } / c2.w + 1.0f) * viewport;
+
+            // Back facing and degenerate triangles, closed occluders are covered by their front faces
+            float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+            if (area <= 0.0f)
+                continue;
+
+            int min_x = std::max(0, static_cast<int>(std::min(std::min(v0.x, v1.x), v2.x)));
+            int max_x = std::min(_width - 1, static_cast<int>(std::max(std::max(v0.x, v1.x), v2.x)));
+            int min_y = std::max(0, static_cast<int>(std::min(std::min(v0.y, v1.y), v2.y)));
+            int max_y = std::min(_height - 1, static_cast<int>(std::max(std::max(v0.y, v1.y), v2.y)));
+
+            if (min_x > max_x || min_y > max_y)
+                continue;
+
+            uint32_t index = static_cast<uint32_t>(_triangles.size());
+            _triangles.push_back({ v0, v1, v2 });
+
+            for (int ty = min_y / TILE_SIZE; ty <= max_y / TILE_SIZE; ty++)
+            {
+                for (int tx = min_x / TILE_SIZE; tx <= max_x / TILE_SIZE; tx++)
+                {
+                    _bins[static_cast<size_t>(ty) * _tiles_x + tx].push_back(index);
+                }
+            }
+        }
+
+        _raster_time += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    inline void OcclusionCuller::rasterize(ThreadPool &pool)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        pool.parallel_for(_bins.size(), [this](size_t tile) { _rasterize_tile(tile); });
+
+        _raster_time += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    inline void OcclusionCuller::_rasterize_tile(size_t tile)
+    {
+        using namespace simd;
+
+        const int tile_x = static_cast<int>(tile % _tiles_x) * TILE_SIZE;
+        const int tile_y = static_cast<int>(tile / _tiles_x) * TILE_SIZE;
+
+        for (int y = tile_y; y < tile_y + TILE_SIZE; y++)
+        {
+            std::fill_n(&_depth[static_cast<size_t>(y) * _width + tile_x], TILE_SIZE, 1.0f);
+        }
+
+        alignas(32) float lane_offsets[WIDTH];
+        for (int lane = 0; lane < WIDTH; lane++)
+        {
+            lane_offsets[lane] = lane + 0.5f;
+        }
+        const floatv offsets = load(lane_offsets);
+        const floatv zero = set1(0.0f);
+
+        for (uint32_t index : _bins[tile])
+        {
+            const ScreenTriangle& triangle = _triangles[index];
+            const glm::vec3& v0 = triangle.v0;
+            const glm::vec3& v1 = triangle.v1;
+            const glm::vec3& v2 = triangle.v2;
+
+            // Edge functions a * x + b * y + c, positive inside a counter clockwise triangle
+            const glm::vec3 a{ v0.y - v1.y, v1.y - v2.y, v2.y - v0.y };
+            const glm::vec3 b{ v1.x - v0.x, v2.x - v1.x, v0.x - v2.x };
+            const glm::vec3 c{
+                -(a.x * v0.x + b.x * v0.y),
+                -(a.y * v1.x + b.y * v1.y),
+                -(a.z * v2.x + b.z * v2.y)
+            };
+
+            // Depth is linear in screen space
+            const float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+            const float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+            const float dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+
+            // Triangle bounds clamped to the tile, x aligned to the SIMD width
+            int min_x = std::max(tile_x, static_cast<int>(std::min(std::min(v0.x, v1.x), v2.x)));
+            int max_x = std::min(tile_x + TILE_SIZE - 1, static_cast<int>(std::max(std::max(v0.x, v1.x), v2.x)));
+            int min_y = std::max(tile_y, static_cast<int>(std::min(std::min(v0.y, v1.y), v2.y)));
+            int max_y = std::min(tile_y + TILE_SIZE - 1, static_cast<int>(std::max(std::max(v0.y, v1.y), v2.y)));
+            min_x -= (min_x - tile_x) % WIDTH;
+
+            const floatv a0 = set1(a.x), a1 = set1(a.y), a2 = set1(a.z);
+            const floatv depth_dx = set1(dzdx);
+
+            for (int y = min_y; y <= max_y; y++)
+            {
+                const float py = y + 0.5f;
+                const floatv row0 = set1(b.x * py + c.x);
+                const floatv row1 = set1(b.y * py + c.y);
+                const floatv row2 = set1(b.z * py + c.z);
+                const floatv row_depth = set1(v0.z + dzdy * (py - v0.y) - dzdx * v0.x);
+
+                float* depth_row = &_depth[static_cast<size_t>(y) * _width];
+
+                for (int x = min_x; x <= max_x; x += WIDTH)
+                {
+                    const floatv px = add(set1(static_cast<float>(x)), offsets);
+
+                    maskv inside = greater_equal(fmadd(a0, px, row0), zero);
+                    inside = mask_and(inside, greater_equal(fmadd(a1, px, row1), zero));
+                    inside = mask_and(inside, greater_equal(fmadd(a2, px, row2), zero));
+
+                    if (!movemask(inside))
+                        continue;
+
+                    const floatv depth = fmadd(depth_dx, px, row_depth);
+                    const floatv current = load(depth_row + x);
+                    store(depth_row + x, select(inside, min(current, depth), current));
+                }
+            }
+        }
+
+        float farthest = 0.0f;
+        for (int y = tile_y; y < tile_y + TILE_SIZE; y++)
+        {
+            const float* row = &_depth[static_cast<size_t>(y) * _width + tile_x];
+            farthest = std::max(farthest, *std::max_element(row, row + TILE_SIZE));
+        }
+        _tile_max[tile] = farthest;
+    }
+
+    inline bool OcclusionCuller::is_visible(const glm::vec3 &min, const glm::vec3 &max) const
+    {
+        glm::vec2 screen_min{ std::numeric_limits<float>::max() };
+        glm::vec2 screen_max{ std::numeric_limits<float>::lowest() };
+        float nearest = std::numeric_limits<float>::max();
+
+        for (int corner = 0; corner < 8; corner++)
+        {
+            const glm::vec3 point{ corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y, corner & 4 ? max.z : min.z };
+            const glm::vec4 clip = _view_projection * glm::vec4{ point, 1.0f };
+
+            if (clip.w <= 1e-4f)
+                return true;
+
+            const glm::vec3 ndc = glm::vec3{ clip } / clip.w;
+            screen_min = glm::min(screen_min, glm::vec2{ ndc.x, ndc.y });
+            screen_max = glm::max(screen_max, glm::vec2{ ndc.x, ndc.y });
+            nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+        }
+
+        int min_x = std::max(0, static_cast<int>((screen_min.x * 0.5f + 0.5f) * _width));
+        int max_x = std::min(_width - 1, static_cast<int>((screen_max.x * 0.5f + 0.5f) * _width));
+        int min_y = std::max(0, static_cast<int>((screen_min.y * 0.5f + 0.5f) * _height));
+        int max_y = std::min(_height - 1, static_cast<int>((screen_max.y * 0.5f + 0.5f) * _height));
+
+        // Off screen, the frustum test is responsible for these
+        if (min_x > max_x || min_y > max_y)
+            return true;
+
+        for (int ty = min_y / TILE_SIZE; ty <= max_y / TILE_SIZE; ty++)
+        {
+            for (int tx = min_x / TILE_SIZE; tx <= max_x / TILE_SIZE; tx++)
+            {
+                if (nearest > _tile_max[static_cast<size_t>(ty) * _tiles_x + tx])
+                    continue;
+
+                int x_begin = std::max(min_x, tx * TILE_SIZE);
+                int x_end = std::min(max_x, tx * TILE_SIZE + TILE_SIZE - 1);
+                int y_begin = std::max(min_y, ty * TILE_SIZE);
+                int y_end = std::min(max_y, ty * TILE_SIZE + TILE_SIZE - 1);
+
+                for (int y = y_begin; y <= y_end; y++)
+                {
+                    const float* row = &_depth[static_cast<size_t>(y) * _width];
+                    for (int x = x_begin; x <= x_end; x++)
+                    {
+                        if (nearest <= row[x])
+                            return true;
+                    }
+                }
+            }
+        }
+
+        return false;
+    }
+
+}
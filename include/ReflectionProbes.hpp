@@ -0,0 +1,547 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "Shader.hpp"
+#include "EnvironmentLibrary.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace PBR{
+
+    // Placed in the scene. The box bounds the reflections for the parallax correction and is where
+    // the probe is used, the capture point should be inside it
+    struct ReflectionProbe
+    {
+        glm::vec3 position{ 0.0f };
+        glm::vec3 box_min{ -1.0f };
+        glm::vec3 box_max{ 1.0f };
+    };
+
+    // Local reflections of a scene, every probe is a layer of one prefiltered cube map array with the
+    // mip chain of the environment prefilter map. A probe is baked in slices, one face of the capture
+    // or all faces of a prefilter mip, a few per frame, and only again when the static scene changes.
+    // Finished probes are read back without waiting on the GPU and written to disk a few frames later,
+    // a later run with the same scene loads them instead
+    class ReflectionProbes
+    {
+    public:
+        static constexpr int MAX_PROBES = 8;
+        static constexpr int SIZE = 128;
+        static constexpr int MIPS = 5;
+
+        // Draws the scene into the bound capture face
+        using CaptureFunction = std::function<void(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& position)>;
+
+        ReflectionProbes() = default;
+
+        ReflectionProbes(const ReflectionProbes&) = delete;
+        ReflectionProbes& operator=(const ReflectionProbes&) = delete;
+
+        // New probe set, what the cache has for the signature is loaded and the rest is baked.
+        // The signature stands for everything the captures see, an empty cache path never touches the disk
+        void set_probes(const std::vector<ReflectionProbe>& probes, const std::string& cache_path, uint64_t signature);
+        // Something the captures see changed, every probe is baked again
+        void invalidate(uint64_t signature);
+        // The probe was moved and let go, the cache may have its new placement
+        void invalidate_probe(size_t index);
+        // Bakes every probe again even when the cache has them, for what the signature does not cover
+        void rebake();
+
+        // Writes the finished read backs, then runs up to the slice count of the bake.
+        // Restores neither the framebuffer nor the viewport
+        void update(const CaptureFunction& capture, const Shader& prefilter, unsigned int cubeVAO);
+
+        // The nearest one or two baked probes whose boxes contain position, -1 for none.
+        // weight is the share of the first one
+        void select(const glm::vec3& position, int& first, int& second, float& weight) const;
+
+        // Boxes of every probe and the unit of the array, the per draw pick is set by the renderer
+        void set_uniforms(const Shader& shader, unsigned int unit) const;
+        void bind(unsigned int unit) const;
+
+        size_t get_count() const { return _probes.size(); }
+        const ReflectionProbe& get_probe(size_t index) const { return _probes[index]; }
+        // A probe still being dragged is baked but neither loaded nor written, the disk is used once it is released
+        void set_probe(size_t index, const ReflectionProbe& probe, bool released = true);
+        bool is_baked(size_t index) const { return _baked[index]; }
+        // Probes still waiting for their bake
+        size_t get_pending() const;
+        uint64_t get_signature() const { return _signature; }
+
+        void set_enabled(bool enabled) { _enabled = enabled; }
+        bool is_enabled() const { return _enabled; }
+        void set_slices_per_frame(int slices) { _slices_per_frame = slices; }
+        int get_slices_per_frame() const { return _slices_per_frame; }
+        // Bakes and cache loads since the probes were set
+        int get_bake_count() const { return _bakes; }
+        int get_load_count() const { return _loads; }
+
+        // Must be called while the context is still alive
+        void release();
+
+    private:
+        // Six capture faces, the scene shaders draw one face at a time, then one layered draw per prefilter mip
+        static constexpr int PREFILTER_SLICE = 6;
+        static constexpr int SLICE_COUNT = PREFILTER_SLICE + MIPS;
+        static constexpr char CACHE_MAGIC[4] = { 'P', 'R', 'B', '1' };
+
+        struct CacheHeader
+        {
+            char magic[4];
+            uint32_t size;
+            uint32_t mips;
+            float position[3];
+            float box_min[3];
+            float box_max[3];
+            uint64_t signature;
+        };
+
+        // Every mip of a baked probe on its way to the cache file, written once the fence has passed
+        struct Readback
+        {
+            std::string file;
+            CacheHeader header;
+            unsigned int buffer;
+            GLsync fence;
+        };
+
+        void _create();
+        void _run_slice(const CaptureFunction& capture, const Shader& prefilter, unsigned int cubeVAO);
+        std::string _cache_file(size_t index) const;
+        CacheHeader _cache_header(size_t index) const;
+        bool _load(size_t index);
+        void _read_back(size_t index);
+        // Without wait only the read backs the GPU is done with
+        void _write_readbacks(bool wait);
+        static void _write(const Readback& readback);
+
+        std::vector<ReflectionProbe> _probes;
+        std::vector<bool> _baked;
+        // Still being dragged, its placement is about to change again
+        std::vector<bool> _held;
+        std::string _cache_path;
+        uint64_t _signature{ 0 };
+        std::vector<Readback> _readbacks;
+
+        // Probe being baked and its next slice, -1 when idle
+        int _baking{ -1 };
+        int _next_slice{ 0 };
+
+        bool _enabled{ true };
+        int _slices_per_frame{ 4 };
+        int _bakes{ 0 };
+        int _loads{ 0 };
+
+        unsigned int _array{ 0 };
+        // Scene capture of the probe being baked, with its own mip chain for the prefilter to read
+        unsigned int _capture{ 0 };
+        unsigned int _capture_depth{ 0 };
+        unsigned int _capture_framebuffer{ 0 };
+        unsigned int _prefilter_framebuffer{ 0 };
+    };
+
+    inline void ReflectionProbes::_create()
+    {
+        // R11F_G11F_B10F like the HDR target, the probes are lighting and need no alpha
+        glGenTextures(1, &_array);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, _array);
+        glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, MIPS, GL_R11F_G11F_B10F, SIZE, SIZE, MAX_PROBES * 6);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+
+        const int capture_mips = static_cast<int>(std::log2(SIZE)) + 1;
+        glGenTextures(1, &_capture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, _capture);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, capture_mips, GL_R11F_G11F_B10F, SIZE, SIZE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        glGenRenderbuffers(1, &_capture_depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, _capture_depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, SIZE, SIZE);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &_capture_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, _capture_framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _capture_depth);
+
+        glGenFramebuffers(1, &_prefilter_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    inline void ReflectionProbes::set_probes(const std::vector<ReflectionProbe>& probes, const std::string& cache_path, uint64_t signature)
+    {
+        if (_array == 0)
+            _create();
+
+        _probes.assign(probes.begin(), probes.begin() + std::min(probes.size(), static_cast<size_t>(MAX_PROBES)));
+        if (probes.size() > MAX_PROBES)
+            std::cerr << "Only the first " << MAX_PROBES << " of " << probes.size() << " reflection probes are used\n";
+
+        _held.assign(_probes.size(), false);
+        _cache_path = cache_path;
+        _bakes = 0;
+        _loads = 0;
+        invalidate(signature);
+    }
+
+    inline void ReflectionProbes::invalidate(uint64_t signature)
+    {
+        _signature = signature;
+        _baked.assign(_probes.size(), false);
+        _baking = -1;
+
+        for (size_t i = 0; i < _probes.size(); i++)
+        {
+            _baked[i] = _load(i);
+        }
+    }
+
+    inline void ReflectionProbes::invalidate_probe(size_t index)
+    {
+        _baked[index] = _load(index);
+        if (_baking == static_cast<int>(index))
+            _baking = -1;
+    }
+
+    inline void ReflectionProbes::set_probe(size_t index, const ReflectionProbe& probe, bool released)
+    {
+        const ReflectionProbe& previous = _probes[index];
+        const bool moved = probe.position != previous.position || probe.box_min != previous.box_min || probe.box_max != previous.box_max;
+        _held[index] = !released;
+        _probes[index] = probe;
+        if (released)
+        {
+            // Baked at the final placement during the drag, only the write was held back
+            if (!moved && _baked[index])
+                _read_back(index);
+            else
+                invalidate_probe(index);
+            return;
+        }
+
+        _baked[index] = false;
+        if (_baking == static_cast<int>(index))
+            _baking = -1;
+    }
+
+    inline void ReflectionProbes::rebake()
+    {
+        _baked.assign(_probes.size(), false);
+        _baking = -1;
+    }
+
+    inline size_t ReflectionProbes::get_pending() const
+    {
+        return static_cast<size_t>(std::count(_baked.begin(), _baked.end(), false));
+    }
+
+    inline void ReflectionProbes::update(const CaptureFunction& capture, const Shader& prefilter, unsigned int cubeVAO)
+    {
+        _write_readbacks(false);
+
+        for (int slice = 0; slice < _slices_per_frame; slice++)
+        {
+            if (_baking < 0)
+            {
+                auto pending = std::find(_baked.begin(), _baked.end(), false);
+                if (pending == _baked.end())
+                    return;
+
+                _baking = static_cast<int>(pending - _baked.begin());
+                _next_slice = 0;
+            }
+
+            _run_slice(capture, prefilter, cubeVAO);
+
+            if (++_next_slice == SLICE_COUNT)
+            {
+                _baked[_baking] = true;
+                _bakes++;
+                if (!_held[_baking])
+                    _read_back(_baking);
+                _baking = -1;
+            }
+        }
+    }
+
+    inline void ReflectionProbes::_run_slice(const CaptureFunction& capture, const Shader& prefilter, unsigned int cubeVAO)
+    {
+        static const glm::mat4 capture_projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, 100.0f);
+
+        const ReflectionProbe& probe = _probes[_baking];
+
+        if (_next_slice < PREFILTER_SLICE)
+        {
+            const int face = _next_slice;
+
+            glBindFramebuffer(GL_FRAMEBUFFER, _capture_framebuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, _capture, 0);
+            glViewport(0, 0, SIZE, SIZE);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            const glm::mat4 view = EnvironmentLibrary::capture_view(face) * glm::translate(glm::mat4{ 1.0f }, -probe.position);
+            capture(view, capture_projection, probe.position);
+            return;
+        }
+
+        const int mip = _next_slice - PREFILTER_SLICE;
+        const int size = SIZE >> mip;
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, _capture);
+        // The prefilter reads the lower mips of the capture for its wide lobes
+        if (_next_slice == PREFILTER_SLICE)
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+        EnvironmentLibrary::set_prefilter_uniforms(prefilter, mip, MIPS, SIZE, size, EnvironmentLibrary::DEFAULT_PREFILTER_SAMPLES[mip]);
+        EnvironmentLibrary::set_capture_uniforms(prefilter, capture_projection, _baking * 6);
+
+        // The whole mip of the array is attached, the geometry shader writes the six layers of the probe.
+        // No clear, it would clear the other probes too, and the cube covers every texel anyway
+        glBindFramebuffer(GL_FRAMEBUFFER, _prefilter_framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _array, mip);
+        glViewport(0, 0, size, size);
+
+        glBindVertexArray(cubeVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glBindVertexArray(0);
+    }
+
+    inline void ReflectionProbes::select(const glm::vec3& position, int& first, int& second, float& weight) const
+    {
+        first = -1;
+        second = -1;
+        weight = 1.0f;
+        if (!_enabled)
+            return;
+
+        float first_distance = 0.0f;
+        float second_distance = 0.0f;
+        for (size_t i = 0; i < _probes.size(); i++)
+        {
+            const ReflectionProbe& probe = _probes[i];
+            if (!_baked[i] || glm::any(glm::lessThan(position, probe.box_min)) || glm::any(glm::lessThan(probe.box_max, position)))
+                continue;
+
+            const float distance = glm::length(position - probe.position);
+            if (first < 0 || distance < first_distance)
+            {
+                second = first;
+                second_distance = first_distance;
+                first = static_cast<int>(i);
+                first_distance = distance;
+            }
+            else if (second < 0 || distance < second_distance)
+            {
+                second = static_cast<int>(i);
+                second_distance = distance;
+            }
+        }
+
+        // Inverse distance, the closer probe gets more
+        if (second >= 0)
+            weight = first_distance + second_distance > 0.0f ? second_distance / (first_distance + second_distance) : 0.5f;
+    }
+
+    inline void ReflectionProbes::set_uniforms(const Shader& shader, unsigned int unit) const
+    {
+        shader.use();
+        shader.setInt("probe_maps", static_cast<int>(unit));
+        shader.setInt("probeCount", _enabled ? static_cast<int>(_probes.size()) : 0);
+        for (size_t i = 0; i < _probes.size(); i++)
+        {
+            const std::string index = "[" + std::to_string(i) + "]";
+            shader.setVec3("probePositions" + index, _probes[i].position);
+            shader.setVec3("probeBoxMin" + index, _probes[i].box_min);
+            // An empty box keeps the per pixel pick away from a probe that is not baked yet
+            shader.setVec3("probeBoxMax" + index, _baked[i] ? _probes[i].box_max : _probes[i].box_min - 1.0f);
+        }
+    }
+
+    inline void ReflectionProbes::bind(unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, _array);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    inline std::string ReflectionProbes::_cache_file(size_t index) const
+    {
+        return _cache_path + "_" + std::to_string(index) + ".probe";
+    }
+
+    inline ReflectionProbes::CacheHeader ReflectionProbes::_cache_header(size_t index) const
+    {
+        const ReflectionProbe& probe = _probes[index];
+
+        CacheHeader header{};
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+        header.size = SIZE;
+        header.mips = MIPS;
+        for (int i = 0; i < 3; i++)
+        {
+            header.position[i] = probe.position[i];
+            header.box_min[i] = probe.box_min[i];
+            header.box_max[i] = probe.box_max[i];
+        }
+        header.signature = _signature;
+        return header;
+    }
+
+    inline bool ReflectionProbes::_load(size_t index)
+    {
+        if (_cache_path.empty())
+            return false;
+
+        std::ifstream file{ _cache_file(index), std::ios::binary };
+        if (!file)
+            return false;
+
+        // A different placement, resolution or scene is baked again and overwrites the file
+        const CacheHeader expected = _cache_header(index);
+        CacheHeader header{};
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(&header, &expected, sizeof(header)) != 0)
+            return false;
+
+        std::vector<uint32_t> texels;
+        for (int mip = 0; mip < MIPS; mip++)
+        {
+            const int size = SIZE >> mip;
+            texels.resize(static_cast<size_t>(size) * size * 6);
+            if (!file.read(reinterpret_cast<char*>(texels.data()), texels.size() * sizeof(uint32_t)))
+                return false;
+
+            glTextureSubImage3D(_array, mip, 0, 0, static_cast<int>(index) * 6, size, size, 6, GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, texels.data());
+        }
+
+        _loads++;
+        return true;
+    }
+
+    inline void ReflectionProbes::_read_back(size_t index)
+    {
+        if (_cache_path.empty())
+            return;
+
+        size_t bytes = 0;
+        for (int mip = 0; mip < MIPS; mip++)
+        {
+            bytes += static_cast<size_t>(SIZE >> mip) * (SIZE >> mip) * 6 * sizeof(uint32_t);
+        }
+
+        // The header is taken now, a probe moved before the write keeps the placement it was baked at
+        Readback readback{ _cache_file(index), _cache_header(index), 0, nullptr };
+        glGenBuffers(1, &readback.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+
+        // Packed the way the texture stores it, into the buffer so the copy is queued behind the bake
+        size_t offset = 0;
+        for (int mip = 0; mip < MIPS; mip++)
+        {
+            const int size = SIZE >> mip;
+            const size_t mip_bytes = static_cast<size_t>(size) * size * 6 * sizeof(uint32_t);
+            glGetTextureSubImage(_array, mip, 0, 0, static_cast<int>(index) * 6, size, size, 6, GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV,
+                static_cast<GLsizei>(mip_bytes), reinterpret_cast<void*>(offset));
+            offset += mip_bytes;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        _readbacks.push_back(std::move(readback));
+    }
+
+    inline void ReflectionProbes::_write_readbacks(bool wait)
+    {
+        for (auto readback = _readbacks.begin(); readback != _readbacks.end();)
+        {
+            const GLenum status = wait ? glClientWaitSync(readback->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000)
+                                       : glClientWaitSync(readback->fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED && !wait)
+            {
+                ++readback;
+                continue;
+            }
+
+            if (status != GL_WAIT_FAILED)
+                _write(*readback);
+            glDeleteSync(readback->fence);
+            glDeleteBuffers(1, &readback->buffer);
+            readback = _readbacks.erase(readback);
+        }
+    }
+
+    inline void ReflectionProbes::_write(const Readback& readback)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path{ readback.file }.parent_path(), error);
+        std::ofstream file{ readback.file, std::ios::binary };
+        if (!file)
+        {
+            std::cerr << "Could not write the reflection probe cache: " << readback.file << std::endl;
+            return;
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        GLint64 bytes = 0;
+        glGetBufferParameteri64v(GL_PIXEL_PACK_BUFFER, GL_BUFFER_SIZE, &bytes);
+        const void* texels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (texels != nullptr)
+        {
+            file.write(reinterpret_cast<const char*>(&readback.header), sizeof(readback.header));
+            file.write(static_cast<const char*>(texels), bytes);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    inline void ReflectionProbes::release()
+    {
+        // The last bakes still reach the disk
+        _write_readbacks(true);
+
+        for (unsigned int* texture : { &_array, &_capture })
+        {
+            if (*texture != 0)
+                glDeleteTextures(1, texture);
+            *texture = 0;
+        }
+        if (_capture_depth != 0)
+            glDeleteRenderbuffers(1, &_capture_depth);
+        for (unsigned int* framebuffer : { &_capture_framebuffer, &_prefilter_framebuffer })
+        {
+            if (*framebuffer != 0)
+                glDeleteFramebuffers(1, framebuffer);
+            *framebuffer = 0;
+        }
+        _capture_depth = 0;
+
+        _probes.clear();
+        _baked.clear();
+        _held.clear();
+        _baking = -1;
+    }
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace PBR{
+
+    struct DrawItem
+    {
+        uint32_t key;
+        uint32_t index;
+    };
+
+    // Draw list sorted by view depth with an LSD radix sort.
+    // Both the item and the scratch buffer keep their capacity, so a warmed up queue never allocates
+    class RenderQueue
+    {
+    public:
+        void clear() { _items.clear(); }
+
+        void push(float depth, uint32_t index) { _items.push_back({ _to_key(depth), index }); }
+
+        // Nearest first, opaque surfaces get the most out of early depth rejection this way
+        void sort_front_to_back() { _sort(false); }
+        // Farthest first, blending is only correct when the background is already drawn
+        void sort_back_to_front() { _sort(true); }
+
+        size_t size() const { return _items.size(); }
+        bool empty() const { return _items.empty(); }
+
+        std::vector<DrawItem>::const_iterator begin() const { return _items.begin(); }
+        std::vector<DrawItem>::const_iterator end() const { return _items.end(); }
+
+    private:
+        std::vector<DrawItem> _items;
+        std::vector<DrawItem> _scratch;
+
+        // Flips the float bits so unsigned integer order matches float order, negative depths included
+        static uint32_t _to_key(float depth)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &depth, sizeof(bits));
+            return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+        }
+
+        void _sort(bool descending);
+    };
+
+    inline void RenderQueue::_sort(bool descending)
+    {
+        const size_t count = _items.size();
+        if (count < 2)
+            return;
+
+        _scratch.resize(count);
+
+        const uint32_t flip = descending ? ~0u : 0u;
+
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            size_t histogram[256]{};
+            for (const DrawItem& item : _items)
+            {
+                histogram[((item.key ^ flip) >> shift) & 0xFF]++;
+            }
+
+            // Every item shares this digit, the pass would not move anything
+            if (histogram[((_items.front().key ^ flip) >> shift) & 0xFF] == count)
+                continue;
+
+            size_t offset = 0;
+            for (size_t& bucket : histogram)
+            {
+                size_t bucket_count = bucket;
+                bucket = offset;
+                offset += bucket_count;
+            }
+
+            for (const DrawItem& item : _items)
+            {
+                _scratch[histogram[((item.key ^ flip) >> shift) & 0xFF]++] = item;
+            }
+
+            std::swap(_items, _scratch);
+        }
+    }
+
+}
@@ -17,6 +17,8 @@ namespace PBR{
     enum class ShaderType{
         FragmentShader = GL_FRAGMENT_SHADER,
         VertexShader = GL_VERTEX_SHADER,
+        GeometryShader = GL_GEOMETRY_SHADER,
+        ComputeShader = GL_COMPUTE_SHADER,
         Program,
         None
     };
@@ -28,6 +30,10 @@ namespace PBR{
             return "Vertex Shader";
         case ShaderType::FragmentShader:
             return "Fragment Shader";
+        case ShaderType::GeometryShader:
+            return "Geometry Shader";
+        case ShaderType::ComputeShader:
+            return "Compute Shader";
         case ShaderType::Program:
             return "Program";
         case ShaderType::None: 
@@ -50,13 +56,17 @@ namespace PBR{
         // constructor generates the shader on the fly
         // ------------------------------------------------------------------------
         Shader() = default;
-        Shader(std::string_view shaderPath)
+        // defines are added to every stage right after its #version line, so one file can build several variants.
+        // #include "file" lines are replaced by the file, relative to the directory of the shader
+        Shader(std::string_view shaderPath, const std::vector<std::string>& defines = {})
         {
             try 
             {
                 std::ifstream shaderFile{ shaderPath.data() };
                 
                 auto shaders = Shader::readShaderFile(shaderFile);
+                Shader::__resolve_includes(shaders, std::filesystem::path{ shaderPath }.parent_path());
+                Shader::__add_defines(shaders, defines);
                 ID = Shader::compileShader(shaders);
 
             }
@@ -90,6 +100,12 @@ namespace PBR{
             glUniform1i(location, value); 
         }
         // ------------------------------------------------------------------------
+        void setUint(const std::string &name, unsigned int value) const
+        { 
+            int location = glGetUniformLocation(ID, name.c_str());
+            glUniform1ui(location, value); 
+        }
+        // ------------------------------------------------------------------------
         void setFloat(const std::string &name, float value) const
         { 
             int location = glGetUniformLocation(ID, name.c_str());
@@ -220,6 +236,48 @@ namespace PBR{
             return programID;
         }
 
+        void __resolve_includes(std::vector<ShaderInfo>& shaders, const std::filesystem::path& directory){
+            for(ShaderInfo& info: shaders){
+                std::stringstream source{ info.shaderSource };
+                std::stringstream resolved;
+                std::string line;
+                while (std::getline(source, line)){
+                    size_t include = line.find("#include");
+                    size_t open = line.find('"', include);
+                    size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+                    if(include == std::string::npos || close == std::string::npos){
+                        resolved << line << "\n";
+                        continue;
+                    }
+
+                    const std::filesystem::path path = directory / line.substr(open + 1, close - open - 1);
+                    std::ifstream file{ path };
+                    if(!file)
+                        throw std::runtime_error{ "Shader include not found: " + path.string() };
+                    resolved << file.rdbuf() << "\n";
+                }
+                info.shaderSource = resolved.str();
+            }
+        }
+
+        void __add_defines(std::vector<ShaderInfo>& shaders, const std::vector<std::string>& defines){
+            if(defines.empty())
+                return;
+
+            std::string block;
+            for(const std::string& define: defines){
+                block += "#define " + define + "\n";
+            }
+
+            for(ShaderInfo& info: shaders){
+                // #version has to stay the first directive of the source
+                size_t version = info.shaderSource.find("#version");
+                size_t position = version == std::string::npos ? 0 : info.shaderSource.find('\n', version);
+                position = position == std::string::npos ? info.shaderSource.size() : position + 1;
+                info.shaderSource.insert(position, block);
+            }
+        }
+
         ShaderType __get_shader_type(std::string_view typeString){
             if(typeString.find("Vertex Shader") != std::string::npos){
                 return ShaderType::VertexShader;
@@ -227,6 +285,12 @@ namespace PBR{
             else if(typeString.find("Fragment Shader") != std::string::npos){
                 return ShaderType::FragmentShader;
             }
+            else if(typeString.find("Geometry Shader") != std::string::npos){
+                return ShaderType::GeometryShader;
+            }
+            else if(typeString.find("Compute Shader") != std::string::npos){
+                return ShaderType::ComputeShader;
+            }
             return ShaderType::None;
         }
 
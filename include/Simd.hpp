@@ -0,0 +1,115 @@
+#pragma once
+
+// Thin wrapper over the widest float vector the compiler was allowed to use.
+// Kernels are written once against PBR::simd and compile to AVX (8 lanes),
+// SSE (4 lanes) or plain scalar code (1 lane) depending on the target flags.
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define PBR_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define PBR_SIMD_SSE
+#else
+    #define PBR_SIMD_SCALAR
+#endif
+
+#include <cmath>
+
+namespace PBR::simd{
+
+#if defined(PBR_SIMD_AVX)
+
+    constexpr int WIDTH = 8;
+    constexpr const char* NAME = "AVX";
+
+    using floatv = __m256;
+    using maskv = __m256;
+
+    inline floatv load(const float* ptr){ return _mm256_loadu_ps(ptr); }
+    inline void store(float* ptr, floatv value){ _mm256_storeu_ps(ptr, value); }
+    inline floatv set1(float value){ return _mm256_set1_ps(value); }
+
+    inline floatv add(floatv a, floatv b){ return _mm256_add_ps(a, b); }
+    inline floatv sub(floatv a, floatv b){ return _mm256_sub_ps(a, b); }
+    inline floatv mul(floatv a, floatv b){ return _mm256_mul_ps(a, b); }
+    inline floatv div(floatv a, floatv b){ return _mm256_div_ps(a, b); }
+    inline floatv sqrt(floatv a){ return _mm256_sqrt_ps(a); }
+    inline floatv min(floatv a, floatv b){ return _mm256_min_ps(a, b); }
+    inline floatv max(floatv a, floatv b){ return _mm256_max_ps(a, b); }
+    inline floatv abs(floatv a){ return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    #if defined(__FMA__)
+    inline floatv fmadd(floatv a, floatv b, floatv c){ return _mm256_fmadd_ps(a, b, c); }
+    #else
+    inline floatv fmadd(floatv a, floatv b, floatv c){ return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+    #endif
+
+    inline maskv greater_equal(floatv a, floatv b){ return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    inline maskv mask_and(maskv a, maskv b){ return _mm256_and_ps(a, b); }
+    inline maskv mask_true(){ return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+    // a where the mask is set, b elsewhere
+    inline floatv select(maskv mask, floatv a, floatv b){ return _mm256_blendv_ps(b, a, mask); }
+    // One bit per lane, lane 0 in bit 0
+    inline unsigned int movemask(maskv mask){ return static_cast<unsigned int>(_mm256_movemask_ps(mask)); }
+
+#elif defined(PBR_SIMD_SSE)
+
+    constexpr int WIDTH = 4;
+    constexpr const char* NAME = "SSE";
+
+    using floatv = __m128;
+    using maskv = __m128;
+
+    inline floatv load(const float* ptr){ return _mm_loadu_ps(ptr); }
+    inline void store(float* ptr, floatv value){ _mm_storeu_ps(ptr, value); }
+    inline floatv set1(float value){ return _mm_set1_ps(value); }
+
+    inline floatv add(floatv a, floatv b){ return _mm_add_ps(a, b); }
+    inline floatv sub(floatv a, floatv b){ return _mm_sub_ps(a, b); }
+    inline floatv mul(floatv a, floatv b){ return _mm_mul_ps(a, b); }
+    inline floatv div(floatv a, floatv b){ return _mm_div_ps(a, b); }
+    inline floatv sqrt(floatv a){ return _mm_sqrt_ps(a); }
+    inline floatv min(floatv a, floatv b){ return _mm_min_ps(a, b); }
+    inline floatv max(floatv a, floatv b){ return _mm_max_ps(a, b); }
+    inline floatv abs(floatv a){ return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+    inline floatv fmadd(floatv a, floatv b, floatv c){ return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+    inline maskv greater_equal(floatv a, floatv b){ return _mm_cmpge_ps(a, b); }
+    inline maskv mask_and(maskv a, maskv b){ return _mm_and_ps(a, b); }
+    inline maskv mask_true(){ return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+    // a where the mask is set, b elsewhere
+    inline floatv select(maskv mask, floatv a, floatv b){ return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    // One bit per lane, lane 0 in bit 0
+    inline unsigned int movemask(maskv mask){ return static_cast<unsigned int>(_mm_movemask_ps(mask)); }
+
+#else
+
+    constexpr int WIDTH = 1;
+    constexpr const char* NAME = "Scalar";
+
+    using floatv = float;
+    using maskv = bool;
+
+    inline floatv load(const float* ptr){ return *ptr; }
+    inline void store(float* ptr, floatv value){ *ptr = value; }
+    inline floatv set1(float value){ return value; }
+
+    inline floatv add(floatv a, floatv b){ return a + b; }
+    inline floatv sub(floatv a, floatv b){ return a - b; }
+    inline floatv mul(floatv a, floatv b){ return a * b; }
+    inline floatv div(floatv a, floatv b){ return a / b; }
+    inline floatv sqrt(floatv a){ return std::sqrt(a); }
+    inline floatv min(floatv a, floatv b){ return a < b ? a : b; }
+    inline floatv max(floatv a, floatv b){ return a > b ? a : b; }
+    inline floatv abs(floatv a){ return std::fabs(a); }
+    inline floatv fmadd(floatv a, floatv b, floatv c){ return a * b + c; }
+
+    inline maskv greater_equal(floatv a, floatv b){ return a >= b; }
+    inline maskv mask_and(maskv a, maskv b){ return a && b; }
+    inline maskv mask_true(){ return true; }
+    inline floatv select(maskv mask, floatv a, floatv b){ return mask ? a : b; }
+    inline unsigned int movemask(maskv mask){ return mask ? 1u : 0u; }
+
+#endif
+
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "Model.hpp"
+#include "Shader.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace PBR{
+
+    // Skins every mesh added this frame once with a compute shader into one transient vertex buffer.
+    // The output has the Vertex layout, so every later pass (depth prepass, shadows, color) draws the
+    // skinned meshes with the static shaders and pays for the skinning only once.
+    class SkinningPass
+    {
+    public:
+        // Storage bindings of shaders/skinning.shader, the palettes stay at the binding of AnimationSystem::upload
+        static constexpr unsigned int REST_VERTICES_BINDING = 1;
+        static constexpr unsigned int INFLUENCES_BINDING = 2;
+        static constexpr unsigned int SKINNED_VERTICES_BINDING = 3;
+
+        SkinningPass() = default;
+
+        SkinningPass(const SkinningPass&) = delete;
+        SkinningPass& operator=(const SkinningPass&) = delete;
+
+        // Forgets the meshes of the last frame
+        void clear();
+
+        // Queues the skinned meshes of the model, returns the slot of the first one, the others follow it
+        uint32_t add(const Model& model, uint32_t palette_offset);
+
+        // Skins the queued meshes, the palette buffer must already be bound
+        void dispatch(const Shader& shader, bool dual_quaternions);
+
+        // Draws the skinned copy of the mesh in the slot with the indices of its source mesh,
+        // meshes of the model without bones are drawn from their own buffers
+        void draw(uint32_t slot, const Shader& shader) const;
+
+        size_t get_mesh_count() const { return _jobs.size(); }
+        size_t get_vertex_count() const { return _vertex_count; }
+
+        // Must be called while the context is still alive
+        void release();
+
+    private:
+        struct Job
+        {
+            const Mesh* mesh;
+            uint32_t palette_offset;
+            uint32_t first_vertex;
+        };
+
+        static constexpr unsigned int GROUP_SIZE = 64;
+
+        std::vector<Job> _jobs;
+        uint32_t _vertex_count{ 0 };
+
+        unsigned int _buffer{ 0 };
+        unsigned int _vao{ 0 };
+        size_t _capacity{ 0 };
+
+        void _reserve(size_t size);
+    };
+
+    inline void SkinningPass::clear()
+    {
+        _jobs.clear();
+        _vertex_count = 0;
+    }
+
+    inline uint32_t SkinningPass::add(const Model& model, uint32_t palette_offset)
+    {
+        const uint32_t slot = static_cast<uint32_t>(_jobs.size());
+        for (const Mesh& mesh : model.get_meshes())
+        {
+            _jobs.push_back({ &mesh, palette_offset, _vertex_count });
+            if (mesh.is_skinned())
+                _vertex_count += mesh.vertex_count();
+        }
+        return slot;
+    }
+
+    inline void SkinningPass::dispatch(const Shader& shader, bool dual_quaternions)
+    {
+        if (_jobs.empty())
+            return;
+
+        _reserve(static_cast<size_t>(_vertex_count) * sizeof(Vertex));
+
+        shader.use();
+        shader.setBool("dualQuaternions", dual_quaternions);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SKINNED_VERTICES_BINDING, _buffer);
+
+        for (const Job& job : _jobs)
+        {
+            if (!job.mesh->is_skinned())
+                continue;
+
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, REST_VERTICES_BINDING, job.mesh->get_vertex_buffer());
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INFLUENCES_BINDING, job.mesh->get_skin_buffer());
+
+            shader.setUint("vertexCount", job.mesh->vertex_count());
+            shader.setUint("outputOffset", job.first_vertex);
+            shader.setUint("paletteOffset", job.palette_offset);
+
+            glDispatchCompute((job.mesh->vertex_count() + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+        }
+
+        // The draws of this frame fetch the results as vertex attributes
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    }
+
+    inline void SkinningPass::draw(uint32_t slot, const Shader& shader) const
+    {
+        const Job& job = _jobs[slot];
+        if (!job.mesh->is_skinned())
+        {
+            job.mesh->draw(shader);
+            return;
+        }
+
+        glBindVertexArray(_vao);
+        glVertexArrayElementBuffer(_vao, job.mesh->get_element_buffer());
+        glDrawElementsBaseVertex(GL_TRIANGLES, job.mesh->index_count(), GL_UNSIGNED_INT, nullptr, static_cast<GLint>(job.first_vertex));
+        glBindVertexArray(0);
+    }
+
+    inline void SkinningPass::_reserve(size_t size)
+    {
+        if (_buffer == 0)
+        {
+            glGenBuffers(1, &_buffer);
+
+            // Same attributes as Mesh, the element buffer is switched per draw
+            glCreateVertexArrays(1, &_vao);
+            glBindVertexArray(_vao);
+            glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), nullptr);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void *>(offsetof(Vertex, normal)));
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void *>(offsetof(Vertex, tex_coords)));
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void *>(offsetof(Vertex, tangent)));
+            glEnableVertexAttribArray(4);
+            glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void *>(offsetof(Vertex, bitangent)));
+
+            glBindVertexArray(0);
+        }
+
+        if (size <= _capacity)
+            return;
+
+        // Grows by half again so a few more characters on screen do not reallocate every frame
+        _capacity = std::max(size, _capacity + _capacity / 2);
+        glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+        glBufferData(GL_ARRAY_BUFFER, _capacity, nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    inline void SkinningPass::release()
+    {
+        if (_buffer != 0)
+            glDeleteBuffers(1, &_buffer);
+        if (_vao != 0)
+            glDeleteVertexArrays(1, &_vao);
+
+        _buffer = 0;
+        _vao = 0;
+        _capacity = 0;
+        clear();
+    }
+
+}
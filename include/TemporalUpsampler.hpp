@@ -0,0 +1,186 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "Shader.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace PBR{
+
+    // Temporal reconstruction of a jittered, possibly lower resolution, frame into a display sized history.
+    // Every frame is rendered with a different sub-pixel offset of the Halton (2, 3) sequence, the resolve
+    // reprojects the history along the motion vectors, clips it to the neighborhood of the new samples
+    // and blends them in, so over a few frames every output pixel gathers samples from all around it.
+    // The two history textures are used in turn and reallocated only when the window size changes
+    class TemporalUpsampler
+    {
+    public:
+        TemporalUpsampler() = default;
+
+        TemporalUpsampler(const TemporalUpsampler&) = delete;
+        TemporalUpsampler& operator=(const TemporalUpsampler&) = delete;
+
+        // Display size, a new size drops the history
+        void resize(int width, int height);
+
+        // Advances the sequence, lower scales use more phases so every output pixel is covered.
+        // Returns the offset of the next frame in render pixels, in [-0.5, 0.5)
+        glm::vec2 next_jitter(float render_scale);
+        // Moves the image by the current jitter, the same for every pass that writes the frame
+        glm::mat4 jitter_projection(const glm::mat4& projection, const glm::vec2& render_size) const;
+        const glm::vec2& get_jitter() const { return _jitter; }
+
+        // Reconstructs the rendered part of color and velocity into the next history, sampled units 0 to 2
+        void resolve(const Shader& shader, unsigned int quadVAO, unsigned int color, unsigned int velocity, const glm::vec2& render_scale);
+
+        // History written by the last resolve, display sized
+        unsigned int get_output() const { return _textures[_read]; }
+
+        // Next resolve starts over from the current frame, for cuts and scene changes
+        void invalidate() { _history_valid = false; }
+
+        void set_feedback(float feedback) { _feedback = feedback; }
+        float get_feedback() const { return _feedback; }
+        int get_phase_count() const { return _phase_count; }
+
+        // Must be called while the context is still alive
+        void release();
+
+    private:
+        static float _halton(int index, int base);
+
+        unsigned int _textures[2]{};
+        unsigned int _framebuffers[2]{};
+        int _read{ 0 };
+
+        int _width{ 0 };
+        int _height{ 0 };
+
+        glm::vec2 _jitter{ 0.0f };
+        int _frame{ 0 };
+        int _phase_count{ 8 };
+        bool _history_valid{ false };
+        float _feedback{ 0.1f };
+    };
+
+    inline float TemporalUpsampler::_halton(int index, int base)
+    {
+        float result = 0.0f;
+        float fraction = 1.0f;
+        while (index > 0)
+        {
+            fraction /= base;
+            result += fraction * (index % base);
+            index /= base;
+        }
+        return result;
+    }
+
+    inline void TemporalUpsampler::resize(int width, int height)
+    {
+        if (width == _width && height == _height && _framebuffers[0] != 0)
+            return;
+
+        release();
+        _width = width;
+        _height = height;
+
+        glGenTextures(2, _textures);
+        glGenFramebuffers(2, _framebuffers);
+        for (int i = 0; i < 2; i++)
+        {
+            glBindTexture(GL_TEXTURE_2D, _textures[i]);
+            // Accumulated over many frames, R11F_G11F_B10F would band
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, _width, _height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, _framebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _textures[i], 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cerr << "Temporal history framebuffer " << i << " is not complete\n";
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        _history_valid = false;
+    }
+
+    inline glm::vec2 TemporalUpsampler::next_jitter(float render_scale)
+    {
+        // 8 phases at full resolution, and as many more as there are output pixels per render pixel
+        _phase_count = std::clamp(static_cast<int>(std::ceil(8.0f / (render_scale * render_scale))), 8, 64);
+
+        // Index 0 of the sequence is the corner, start at 1
+        const int index = _frame % _phase_count + 1;
+        _jitter = glm::vec2{ _halton(index, 2), _halton(index, 3) } - 0.5f;
+        _frame++;
+        return _jitter;
+    }
+
+    inline glm::mat4 TemporalUpsampler::jitter_projection(const glm::mat4& projection, const glm::vec2& render_size) const
+    {
+        // In clip space, so it is the same pixel offset at every depth
+        return glm::translate(glm::mat4{ 1.0f }, glm::vec3{ 2.0f * _jitter / render_size, 0.0f }) * projection;
+    }
+
+    inline void TemporalUpsampler::resolve(const Shader& shader, unsigned int quadVAO, unsigned int color, unsigned int velocity, const glm::vec2& render_scale)
+    {
+        const int write = 1 - _read;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, _framebuffers[write]);
+        glViewport(0, 0, _width, _height);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, color);
+        glActiveTexture(GL_TEXTURE0 + 1);
+        glBindTexture(GL_TEXTURE_2D, velocity);
+        glActiveTexture(GL_TEXTURE0 + 2);
+        glBindTexture(GL_TEXTURE_2D, _textures[_read]);
+
+        shader.use();
+        shader.setInt("sceneColor", 0);
+        shader.setInt("sceneVelocity", 1);
+        shader.setInt("history", 2);
+        shader.setVec2("renderScale", render_scale);
+        shader.setVec2("jitter", _jitter);
+        shader.setBool("historyValid", _history_valid);
+        shader.setFloat("feedback", _feedback);
+
+        glDisable(GL_DEPTH_TEST);
+        glBindVertexArray(quadVAO);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+
+        _read = write;
+        _history_valid = true;
+    }
+
+    inline void TemporalUpsampler::release()
+    {
+        if (_textures[0] != 0)
+        {
+            glDeleteTextures(2, _textures);
+            glDeleteFramebuffers(2, _framebuffers);
+        }
+
+        for (int i = 0; i < 2; i++)
+        {
+            _textures[i] = 0;
+            _framebuffers[i] = 0;
+        }
+        _width = 0;
+        _height = 0;
+        _history_valid = false;
+    }
+
+}
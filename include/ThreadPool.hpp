@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+
+namespace PBR{
+
+    // Fixed set of worker threads for data parallel jobs.
+    // parallel_for hands out indices to the workers and the calling thread and blocks until all are done,
+    // so jobs can capture locals by reference.
+    class ThreadPool
+    {
+    public:
+        explicit ThreadPool(unsigned int worker_count = std::max(std::thread::hardware_concurrency(), 2u) - 1);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Calls task(i) for every i in [0, count)
+        void parallel_for(size_t count, const std::function<void(size_t)>& task);
+
+        // Worker threads plus the calling thread
+        unsigned int get_thread_count() const { return static_cast<unsigned int>(_workers.size()) + 1; }
+
+    private:
+        std::vector<std::thread> _workers;
+
+        std::mutex _mutex;
+        std::condition_variable _start;
+        std::condition_variable _done;
+
+        const std::function<void(size_t)>* _task{ nullptr };
+        size_t _count{ 0 };
+        std::atomic<size_t> _next{ 0 };
+        size_t _active{ 0 };
+        uint64_t _generation{ 0 };
+        bool _stop{ false };
+
+        void _worker_loop();
+        void _run_tasks();
+    };
+
+    inline ThreadPool::ThreadPool(unsigned int worker_count)
+    {
+        _workers.reserve(worker_count);
+        for (unsigned int i = 0; i < worker_count; i++)
+        {
+            _workers.emplace_back(&ThreadPool::_worker_loop, this);
+        }
+    }
+
+    inline ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock{ _mutex };
+            _stop = true;
+        }
+        _start.notify_all();
+
+        for (std::thread& worker : _workers)
+        {
+            worker.join();
+        }
+    }
+
+    inline void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)> &task)
+    {
+        if (_workers.empty() || count <= 1)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                task(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{ _mutex };
+            _task = &task;
+            _count = count;
+            _next = 0;
+            _active = _workers.size();
+            _generation++;
+        }
+        _start.notify_all();
+
+        _run_tasks();
+
+        // Every worker checks in, so none of them can still be looking at the task after we return
+        std::unique_lock<std::mutex> lock{ _mutex };
+        _done.wait(lock, [this] { return _active == 0; });
+        _task = nullptr;
+    }
+
+    inline void ThreadPool::_worker_loop()
+    {
+        uint64_t generation = 0;
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock{ _mutex };
+                _start.wait(lock, [&] { return _stop || _generation != generation; });
+
+                if (_stop)
+                    return;
+
+                generation = _generation;
+            }
+
+            _run_tasks();
+
+            std::lock_guard<std::mutex> lock{ _mutex };
+            if (--_active == 0)
+                _done.notify_one();
+        }
+    }
+
+    inline void ThreadPool::_run_tasks()
+    {
+        for (size_t i = _next.fetch_add(1); i < _count; i = _next.fetch_add(1))
+        {
+            (*_task)(i);
+        }
+    }
+
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#include "Simd.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cassert>
+
+namespace PBR{
+
+    // Flat transform hierarchy stored as structure of arrays.
+    // Nodes are kept in topological order (a parent always has a smaller index than its children),
+    // so world matrices are updated front to back in a single linear pass without recursion.
+    class TransformHierarchy
+    {
+    public:
+        static constexpr uint32_t NO_PARENT = ~0u;
+
+        TransformHierarchy() = default;
+        explicit TransformHierarchy(size_t capacity);
+
+        // Appends a node, the parent must already exist
+        uint32_t add_node(uint32_t parent = NO_PARENT);
+
+        void set_local_position(uint32_t node, const glm::vec3& position);
+        void set_local_rotation(uint32_t node, const glm::quat& rotation);
+        // Euler angles in degrees, applied in the same Y * X * Z order as Transform
+        void set_local_euler(uint32_t node, const glm::vec3& degrees);
+        void set_local_scale(uint32_t node, const glm::vec3& scale);
+
+        glm::vec3 get_local_position(uint32_t node) const { return { _px[node], _py[node], _pz[node] }; }
+        glm::quat get_local_rotation(uint32_t node) const { return { _qw[node], _qx[node], _qy[node], _qz[node] }; }
+        glm::vec3 get_local_scale(uint32_t node) const { return { _sx[node], _sy[node], _sz[node] }; }
+
+        uint32_t get_parent(uint32_t node) const { return _parents[node]; }
+        const glm::mat4& get_local_matrix(uint32_t node) const { return _local[node]; }
+        const glm::mat4& get_world_matrix(uint32_t node) const { return _world[node]; }
+
+        // True if the world matrix of the node was recomputed by the last update
+        bool world_changed(uint32_t node) const { return _test(_world_changed, node); }
+
+        // Recomposes the dirty local matrices in SIMD batches, then propagates world matrices linearly
+        void update();
+
+        size_t size() const { return _count; }
+
+    private:
+        // SoA arrays are padded to a multiple of this so every batch load stays in bounds
+        static constexpr size_t PADDING = 8;
+
+        size_t _count{ 0 };
+
+        std::vector<uint32_t> _parents;
+
+        std::vector<float> _px, _py, _pz;
+        std::vector<float> _qx, _qy, _qz, _qw;
+        std::vector<float> _sx, _sy, _sz;
+
+        std::vector<glm::mat4> _local;
+        std::vector<glm::mat4> _world;
+
+        std::vector<uint64_t> _local_dirty;
+        std::vector<uint64_t> _world_changed;
+
+        void _grow();
+        void _compose_local(size_t first);
+
+        static void _set(std::vector<uint64_t>& bits, size_t index){ bits[index >> 6] |= uint64_t{ 1 } << (index & 63); }
+        static bool _test(const std::vector<uint64_t>& bits, size_t index){ return (bits[index >> 6] >> (index & 63)) & 1; }
+        static void _multiply_affine(const glm::mat4& parent, const glm::mat4& local, glm::mat4& out);
+    };
+
+    inline TransformHierarchy::TransformHierarchy(size_t capacity)
+    {
+        size_t padded = (capacity + PADDING - 1) / PADDING * PADDING;
+
+        _parents.reserve(padded);
+        for (std::vector<float>* stream : { &_px, &_py, &_pz, &_qx, &_qy, &_qz, &_qw, &_sx, &_sy, &_sz })
+        {
+            stream->reserve(padded);
+        }
+        _local.reserve(padded);
+        _world.reserve(padded);
+    }
+
+    inline uint32_t TransformHierarchy::add_node(uint32_t parent)
+    {
+        assert(parent == NO_PARENT || parent < _count);
+
+        if (_count == _parents.size())
+            _grow();
+
+        uint32_t node = static_cast<uint32_t>(_count++);
+        _parents[node] = parent;
+        _set(_local_dirty, node);
+        return node;
+    }
+
+    inline void TransformHierarchy::set_local_position(uint32_t node, const glm::vec3 &position)
+    {
+        _px[node] = position.x;
+        _py[node] = position.y;
+        _pz[node] = position.z;
+        _set(_local_dirty, node);
+    }
+
+    inline void TransformHierarchy::set_local_rotation(uint32_t node, const glm::quat &rotation)
+    {
+        _qx[node] = rotation.x;
+        _qy[node] = rotation.y;
+        _qz[node] = rotation.z;
+        _qw[node] = rotation.w;
+        _set(_local_dirty, node);
+    }
+
+    inline void TransformHierarchy::set_local_euler(uint32_t node, const glm::vec3 &degrees)
+    {
+        const glm::quat x = glm::angleAxis(glm::radians(degrees.x), glm::vec3{ 1.0f, 0.0f, 0.0f });
+        const glm::quat y = glm::angleAxis(glm::radians(degrees.y), glm::vec3{ 0.0f, 1.0f, 0.0f });
+        const glm::quat z = glm::angleAxis(glm::radians(degrees.z), glm::vec3{ 0.0f, 0.0f, 1.0f });
+        set_local_rotation(node, y * x * z);
+    }
+
+    inline void TransformHierarchy::set_local_scale(uint32_t node, const glm::vec3 &scale)
+    {
+        _sx[node] = scale.x;
+        _sy[node] = scale.y;
+        _sz[node] = scale.z;
+        _set(_local_dirty, node);
+    }
+
+    inline void TransformHierarchy::update()
+    {
+        // 1. Local matrices, one batch of simd::WIDTH nodes at a time, skipping clean batches
+        constexpr uint64_t lane_mask = (uint64_t{ 1 } << simd::WIDTH) - 1;
+        for (size_t first = 0; first < _count; first += simd::WIDTH)
+        {
+            if ((_local_dirty[first >> 6] >> (first & 63)) & lane_mask)
+                _compose_local(first);
+        }
+
+        // 2. World matrices, parents are always visited before their children
+        std::fill(_world_changed.begin(), _world_changed.end(), 0);
+        for (size_t node = 0; node < _count; node++)
+        {
+            uint32_t parent = _parents[node];
+            bool parent_changed = parent != NO_PARENT && _test(_world_changed, parent);
+
+            if (!parent_changed && !_test(_local_dirty, node))
+                continue;
+
+            if (parent == NO_PARENT)
+                _world[node] = _local[node];
+            else
+                _multiply_affine(_world[parent], _local[node], _world[node]);
+
+            _set(_world_changed, node);
+        }
+
+        std::fill(_local_dirty.begin(), _local_dirty.end(), 0);
+    }
+
+    inline void TransformHierarchy::_grow()
+    {
+        size_t size = _parents.size() + PADDING;
+
+        _parents.resize(size, NO_PARENT);
+        _px.resize(size, 0.0f);
+        _py.resize(size, 0.0f);
+        _pz.resize(size, 0.0f);
+        _qx.resize(size, 0.0f);
+        _qy.resize(size, 0.0f);
+        _qz.resize(size, 0.0f);
+        _qw.resize(size, 1.0f);
+        _sx.resize(size, 1.0f);
+        _sy.resize(size, 1.0f);
+        _sz.resize(size, 1.0f);
+        _local.resize(size, glm::mat4{ 1.0f });
+        _world.resize(size, glm::mat4{ 1.0f });
+        _local_dirty.resize((size + 63) / 64, 0);
+        _world_changed.resize((size + 63) / 64, 0);
+    }
+
+    inline void TransformHierarchy::_compose_local(size_t first)
+    {
+        using namespace simd;
+
+        const floatv qx = load(&_qx[first]);
+        const floatv qy = load(&_qy[first]);
+        const floatv qz = load(&_qz[first]);
+        const floatv qw = load(&_qw[first]);
+
+        const floatv two = set1(2.0f);
+        const floatv one = set1(1.0f);
+
+        const floatv xx = mul(qx, qx), yy = mul(qy, qy), zz = mul(qz, qz);
+        const floatv xy = mul(qx, qy), xz = mul(qx, qz), yz = mul(qy, qz);
+        const floatv wx = mul(qw, qx), wy = mul(qw, qy), wz = mul(qw, qz);
+
+        const floatv sx = load(&_sx[first]);
+        const floatv sy = load(&_sy[first]);
+        const floatv sz = load(&_sz[first]);
+
+        // Rotation columns scaled per axis: translation * rotation * scale
+        floatv columns[12];
+        columns[0] = mul(sub(one, mul(two, add(yy, zz))), sx);
+        columns[1] = mul(mul(two, add(xy, wz)), sx);
+        columns[2] = mul(mul(two, sub(xz, wy)), sx);
+
+        columns[3] = mul(mul(two, sub(xy, wz)), sy);
+        columns[4] = mul(sub(one, mul(two, add(xx, zz))), sy);
+        columns[5] = mul(mul(two, add(yz, wx)), sy);
+
+        columns[6] = mul(mul(two, add(xz, wy)), sz);
+        columns[7] = mul(mul(two, sub(yz, wx)), sz);
+        columns[8] = mul(sub(one, mul(two, add(xx, yy))), sz);
+
+        columns[9] = load(&_px[first]);
+        columns[10] = load(&_py[first]);
+        columns[11] = load(&_pz[first]);
+
+        // Transpose the batch back to one matrix per node
+        alignas(32) float lanes[12][WIDTH];
+        for (int i = 0; i < 12; i++)
+        {
+            store(lanes[i], columns[i]);
+        }
+
+        for (int lane = 0; lane < WIDTH; lane++)
+        {
+            float* matrix = &_local[first + lane][0][0];
+            matrix[0] = lanes[0][lane];  matrix[1] = lanes[1][lane];  matrix[2] = lanes[2][lane];   matrix[3] = 0.0f;
+            matrix[4] = lanes[3][lane];  matrix[5] = lanes[4][lane];  matrix[6] = lanes[5][lane];   matrix[7] = 0.0f;
+            matrix[8] = lanes[6][lane];  matrix[9] = lanes[7][lane];  matrix[10] = lanes[8][lane];  matrix[11] = 0.0f;
+            matrix[12] = lanes[9][lane]; matrix[13] = lanes[10][lane]; matrix[14] = lanes[11][lane]; matrix[15] = 1.0f;
+        }
+    }
+
+    inline void TransformHierarchy::_multiply_affine(const glm::mat4 &parent, const glm::mat4 &local, glm::mat4 &out)
+    {
+    #if defined(PBR_SIMD_SCALAR)
+        out = parent * local;
+    #else
+        const float* a = &parent[0][0];
+        const float* b = &local[0][0];
+        float* result = &out[0][0];
+
+        const __m128 a0 = _mm_loadu_ps(a);
+        const __m128 a1 = _mm_loadu_ps(a + 4);
+        const __m128 a2 = _mm_loadu_ps(a + 8);
+        const __m128 a3 = _mm_loadu_ps(a + 12);
+
+        // Every column is a linear combination of the parent columns, the local matrix is affine
+        // so the first three columns have no translation term and the last one has a weight of one
+        for (int column = 0; column < 3; column++)
+        {
+            const float* c = b + column * 4;
+            __m128 r = _mm_mul_ps(a0, _mm_set1_ps(c[0]));
+            r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(c[1])));
+            r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(c[2])));
+            _mm_storeu_ps(result + column * 4, r);
+        }
+
+        const float* t = b + 12;
+        __m128 r = _mm_mul_ps(a0, _mm_set1_ps(t[0]));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(t[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(t[2])));
+        _mm_storeu_ps(result + 12, _mm_add_ps(r, a3));
+    #endif
+    }
+
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "Model.hpp"
+#include "AnimationClip.hpp"
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace PBR{
+
+    // Skinned positions and normals of every vertex of a model, sampled at a fixed rate over one clip.
+    // Vertex v of frame f is the texel (v % width, f * rows_per_frame + v / width), the meshes follow
+    // each other in the order of Model::get_meshes() starting at get_mesh_base()
+    struct VertexAnimationTexture
+    {
+        unsigned int positions{ 0 };
+        unsigned int normals{ 0 };
+
+        uint32_t vertex_count{ 0 };
+        uint32_t frame_count{ 0 };
+        uint32_t width{ 0 };
+        uint32_t rows_per_frame{ 0 };
+        float frame_rate{ 30.0f };
+
+        // First texel of every mesh
+        std::vector<uint32_t> mesh_bases;
+
+        float get_duration() const { return frame_count / frame_rate; }
+        uint32_t get_mesh_base(size_t mesh) const { return mesh_bases[mesh]; }
+        // Bytes of both textures on the GPU, four half floats per texel
+        size_t gpu_bytes() const { return static_cast<size_t>(width) * rows_per_frame * frame_count * 2 * 4 * sizeof(uint16_t); }
+
+        // Must be called while the context is still alive
+        void release();
+    };
+
+    namespace detail{
+
+        // Meshes in the order Model::process_node visits them
+        inline void collect_meshes(const aiScene* scene, const aiNode* node, std::vector<const aiMesh*>& meshes)
+        {
+            for (unsigned int i = 0; i < node->mNumMeshes; i++)
+            {
+                meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+            }
+            for (unsigned int i = 0; i < node->mNumChildren; i++)
+            {
+                collect_meshes(scene, node->mChildren[i], meshes);
+            }
+        }
+
+        inline unsigned int create_animation_texture(uint32_t width, uint32_t height, const std::vector<glm::vec4>& texels)
+        {
+            unsigned int texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, texels.data());
+
+            // Only read with texelFetch, the frames are blended in the shader
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            return texture;
+        }
+
+    }
+
+    // Offline step: plays the first animation of the model file and skins every vertex on the CPU at
+    // each frame. Crowds drawn from the texture have no per frame animation cost on the CPU at all.
+    // The poses come from AnimationClip, learnopengl's Animator brings its own Model and cannot share a
+    // translation unit with this one, the animation benchmark checks that both produce the same matrices
+    inline VertexAnimationTexture bake_vertex_animation(const Model& model, float frame_rate = 30.0f, uint32_t max_width = 4096)
+    {
+        // Same flags as Model::load_model, so the vertices come out in the same order
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(model.get_path(), aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights);
+        if (scene == nullptr || scene->mRootNode == nullptr || scene->mNumAnimations == 0)
+            throw std::runtime_error{ "Failed to load an animation to bake from: " + model.get_path() };
+
+        std::map<std::string, BoneInfo> bone_info = model.get_bone_info();
+        int bone_count = model.get_bone_count();
+        AnimationClip clip{ scene, bone_info, bone_count };
+        AnimationPlayer player{ clip };
+        std::vector<glm::mat4> bones(clip.get_bone_count(), glm::mat4{ 1.0f });
+
+        std::vector<const aiMesh*> meshes;
+        detail::collect_meshes(scene, scene->mRootNode, meshes);
+
+        VertexAnimationTexture result;
+        result.frame_rate = frame_rate;
+
+        // Rest pose and up to four influences of every vertex, in texel order
+        struct Influence
+        {
+            int bone_ids[MAX_BONE_INFLUENCES]{};
+            float weights[MAX_BONE_INFLUENCES]{};
+        };
+        std::vector<glm::vec3> rest_positions;
+        std::vector<glm::vec3> rest_normals;
+        std::vector<Influence> influences;
+
+        for (const aiMesh* mesh : meshes)
+        {
+            const uint32_t base = static_cast<uint32_t>(rest_positions.size());
+            result.mesh_bases.push_back(base);
+
+            for (unsigned int v = 0; v < mesh->mNumVertices; v++)
+            {
+                rest_positions.emplace_back(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z);
+                rest_normals.push_back(mesh->HasNormals() ? glm::vec3{ mesh->mNormals[v].x, mesh->mNormals[v].y, mesh->mNormals[v].z } : glm::vec3{ 0.0f, 0.0f, 1.0f });
+            }
+            influences.resize(rest_positions.size());
+
+            for (unsigned int b = 0; b < mesh->mNumBones; b++)
+            {
+                const aiBone* bone = mesh->mBones[b];
+                auto info = bone_info.find(bone->mName.C_Str());
+                if (info == bone_info.end())
+                    continue;
+
+                for (unsigned int w = 0; w < bone->mNumWeights; w++)
+                {
+                    Influence& influence = influences[base + bone->mWeights[w].mVertexId];
+                    float* smallest = std::min_element(influence.weights, influence.weights + MAX_BONE_INFLUENCES);
+                    if (bone->mWeights[w].mWeight > *smallest)
+                    {
+                        influence.bone_ids[smallest - influence.weights] = info->second.id;
+                        *smallest = bone->mWeights[w].mWeight;
+                    }
+                }
+            }
+        }
+
+        // Both dimensions are limited by the driver, the frames stack up along the height
+        GLint max_texture_size = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+        const uint32_t max_size = static_cast<uint32_t>(std::max(max_texture_size, 1));
+
+        result.vertex_count = static_cast<uint32_t>(rest_positions.size());
+        result.width = std::max<uint32_t>(1, std::min({ result.vertex_count, max_width, max_size }));
+        result.rows_per_frame = (result.vertex_count + result.width - 1) / result.width;
+        if (result.rows_per_frame > max_size)
+            throw std::runtime_error{ "Too many vertices for a vertex animation texture: " + model.get_path() };
+
+        // The last frame is not stored, playback wraps from it to the first one
+        const float duration = clip.get_duration() / clip.get_ticks_per_second();
+        result.frame_count = std::max<uint32_t>(1, static_cast<uint32_t>(std::ceil(duration * frame_rate)));
+
+        // A clip too long for the height is sampled at a lower rate instead
+        const uint32_t max_frames = max_size / result.rows_per_frame;
+        if (result.frame_count > max_frames)
+        {
+            result.frame_count = max_frames;
+            result.frame_rate = max_frames / duration;
+            std::cerr << "Vertex animation of " << model.get_path() << " is baked at " << result.frame_rate
+                << " frames per second to fit a " << max_size << " texel texture" << std::endl;
+        }
+
+        const size_t frame_texels = static_cast<size_t>(result.width) * result.rows_per_frame;
+        std::vector<glm::vec4> positions(frame_texels * result.frame_count, glm::vec4{ 0.0f });
+        std::vector<glm::vec4> normals(frame_texels * result.frame_count, glm::vec4{ 0.0f });
+
+        for (uint32_t frame = 0; frame < result.frame_count; frame++)
+        {
+            player.set_time(frame / result.frame_rate * clip.get_ticks_per_second());
+            player.evaluate(bones.data());
+
+            glm::vec4* frame_positions = positions.data() + frame * frame_texels;
+            glm::vec4* frame_normals = normals.data() + frame * frame_texels;
+            for (uint32_t v = 0; v < result.vertex_count; v++)
+            {
+                const Influence& influence = influences[v];
+
+                glm::mat4 skin{ 0.0f };
+                float total = 0.0f;
+                for (int i = 0; i < MAX_BONE_INFLUENCES; i++)
+                {
+                    skin += bones[influence.bone_ids[i]] * influence.weights[i];
+                    total += influence.weights[i];
+                }
+                // Vertices without bones stay in the rest pose
+                skin = total > 0.0f ? skin * (1.0f / total) : glm::mat4{ 1.0f };
+
+                frame_positions[v] = glm::vec4{ glm::vec3{ skin * glm::vec4{ rest_positions[v], 1.0f } }, 1.0f };
+                frame_normals[v] = glm::vec4{ glm::normalize(glm::mat3{ skin } * rest_normals[v]), 0.0f };
+            }
+        }
+
+        const uint32_t height = result.rows_per_frame * result.frame_count;
+        result.positions = detail::create_animation_texture(result.width, height, positions);
+        result.normals = detail::create_animation_texture(result.width, height, normals);
+
+        return result;
+    }
+
+    inline void VertexAnimationTexture::release()
+    {
+        if (positions != 0)
+            glDeleteTextures(1, &positions);
+        if (normals != 0)
+            glDeleteTextures(1, &normals);
+
+        positions = 0;
+        normals = 0;
+    }
+
+}
@@ -2,9 +2,16 @@
 #define ENTITY_H
 
 #include <glm/glm.hpp> //glm::mat4
+#include <glm/gtc/matrix_transform.hpp> //glm::rotate
 #include <list> //std::list
 #include <array> //std::array
 #include <memory> //std::unique_ptr
+#include <vector> //std::vector
+#include <algorithm> //std::max
+#include <cmath> //std::abs
+
+#include <learnopengl/camera.h>
+#include "Model.hpp"
 
 class Transform
 {
@@ -65,7 +72,7 @@ public:
 		m_isDirty = true;
 	}
 
-	const glm::vec3& getGlobalPosition() const
+	glm::vec3 getGlobalPosition() const
 	{
 		return m_modelMatrix[3];
 	}
@@ -169,12 +176,12 @@ struct BoundingVolume
 	};
 };
 
-struct Sphere : public BoundingVolume
+struct BoundingSphere : public BoundingVolume
 {
 	glm::vec3 center{ 0.f, 0.f, 0.f };
 	float radius{ 0.f };
 
-	Sphere(const glm::vec3& inCenter, float inRadius)
+	BoundingSphere(const glm::vec3& inCenter, float inRadius)
 		: BoundingVolume{}, center{ inCenter }, radius{ inRadius }
 	{}
 
@@ -195,7 +202,7 @@ struct Sphere : public BoundingVolume
 		const float maxScale = std::max(std::max(globalScale.x, globalScale.y), globalScale.z);
 
 		//Max scale is assuming for the diameter. So, we need the half to apply it to our radius
-		Sphere globalSphere(globalCenter, radius * (maxScale * 0.5f));
+		BoundingSphere globalSphere(globalCenter, radius * (maxScale * 0.5f));
 
 		//Check Firstly the result that have the most chance to failure to avoid to call all functions.
 		return (globalSphere.isOnOrForwardPlane(camFrustum.leftFace) &&
@@ -269,6 +276,8 @@ struct AABB : public BoundingVolume
 		: BoundingVolume{}, center{ inCenter }, extents{ iI, iJ, iK }
 	{}
 
+	using BoundingVolume::isOnFrustum;
+
 	std::array<glm::vec3, 8> getVertice() const
 	{
 		std::array<glm::vec3, 8> vertice;
@@ -342,47 +351,50 @@ Frustum createFrustumFromCamera(const Camera& cam, float aspect, float fovY, flo
 	return frustum;
 }
 
-AABB generateAABB(const Model& model)
+//World space AABB of an object space box under an affine matrix
+AABB transformAABB(const glm::vec3& center, const glm::vec3& extents, const glm::mat4& model)
 {
-	glm::vec3 minAABB = glm::vec3(std::numeric_limits<float>::max());
-	glm::vec3 maxAABB = glm::vec3(std::numeric_limits<float>::min());
-	for (auto&& mesh : model.meshes)
-	{
-		for (auto&& vertex : mesh.vertices)
-		{
-			minAABB.x = std::min(minAABB.x, vertex.Position.x);
-			minAABB.y = std::min(minAABB.y, vertex.Position.y);
-			minAABB.z = std::min(minAABB.z, vertex.Position.z);
+	const glm::vec3 globalCenter{ model * glm::vec4(center, 1.f) };
 
-			maxAABB.x = std::max(maxAABB.x, vertex.Position.x);
-			maxAABB.y = std::max(maxAABB.y, vertex.Position.y);
-			maxAABB.z = std::max(maxAABB.z, vertex.Position.z);
-		}
-	}
-	return AABB(minAABB, maxAABB);
+	//Each world axis extent is the sum of the absolute projections of the scaled local axes
+	const glm::vec3 right = glm::vec3(model[0]) * extents.x;
+	const glm::vec3 up = glm::vec3(model[1]) * extents.y;
+	const glm::vec3 forward = glm::vec3(model[2]) * extents.z;
+
+	return AABB(globalCenter,
+		std::abs(right.x) + std::abs(up.x) + std::abs(forward.x),
+		std::abs(right.y) + std::abs(up.y) + std::abs(forward.y),
+		std::abs(right.z) + std::abs(up.z) + std::abs(forward.z));
 }
 
-Sphere generateSphereBV(const Model& model)
+//Bounds are computed by the Model at load time, so this works after the geometry was released
+AABB generateAABB(const Model& model)
 {
-	glm::vec3 minAABB = glm::vec3(std::numeric_limits<float>::max());
-	glm::vec3 maxAABB = glm::vec3(std::numeric_limits<float>::min());
-	for (auto&& mesh : model.meshes)
-	{
-		for (auto&& vertex : mesh.vertices)
-		{
-			minAABB.x = std::min(minAABB.x, vertex.Position.x);
-			minAABB.y = std::min(minAABB.y, vertex.Position.y);
-			minAABB.z = std::min(minAABB.z, vertex.Position.z);
-
-			maxAABB.x = std::max(maxAABB.x, vertex.Position.x);
-			maxAABB.y = std::max(maxAABB.y, vertex.Position.y);
-			maxAABB.z = std::max(maxAABB.z, vertex.Position.z);
-		}
-	}
+	const Bounds& bounds = model.get_bounds();
+	return AABB(bounds.min, bounds.max);
+}
 
-	return Sphere((maxAABB + minAABB) * 0.5f, glm::length(minAABB - maxAABB));
+BoundingSphere generateSphereBV(const Model& model)
+{
+	const Bounds& bounds = model.get_bounds();
+	return BoundingSphere(bounds.sphere_center, bounds.sphere_radius);
 }
 
+struct CullingStats
+{
+	unsigned int visibleEntities = 0;
+	unsigned int totalEntities = 0;
+	unsigned int visibleMeshes = 0;
+	unsigned int totalMeshes = 0;
+	unsigned int occludedEntities = 0;
+	size_t occluderTriangles = 0;
+
+	//CPU timings in milliseconds
+	double updateTime = 0.0;
+	double cullTime = 0.0;
+	double rasterTime = 0.0;
+};
+
 class Entity
 {
 public:
@@ -396,45 +408,40 @@ public:
 	Model* pModel = nullptr;
 	std::unique_ptr<AABB> boundingVolume;
 
+	//Index into the material table of the scene that owns this entity, -1 if it has none
+	int materialIndex = -1;
+
+	//Instance in the animation system of the scene that skins this entity, -1 draws it in bind pose
+	int animationInstance = -1;
+
+	//Grouping node, it has no bounds and is never drawn
+	Entity() = default;
 
 	// constructor, expects a filepath to a 3D model.
-	Entity(Model& model) : pModel{ &model }
+	Entity(Model& model, int material = -1) : pModel{ &model }, materialIndex{ material }
 	{
 		boundingVolume = std::make_unique<AABB>(generateAABB(model));
-		//boundingVolume = std::make_unique<Sphere>(generateSphereBV(model));
+		//boundingVolume = std::make_unique<BoundingSphere>(generateSphereBV(model));
 	}
 
-	AABB getGlobalAABB()
+	//Procedural geometry that is not backed by a Model, like the sphere and the quad
+	Entity(const AABB& bounds, int material = -1) : materialIndex{ material }
 	{
-		//Get global scale thanks to our transform
-		const glm::vec3 globalCenter{ transform.getModelMatrix() * glm::vec4(boundingVolume->center, 1.f) };
-
-		// Scaled orientation
-		const glm::vec3 right = transform.getRight() * boundingVolume->extents.x;
-		const glm::vec3 up = transform.getUp() * boundingVolume->extents.y;
-		const glm::vec3 forward = transform.getForward() * boundingVolume->extents.z;
-
-		const float newIi = std::abs(glm::dot(glm::vec3{ 1.f, 0.f, 0.f }, right)) +
-			std::abs(glm::dot(glm::vec3{ 1.f, 0.f, 0.f }, up)) +
-			std::abs(glm::dot(glm::vec3{ 1.f, 0.f, 0.f }, forward));
-
-		const float newIj = std::abs(glm::dot(glm::vec3{ 0.f, 1.f, 0.f }, right)) +
-			std::abs(glm::dot(glm::vec3{ 0.f, 1.f, 0.f }, up)) +
-			std::abs(glm::dot(glm::vec3{ 0.f, 1.f, 0.f }, forward));
-
-		const float newIk = std::abs(glm::dot(glm::vec3{ 0.f, 0.f, 1.f }, right)) +
-			std::abs(glm::dot(glm::vec3{ 0.f, 0.f, 1.f }, up)) +
-			std::abs(glm::dot(glm::vec3{ 0.f, 0.f, 1.f }, forward));
+		boundingVolume = std::make_unique<AABB>(bounds);
+	}
 
-		return AABB(globalCenter, newIi, newIj, newIk);
+	AABB getGlobalAABB() const
+	{
+		return transformAABB(boundingVolume->center, boundingVolume->extents, transform.getModelMatrix());
 	}
 
 	//Add child. Argument input is argument of any constructor that you create. By default you can use the default constructor and don't put argument input.
 	template<typename... TArgs>
-	void addChild(TArgs&... args)
+	Entity& addChild(TArgs&&... args)
 	{
-		children.emplace_back(std::make_unique<Entity>(args...));
+		children.emplace_back(std::make_unique<Entity>(std::forward<TArgs>(args)...));
 		children.back()->parent = this;
+		return *children.back();
 	}
 
 	//Update transform if it was changed
@@ -465,21 +472,16 @@ public:
 		}
 	}
 
-
-	void drawSelfAndChild(const Frustum& frustum, Shader& ourShader, unsigned int& display, unsigned int& total)
+	//Flattens the entities that have bounds, parents always come before their children
+	void collectDrawable(std::vector<const Entity*>& drawable) const
 	{
-		if (boundingVolume->isOnFrustum(frustum, transform))
-		{
-			ourShader.setMat4("model", transform.getModelMatrix());
-			pModel->Draw(ourShader);
-			display++;
-		}
-		total++;
+		if (boundingVolume)
+			drawable.push_back(this);
 
 		for (auto&& child : children)
 		{
-			child->drawSelfAndChild(frustum, ourShader, display, total);
+			child->collectDrawable(drawable);
 		}
 	}
 };
-#endif
+#endif
\ No newline at end of file
@@ -19,6 +19,7 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <cassert>
 #include <learnopengl/assimp_glm_helpers.h>
 #include <learnopengl/animdata.h>
 
@@ -5,11 +5,17 @@
 layout (location = 0) in vec3 aPos;
 
 out vec3 WorldPos;
+out vec4 CurrentPosition;
+out vec4 PreviousPosition;
 
 
 uniform mat4 projection;
 uniform mat4 view;
 
+// Without the translation, the sky only moves when the camera turns
+uniform mat4 unjitteredViewProjection;
+uniform mat4 previousViewProjection;
+
 
 void main()
 {
@@ -19,6 +25,8 @@ void main()
 	vec4 clipPos = projection * clear_view * vec4(WorldPos, 1.0);
 
 	gl_Position = clipPos.xyww;
+    CurrentPosition = unjitteredViewProjection * vec4(WorldPos, 1.0);
+    PreviousPosition = previousViewProjection * vec4(WorldPos, 1.0);
 }
 
 
@@ -27,18 +35,23 @@ void main()
 #version 460 core
 
 in vec3 WorldPos;
+in vec4 CurrentPosition;
+in vec4 PreviousPosition;
 
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec2 Velocity;
 
 uniform samplerCube environmentMap;
+// Sky the current one fades in from, environmentBlend is the weight of the current one
+uniform samplerCube previousEnvironmentMap;
+uniform float environmentBlend;
 
 void main()
 {		
     vec3 envColor = texture(environmentMap, WorldPos).rgb;
-    
-    // HDR tonemap and gamma correct
-    envColor = envColor / (envColor + vec3(1.0));
-    envColor = pow(envColor, vec3(1.0/2.2)); 
-    
+    if (environmentBlend < 1.0)
+        envColor = mix(texture(previousEnvironmentMap, WorldPos).rgb, envColor, environmentBlend);
+
     FragColor = vec4(envColor, 1.0);
+    Velocity = (CurrentPosition.xy / CurrentPosition.w - PreviousPosition.xy / PreviousPosition.w) * 0.5;
 }
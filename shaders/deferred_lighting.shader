@@ -0,0 +1,103 @@
+#Vertex Shader
+
+#version 460 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec2 aTexCord;
+
+out vec2 TexCord;
+
+void main(){
+    TexCord = aTexCord;
+    gl_Position = vec4(aPos.xy, 0.0, 1.0);
+}
+
+#Fragment Shader
+
+#version 460 core
+
+#define PI 3.1415926535897932384626433832795
+
+
+out vec4 FragColor;
+
+in vec2 TexCord;
+
+// Written by the GBUFFER variants of pbr.shader and pbr_model.shader
+uniform sampler2D gAlbedo;
+uniform sampler2D gMaterial;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseViewProjection;
+// Rendered part of the targets, smaller than one with dynamic resolution
+uniform vec2 gbufferScale;
+
+uniform samplerCube irradiance_map;
+uniform samplerCube prefilter_map;
+// Environment the current one fades in from, environmentBlend is the weight of the current one
+uniform samplerCube previous_irradiance_map;
+uniform samplerCube previous_prefilter_map;
+uniform float environmentBlend;
+
+#include "include/probes.glsl"
+
+uniform sampler2D brdfLUT;
+
+// Rebuilt from the depth buffer, the shared lighting functions read it in place of the forward shaders' input
+vec3 FragPos;
+
+#include "include/lighting.glsl"
+#include "include/shadows.glsl"
+
+vec3 octDecode(vec2 e);
+
+void main()
+{
+    // TexCord spans the viewport, the targets are window sized
+    vec2 uv = TexCord * gbufferScale;
+    float depth = texture(gDepth, uv).r;
+    // Background, the sky box is drawn over it afterwards
+    if (depth == 1.0)
+        discard;
+
+    vec4 position = inverseViewProjection * vec4(vec3(TexCord, depth) * 2.0 - 1.0, 1.0);
+    FragPos = position.xyz / position.w;
+
+    vec3 albedo = pow(texture(gAlbedo, uv).rgb, vec3(2.2));
+    vec3 arm = texture(gMaterial, uv).rgb;
+    float ambient_occlision = arm.r;
+    float roughness = arm.g;
+    float metallic = arm.b;
+
+    vec3 normal = octDecode(texture(gNormal, uv).rg);
+
+    vec3 result = vec3(0.0f);
+
+    float shadow = shadows ? calcShadow(normal) : 1.0;
+
+    for(int i = 0; i < 4; ++i){
+        result += calcPBRLighting(light, normalize(lightDirections[i]), light.isDirLight, metallic, albedo, normal, roughness) * (i == shadowLight ? shadow : 1.0);
+    }
+
+    if (clusteredLighting)
+        result += calcClusteredLighting(metallic, albedo, normal, roughness);
+
+    result += calcPBRAmbientLightning(metallic, albedo, normal, roughness, ambient_occlision);
+
+    FragColor = vec4(result, 1.0f);
+}
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+// Picked per pixel, there is no draw to pick them for
+void selectProbes(out int first, out int second, out float weight)
+{
+    pickProbes(FragPos, first, second, weight);
+}
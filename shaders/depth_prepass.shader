@@ -0,0 +1,59 @@
+#Vertex Shader
+
+#version 460 core
+
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+#ifdef SKINNED
+layout (location = 5) in uvec4 aBoneIds;
+layout (location = 6) in vec4 aBoneWeights;
+
+#include "include/skinning.glsl"
+#endif
+
+// The ALPHA_MASKED variant needs the full vertex stream, the position only one has no texture coordinates
+#ifdef ALPHA_MASKED
+layout (location = 2) in vec2 aTexCord;
+
+out vec2 TexCord;
+#endif
+
+// Same expression as the color pass shaders, so GL_EQUAL matches bit for bit
+invariant gl_Position;
+
+void main(){
+#ifdef SKINNED
+    vec4 vertexLocation = model * (skinMatrix(aBoneIds, aBoneWeights) * vec4(aPos, 1.0f));
+#else
+    vec4 vertexLocation = model * vec4(aPos, 1.0f);
+#endif
+#ifdef ALPHA_MASKED
+    TexCord = aTexCord;
+#endif
+    gl_Position = projection * view * vertexLocation;
+}
+
+#Fragment Shader
+
+#version 460 core
+
+#ifdef ALPHA_MASKED
+in vec2 TexCord;
+
+uniform sampler2D albedo_map;
+uniform float opacity;
+uniform float alphaCutoff;
+#endif
+
+void main()
+{
+#ifdef ALPHA_MASKED
+    // Same test as the color pass, so a masked caster shadows only what it draws
+    if (texture(albedo_map, TexCord).a * opacity < alphaCutoff)
+        discard;
+#endif
+}
@@ -4,15 +4,42 @@
 
 layout (location = 0) in vec3 aPos;
 
+out vec3 cubePos;
+
+void main()
+{
+    cubePos = aPos;
+    gl_Position = vec4(aPos, 1.0);
+}
+
+
+#Geometry Shader
+
+#version 460 core
+
+// One draw renders every face, an invocation per face writes its layer of the attached cube map
+layout (triangles, invocations = 6) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+in vec3 cubePos[];
+
 out vec3 localPos;
 
 uniform mat4 projection;
-uniform mat4 view;
+uniform mat4 captureViews[6];
+// First layer of the cube in a cube map array
+uniform int layerOffset;
 
 void main()
 {
-    localPos = aPos;
-    gl_Position = projection * view * vec4(localPos, 1.0);
+    for(int i = 0; i < 3; ++i)
+    {
+        localPos = cubePos[i];
+        gl_Layer = layerOffset + gl_InvocationID;
+        gl_Position = projection * captureViews[gl_InvocationID] * vec4(cubePos[i], 1.0);
+        EmitVertex();
+    }
+    EndPrimitive();
 }
 
 
@@ -0,0 +1,334 @@
+// Direct and image based lighting of the forward material shaders and the deferred lighting pass.
+// Expects PI, the world space FragPos and the environment maps with include/probes.glsl to be declared
+// before it, and selectProbes to be defined by the includer
+
+// Light struct
+struct Light{
+    vec3 position;    
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+
+    vec3 attenuationScalars;
+
+    bool isDirLight;
+};
+
+uniform vec3 lightDirections[4];
+
+
+uniform Light light;
+uniform vec3 viewPos;
+uniform mat4 view;
+
+// Point and spot lights of the clustered path, assigned to the froxels by PBR::LightClusters
+struct ClusterLight{
+    vec4 positionRange;
+    vec4 colorType;
+    vec4 directionOuter;
+    vec4 attenuationInner;
+};
+
+layout(std430, binding = 5) readonly buffer ClusterLights{
+    ClusterLight clusterLights[];
+};
+layout(std430, binding = 6) readonly buffer ClusterRanges{
+    uvec2 clusterRanges[];
+};
+layout(std430, binding = 7) readonly buffer ClusterLightIndices{
+    uint clusterLightIndices[];
+};
+
+uniform bool clusteredLighting;
+uniform uint clusterTilesX;
+uniform uint clusterTilesY;
+uniform uint clusterSlices;
+uniform vec2 clusterScreenScale;
+uniform vec2 clusterDepthScaleBias;
+
+float RadicalInverse_VdC(uint bits);
+vec2 Hammersley(uint i, uint N);
+vec3 ImportanceSampleGGX(vec2 Xi, vec3 N, float roughness);
+float GeometrySchlickGGX(float NdotV, float roughness);
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness);
+vec2 IntegrateBRDF(float NdotV, float roughness);
+
+vec3 schlickFresnel(float vDotH, float metallic, vec3 color);
+vec3 fresnelSchlickRoughness(float nDotV, float metallic, vec3 color, float roughness);
+float geomSmith(float dp, float roughness);
+float ggxDistribution(float nDotH, float roughness);
+
+vec3 calcPBRLighting(Light light, vec3 posDir, bool isDirlight, float metallic, vec3 color, vec3 normal, float roughness);
+vec3 calcPBRRadiance(vec3 L, vec3 lightIntensity, float metallic, vec3 color, vec3 normal, float roughness);
+vec3 calcClusteredLighting(float metallic, vec3 color, vec3 normal, float roughness);
+vec3 calcPBRAmbientLightning(float metallic, vec3 color, vec3 normal, float roughness, float ao);
+
+// Defined by the includer, the reflection probes of the fragment, -1 for none
+void selectProbes(out int first, out int second, out float weight);
+
+vec3 schlickFresnel(float vDotH, float metallic, vec3 color)
+{
+    vec3 F0 = vec3(0.04);
+
+    F0 = mix(F0, color, metallic);
+
+    vec3 ret = F0 + (1 - F0) * pow(clamp(1.0 - vDotH, 0.0, 1.0), 5);
+
+    return ret;
+}
+
+vec3 fresnelSchlickRoughness(float nDotV, float metallic, vec3 color, float roughness)
+{
+    vec3 F0 = vec3(0.04);
+
+    F0 = mix(F0, color, metallic);
+
+    vec3 ret = F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - nDotV, 0.0, 1.0), 5.0);
+
+    return ret;
+}   
+
+
+float geomSmith(float dp, float roughness)
+{
+    float k = (roughness + 1.0) * (roughness + 1.0) / 8.0;
+    float denom = dp * (1.0 - k) + k;
+    return dp / denom;
+}
+
+
+float ggxDistribution(float nDotH, float roughness)
+{
+    float alpha2 = roughness * roughness * roughness * roughness;
+    float d = nDotH * nDotH * (alpha2 - 1.0f) + 1.0f;
+    float ggxdistrib = alpha2 / (PI * d * d);
+    return ggxdistrib;
+}
+
+
+vec3 calcPBRLighting(Light light, vec3 posDir, bool isDirlight, float metallic, vec3 color, vec3 normal, float roughness)
+{
+    vec3 lightIntensity = light.diffuse;
+
+    // Light Direction vector
+    vec3 L = vec3(0.0);
+
+    if (isDirlight) {
+        L = -posDir.xyz;
+    } else {
+        L = posDir - FragPos;
+        float lightToPixelDist = length(L);
+        L = normalize(L);
+        lightIntensity /= (lightToPixelDist * lightToPixelDist);
+    }
+
+    return calcPBRRadiance(L, lightIntensity, metallic, color, normal, roughness);
+}
+
+// Cook-Torrance BRDF for light arriving from direction L with the given radiance
+vec3 calcPBRRadiance(vec3 L, vec3 lightIntensity, float metallic, vec3 color, vec3 normal, float roughness)
+{
+    // Normal vector
+    vec3 N = normal;
+
+    // View direction vector
+    vec3 V = normalize(viewPos - FragPos);
+
+    // Halfway direction vector
+    vec3 H = normalize(V + L);
+
+    float nDotH = max(dot(N, H), 0.0);
+    float vDotH = max(dot(V, H), 0.0);
+    float nDotL = max(dot(N, L), 0.0);
+    float nDotV = max(dot(N, V), 0.0);
+
+    vec3 F = schlickFresnel(vDotH, metallic, color);
+
+    vec3 kS = F;
+    vec3 kD = 1.0 - kS;
+
+    kD *= 1.0 - metallic;
+
+    vec3 SpecBRDF_nom  = ggxDistribution(nDotH, roughness) *
+                         F *
+                         geomSmith(nDotL, roughness) *
+                         geomSmith(nDotV, roughness);
+
+    float SpecBRDF_denom = 4.0 * nDotV * nDotL + 0.0001;
+
+    vec3 SpecBRDF = SpecBRDF_nom / SpecBRDF_denom;
+
+    vec3 DiffuseBRDF = kD * color / PI;
+
+    vec3 FinalColor = (DiffuseBRDF + SpecBRDF) * lightIntensity * nDotL;
+
+    return FinalColor;
+}
+
+// Point and spot lights of the cluster the fragment falls in
+vec3 calcClusteredLighting(float metallic, vec3 color, vec3 normal, float roughness)
+{
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    uint slice = uint(clamp(log(viewDepth) * clusterDepthScaleBias.x + clusterDepthScaleBias.y, 0.0, float(clusterSlices - 1u)));
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * clusterScreenScale), uvec2(clusterTilesX - 1u, clusterTilesY - 1u));
+    uvec2 range = clusterRanges[(slice * clusterTilesY + tile.y) * clusterTilesX + tile.x];
+
+    vec3 result = vec3(0.0);
+    for (uint i = range.x; i < range.x + range.y; ++i) {
+        ClusterLight clusterLight = clusterLights[clusterLightIndices[i]];
+
+        vec3 L = clusterLight.positionRange.xyz - FragPos;
+        float dist = length(L);
+        L /= dist;
+
+        // Classical attenuation, faded to zero at the range the light was assigned with
+        vec3 scalars = clusterLight.attenuationInner.xyz;
+        float window = clamp(1.0 - pow(dist / clusterLight.positionRange.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (scalars.x + scalars.y * dist + scalars.z * dist * dist);
+
+        if (clusterLight.colorType.w > 0.5)
+            attenuation *= smoothstep(clusterLight.directionOuter.w, clusterLight.attenuationInner.w, dot(-L, clusterLight.directionOuter.xyz));
+
+        result += calcPBRRadiance(L, clusterLight.colorType.rgb * attenuation, metallic, color, normal, roughness);
+    }
+    return result;
+}
+
+vec3 calcPBRAmbientLightning(float metallic, vec3 color, vec3 normal, float roughness, float ao)
+{    
+    vec3 N = normal;
+
+    vec3 V = normalize(viewPos - FragPos);
+
+    vec3 R = reflect(-V, N); 
+
+    vec3 F = fresnelSchlickRoughness(max(dot(N, V), 0.0), metallic, color,  roughness);
+
+    vec3 kS = F;
+    vec3 kD = 1.0 - kS;
+    kD *= 1.0 - metallic;
+
+    vec3 irradiance = texture(irradiance_map, N).rgb;
+    if (environmentBlend < 1.0)
+        irradiance = mix(texture(previous_irradiance_map, N).rgb, irradiance, environmentBlend);
+    vec3 diffuse = irradiance * color;
+
+    const float MAX_REFLECTION_LOD = 4.0;
+    vec3 prefiltered_color = textureLod(prefilter_map, R, roughness * MAX_REFLECTION_LOD).rgb;
+    if (environmentBlend < 1.0)
+        prefiltered_color = mix(textureLod(previous_prefilter_map, R, roughness * MAX_REFLECTION_LOD).rgb, prefiltered_color, environmentBlend);
+    int firstProbe, secondProbe;
+    float weight;
+    selectProbes(firstProbe, secondProbe, weight);
+    prefiltered_color = probeReflection(firstProbe, secondProbe, weight, FragPos, R, roughness * MAX_REFLECTION_LOD, prefiltered_color);
+    // vec2 brdf  = texture(brdfLUT, vec2(max(dot(N, V), 0.0), roughness)).rg;
+    vec2 brdf  = IntegrateBRDF(max(dot(N, V), 0.0), roughness);
+    vec3 specular = prefiltered_color * (F * brdf.x + brdf.y);
+
+    vec3 ambient = (kD * diffuse + specular) * ao;
+
+    return ambient;
+}
+
+
+float RadicalInverse_VdC(uint bits) 
+{
+     bits = (bits << 16u) | (bits >> 16u);
+     bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+     bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+     bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+     bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+     return float(bits) * 2.3283064365386963e-10; // / 0x100000000
+}
+// ----------------------------------------------------------------------------
+vec2 Hammersley(uint i, uint N)
+{
+	return vec2(float(i)/float(N), RadicalInverse_VdC(i));
+}
+// ----------------------------------------------------------------------------
+vec3 ImportanceSampleGGX(vec2 Xi, vec3 N, float roughness)
+{
+	float a = roughness*roughness;
+	
+	float phi = 2.0 * PI * Xi.x;
+	float cosTheta = sqrt((1.0 - Xi.y) / (1.0 + (a*a - 1.0) * Xi.y));
+	float sinTheta = sqrt(1.0 - cosTheta*cosTheta);
+	
+	// from spherical coordinates to cartesian coordinates - halfway vector
+	vec3 H;
+	H.x = cos(phi) * sinTheta;
+	H.y = sin(phi) * sinTheta;
+	H.z = cosTheta;
+	
+	// from tangent-space H vector to world-space sample vector
+	vec3 up          = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+	vec3 tangent   = normalize(cross(up, N));
+	vec3 bitangent = cross(N, tangent);
+	
+	vec3 sampleVec = tangent * H.x + bitangent * H.y + N * H.z;
+	return normalize(sampleVec);
+}
+// ----------------------------------------------------------------------------
+float GeometrySchlickGGX(float NdotV, float roughness)
+{
+    // note that we use a different k for IBL
+    float a = roughness;
+    float k = (a * a) / 2.0;
+
+    float nom   = NdotV;
+    float denom = NdotV * (1.0 - k) + k;
+
+    return nom / denom;
+}
+// ----------------------------------------------------------------------------
+float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness)
+{
+    float NdotV = max(dot(N, V), 0.0);
+    float NdotL = max(dot(N, L), 0.0);
+    float ggx2 = GeometrySchlickGGX(NdotV, roughness);
+    float ggx1 = GeometrySchlickGGX(NdotL, roughness);
+
+    return ggx1 * ggx2;
+}
+// ----------------------------------------------------------------------------
+vec2 IntegrateBRDF(float NdotV, float roughness)
+{
+    vec3 V;
+    V.x = sqrt(1.0 - NdotV*NdotV);
+    V.y = 0.0;
+    V.z = NdotV;
+
+    float A = 0.0;
+    float B = 0.0; 
+
+    vec3 N = vec3(0.0, 0.0, 1.0);
+    
+    const uint SAMPLE_COUNT = 32u;
+    for(uint i = 0u; i < SAMPLE_COUNT; ++i)
+    {
+        // generates a sample vector that's biased towards the
+        // preferred alignment direction (importance sampling).
+        vec2 Xi = Hammersley(i, SAMPLE_COUNT);
+        vec3 H = ImportanceSampleGGX(Xi, N, roughness);
+        vec3 L = normalize(2.0 * dot(V, H) * H - V);
+
+        float NdotL = max(L.z, 0.0);
+        float NdotH = max(H.z, 0.0);
+        float VdotH = max(dot(V, H), 0.0);
+
+        if(NdotL > 0.0)
+        {
+            float G = GeometrySmith(N, V, L, roughness);
+            float G_Vis = (G * VdotH) / (NdotH * NdotV);
+            float Fc = pow(1.0 - VdotH, 5.0);
+
+            A += (1.0 - Fc) * G_Vis;
+            B += Fc * G_Vis;
+        }
+    }
+    A /= float(SAMPLE_COUNT);
+    B /= float(SAMPLE_COUNT);
+    return vec2(A, B);
+}
@@ -0,0 +1,70 @@
+// Local reflection probes, box projected so the reflections line up with what the probe captured
+const int MAX_PROBES = 8;
+uniform samplerCubeArray probe_maps;
+uniform vec3 probePositions[MAX_PROBES];
+uniform vec3 probeBoxMin[MAX_PROBES];
+uniform vec3 probeBoxMax[MAX_PROBES];
+// Probes of the scene, the ones past the count are empty
+uniform int probeCount;
+
+// The nearest two probes whose boxes contain P, for passes that have no draw to pick for
+void pickProbes(vec3 P, out int first, out int second, out float weight)
+{
+    first = -1;
+    second = -1;
+    weight = 1.0;
+    float firstDistance = 0.0;
+    float secondDistance = 0.0;
+    for (int i = 0; i < probeCount; ++i)
+    {
+        if (any(lessThan(P, probeBoxMin[i])) || any(greaterThan(P, probeBoxMax[i])))
+            continue;
+
+        float probeDistance = length(P - probePositions[i]);
+        if (first < 0 || probeDistance < firstDistance)
+        {
+            second = first;
+            secondDistance = firstDistance;
+            first = i;
+            firstDistance = probeDistance;
+        }
+        else if (second < 0 || probeDistance < secondDistance)
+        {
+            second = i;
+            secondDistance = probeDistance;
+        }
+    }
+
+    if (second >= 0)
+        weight = firstDistance + secondDistance > 0.0 ? secondDistance / (firstDistance + secondDistance) : 0.5;
+}
+
+vec3 sampleProbe(int probe, vec3 P, vec3 R, float lod)
+{
+    // Where the reflected ray leaves the box, looked up from the capture point
+    vec3 first = (probeBoxMax[probe] - P) / R;
+    vec3 second = (probeBoxMin[probe] - P) / R;
+    vec3 furthest = max(first, second);
+    float hit = min(min(furthest.x, furthest.y), furthest.z);
+    vec3 direction = P + R * hit - probePositions[probe];
+    return textureLod(probe_maps, vec4(direction, float(probe)), lod).rgb;
+}
+
+// The environment takes over in the last quarter unit inside the box
+float probeFade(int probe, vec3 P)
+{
+    vec3 inside = min(P - probeBoxMin[probe], probeBoxMax[probe] - P);
+    return clamp(min(min(inside.x, inside.y), inside.z) * 4.0, 0.0, 1.0);
+}
+
+// weight is the share of the first probe, -1 is no probe
+vec3 probeReflection(int first, int second, float weight, vec3 P, vec3 R, float lod, vec3 environment)
+{
+    if (first < 0)
+        return environment;
+
+    vec3 color = mix(environment, sampleProbe(first, P, R, lod), probeFade(first, P));
+    if (second >= 0)
+        color = mix(mix(environment, sampleProbe(second, P, R, lod), probeFade(second, P)), color, weight);
+    return color;
+}
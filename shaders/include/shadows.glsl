@@ -0,0 +1,35 @@
+// Expects FragPos and the view matrix of include/lighting.glsl to be declared before it
+
+// Cascaded shadow map of one of the directional lights, see PBR::CascadedShadowMap.
+// Bound to a fixed unit, a sampler left on unit 0 would clash with albedo_map
+uniform bool shadows;
+uniform int shadowLight;
+layout(binding = 14) uniform sampler2DArrayShadow shadowMap;
+uniform mat4 shadowMatrices[4];
+uniform vec4 cascadeSplits;
+uniform vec4 cascadeTexelSizes;
+
+// Fraction of the shadow casting light reaching the fragment, 3x3 PCF in the cascade of its view depth
+float calcShadow(vec3 normal)
+{
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    if (viewDepth > cascadeSplits[3])
+        return 1.0;
+
+    int cascade = 0;
+    while (viewDepth > cascadeSplits[cascade])
+        cascade++;
+
+    // Pushed out along the normal so lit surfaces do not shadow themselves
+    vec3 position = FragPos + normal * cascadeTexelSizes[cascade] * 1.5;
+    vec3 coords = (shadowMatrices[cascade] * vec4(position, 1.0)).xyz;
+
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; ++x) {
+        for (int y = -1; y <= 1; ++y) {
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, float(cascade), coords.z));
+        }
+    }
+    return lit / 9.0;
+}
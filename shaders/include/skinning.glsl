@@ -0,0 +1,47 @@
+// Palettes of every animated instance: 4 columns per bone, or the real and dual part of a dual quaternion
+layout (std430, binding = 0) readonly buffer BonePalettes{
+    vec4 bonePalettes[];
+};
+uniform uint paletteOffset;
+uniform bool dualQuaternions;
+
+// Linear blend of the bone matrices, or the blended dual quaternion turned into a matrix
+mat4 skinMatrix(uvec4 boneIds, vec4 boneWeights){
+    // Meshes without influences in a skinned model read zero weights and stay in the bind pose
+    if (dot(boneWeights, vec4(1.0)) == 0.0)
+        return mat4(1.0);
+
+    if (dualQuaternions) {
+        vec4 pivot = bonePalettes[(paletteOffset + boneIds[0]) * 2u];
+        vec4 real = vec4(0.0);
+        vec4 dual = vec4(0.0);
+        for (int i = 0; i < 4; ++i) {
+            uint index = (paletteOffset + boneIds[i]) * 2u;
+            // q and -q are the same rotation, blend them all in the hemisphere of the first one
+            float weight = dot(bonePalettes[index], pivot) < 0.0 ? -boneWeights[i] : boneWeights[i];
+            real += bonePalettes[index] * weight;
+            dual += bonePalettes[index + 1u] * weight;
+        }
+        float norm = length(real);
+        real /= norm;
+        dual /= norm;
+
+        vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+        vec3 r2 = real.xyz * 2.0;
+        vec3 rr = real.xyz * r2;
+        vec3 rw = real.w * r2;
+        float xy = real.x * r2.y, xz = real.x * r2.z, yz = real.y * r2.z;
+        return mat4(
+            vec4(1.0 - rr.y - rr.z, xy + rw.z, xz - rw.y, 0.0),
+            vec4(xy - rw.z, 1.0 - rr.x - rr.z, yz + rw.x, 0.0),
+            vec4(xz + rw.y, yz - rw.x, 1.0 - rr.x - rr.y, 0.0),
+            vec4(translation, 1.0));
+    }
+
+    mat4 skin = mat4(0.0);
+    for (int i = 0; i < 4; ++i) {
+        uint index = (paletteOffset + boneIds[i]) * 4u;
+        skin += mat4(bonePalettes[index], bonePalettes[index + 1u], bonePalettes[index + 2u], bonePalettes[index + 3u]) * boneWeights[i];
+    }
+    return skin;
+}
@@ -10,8 +10,19 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+#ifdef SKINNED
+layout (location = 5) in uvec4 aBoneIds;
+layout (location = 6) in vec4 aBoneWeights;
+
+#include "include/skinning.glsl"
+#endif
+
 void main(){
+#ifdef SKINNED
+    vec4 vertexLocation = model * (skinMatrix(aBoneIds, aBoneWeights) * vec4(aPos, 1.0f));
+#else
     vec4 vertexLocation = model * vec4(aPos, 1.0f);
+#endif
     gl_Position = projection * view * vertexLocation;
 }
 
@@ -0,0 +1,120 @@
+#Vertex Shader
+
+#version 460 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec2 aTexCord;
+
+out vec2 TexCord;
+
+void main(){
+    TexCord = aTexCord;
+    gl_Position = vec4(aPos.xy, 0.0, 1.0);
+}
+
+#Fragment Shader
+
+#version 460 core
+
+out vec4 FragColor;
+
+in vec2 TexCord;
+
+// Linear scene color, every lit shader writes here without tonemapping
+uniform sampler2D hdrBuffer;
+
+// Part of the buffer that was rendered, the rest is stale
+uniform vec2 renderScale;
+// 0: bilinear, 1: Catmull-Rom
+uniform int upscaleFilter;
+
+uniform float exposure;
+// 0: Reinhard, 1: ACES fit
+uniform int tonemapper;
+
+// Clamped into the rendered part so the filters never read past its edge
+vec3 fetch(vec2 uv)
+{
+    vec2 size = vec2(textureSize(hdrBuffer, 0));
+    return texture(hdrBuffer, clamp(uv, 0.5 / size, (size * renderScale - 0.5) / size)).rgb;
+}
+
+// Bicubic Catmull-Rom in 9 bilinear taps instead of 16 point ones, sharper than bilinear when upscaling
+vec3 sampleCatmullRom(vec2 uv)
+{
+    vec2 size = vec2(textureSize(hdrBuffer, 0));
+    vec2 samplePos = uv * size;
+    vec2 texPos1 = floor(samplePos - 0.5) + 0.5;
+    vec2 f = samplePos - texPos1;
+
+    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+    vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+    vec2 w3 = f * f * (-0.5 + 0.5 * f);
+
+    // The two middle taps merged into one bilinear fetch
+    vec2 w12 = w1 + w2;
+    vec2 texPos0 = (texPos1 - 1.0) / size;
+    vec2 texPos3 = (texPos1 + 2.0) / size;
+    vec2 texPos12 = (texPos1 + w2 / w12) / size;
+
+    vec3 result = vec3(0.0);
+    result += fetch(vec2(texPos0.x, texPos0.y)) * w0.x * w0.y;
+    result += fetch(vec2(texPos12.x, texPos0.y)) * w12.x * w0.y;
+    result += fetch(vec2(texPos3.x, texPos0.y)) * w3.x * w0.y;
+
+    result += fetch(vec2(texPos0.x, texPos12.y)) * w0.x * w12.y;
+    result += fetch(vec2(texPos12.x, texPos12.y)) * w12.x * w12.y;
+    result += fetch(vec2(texPos3.x, texPos12.y)) * w3.x * w12.y;
+
+    result += fetch(vec2(texPos0.x, texPos3.y)) * w0.x * w3.y;
+    result += fetch(vec2(texPos12.x, texPos3.y)) * w12.x * w3.y;
+    result += fetch(vec2(texPos3.x, texPos3.y)) * w3.x * w3.y;
+
+    // The negative lobes can undershoot next to bright highlights
+    return max(result, vec3(0.0));
+}
+
+vec3 reinhard(vec3 color)
+{
+    return color / (color + vec3(1.0));
+}
+
+// Stephen Hill's fit of the ACES reference rendering and output transforms
+vec3 acesFit(vec3 color)
+{
+    const mat3 inputMatrix = mat3(
+        0.59719, 0.07600, 0.02840,
+        0.35458, 0.90834, 0.13383,
+        0.04823, 0.01566, 0.83777
+    );
+    const mat3 outputMatrix = mat3(
+         1.60475, -0.10208, -0.00327,
+        -0.53108,  1.10813, -0.07276,
+        -0.07367, -0.00605,  1.07602
+    );
+
+    color = inputMatrix * color;
+    vec3 a = color * (color + 0.0245786) - 0.000090537;
+    vec3 b = color * (0.983729 * color + 0.4329510) + 0.238081;
+    color = outputMatrix * (a / b);
+
+    return clamp(color, 0.0, 1.0);
+}
+
+vec3 linearToSrgb(vec3 color)
+{
+    vec3 low = color * 12.92;
+    vec3 high = 1.055 * pow(color, vec3(1.0 / 2.4)) - 0.055;
+    return mix(high, low, lessThanEqual(color, vec3(0.0031308)));
+}
+
+void main()
+{
+    vec2 uv = TexCord * renderScale;
+    vec3 color = (upscaleFilter == 1 ? sampleCatmullRom(uv) : fetch(uv)) * exposure;
+
+    color = tonemapper == 1 ? acesFit(color) : reinhard(color);
+
+    FragColor = vec4(linearToSrgb(color), 1.0);
+}
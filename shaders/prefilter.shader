@@ -4,17 +4,42 @@
 
 layout (location = 0) in vec3 aPos;
 
-out vec3 WorldPos;
+out vec3 cubePos;
 
+void main()
+{
+    cubePos = aPos;
+    gl_Position = vec4(aPos, 1.0);
+}
 
-uniform mat4 projection;
-uniform mat4 view;
 
+#Geometry Shader
+
+#version 460 core
+
+// One draw renders every face, an invocation per face writes its layer of the attached cube map
+layout (triangles, invocations = 6) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+in vec3 cubePos[];
+
+out vec3 WorldPos;
+
+uniform mat4 projection;
+uniform mat4 captureViews[6];
+// First layer of the cube in a cube map array
+uniform int layerOffset;
 
 void main()
 {
-    WorldPos = aPos;
-    gl_Position =  projection * view * vec4(WorldPos, 1.0);
+    for(int i = 0; i < 3; ++i)
+    {
+        WorldPos = cubePos[i];
+        gl_Layer = layerOffset + gl_InvocationID;
+        gl_Position = projection * captureViews[gl_InvocationID] * vec4(cubePos[i], 1.0);
+        EmitVertex();
+    }
+    EndPrimitive();
 }
 
 
@@ -27,6 +52,12 @@ in vec3 WorldPos;
 
 uniform samplerCube environmentMap;
 uniform float roughness;
+// Face size of mip 0 of the source and of the mip being written
+uniform float sourceResolution;
+uniform float targetResolution;
+uniform uint sampleCount;
+// Off reads mip 0 for every sample, the bake as it was before the source had mips
+uniform bool filteredSampling;
 
 const float PI = 3.14159265359;
 // ----------------------------------------------------------------------------
@@ -92,14 +123,22 @@ void main()
     vec3 R = N;
     vec3 V = R;
 
-    const uint SAMPLE_COUNT = 1024u;
+    // A mirror only needs the source averaged down to the texel size of the target
+    float saTexel  = 4.0 * PI / (6.0 * sourceResolution * sourceResolution);
+    if(roughness == 0.0)
+    {
+        float lod = filteredSampling ? max(log2(sourceResolution / targetResolution), 0.0) : 0.0;
+        FragColor = vec4(textureLod(environmentMap, N, lod).rgb, 1.0);
+        return;
+    }
+
     vec3 prefilteredColor = vec3(0.0);
     float totalWeight = 0.0;
     
-    for(uint i = 0u; i < SAMPLE_COUNT; ++i)
+    for(uint i = 0u; i < sampleCount; ++i)
     {
         // generates a sample vector that's biased towards the preferred alignment direction (importance sampling).
-        vec2 Xi = Hammersley(i, SAMPLE_COUNT);
+        vec2 Xi = Hammersley(i, sampleCount);
         vec3 H = ImportanceSampleGGX(Xi, N, roughness);
         vec3 L  = normalize(2.0 * dot(V, H) * H - V);
 
@@ -112,11 +151,11 @@ void main()
             float HdotV = max(dot(H, V), 0.0);
             float pdf = D * NdotH / (4.0 * HdotV) + 0.0001; 
 
-            float resolution = 512.0; // resolution of source cubemap (per face)
-            float saTexel  = 4.0 * PI / (6.0 * resolution * resolution);
-            float saSample = 1.0 / (float(SAMPLE_COUNT) * pdf + 0.0001);
+            // Each sample stands for the solid angle its pdf gives it, the mip whose texels cover about
+            // that much averages the source in between. One level of bias hides the few samples left
+            float saSample = 1.0 / (float(sampleCount) * pdf + 0.0001);
 
-            float mipLevel = roughness == 0.0 ? 0.0 : 0.5 * log2(saSample / saTexel); 
+            float mipLevel = filteredSampling ? max(0.5 * log2(saSample / saTexel) + 1.0, 0.0) : 0.0;
             
             prefilteredColor += textureLod(environmentMap, L, mipLevel).rgb * NdotL;
             totalWeight      += NdotL;
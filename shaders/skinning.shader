@@ -0,0 +1,58 @@
+#Compute Shader
+
+#version 460 core
+
+layout (local_size_x = 64) in;
+
+// Rest pose of one mesh in the Vertex layout: position, normal, tex coords, tangent, bitangent
+layout (std430, binding = 1) readonly buffer RestVertices{
+    float restVertices[];
+};
+// SkinInfluence: the 4 bone ids in one word, the 4 unorm16 weights in the next two
+layout (std430, binding = 2) readonly buffer Influences{
+    uint influences[];
+};
+// Transient buffer shared by every skinned mesh of the frame, same layout as the rest pose
+layout (std430, binding = 3) writeonly buffer SkinnedVertices{
+    float skinnedVertices[];
+};
+
+uniform uint vertexCount;
+uniform uint outputOffset;
+
+const uint VERTEX_FLOATS = 14u;
+
+#include "include/skinning.glsl"
+
+vec3 readVec3(uint index){
+    return vec3(restVertices[index], restVertices[index + 1u], restVertices[index + 2u]);
+}
+
+void writeVec3(uint index, vec3 value){
+    skinnedVertices[index] = value.x;
+    skinnedVertices[index + 1u] = value.y;
+    skinnedVertices[index + 2u] = value.z;
+}
+
+void main(){
+    uint vertex = gl_GlobalInvocationID.x;
+    if (vertex >= vertexCount)
+        return;
+
+    uint ids = influences[vertex * 3u];
+    uvec4 boneIds = uvec4(ids & 0xFFu, (ids >> 8u) & 0xFFu, (ids >> 16u) & 0xFFu, ids >> 24u);
+    vec4 boneWeights = vec4(unpackUnorm2x16(influences[vertex * 3u + 1u]), unpackUnorm2x16(influences[vertex * 3u + 2u]));
+
+    mat4 skin = skinMatrix(boneIds, boneWeights);
+    mat3 linear = mat3(skin);
+
+    uint source = vertex * VERTEX_FLOATS;
+    uint destination = (outputOffset + vertex) * VERTEX_FLOATS;
+
+    writeVec3(destination, vec3(skin * vec4(readVec3(source), 1.0)));
+    writeVec3(destination + 3u, linear * readVec3(source + 3u));
+    skinnedVertices[destination + 6u] = restVertices[source + 6u];
+    skinnedVertices[destination + 7u] = restVertices[source + 7u];
+    writeVec3(destination + 8u, linear * readVec3(source + 8u));
+    writeVec3(destination + 11u, linear * readVec3(source + 11u));
+}
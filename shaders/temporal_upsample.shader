@@ -0,0 +1,110 @@
+#Vertex Shader
+
+#version 460 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec2 aTexCord;
+
+out vec2 TexCord;
+
+void main(){
+    TexCord = aTexCord;
+    gl_Position = vec4(aPos.xy, 0.0, 1.0);
+}
+
+#Fragment Shader
+
+#version 460 core
+
+out vec4 FragColor;
+
+// Output texture coordinates, the history is display sized
+in vec2 TexCord;
+
+// Jittered frame, only the renderScale part of the textures was rendered
+uniform sampler2D sceneColor;
+uniform sampler2D sceneVelocity;
+uniform sampler2D history;
+
+uniform vec2 renderScale;
+// Offset the frame was rendered with, in render pixels
+uniform vec2 jitter;
+uniform bool historyValid;
+// Weight of a sample that lands exactly on the output pixel, the rest comes from the history
+uniform float feedback;
+
+// Tonemapped weights keep single bright samples from dominating the average
+float luminanceWeight(vec3 color)
+{
+    return 1.0 / (1.0 + dot(color, vec3(0.2126, 0.7152, 0.0722)));
+}
+
+void main()
+{
+    vec2 inputSize = vec2(textureSize(sceneColor, 0));
+    vec2 renderSize = inputSize * renderScale;
+
+    // Unjittered position of the output pixel in render pixels, and the render pixel whose sample is closest to it
+    vec2 position = TexCord * renderSize;
+    ivec2 closest = ivec2(floor(position + jitter));
+
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    vec3 minimum = vec3(1.0e9);
+    vec3 maximum = vec3(-1.0e9);
+    vec3 moment1 = vec3(0.0);
+    vec3 moment2 = vec3(0.0);
+    float closestWeight = 0.0;
+
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            ivec2 pixel = clamp(closest + ivec2(x, y), ivec2(0), ivec2(renderSize) - 1);
+            vec3 color = texelFetch(sceneColor, pixel, 0).rgb;
+
+            // Where the jittered frame actually sampled the scene for this pixel
+            vec2 offset = vec2(pixel) + 0.5 - jitter - position;
+            // Blackman-Harris approximated by a Gaussian, one render pixel wide
+            float distanceWeight = exp(-2.29 * dot(offset, offset));
+            float weight = distanceWeight * luminanceWeight(color);
+
+            sum += color * weight;
+            weightSum += weight;
+            if (x == 0 && y == 0)
+                closestWeight = distanceWeight;
+
+            minimum = min(minimum, color);
+            maximum = max(maximum, color);
+            moment1 += color;
+            moment2 += color * color;
+        }
+    }
+    vec3 current = sum / max(weightSum, 1.0e-5);
+
+    vec2 velocity = texelFetch(sceneVelocity, clamp(closest, ivec2(0), ivec2(renderSize) - 1), 0).rg;
+    vec2 previousCord = TexCord - velocity;
+
+    if (!historyValid || any(lessThan(previousCord, vec2(0.0))) || any(greaterThan(previousCord, vec2(1.0))))
+    {
+        FragColor = vec4(current, 1.0);
+        return;
+    }
+
+    // Variance clipping inside the neighborhood box, a stale history is pulled towards what the frame sees now
+    vec3 mean = moment1 / 9.0;
+    vec3 deviation = sqrt(max(moment2 / 9.0 - mean * mean, vec3(0.0)));
+    vec3 low = max(minimum, mean - deviation * 1.25);
+    vec3 high = min(maximum, mean + deviation * 1.25);
+
+    vec3 previous = clamp(texture(history, previousCord).rgb, low, high);
+
+    // A render pixel covers several output pixels when upsampling, only the ones close to its sample take much of it
+    float alpha = clamp(feedback * closestWeight, 0.02, 1.0);
+
+    float currentWeight = alpha * luminanceWeight(current);
+    float previousWeight = (1.0 - alpha) * luminanceWeight(previous);
+    vec3 result = (current * currentWeight + previous * previousWeight) / (currentWeight + previousWeight);
+
+    FragColor = vec4(result, 1.0);
+}
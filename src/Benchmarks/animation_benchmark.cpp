@@ -0,0 +1,277 @@
+// Compares learnopengl's Animator, which walks the node tree and looks bones up by name every frame,
+// with the compiled AnimationClip that evaluates a flat node array.
+// Both play the same generated skeleton and their bone matrices are compared after every run.
+// The crowd runs play many instances of one clip through AnimationSystem on one thread and on the pool,
+// the compression runs report the size and error of a compressed smooth clip and how fast it decodes.
+
+#include <glad/glad.h>
+
+#include <learnopengl/animator.h>
+#include <AnimationClip.hpp>
+#include <AnimationSystem.hpp>
+
+#include <assimp/scene.h>
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+#include <memory>
+
+using Clock = std::chrono::high_resolution_clock;
+
+template<typename TFunction>
+double measure_ms(TFunction&& function, int iterations)
+{
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        function();
+    }
+    auto end = Clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+// Skeleton of node_count nodes where every fourth node is an unanimated helper,
+// the animated nodes are bones with key_count keys of each kind.
+// Smooth clips follow slow sine curves with a constant scale, like sampled motion capture
+std::unique_ptr<aiScene> create_scene(size_t node_count, unsigned int key_count, std::map<std::string, BoneInfo>& bone_info, int& bone_count, bool smooth = false)
+{
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> scale(0.9f, 1.1f);
+
+    const double duration = 100.0;
+
+    std::vector<aiNode*> nodes(node_count);
+    std::vector<std::vector<aiNode*>> children(node_count);
+    for (size_t i = 0; i < node_count; i++)
+    {
+        nodes[i] = new aiNode("node_" + std::to_string(i));
+        nodes[i]->mTransformation = aiMatrix4x4{ aiVector3D{ 1.0f }, aiQuaternion{ offset(random), offset(random), offset(random) }, aiVector3D{ offset(random), offset(random), offset(random) } };
+
+        // Mostly chains with a branch every few nodes, like limbs and fingers
+        if (i > 0)
+        {
+            size_t parent = i - 1 - random() % std::min<size_t>(i, 3);
+            nodes[i]->mParent = nodes[parent];
+            children[parent].push_back(nodes[i]);
+        }
+    }
+    for (size_t i = 0; i < node_count; i++)
+    {
+        if (children[i].empty())
+            continue;
+
+        nodes[i]->mNumChildren = static_cast<unsigned int>(children[i].size());
+        nodes[i]->mChildren = new aiNode*[children[i].size()];
+        std::copy(children[i].begin(), children[i].end(), nodes[i]->mChildren);
+    }
+
+    std::vector<aiNodeAnim*> channels;
+    for (size_t i = 0; i < node_count; i++)
+    {
+        if (i % 4 == 3)
+            continue;
+
+        aiNodeAnim* channel = new aiNodeAnim();
+        channel->mNodeName = nodes[i]->mName;
+        channel->mNumPositionKeys = key_count;
+        channel->mNumRotationKeys = key_count;
+        channel->mNumScalingKeys = key_count;
+        channel->mPositionKeys = new aiVectorKey[key_count];
+        channel->mRotationKeys = new aiQuatKey[key_count];
+        channel->mScalingKeys = new aiVectorKey[key_count];
+
+        // Rotations drift a little from key to key like sampled motion, positions and scales jump around
+        aiQuaternion rotation{ aiVector3D{ offset(random), offset(random), offset(random) }.Normalize(), offset(random) * 3.0f };
+        const aiQuaternion base = rotation;
+        const aiVector3D axis = aiVector3D{ offset(random), offset(random), offset(random) }.Normalize();
+        const aiVector3D center{ offset(random), offset(random), offset(random) };
+        const float frequency = 0.05f + 0.1f * std::abs(offset(random));
+        for (unsigned int k = 0; k < key_count; k++)
+        {
+            double time = duration * k / (key_count - 1);
+            if (smooth)
+            {
+                const float phase = static_cast<float>(time) * frequency;
+                channel->mPositionKeys[k] = aiVectorKey{ time, center + aiVector3D{ std::sin(phase), std::cos(phase * 0.7f), 0.0f } * 0.3f };
+                rotation = base * aiQuaternion{ axis, std::sin(phase) * 0.8f };
+                channel->mRotationKeys[k] = aiQuatKey{ time, rotation };
+                channel->mScalingKeys[k] = aiVectorKey{ time, aiVector3D{ 1.0f } };
+                continue;
+            }
+
+            channel->mPositionKeys[k] = aiVectorKey{ time, aiVector3D{ offset(random), offset(random), offset(random) } };
+            rotation = rotation * aiQuaternion{ aiVector3D{ offset(random), offset(random), offset(random) }.Normalize(), offset(random) * 0.5f };
+            rotation.Normalize();
+            channel->mRotationKeys[k] = aiQuatKey{ time, rotation };
+            channel->mScalingKeys[k] = aiVectorKey{ time, aiVector3D{ scale(random) } };
+        }
+        channels.push_back(channel);
+
+        BoneInfo& bone = bone_info[channel->mNodeName.data];
+        bone.id = bone_count++;
+        bone.offset = glm::mat4{ 1.0f };
+        bone.offset[3] = glm::vec4{ offset(random), offset(random), offset(random), 1.0f };
+    }
+
+    aiAnimation* animation = new aiAnimation();
+    animation->mDuration = duration;
+    animation->mTicksPerSecond = 30.0;
+    animation->mNumChannels = static_cast<unsigned int>(channels.size());
+    animation->mChannels = new aiNodeAnim*[channels.size()];
+    std::copy(channels.begin(), channels.end(), animation->mChannels);
+
+    auto scene = std::make_unique<aiScene>();
+    scene->mRootNode = nodes[0];
+    scene->mNumAnimations = 1;
+    scene->mAnimations = new aiAnimation*[1]{ animation };
+    return scene;
+}
+
+void run(size_t node_count, unsigned int key_count, int iterations)
+{
+    std::map<std::string, BoneInfo> bone_info;
+    int bone_count = 0;
+    std::unique_ptr<aiScene> scene = create_scene(node_count, key_count, bone_info, bone_count);
+
+    Animation animation{ scene.get(), bone_info, bone_count };
+    Animator animator{ &animation };
+
+    PBR::AnimationClip clip{ scene.get(), bone_info, bone_count };
+    PBR::AnimationPlayer player{ clip };
+
+    // A frame time that does not divide the clip, so the time visits every segment
+    const float delta_time = 1.0f / 61.0f;
+
+    double animator_ms = measure_ms([&] { animator.UpdateAnimation(delta_time); }, iterations);
+    double clip_ms = measure_ms([&] { player.update(delta_time); }, iterations);
+
+    // Both advanced by the same steps, so they sit at the same time
+    std::vector<glm::mat4> expected = animator.GetFinalBoneMatrices();
+    const std::vector<glm::mat4>& actual = player.get_bone_matrices();
+
+    float max_error = 0.0f;
+    for (int bone = 0; bone < bone_count; bone++)
+    {
+        for (int column = 0; column < 4; column++)
+        {
+            for (int row = 0; row < 4; row++)
+            {
+                max_error = std::max(max_error, std::abs(expected[bone][column][row] - actual[bone][column][row]));
+            }
+        }
+    }
+
+    std::cout << std::setw(6) << node_count << " nodes, " << std::setw(3) << bone_count << " bones, " << std::setw(5) << key_count << " keys | "
+        << "Animator: " << std::setw(9) << std::fixed << std::setprecision(4) << animator_ms << " ms, "
+        << "AnimationClip: " << std::setw(9) << clip_ms << " ms, "
+        << "speedup: " << std::setw(6) << std::setprecision(1) << animator_ms / clip_ms << "x, "
+        << "max error: " << std::scientific << std::setprecision(2) << max_error << std::defaultfloat << '\n';
+}
+
+void run_crowd(size_t instance_count, int iterations)
+{
+    std::map<std::string, BoneInfo> bone_info;
+    int bone_count = 0;
+    std::unique_ptr<aiScene> scene = create_scene(128, 600, bone_info, bone_count);
+    PBR::AnimationClip clip{ scene.get(), bone_info, bone_count };
+
+    PBR::ThreadPool serial{ 0 };
+    PBR::ThreadPool pool;
+
+    std::mt19937 random(99);
+    std::uniform_real_distribution<float> start(0.0f, clip.get_duration());
+    std::uniform_real_distribution<float> speed(0.8f, 1.2f);
+
+    PBR::AnimationSystem serial_system;
+    PBR::AnimationSystem pool_system;
+    for (size_t i = 0; i < instance_count; i++)
+    {
+        float time = start(random);
+        float rate = speed(random);
+        serial_system.add_instance(clip, time, rate);
+        pool_system.add_instance(clip, time, rate);
+    }
+
+    const float delta_time = 1.0f / 61.0f;
+    double serial_ms = measure_ms([&] { serial_system.update(delta_time, serial); }, iterations);
+    double pool_ms = measure_ms([&] { pool_system.update(delta_time, pool); }, iterations);
+
+    bool match = serial_system.get_palettes() == pool_system.get_palettes();
+
+    std::cout << std::setw(6) << instance_count << " instances of " << bone_count << " bones | "
+        << "1 thread: " << std::setw(8) << std::fixed << std::setprecision(3) << serial_ms << " ms, "
+        << pool.get_thread_count() << " threads: " << std::setw(8) << pool_ms << " ms, "
+        << "speedup: " << std::setw(5) << std::setprecision(1) << serial_ms / pool_ms << "x, "
+        << "palettes " << (match ? "match" : "DIFFER") << std::defaultfloat << '\n';
+}
+
+void run_compression(unsigned int key_count, int iterations)
+{
+    std::map<std::string, BoneInfo> bone_info;
+    int bone_count = 0;
+    std::unique_ptr<aiScene> scene = create_scene(128, key_count, bone_info, bone_count, true);
+
+    Animation animation{ scene.get(), bone_info, bone_count };
+    Animator animator{ &animation };
+
+    PBR::AnimationClip clip{ scene.get(), bone_info, bone_count };
+    PBR::AnimationClip compressed{ scene.get(), bone_info, bone_count };
+    PBR::CompressionReport report = compressed.compress();
+
+    PBR::AnimationPlayer player{ clip };
+    PBR::AnimationPlayer compressed_player{ compressed };
+
+    const float delta_time = 1.0f / 61.0f;
+    double animator_ms = measure_ms([&] { animator.UpdateAnimation(delta_time); }, iterations);
+    double clip_ms = measure_ms([&] { player.update(delta_time); }, iterations);
+    double compressed_ms = measure_ms([&] { compressed_player.update(delta_time); }, iterations);
+
+    float max_error = 0.0f;
+    for (int bone = 0; bone < bone_count; bone++)
+    {
+        for (int column = 0; column < 4; column++)
+        {
+            for (int row = 0; row < 4; row++)
+            {
+                max_error = std::max(max_error, std::abs(player.get_bone_matrices()[bone][column][row] - compressed_player.get_bone_matrices()[bone][column][row]));
+            }
+        }
+    }
+
+    std::cout << std::setw(5) << key_count << " keys | "
+        << "keys kept: " << report.kept_keys << " / " << report.original_keys << ", "
+        << std::fixed << std::setprecision(1) << report.original_bytes / 1024.0 << " KiB -> " << report.compressed_bytes / 1024.0 << " KiB, "
+        << "ratio: " << std::setprecision(1) << report.get_ratio() << "x" << std::defaultfloat << '\n'
+        << "           | key error: position " << std::scientific << std::setprecision(2) << report.max_position_error
+        << ", rotation " << report.max_rotation_error << " rad, scale " << report.max_scale_error
+        << ", palette error vs uncompressed: " << max_error << std::defaultfloat << '\n'
+        << "           | Animator: " << std::fixed << std::setprecision(4) << animator_ms << " ms, "
+        << "AnimationClip: " << clip_ms << " ms, compressed: " << compressed_ms << " ms" << std::defaultfloat << '\n';
+}
+
+int main()
+{
+    // Animator has a fixed palette of 100 matrices, so the skeletons stay below 100 bones
+    run(32, 30, 2000);
+    run(64, 30, 1000);
+    run(128, 30, 500);
+    run(128, 600, 200);
+    // Long clips, where scanning the keys from the start dominated
+    run(128, 4000, 50);
+
+    std::cout << '\n';
+    run_crowd(100, 100);
+    run_crowd(500, 50);
+    run_crowd(2000, 10);
+
+    std::cout << '\n';
+    run_compression(300, 500);
+    run_compression(3000, 100);
+
+    return 0;
+}
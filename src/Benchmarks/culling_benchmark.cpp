@@ -0,0 +1,105 @@
+// Frustum culling of world space AABBs: virtual BoundingVolume path vs the scalar and SIMD batch kernels.
+
+#include <glad/glad.h>
+
+#include <learnopengl/entity.h>
+#include <FrustumCulling.hpp>
+
+#include <bit>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <vector>
+
+using Clock = std::chrono::high_resolution_clock;
+
+template<typename TFunction>
+double measure_ms(TFunction&& function, int iterations)
+{
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        function();
+    }
+    auto end = Clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+size_t count_visible(const std::vector<uint64_t>& visibility)
+{
+    size_t count = 0;
+    for (uint64_t word : visibility)
+    {
+        count += std::popcount(word);
+    }
+    return count;
+}
+
+void run(size_t box_count, int iterations)
+{
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> extent(0.1f, 2.0f);
+
+    std::vector<std::unique_ptr<BoundingVolume>> volumes;
+    volumes.reserve(box_count);
+
+    PBR::AABBStream stream;
+    stream.reserve(box_count);
+
+    for (size_t i = 0; i < box_count; i++)
+    {
+        glm::vec3 center{ position(random), position(random), position(random) };
+        glm::vec3 extents{ extent(random), extent(random), extent(random) };
+
+        volumes.push_back(std::make_unique<AABB>(center, extents.x, extents.y, extents.z));
+        stream.push_back(center, extents);
+    }
+
+    Camera camera(glm::vec3{ 0.0f, 0.0f, 0.0f });
+    Frustum frustum = createFrustumFromCamera(camera, 16.0f / 9.0f, glm::radians(45.0f), 0.1f, 100.0f);
+
+    std::vector<uint64_t> virtual_mask;
+    std::vector<uint64_t> scalar_mask;
+    std::vector<uint64_t> simd_mask;
+
+    double virtual_ms = measure_ms([&] {
+        virtual_mask.assign((box_count + 63) / 64, 0);
+        for (size_t i = 0; i < box_count; i++)
+        {
+            if (volumes[i]->isOnFrustum(frustum))
+                virtual_mask[i >> 6] |= uint64_t{ 1 } << (i & 63);
+        }
+    }, iterations);
+    double scalar_ms = measure_ms([&] { PBR::cull_aabbs_scalar(frustum, stream, scalar_mask); }, iterations);
+    double simd_ms = measure_ms([&] { PBR::cull_aabbs(frustum, stream, simd_mask); }, iterations);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < virtual_mask.size(); i++)
+    {
+        mismatches += std::popcount(virtual_mask[i] ^ simd_mask[i]);
+    }
+
+    std::cout << std::setw(8) << box_count
+        << std::setw(12) << count_visible(simd_mask)
+        << std::setw(14) << virtual_ms << std::setw(14) << scalar_ms << std::setw(14) << simd_ms
+        << std::setw(12) << mismatches << "\n";
+}
+
+int main()
+{
+    std::cout << "AABB frustum culling, " << PBR::simd::NAME << " (" << PBR::simd::WIDTH << " lanes), times in ms\n";
+    std::cout << std::setw(8) << "boxes" << std::setw(12) << "visible"
+        << std::setw(14) << "virtual" << std::setw(14) << "scalar" << std::setw(14) << "simd"
+        << std::setw(12) << "mismatches" << "\n";
+    std::cout << std::fixed << std::setprecision(4);
+
+    run(1000, 1000);
+    run(10000, 200);
+    run(100000, 50);
+    run(1000000, 10);
+
+    return 0;
+}
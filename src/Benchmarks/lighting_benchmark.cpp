@@ -0,0 +1,103 @@
+// Light assignment of the clustered forward path: the scalar reference that tests every cluster against
+// every light vs the SIMD kernel that only walks the depth slices each light overlaps.
+// Both assignments are compared, and the lights per cluster show how much shading work is left per pixel
+// compared to looping over every light.
+
+#include <glad/glad.h>
+
+#include <ClusteredLighting.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+using Clock = std::chrono::high_resolution_clock;
+
+template<typename TFunction>
+double measure_ms(TFunction&& function, int iterations)
+{
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        function();
+    }
+    auto end = Clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+// Small point and spot lights scattered in front of a camera at the origin looking down -Z
+std::vector<PBR::ClusterLight> create_lights(size_t light_count)
+{
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-40.0f, 40.0f);
+    std::uniform_real_distribution<float> depth(-100.0f, 0.0f);
+    std::uniform_real_distribution<float> color(0.2f, 1.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+
+    std::vector<PBR::ClusterLight> lights;
+    lights.reserve(light_count);
+    for (size_t i = 0; i < light_count; i++)
+    {
+        const glm::vec3 light_position{ position(random), position(random) * 0.5f, depth(random) };
+        const glm::vec3 light_color{ color(random), color(random), color(random) };
+        const glm::vec3 attenuation{ 1.0f, 0.7f, 1.8f };
+
+        if (i % 4 == 3)
+        {
+            PBR::SpotLight spot{ light_position, glm::vec3{ direction(random), -1.0f, direction(random) }, 0.91f, 0.82f, glm::vec3{ 0.0f }, light_color, light_color, attenuation };
+            lights.push_back(PBR::pack_light(spot));
+        }
+        else
+        {
+            PBR::PointLight point{ light_position, glm::vec3{ 0.0f }, light_color, light_color, attenuation };
+            lights.push_back(PBR::pack_light(point));
+        }
+    }
+    return lights;
+}
+
+void run(size_t light_count, int iterations)
+{
+    std::vector<PBR::ClusterLight> lights = create_lights(light_count);
+
+    const glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+    const glm::mat4 view{ 1.0f };
+
+    PBR::LightClusters scalar;
+    PBR::LightClusters clusters;
+    scalar.set_projection(projection, 0.1f, 100.0f);
+    clusters.set_projection(projection, 0.1f, 100.0f);
+
+    double scalar_ms = measure_ms([&] { scalar.assign_scalar(view, lights); }, iterations);
+    double simd_ms = measure_ms([&] { clusters.assign(view, lights); }, iterations);
+
+    bool match = scalar.get_ranges() == clusters.get_ranges() && scalar.get_indices() == clusters.get_indices();
+
+    const std::vector<uint32_t>& ranges = clusters.get_ranges();
+    uint32_t max_lights = 0;
+    for (uint32_t cluster = 0; cluster < PBR::LightClusters::CLUSTER_COUNT; cluster++)
+    {
+        max_lights = std::max(max_lights, ranges[cluster * 2 + 1]);
+    }
+    const double average_lights = static_cast<double>(clusters.get_indices().size()) / PBR::LightClusters::CLUSTER_COUNT;
+
+    std::cout << std::setw(5) << light_count << " lights | "
+        << "scalar: " << std::setw(8) << std::fixed << std::setprecision(3) << scalar_ms << " ms, "
+        << PBR::simd::NAME << ": " << std::setw(7) << simd_ms << " ms, "
+        << "speedup: " << std::setw(5) << std::setprecision(1) << scalar_ms / simd_ms << "x | "
+        << "lights per cluster: " << std::setw(6) << std::setprecision(2) << average_lights << " avg, " << std::setw(4) << max_lights << " max"
+        << " (vs " << light_count << " unclustered), "
+        << "assignment " << (match ? "matches" : "DIFFERS") << std::defaultfloat << '\n';
+}
+
+int main()
+{
+    for (size_t light_count = 4; light_count <= 4096; light_count *= 2)
+    {
+        run(light_count, light_count <= 256 ? 200 : 20);
+    }
+
+    return 0;
+}
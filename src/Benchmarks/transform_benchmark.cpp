@@ -0,0 +1,142 @@
+// Compares the pointer based Entity scene graph with the flat TransformHierarchy.
+// Both build the same 4-ary tree and run a full update and an update with ~1% of the nodes moved.
+
+#include <glad/glad.h>
+
+#include <learnopengl/entity.h>
+#include <TransformHierarchy.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+
+using Clock = std::chrono::high_resolution_clock;
+
+template<typename TFunction>
+double measure_ms(TFunction&& function, int iterations)
+{
+    auto start = Clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        function();
+    }
+    auto end = Clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+struct NodeState
+{
+    glm::vec3 position;
+    glm::vec3 rotation;
+    glm::vec3 scale;
+};
+
+void run(size_t node_count, int iterations)
+{
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> offset(-2.0f, 2.0f);
+    std::uniform_real_distribution<float> angle(-180.0f, 180.0f);
+    std::uniform_real_distribution<float> scale(0.5f, 1.5f);
+
+    std::vector<NodeState> states(node_count);
+    for (NodeState& state : states)
+    {
+        state = { { offset(random), offset(random), offset(random) }, { angle(random), angle(random), angle(random) }, glm::vec3{ scale(random) } };
+    }
+
+    // Entity graph, the parent of node i is (i - 1) / 4
+    Entity root;
+    std::vector<Entity*> entities(node_count);
+    entities[0] = &root;
+    for (size_t i = 1; i < node_count; i++)
+    {
+        entities[i] = &entities[(i - 1) / 4]->addChild();
+    }
+
+    PBR::TransformHierarchy hierarchy(node_count);
+    for (size_t i = 0; i < node_count; i++)
+    {
+        hierarchy.add_node(i == 0 ? PBR::TransformHierarchy::NO_PARENT : static_cast<uint32_t>((i - 1) / 4));
+    }
+
+    for (size_t i = 0; i < node_count; i++)
+    {
+        entities[i]->transform.setLocalPosition(states[i].position);
+        entities[i]->transform.setLocalRotation(states[i].rotation);
+        entities[i]->transform.setLocalScale(states[i].scale);
+
+        uint32_t node = static_cast<uint32_t>(i);
+        hierarchy.set_local_position(node, states[i].position);
+        hierarchy.set_local_euler(node, states[i].rotation);
+        hierarchy.set_local_scale(node, states[i].scale);
+    }
+
+    double entity_full = measure_ms([&] { root.forceUpdateSelfAndChild(); }, iterations);
+    double hierarchy_full = measure_ms([&] {
+        for (size_t i = 0; i < node_count; i++)
+        {
+            hierarchy.set_local_scale(static_cast<uint32_t>(i), states[i].scale);
+        }
+        hierarchy.update();
+    }, iterations);
+
+    float max_error = 0.0f;
+    for (size_t i = 0; i < node_count; i++)
+    {
+        const glm::mat4& a = entities[i]->transform.getModelMatrix();
+        const glm::mat4& b = hierarchy.get_world_matrix(static_cast<uint32_t>(i));
+        for (int column = 0; column < 4; column++)
+        {
+            for (int row = 0; row < 4; row++)
+            {
+                max_error = std::max(max_error, std::abs(a[column][row] - b[column][row]));
+            }
+        }
+    }
+
+    // Sparse updates, the same random subset is moved every iteration
+    std::vector<size_t> moved;
+    std::uniform_int_distribution<size_t> pick(0, node_count - 1);
+    for (size_t i = 0; i < std::max<size_t>(node_count / 100, 1); i++)
+    {
+        moved.push_back(pick(random));
+    }
+
+    double entity_sparse = measure_ms([&] {
+        for (size_t i : moved)
+        {
+            entities[i]->transform.setLocalPosition(states[i].position);
+        }
+        root.updateSelfAndChild();
+    }, iterations);
+    double hierarchy_sparse = measure_ms([&] {
+        for (size_t i : moved)
+        {
+            hierarchy.set_local_position(static_cast<uint32_t>(i), states[i].position);
+        }
+        hierarchy.update();
+    }, iterations);
+
+    std::cout << std::setw(8) << node_count
+        << std::setw(14) << entity_full << std::setw(14) << hierarchy_full
+        << std::setw(14) << entity_sparse << std::setw(14) << hierarchy_sparse
+        << std::setw(14) << max_error << "\n";
+}
+
+int main()
+{
+    std::cout << "Transform update, " << PBR::simd::NAME << " (" << PBR::simd::WIDTH << " lanes), times in ms\n";
+    std::cout << std::setw(8) << "nodes"
+        << std::setw(14) << "entity full" << std::setw(14) << "soa full"
+        << std::setw(14) << "entity 1%" << std::setw(14) << "soa 1%"
+        << std::setw(14) << "max error" << "\n";
+    std::cout << std::fixed << std::setprecision(4);
+
+    run(1000, 200);
+    run(10000, 50);
+    run(100000, 10);
+
+    return 0;
+}
@@ -1,24 +1,44 @@
 #include "common.hpp"
 
 #include <map>
+#include <memory>
+#include <chrono>
+#include <limits>
 #include "Model.hpp"
+#include <learnopengl/entity.h>
+#include "FrustumCulling.hpp"
+#include "DynamicBVH.hpp"
+#include "OcclusionCulling.hpp"
+#include "ThreadPool.hpp"
+#include "GpuTimer.hpp"
+#include "RenderQueue.hpp"
+#include "AnimationSystem.hpp"
+#include "SkinningPass.hpp"
+#include "VertexAnimationTexture.hpp"
+#include "ClusteredLighting.hpp"
+#include "GBuffer.hpp"
+#include "CascadedShadowMap.hpp"
+#include "HdrTarget.hpp"
+#include "DynamicResolution.hpp"
+#include "TemporalUpsampler.hpp"
+#include "EnvironmentLibrary.hpp"
+#include "ReflectionProbes.hpp"
 
 #include <future>
-
-static glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
-static glm::mat4 captureViews[] =
-{
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)),
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f))
-};
+#include <random>
 
 struct Sphere{
     unsigned int VAO;
     unsigned int indexCount;
+    unsigned int depthVAO; // Position only stream for depth passes
+};
+
+// Opaque surfaces are drawn without blending, masked ones discard below the alpha cutoff and
+// blended ones are drawn back to front after the sky box
+enum class BlendMode{
+    Opaque,
+    Masked,
+    Blended,
 };
 
 struct MaterialContext{
@@ -27,6 +47,9 @@ struct MaterialContext{
     unsigned int metallic_map;
     unsigned int normal_map;
     unsigned int roughness_map;
+    BlendMode blend_mode = BlendMode::Opaque;
+    float opacity = 1.0f;
+    float alpha_cutoff = 0.5f;
 };
 
 struct DrawSphereContext{
@@ -47,12 +70,128 @@ struct DrawModelContext{
     unsigned int albedo_map;
     unsigned int arm_map;
     unsigned int normal_map;
+    BlendMode blend_mode = BlendMode::Opaque;
+    float opacity = 1.0f;
+    float alpha_cutoff = 0.5f;
+};
+
+// Shader variants of one material model, compiled from the same file with different defines
+struct MaterialShaders{
+    const PBR::Shader* opaque;
+    const PBR::Shader* masked;
+    const PBR::Shader* blended;
+
+    // SKINNED variants, null for materials that are never skinned
+    const PBR::Shader* skinned_opaque = nullptr;
+    const PBR::Shader* skinned_masked = nullptr;
+    const PBR::Shader* skinned_blended = nullptr;
+
+    const PBR::Shader& get(BlendMode mode, bool skinned = false) const
+    {
+        if (skinned && skinned_opaque)
+        {
+            switch (mode)
+            {
+            case BlendMode::Masked:
+                return *skinned_masked;
+            case BlendMode::Blended:
+                return *skinned_blended;
+            default:
+                return *skinned_opaque;
+            }
+        }
+
+        switch (mode)
+        {
+        case BlendMode::Masked:
+            return *masked;
+        case BlendMode::Blended:
+            return *blended;
+        default:
+            return *opaque;
+        }
+    }
+};
+
+// Instanced copies of one animated model played back from a baked vertex animation texture,
+// nothing about them is updated on the CPU after they are created
+struct Crowd{
+    DrawModelContext material;
+    PBR::VertexAnimationTexture animation;
+    unsigned int instance_buffer;
+    uint32_t instance_count;
+};
+
+// Entity hierarchy of a scene, entities index into the context table matching their kind:
+// entities with a Model use model_contexts, the others are spheres and use sphere_contexts
+struct SceneGraph{
+    Entity root;
+    std::vector<DrawModelContext> model_contexts;
+    std::vector<DrawSphereContext> sphere_contexts;
+
+    // Culling buffers, reused across frames
+    std::vector<const Entity*> drawables;
+    PBR::AABBStream world_bounds;
+    std::vector<uint64_t> visibility;
+
+    // One proxy per drawable, the user data of a proxy is the drawable index
+    PBR::DynamicBVH bvh;
+    std::vector<int> proxies;
+
+    const Entity* selected = nullptr;
+
+    // Lay down depth first so the color pass shades each pixel once
+    bool depth_prepass = false;
+
+    // Entities that are rasterized into the software depth buffer before the occlusion test
+    struct Occluder{
+        const Entity* entity;
+        const PBR::OccluderMesh* mesh;
+    };
+    std::vector<Occluder> occluders;
+
+    // Palettes of the animated entities, uploaded once per frame before the scene is drawn
+    PBR::AnimationSystem animations;
+
+    // First slot of the compute skinned meshes of every animation instance this frame, -1 when it is skinned in the vertex shader
+    std::vector<int> skinned_slots;
+
+    // Point and spot lights shaded through the light clusters, on top of the directional lights
+    std::vector<PBR::ClusterLight> lights;
+
+    // Model matrices of the drawables this frame and the last one, for the motion vectors
+    std::vector<glm::mat4> current_models;
+    std::vector<glm::mat4> previous_models;
+
+    // Local reflections, baked from the static drawables when the scene is shown
+    std::vector<PBR::ReflectionProbe> probes;
+
+    bool is_skinned(const Entity& entity) const
+    {
+        return entity.animationInstance >= 0 && entity.pModel && entity.pModel->is_skinned();
+    }
+
+    int get_skinned_slot(const Entity& entity) const
+    {
+        return is_skinned(entity) && entity.animationInstance < static_cast<int>(skinned_slots.size()) ? skinned_slots[entity.animationInstance] : -1;
+    }
+
+    BlendMode get_blend_mode(const Entity& entity) const
+    {
+        return entity.pModel ? model_contexts[entity.materialIndex].blend_mode : sphere_contexts[entity.materialIndex].material.blend_mode;
+    }
+};
+
+struct CullingSettings{
+    bool use_bvh = true;
+    bool occlusion = true;
 };
 
-struct EnvironmentContext{
-    unsigned int cube_map;
-    unsigned int irradiance_map;
-    unsigned int prefilter_map;
+// Forward shades every opaque fragment as it is drawn. Deferred writes the surfaces into the G-buffer
+// and shades each pixel once in a fullscreen pass, blended surfaces stay forward in both
+enum class RenderPath{
+    Forward,
+    Deferred,
 };
 
 
@@ -63,6 +202,18 @@ static unsigned int createQuad();
 
 static unsigned int hdr_texture_from_file(std::string_view path);
 
+// Shader storage binding of the bone palettes, fixed in the skinning shaders
+constexpr unsigned int BONE_PALETTE_BINDING = 0;
+// Shader storage binding of the crowd instances, fixed in the VERTEX_ANIMATION variant of pbr_model.shader
+constexpr unsigned int CROWD_INSTANCE_BINDING = 4;
+constexpr uint32_t CROWD_SIZE = 100;
+// Shader storage bindings of the clustered lights, fixed in pbr.shader and pbr_model.shader
+constexpr unsigned int CLUSTER_LIGHT_BINDING = 5;
+constexpr unsigned int CLUSTER_RANGE_BINDING = 6;
+constexpr unsigned int CLUSTER_INDEX_BINDING = 7;
+// Texture unit of the reflection probe array, after the environment the current one fades in from
+constexpr unsigned int REFLECTION_PROBE_UNIT = 18;
+
 constexpr unsigned int SCR_WIDTH = 1280;
 constexpr unsigned int SCR_HEIGHT = 720;
 constexpr const char* WINDOW_NAME = "PBR Renderer";
@@ -78,6 +229,7 @@ public:
     Camera camera;
     bool first_mouse{ true };
     bool mouse_captured{ true };
+    bool mouse_pressed{ false };
     float lastY{ SCR_WIDTH / 2.0f };
     float lastX{ SCR_HEIGHT / 2.0f };
 
@@ -93,8 +245,83 @@ private:
     std::map<std::string, unsigned int> textures;
     std::map<std::string, unsigned int> VAO;
     std::map<std::string, PBR::Shader> shaders;
+    std::map<std::string, std::unique_ptr<Model>> models;
+    std::map<std::string, std::unique_ptr<SceneGraph>> scenes;
+    std::map<std::string, PBR::OccluderMesh> occluders;
+    // Compiled first animation of every skinned model that has one, by model name
+    std::map<std::string, std::unique_ptr<PBR::AnimationClip>> clips;
+    std::unique_ptr<Crowd> crowd;
     std::vector<unsigned int> buffers;
 
+    // Visible drawables of the current scene by blend mode, filled by the culling pass and reused every frame
+    PBR::RenderQueue opaque_queue;
+    PBR::RenderQueue masked_queue;
+    PBR::RenderQueue transparent_queue;
+
+    PBR::ThreadPool thread_pool;
+    PBR::OcclusionCuller occlusion_culler;
+
+    PBR::GpuTimer scene_timer;
+    PBR::GpuTimer skinning_timer;
+
+    // Skinning with dual quaternions instead of blended matrices, both read the same palette buffer
+    bool dual_quaternion_skinning{ false };
+    // Skin the visible characters once in a compute pass, every pass after it draws them as static meshes
+    bool compute_skinning{ false };
+    PBR::SkinningPass skinning_pass;
+
+    PBR::LightClusters light_clusters;
+    int clustered_light_count{ 64 };
+
+    RenderPath render_path{ RenderPath::Forward };
+    PBR::GBuffer gbuffer;
+    PBR::GpuTimer lighting_timer;
+
+    // Everything is lit into the HDR target, one pass tonemaps it into the window
+    PBR::HdrTarget hdr_target{ GL_R11F_G11F_B10F, true };
+    float exposure{ 1.0f };
+    // 0: Reinhard, 1: ACES fit, the order of the shader
+    int tonemapper{ 0 };
+
+    // Of the window, the render target may be smaller
+    float aspect_ratio{ static_cast<float>(SCR_WIDTH) / static_cast<float>(SCR_HEIGHT) };
+
+    // The scene is rendered into the lower left corner of the HDR target and upscaled by the resolve
+    bool dynamic_resolution{ false };
+    float render_scale{ 1.0f };
+    // 0: bilinear, 1: Catmull-Rom, the order of the shader
+    int upscale_filter{ 1 };
+    PBR::ResolutionController resolution_controller;
+    // Everything the scale affects, from the first scene pass to the resolve
+    PBR::GpuSpanTimer frame_timer;
+
+    // Jittered frames accumulated into a display sized history, replaces the upscale filter when on
+    bool temporal_upsampling{ false };
+    PBR::TemporalUpsampler temporal_upsampler;
+    PBR::GpuTimer temporal_timer;
+    // Unjittered, of the last frame
+    glm::mat4 previous_view_projection{ 1.0f };
+    glm::mat4 previous_sky_view_projection{ 1.0f };
+
+    // Image based lighting, baked in slices the first time an environment is selected
+    PBR::EnvironmentLibrary environments;
+
+    // Probes of the scene shown, cached under cache/probes
+    PBR::ReflectionProbes reflection_probes;
+    const SceneGraph* probe_scene{ nullptr };
+
+    // Shadows of the directional light that points down the most
+    PBR::CascadedShadowMap shadow_map;
+    bool shadows{ true };
+    float shadow_distance{ 50.0f };
+    int shadow_light{ 0 };
+    // Bounds of the static casters the caches were rendered with, two vectors per caster
+    std::vector<glm::vec3> shadow_static_bounds;
+    const SceneGraph* shadow_scene{ nullptr };
+    std::vector<uint64_t> shadow_visibility;
+    std::vector<const Entity*> shadow_static_casters;
+    std::vector<const Entity*> shadow_dynamic_casters;
+
 
     float deltaTime{ 0.0f };
     float lastFrame{ 0.0f };
@@ -119,9 +346,7 @@ private:
     MaterialContext _get_material_context(const std::string& material_name);
 
     void _process_input();
-    unsigned int _generate_cubemap(std::string_view name, unsigned int texture);
-    void _generate_irradiance_map(std::string_view name, unsigned int texture);
-    void _generate_prefilter_map(std::string_view name, unsigned int texture);
+    PBR::EnvironmentBakeShaders _environment_bake_shaders();
     void _generate_brdfLUT_texture(std::string_view name);
     unsigned int _load_brdfLUT_texture(std::string_view path);
 
@@ -132,16 +357,51 @@ private:
     void _get_face();
     void _print_textures();
 
-    void _draw_sphere(const DrawSphereContext& context, const PBR::Shader& shader, const glm::mat4& model = glm::mat4{ 1.0f } );
+    // previous_model is the model matrix of the last frame for the motion vectors, null when it did not move
+    void _draw_sphere(const DrawSphereContext& context, const PBR::Shader& shader, const glm::mat4& model = glm::mat4{ 1.0f }, const glm::mat4* previous_model = nullptr);
     void _draw_cube(const DrawCubeContext& context, const PBR::Shader& shader, const glm::mat4& model = glm::mat4{ 1.0f } );
     void _draw_quad(unsigned int quadVAO, const MaterialContext& context, const PBR::Shader& shader, const glm::mat4& model = glm::mat4{ 1.0f } );
     void _draw_model(const DrawModelContext& context, const PBR::Shader& shader, const glm::mat4& model = glm::mat4{ 1.0f } );
+    void _draw_model(const DrawModelContext& context, const PBR::Shader& shader, const glm::mat4& model, const Frustum& frustum, CullingStats& stats, const glm::mat4* previous_model = nullptr);
+    void _set_model_material(const DrawModelContext& context, const PBR::Shader& shader, const glm::mat4& model, const glm::mat4* previous_model = nullptr);
+    CullingStats _draw_scene(SceneGraph& scene, const Frustum& frustum, const glm::mat4& view_projection, const CullingSettings& settings, const MaterialShaders& model_shaders, const MaterialShaders& sphere_shaders);
+    void _draw_entity(const SceneGraph& scene, size_t drawable, const MaterialShaders& model_shaders, const MaterialShaders& sphere_shaders, const Frustum& frustum, CullingStats& stats);
+    void _draw_transparent(const SceneGraph& scene, const Frustum& frustum, const MaterialShaders& model_shaders, const MaterialShaders& sphere_shaders, CullingStats& stats);
+    void _skin_visible(SceneGraph& scene);
+    void _draw_shadows(const SceneGraph& scene);
+    // Position only draw of an entity, skinned ones use the skinned shader unless the skinning pass already ran
+    // With a frustum the meshes of multi mesh models are culled like _draw_model does, the color pass must match the prepass
+    // Alpha tested entities need the ALPHA_MASKED depth shaders
+    void _draw_depth(const SceneGraph& scene, const Entity& entity, const PBR::Shader& static_shader, const PBR::Shader& skinned_shader, const Frustum* frustum = nullptr, bool alpha_tested = false);
+    // Per mesh test of multi mesh models, the entity test already covered single mesh models. Bind pose bounds, also when skinned
+    static bool _is_mesh_visible(const std::vector<Mesh>& meshes, size_t mesh, const glm::mat4& model, const Frustum& frustum);
+    void _draw_outline(const SceneGraph& scene, const Entity& entity, const PBR::Shader& shader);
+    void _set_skinning(const SceneGraph& scene, const Entity& entity, const PBR::Shader& shader);
+    const Entity* _pick_entity(const SceneGraph& scene, const PBR::Ray& ray);
+    PBR::Ray _cursor_ray();
     void _draw_scene(const std::vector<DrawModelContext>& contexts, const PBR::Shader& shader, const std::vector<glm::mat4> models); 
     void _draw_scene(const std::vector<DrawSphereContext>& contexts, const PBR::Shader& shader, const std::vector<glm::mat4> models); 
     void _draw_spheres(const Sphere& sphere, const PBR::Shader& shader);
+    void _create_crowd(Model& model);
+    void _draw_crowd(const Crowd& crowd, const PBR::Shader& shader, float time);
+
+    // Replaces the clustered lights of the scene with count random point and spot lights
+    void _scatter_lights(SceneGraph& scene, int count);
 
+    // Fullscreen lighting pass of the deferred path into the default framebuffer, which also gets the G-buffer depth
+    void _shade_gbuffer(unsigned int quadVAO, const PBR::Shader& shader, const glm::mat4& view_projection, const glm::vec2& render_size);
+    // Upscale, exposure, tonemapping and sRGB encoding of a window sized HDR texture into the default framebuffer,
+    // render_scale is the part of it that was rendered
+    void _resolve_hdr(unsigned int quadVAO, const PBR::Shader& shader, unsigned int color, const glm::vec2& render_scale);
 
-    void _set_environment(const EnvironmentContext& context, const PBR::Shader& shader);
+
+    // Samplers of the current environment on units 5 to 7, of the one it fades in from on 15 to 17
+    void _set_environment(const PBR::Shader& shader);
+    void _bind_environment();
+    // The reflection probes nearest to position for the next draw with the shader
+    void _set_probes(const PBR::Shader& shader, const glm::vec3& position);
+    // Static, not blended drawables into a reflection probe, the shaders already have the capture camera
+    void _draw_probe_capture(const SceneGraph& scene, const MaterialShaders& model_shaders, const MaterialShaders& sphere_shaders);
 
 };
 
@@ -207,6 +467,24 @@ inline void PbrRenderer::run()
     PBR::Shader pbr_model_shader = shaders["pbr_model_shader"];
     PBR::Shader pbr_shader = shaders["pbr_shader"];
     PBR::Shader sphere_shader = shaders["sphere_shader"];
+    PBR::Shader outline_shader = shaders["outline_shader"];
+    PBR::Shader depth_prepass_shader = shaders["depth_prepass_shader"];
+
+    const MaterialShaders model_shaders{
+        &shaders["pbr_model_shader"], &shaders["pbr_model_masked_shader"], &shaders["pbr_model_blended_shader"],
+        &shaders["pbr_model_skinned_shader"], &shaders["pbr_model_skinned_masked_shader"], &shaders["pbr_model_skinned_blended_shader"]
+    };
+    const MaterialShaders sphere_shaders{ &shaders["pbr_shader"], &shaders["pbr_masked_shader"], &shaders["pbr_blended_shader"] };
+
+    // Blended surfaces are never written to the G-buffer, their slots keep the forward programs
+    const MaterialShaders gbuffer_model_shaders{
+        &shaders["pbr_model_gbuffer_shader"], &shaders["pbr_model_gbuffer_masked_shader"], &shaders["pbr_model_blended_shader"],
+        &shaders["pbr_model_skinned_gbuffer_shader"], &shaders["pbr_model_skinned_gbuffer_masked_shader"], &shaders["pbr_model_skinned_blended_shader"]
+    };
+    const MaterialShaders gbuffer_sphere_shaders{ &shaders["pbr_gbuffer_shader"], &shaders["pbr_gbuffer_masked_shader"], &shaders["pbr_blended_shader"] };
+    const PBR::Shader& deferred_lighting_shader = shaders["deferred_lighting_shader"];
+    const PBR::Shader& post_process_shader = shaders["post_process_shader"];
+    const PBR::Shader& temporal_upsample_shader = shaders["temporal_upsample_shader"];
 
     Sphere sphere = createSphere();
     buffers.emplace_back(sphere.VAO);
@@ -239,9 +517,7 @@ inline void PbrRenderer::run()
     }
     
 
-    unsigned int hdr_cube_map = textures["hdr_cube_map"];
-    unsigned int irradiance_map = textures["irradiance_map"];
-    unsigned int prefilter_map = textures["prefilter_map"];
+    const PBR::EnvironmentBakeShaders environment_bake = _environment_bake_shaders();
 
 
     unsigned int gnome_albedo_map = textures["gnome/albedo_map"];
@@ -265,34 +541,173 @@ inline void PbrRenderer::run()
     unsigned int boulder_normal_map = textures["boulder/normal_map"];
 
 
-    Model rat{ "resources/objects/rat/rat.fbx", false};
+    models.insert({"rat", std::make_unique<Model>("resources/objects/rat/rat.fbx", false)});
     glfwPollEvents();
-    Model chair{ "resources/objects/chair/chair.fbx", false};
+    models.insert({"chair", std::make_unique<Model>("resources/objects/chair/chair.fbx", false, GeometryRetention::Positions)});
     glfwPollEvents();
-    Model bust{ "resources/objects/marble_bust/marble_bust.fbx", false };
+    models.insert({"marble_bust", std::make_unique<Model>("resources/objects/marble_bust/marble_bust.fbx", false, GeometryRetention::Positions)});
     glfwPollEvents();
-    Model boulder{ "resources/objects/boulder/boulder.fbx", false };
+    models.insert({"boulder", std::make_unique<Model>("resources/objects/boulder/boulder.fbx", false, GeometryRetention::Positions)});
     glfwPollEvents();
-    Model gnome{ "resources/objects/gnome/gnome.fbx", false };
+    models.insert({"gnome", std::make_unique<Model>("resources/objects/gnome/gnome.fbx", false)});
     glfwPollEvents();
 
+    Model& rat = *models["rat"];
+    Model& chair = *models["chair"];
+    Model& bust = *models["marble_bust"];
+    Model& boulder = *models["boulder"];
+    Model& gnome = *models["gnome"];
+
+    for (const auto& [name, loaded_model] : models)
+    {
+        if (!loaded_model->is_skinned() || loaded_model->get_animation_count() == 0)
+            continue;
+
+        // The clip appends the animated nodes that are not bones of the mesh, the model keeps its own map
+        std::map<std::string, BoneInfo> bone_info = loaded_model->get_bone_info();
+        int bone_count = loaded_model->get_bone_count();
+        clips.insert({name, std::make_unique<PBR::AnimationClip>(loaded_model->get_path(), bone_info, bone_count)});
+    }
+
+    // Background crowd of the first animated model, baked once instead of animated every frame
+    if (!clips.empty())
+        _create_crowd(*models[clips.begin()->first]);
+
+    // Skinned entities play the clip of their model, the bounds stay the bind pose ones
+    auto animate = [&](SceneGraph& graph, Entity& entity) {
+        auto clip = clips.find(entity.pModel->get_name());
+        if (clip != clips.end())
+            entity.animationInstance = static_cast<int>(graph.animations.add_instance(*clip->second));
+    };
+
+    // The large props keep their positions so they can be simplified into occluders
+    occluders.insert({"chair", PBR::simplify_occluder(chair)});
+    occluders.insert({"marble_bust", PBR::simplify_occluder(bust)});
+    occluders.insert({"boulder", PBR::simplify_occluder(boulder)});
+
+    const char* items[] ={
+        "Sphere",
+        "Spheres",
+        "Model",
+        "Textured Spheres",
+        "Scene",
+        "Nothing",
+        "Crowd",
+    };
+
+    // ---------- Scene Graphs ----------
+    // The -90 degree X rotation and the uniform scales used to be baked in the model matrices
+    // every frame, now they live in the transforms and only dirty entities get recomputed
+    auto model_scene = std::make_unique<SceneGraph>();
+    model_scene->model_contexts.push_back({gnome, gnome_albedo_map, gnome_arm_map, gnome_normal_map});
+    model_scene->root.transform.setLocalRotation({ -90.0f, 0.0f, 0.0f });
+    model_scene->root.transform.setLocalScale(glm::vec3{ 5.0f });
+    animate(*model_scene, model_scene->root.addChild(gnome, 0));
+
+    // Unit sphere, the sphere mesh has a radius of one
+    const AABB sphere_bounds{ glm::vec3{ -1.0f }, glm::vec3{ 1.0f } };
+    const float sphere_offsets[] = { 0.0f, 3.0f, 6.0f, -3.0f, -6.0f, 9.0f, -9.0f, -12.0f };
+
+    auto textured_spheres_scene = std::make_unique<SceneGraph>();
+    for (int i = 0; i < static_cast<int>(contexts.size()); i++)
+    {
+        textured_spheres_scene->sphere_contexts.push_back({sphere, contexts[i]});
+        Entity& sphere_entity = textured_spheres_scene->root.addChild(sphere_bounds, i);
+        sphere_entity.transform.setLocalPosition({ sphere_offsets[i], 0.0f, 0.0f });
+    }
+    // The spheres reflect their neighbours
+    textured_spheres_scene->probes.push_back({ { 0.0f, 0.0f, 2.0f }, { -14.0f, -4.0f, -4.0f }, { 11.0f, 4.0f, 4.0f } });
+
+    auto object_scene = std::make_unique<SceneGraph>();
+    object_scene->model_contexts.push_back({rat, rat_albedo_map, rat_arm_map, rat_normal_map});
+    object_scene->model_contexts.push_back({chair, chair_albedo_map, chair_arm_map, chair_normal_map});
+    object_scene->model_contexts.push_back({boulder, boulder_albedo_map, boulder_arm_map, boulder_normal_map});
+    object_scene->model_contexts.push_back({bust, marble_bust_albedo_map, marble_bust_arm_map, marble_bust_normal_map});
+    object_scene->root.transform.setLocalRotation({ -90.0f, 0.0f, 0.0f });
+
+    // Scaling after the translation is the same as translating by the scaled position
+    auto add_object = [&](Model& object, int context, float scale, const glm::vec3& position) -> Entity& {
+        Entity& entity = object_scene->root.addChild(object, context);
+        entity.transform.setLocalScale(glm::vec3{ scale });
+        entity.transform.setLocalPosition(position * scale);
+        return entity;
+    };
+
+    Entity& rat_entity = add_object(rat, 0, 5.0f, rat_position);
+    animate(*object_scene, rat_entity);
+    Entity& chair_entity = add_object(chair, 1, 5.0f, chair_position);
+    Entity& boulder1_entity = add_object(boulder, 2, 3.0f, boulder1_position);
+    Entity& boulder2_entity = add_object(boulder, 2, 3.0f, boulder2_position);
+    Entity& bust_entity = add_object(bust, 3, 5.0f, bust_position);
+    _scatter_lights(*object_scene, clustered_light_count);
+
+    // One probe on each side of the chair, blended where the boxes overlap, the floor is the bottom of both boxes
+    object_scene->probes.push_back({ { -2.5f, 2.0f, 0.0f }, { -8.0f, -0.5f, -8.0f }, { 1.0f, 8.0f, 8.0f } });
+    object_scene->probes.push_back({ { 3.0f, 2.0f, 0.0f }, { -1.0f, -0.5f, -8.0f }, { 8.0f, 8.0f, 8.0f } });
+
+    scenes.insert({items[2], std::move(model_scene)});
+    scenes.insert({items[3], std::move(textured_spheres_scene)});
+    for (Entity* occluder : { &chair_entity, &boulder1_entity, &boulder2_entity, &bust_entity })
+    {
+        object_scene->occluders.push_back({occluder, &occluders[occluder->pModel->get_name()]});
+    }
+
+    scenes.insert({items[4], std::move(object_scene)});
 
 
-    _set_environment({hdr_cube_map, irradiance_map, prefilter_map}, pbr_shader);
-    _set_environment({hdr_cube_map, irradiance_map, prefilter_map}, pbr_model_shader);
-    _set_environment({hdr_cube_map, irradiance_map, prefilter_map}, sphere_shader);
+
+    for (const MaterialShaders* variants : { &model_shaders, &sphere_shaders })
+    {
+        for (BlendMode mode : { BlendMode::Opaque, BlendMode::Masked, BlendMode::Blended })
+        {
+            _set_environment(variants->get(mode));
+            _set_environment(variants->get(mode, true));
+        }
+    }
+    _set_environment(shaders["pbr_model_crowd_shader"]);
+    _set_environment(deferred_lighting_shader);
+    _set_environment(sphere_shader);
+    _bind_environment();
 
     unsigned int cubeVAO = VAO["cubeVAO"];
     unsigned int skyBoxVAO = VAO["skyBoxVAO"];
     unsigned int quadVAO = VAO["quadVAO"];
 
+    bool clustered_lighting = false;
+    bool shadowed = false;
+    glm::vec2 framebuffer_size{ SCR_WIDTH, SCR_HEIGHT };
+
+    // Per frame, the projection every pass that writes the frame uses, jittered with the temporal upsampling
+    glm::mat4 projection{ 1.0f };
+    glm::mat4 unjittered_projection{ 1.0f };
+
     auto set_lightning = [&](const PBR::Shader& shader){
         
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
         glm::mat4 view = camera.GetViewMatrix();
         
         shader.use();
 
+        if (clustered_lighting)
+            light_clusters.set_uniforms(shader, framebuffer_size);
+        else
+            shader.setBool("clusteredLighting", false);
+
+        shader.setBool("shadows", shadowed);
+        if (shadowed)
+        {
+            glm::vec4 splits, texel_sizes;
+            for (int i = 0; i < PBR::CascadedShadowMap::CASCADES; i++)
+            {
+                const PBR::CascadedShadowMap::Cascade& cascade = shadow_map.get_cascade(i);
+                shader.setMat4("shadowMatrices[" + std::to_string(i) + "]", cascade.shadow_matrix);
+                splits[i] = cascade.split;
+                texel_sizes[i] = cascade.texel_size;
+            }
+            shader.setInt("shadowLight", shadow_light);
+            shader.setVec4("cascadeSplits", splits);
+            shader.setVec4("cascadeTexelSizes", texel_sizes);
+        }
+
         shader.setVec3("light.direction", light_dir);
         shader.setVec3("light.ambient", ambient);
         shader.setVec3("light.diffuse", diffuse);
@@ -309,11 +724,16 @@ inline void PbrRenderer::run()
         shader.setVec3("viewPos", camera.Position);
         shader.setMat4("view", view);
         shader.setMat4("projection", projection);
+
+        shader.setMat4("unjitteredViewProjection", unjittered_projection * view);
+        shader.setMat4("previousViewProjection", previous_view_projection);
+
+        shader.setFloat("environmentBlend", environments.get_blend());
+        reflection_probes.set_uniforms(shader, REFLECTION_PROBE_UNIT);
     };
 
     auto draw_cubemap = [&](){
 
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
         glm::mat4 view = glm::mat4{ glm::mat3{ camera.GetViewMatrix() } };
 
         glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
@@ -322,6 +742,9 @@ inline void PbrRenderer::run()
 
         background_shader.setMat4("view", view);
         background_shader.setMat4("projection", projection);
+        background_shader.setMat4("unjitteredViewProjection", unjittered_projection * view);
+        background_shader.setMat4("previousViewProjection", previous_sky_view_projection);
+        background_shader.setFloat("environmentBlend", environments.get_blend());
 
         glBindVertexArray(skyBoxVAO);
         glDrawArrays(GL_TRIANGLES, 0, 36);
@@ -331,9 +754,78 @@ inline void PbrRenderer::run()
 
     background_shader.use();
     background_shader.setInt("environmentMap", 5);
+    background_shader.setInt("previousEnvironmentMap", 15);
 
  
     int current_item = 0;
+    CullingSettings culling_settings;
+    double pick_time = 0.0;
+    bool compare_prefilter = false;
+    bool has_prefilter_comparison = false;
+    PBR::EnvironmentLibrary::PrefilterComparison prefilter_comparison;
+
+    const glm::mat4 floor_model = glm::scale(glm::rotate(glm::mat4{ 1.0f }, glm::radians(-90.0f), glm::vec3{ 1.0f, 0.0f, 0.0f }), glm::vec3{ 8.0f });
+
+    // Everything the probe captures see, a change bakes them again and misses the disk cache
+    auto probe_signature = [&](const SceneGraph& graph) {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&hash](const void* data, size_t size) {
+            for (size_t i = 0; i < size; i++)
+            {
+                hash = (hash ^ static_cast<const unsigned char*>(data)[i]) * 1099511628211ull;
+            }
+        };
+
+        const size_t environment = environments.get_shown();
+        add(&environment, sizeof(environment));
+        for (const glm::vec3* value : { &light_dir, &light_dir1, &light_dir2, &light_dir3, &ambient, &diffuse, &specular })
+        {
+            add(value, sizeof(*value));
+        }
+        for (size_t i = 0; i < graph.drawables.size() && i < graph.world_bounds.size(); i++)
+        {
+            if (graph.is_skinned(*graph.drawables[i]))
+                continue;
+
+            const glm::vec3 bounds[2] = { graph.world_bounds.get_center(i), graph.world_bounds.get_extents(i) };
+            add(bounds, sizeof(bounds));
+            add(&graph.drawables[i]->materialIndex, sizeof(graph.drawables[i]->materialIndex));
+        }
+        return hash;
+    };
+
+    // The shaders get the probe camera, without shadows, clustered lights or probes, set_lightning restores them next frame
+    auto capture_probe = [&](const glm::mat4& view, const glm::mat4& capture_projection, const glm::vec3& position) {
+        for (const MaterialShaders* variants : { &model_shaders, &sphere_shaders })
+        {
+            for (BlendMode mode : { BlendMode::Opaque, BlendMode::Masked })
+            {
+                const PBR::Shader& shader = variants->get(mode);
+                shader.use();
+                shader.setMat4("view", view);
+                shader.setMat4("projection", capture_projection);
+                shader.setVec3("viewPos", position);
+                shader.setBool("shadows", false);
+                shader.setBool("clusteredLighting", false);
+                shader.setInt("probeFirst", -1);
+                shader.setInt("probeSecond", -1);
+            }
+        }
+
+        if (probe_scene)
+            _draw_probe_capture(*probe_scene, model_shaders, sphere_shaders);
+        if (current_item == 4)
+            _draw_quad(quadVAO, contexts[7], pbr_shader, floor_model);
+
+        glDepthFunc(GL_LEQUAL);
+        background_shader.use();
+        background_shader.setMat4("view", glm::mat4{ glm::mat3{ view } });
+        background_shader.setMat4("projection", capture_projection);
+        glBindVertexArray(skyBoxVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glBindVertexArray(0);
+        glDepthFunc(GL_LESS);
+    };
 
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
@@ -353,87 +845,171 @@ inline void PbrRenderer::run()
         
         _process_input();
 
+        // Resized only together with the window, a smaller render scale only shrinks the viewport
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        width = std::max(width, 1);
+        height = std::max(height, 1);
+        aspect_ratio = static_cast<float>(width) / static_cast<float>(height);
+        hdr_target.resize(width, height);
+
+        if (dynamic_resolution)
+            render_scale = resolution_controller.update(frame_timer.get_milliseconds());
+        // Below half resolution per axis the jitter sequence can no longer cover every output pixel in time
+        if (temporal_upsampling)
+            render_scale = std::max(render_scale, 0.5f);
+        framebuffer_size = glm::vec2{ std::max(std::floor(width * render_scale), 1.0f), std::max(std::floor(height * render_scale), 1.0f) };
+
+        unjittered_projection = glm::perspective(glm::radians(camera.Zoom), aspect_ratio, 0.1f, 100.0f);
+        projection = unjittered_projection;
+        if (temporal_upsampling)
+        {
+            temporal_upsampler.resize(width, height);
+            temporal_upsampler.next_jitter(render_scale);
+            projection = temporal_upsampler.jitter_projection(unjittered_projection, framebuffer_size);
+        }
+
+        // Slices of a pending bake, ahead of the frame timer so they do not count against the render scale
+        if (environments.update(deltaTime, environment_bake))
+            _bind_environment();
+        if (compare_prefilter)
+        {
+            prefilter_comparison = environments.compare_prefilter(environments.get_shown(), environment_bake);
+            has_prefilter_comparison = true;
+            compare_prefilter = false;
+        }
+
+        hdr_target.bind();
+        glViewport(0, 0, static_cast<int>(framebuffer_size.x), static_cast<int>(framebuffer_size.y));
+
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        const float no_motion[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 1, no_motion);
         // Create IMGUI new frame
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
+        frame_timer.begin();
+
+        auto scene = scenes.find(items[current_item]);
+
+        // Probes of the scene shown, what the cache does not have is baked after the frame
+        const SceneGraph* shown_scene = scene != scenes.end() ? scene->second.get() : nullptr;
+        if (shown_scene != probe_scene)
+        {
+            std::string cache_path = std::string{ "cache/probes/" } + items[current_item];
+            std::replace(cache_path.begin(), cache_path.end(), ' ', '_');
+            reflection_probes.set_probes(shown_scene ? shown_scene->probes : std::vector<PBR::ReflectionProbe>{}, cache_path,
+                shown_scene ? probe_signature(*shown_scene) : 0);
+            reflection_probes.bind(REFLECTION_PROBE_UNIT);
+            probe_scene = shown_scene;
+        }
+
+        // Assigned once per frame before any shader reads the clusters
+        clustered_lighting = scene != scenes.end() && !scene->second->lights.empty();
+        if (clustered_lighting)
+        {
+            light_clusters.set_projection(unjittered_projection, 0.1f, 100.0f);
+            light_clusters.assign(camera.GetViewMatrix(), scene->second->lights);
+            light_clusters.upload(scene->second->lights, CLUSTER_LIGHT_BINDING, CLUSTER_RANGE_BINDING, CLUSTER_INDEX_BINDING);
+        }
+
+        // Cascades are fitted before the shaders get their matrices, the casters are drawn with the scene
+        shadowed = shadows && scene != scenes.end();
+        if (shadowed)
+        {
+            const glm::vec3 directions[] = { light_dir, light_dir1, light_dir2, light_dir3 };
+            shadow_light = 0;
+            for (int i = 1; i < 4; i++)
+            {
+                if (glm::normalize(directions[i]).y < glm::normalize(directions[shadow_light]).y)
+                    shadow_light = i;
+            }
+            shadow_map.update(camera.GetViewMatrix(), glm::radians(camera.Zoom), aspect_ratio, 0.1f, shadow_distance, directions[shadow_light]);
+        }
+
         // Actual drawing
-        set_lightning(pbr_model_shader);
-        set_lightning(pbr_shader);
+        for (const MaterialShaders* variants : { &model_shaders, &sphere_shaders, &gbuffer_model_shaders, &gbuffer_sphere_shaders })
+        {
+            for (BlendMode mode : { BlendMode::Opaque, BlendMode::Masked, BlendMode::Blended })
+            {
+                set_lightning(variants->get(mode));
+                set_lightning(variants->get(mode, true));
+            }
+        }
+        set_lightning(deferred_lighting_shader);
         set_lightning(sphere_shader);
+        set_lightning(depth_prepass_shader);
+        set_lightning(shaders["depth_prepass_skinned_shader"]);
+        set_lightning(shaders["pbr_model_crowd_shader"]);
 
         glm::mat4 model{ 1.0f };
 
+        Frustum frustum = createFrustumFromCamera(camera, aspect_ratio, glm::radians(camera.Zoom), 0.1f, 100.0f);
+        CullingStats culling_stats;
+
+        if (scene != scenes.end())
+        {
+            PBR::AnimationSystem& animations = scene->second->animations;
+            if (animations.get_instance_count() > 0)
+            {
+                animations.set_palette_format(dual_quaternion_skinning ? PBR::PaletteFormat::DualQuaternions : PBR::PaletteFormat::Matrices);
+                animations.update(deltaTime, thread_pool);
+                animations.upload(BONE_PALETTE_BINDING);
+            }
+
+            // Culling and occlusion work on the unjittered frustum
+            const glm::mat4 view_projection = unjittered_projection * camera.GetViewMatrix();
+            if (render_path == RenderPath::Deferred)
+            {
+                gbuffer.resize(hdr_target.get_width(), hdr_target.get_height());
+                gbuffer.bind();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+                glClearBufferfv(GL_COLOR, 3, no_motion);
+
+                culling_stats = _draw_scene(*scene->second, frustum, view_projection, culling_settings, gbuffer_model_shaders, gbuffer_sphere_shaders);
+                _shade_gbuffer(quadVAO, deferred_lighting_shader, projection * camera.GetViewMatrix(), framebuffer_size);
+            }
+            else
+            {
+                culling_stats = _draw_scene(*scene->second, frustum, view_projection, culling_settings, model_shaders, sphere_shaders);
+            }
+
+            // Left click with a free cursor selects the closest entity under it
+            bool pressed = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+            if (pressed && !mouse_pressed && !mouse_captured && !ImGui::GetIO().WantCaptureMouse)
+            {
+                auto pick_start = std::chrono::high_resolution_clock::now();
+                scene->second->selected = _pick_entity(*scene->second, _cursor_ray());
+                pick_time = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pick_start).count();
+            }
+            mouse_pressed = pressed;
+        }
+
         switch (current_item)
         {
         case 0:
+            _set_probes(pbr_shader, glm::vec3{ model[3] });
             _draw_sphere({sphere, contexts[2]}, pbr_shader, model);
             break;
         case 1:
             _draw_spheres(sphere, sphere_shader);
             break;
-        case 2:
-            model = glm::rotate(model, glm::radians(-90.0f), glm::vec3{ 1.0f, 0.0f, 0.0f });
-            model = glm::scale(model, glm::vec3{ 5.0f, 5.0f, 5.0f });
-            _draw_model({gnome,gnome_albedo_map,gnome_arm_map,gnome_normal_map}, pbr_model_shader, model);
-            break;
-        case 3:
-            _draw_scene(
-                {
-                    {sphere, contexts[0]},
-                    {sphere, contexts[1]},
-                    {sphere, contexts[2]},
-                    {sphere, contexts[3]},
-                    {sphere, contexts[4]},
-                    {sphere, contexts[5]},
-                    {sphere, contexts[6]},
-                    {sphere, contexts[7]},
-                    
-                },
-                pbr_shader,
-                {
-                    model,
-                    glm::translate(model, glm::vec3{ 3.0f, 0.0f, 0.0f}),
-                    glm::translate(model, glm::vec3{ 6.0f, 0.0f, 0.0f}),
-                    glm::translate(model, glm::vec3{ -3.0f, 0.0f, 0.0f}),
-                    glm::translate(model, glm::vec3{ -6.0f, 0.0f, 0.0f}),
-                    glm::translate(model, glm::vec3{ 9.0f, 0.0f, 0.0f}),
-                    glm::translate(model, glm::vec3{ -9.0f, 0.0f, 0.0f}),
-                    glm::translate(model, glm::vec3{ -12.0f, 0.0f, 0.0f}),
-                }
-            );
-            break;
         case 4:
-            
-            model = glm::rotate(model, glm::radians(-90.0f), glm::vec3{ 1.0f, 0.0f, 0.0f });
-            _draw_scene(
-                {
-                    {rat, rat_albedo_map, rat_arm_map, rat_normal_map},
-                    {chair, chair_albedo_map, chair_arm_map, chair_normal_map},
-                    {boulder, boulder_albedo_map, boulder_arm_map, boulder_normal_map},
-                    {boulder, boulder_albedo_map, boulder_arm_map, boulder_normal_map},
-                    {bust, marble_bust_albedo_map, marble_bust_arm_map, marble_bust_normal_map},
-                },
-                pbr_model_shader,
-                {
-                    glm::translate(glm::scale(model, glm::vec3{ 5.0f, 5.0f, 5.0f }), rat_position),
-                    glm::translate(glm::scale(model, glm::vec3{ 5.0f, 5.0f, 5.0f }), chair_position),
-                    glm::translate(glm::scale(model, glm::vec3{ 3.0f, 3.0f, 3.0f }), boulder1_position),
-                    glm::translate(glm::scale(model, glm::vec3{ 3.0f, 3.0f, 3.0f }), boulder2_position),
-                    glm::translate(glm::scale(model, glm::vec3{ 5.0f, 5.0f, 5.0f }), bust_position),
-                }
-            );
-            
-            _draw_quad(quadVAO, contexts[7], pbr_shader, glm::scale(model, glm::vec3{ 8.0f, 8.0f, 8.0f }));
+            _set_probes(pbr_shader, glm::vec3{ floor_model[3] });
+            _draw_quad(quadVAO, contexts[7], pbr_shader, floor_model);
             break;
 
         case 5:
             
             break;
+        case 6:
+            if (crowd)
+                _draw_crowd(*crowd, shaders["pbr_model_crowd_shader"], currentFrame);
+            break;
         default:
             break;
         }
@@ -446,14 +1022,27 @@ inline void PbrRenderer::run()
         // Draw the cube map
         draw_cubemap();
 
-        const char* items[] ={
-            "Sphere",
-            "Spheres",
-            "Model",
-            "Textured Spheres",
-            "Scene",
-            "Nothing",
-        };
+        // Blended surfaces go over the finished opaque image and the sky box
+        if (scene != scenes.end())
+            _draw_transparent(*scene->second, frustum, model_shaders, sphere_shaders, culling_stats);
+
+        // After the sky box, otherwise it would cover the outline where it overlaps the background
+        if (scene != scenes.end() && scene->second->selected)
+        {
+            const Entity& selected = *scene->second->selected;
+            const PBR::Shader& selected_outline_shader = scene->second->is_skinned(selected) ? shaders["outline_skinned_shader"] : outline_shader;
+            selected_outline_shader.use();
+            selected_outline_shader.setMat4("view", camera.GetViewMatrix());
+            selected_outline_shader.setMat4("projection", projection);
+            _set_skinning(*scene->second, selected, selected_outline_shader);
+            // The outline keeps the motion of the surface under it
+            glColorMaski(1, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            _draw_outline(*scene->second, selected, selected_outline_shader);
+            glColorMaski(1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        }
+
+        previous_view_projection = unjittered_projection * camera.GetViewMatrix();
+        previous_sky_view_projection = unjittered_projection * glm::mat4{ glm::mat3{ camera.GetViewMatrix() } };
 
 
         // Boiler Plate code 
@@ -471,6 +1060,122 @@ inline void PbrRenderer::run()
         ImGui::ColorEdit3("Light Ambient", glm::value_ptr(ambient));
         ImGui::ColorEdit3("Light Diffuse", glm::value_ptr(diffuse));
         ImGui::ColorEdit3("Light Specular", glm::value_ptr(specular));
+
+        ImGui::SliderFloat("Exposure", &exposure, 0.1f, 8.0f);
+        const char* tonemappers[] = { "Reinhard", "ACES Fit" };
+        ImGui::Combo("Tonemapper", &tonemapper, tonemappers, IM_ARRAYSIZE(tonemappers));
+
+        // Selecting only starts the bake, the environment fades in once it is done
+        if (ImGui::BeginCombo("Environment", environments.get_name(environments.get_selected()).c_str()))
+        {
+            for (size_t i = 0; i < environments.get_count(); i++)
+            {
+                std::string label = environments.get_name(i);
+                if (environments.has_failed(i))
+                    label += " (failed)";
+                else if (!environments.is_ready(i) && environments.get_progress(i) > 0.0f)
+                    label += " (" + std::to_string(static_cast<int>(environments.get_progress(i) * 100.0f)) + "%)";
+
+                const bool is_selected = i == environments.get_selected();
+                if (ImGui::Selectable(label.c_str(), is_selected))
+                    environments.select(i);
+                if (is_selected)
+                    ImGui::SetItemDefaultFocus();
+            }
+            ImGui::EndCombo();
+        }
+        float bake_budget = environments.get_budget();
+        if (ImGui::SliderFloat("Bake Budget (ms)", &bake_budget, 0.5f, 8.0f))
+            environments.set_budget(bake_budget);
+        float fade_time = environments.get_fade_time();
+        if (ImGui::SliderFloat("Environment Fade (s)", &fade_time, 0.0f, 3.0f))
+            environments.set_fade_time(fade_time);
+        if (!environments.is_ready(environments.get_selected()))
+            ImGui::Text("Baking: %.0f%%, GPU Time: %.3f ms", environments.get_progress(environments.get_selected()) * 100.0f, environments.get_bake_milliseconds());
+
+        // Mip 0 is a mirror, one sample
+        for (int mip = 1; mip < PBR::EnvironmentLibrary::PREFILTER_MIPS; mip++)
+        {
+            int samples = environments.get_prefilter_samples(mip);
+            const std::string label = "Prefilter Samples Mip " + std::to_string(mip);
+            if (ImGui::SliderInt(label.c_str(), &samples, 64, 256))
+                environments.set_prefilter_samples(mip, samples);
+        }
+        if (ImGui::Button("Compare Prefilter"))
+            compare_prefilter = true;
+        if (has_prefilter_comparison)
+        {
+            ImGui::Text("Prefilter: %.3f ms, %d Sample Reference: %.3f ms", prefilter_comparison.filtered_ms,
+                PBR::EnvironmentLibrary::REFERENCE_PREFILTER_SAMPLES, prefilter_comparison.reference_ms);
+            ImGui::Text("Relative Error per Mip: %.4f %.4f %.4f %.4f %.4f", prefilter_comparison.error[0], prefilter_comparison.error[1],
+                prefilter_comparison.error[2], prefilter_comparison.error[3], prefilter_comparison.error[4]);
+        }
+
+        bool probes_enabled = reflection_probes.is_enabled();
+        if (ImGui::Checkbox("Reflection Probes", &probes_enabled))
+            reflection_probes.set_enabled(probes_enabled);
+        if (probes_enabled && reflection_probes.get_count() > 0)
+        {
+            int probe_slices = reflection_probes.get_slices_per_frame();
+            if (ImGui::SliderInt("Probe Slices per Frame", &probe_slices, 1, 11))
+                reflection_probes.set_slices_per_frame(probe_slices);
+            ImGui::Text("Probes: %zu, Pending: %zu, Baked: %d, From Cache: %d", reflection_probes.get_count(), reflection_probes.get_pending(),
+                reflection_probes.get_bake_count(), reflection_probes.get_load_count());
+            if (ImGui::Button("Rebake Probes"))
+                reflection_probes.rebake();
+
+            // Moved probes are baked again and kept in the scene for the next time it is shown,
+            // the cache is only looked at once the drag is over
+            for (size_t i = 0; scene != scenes.end() && i < reflection_probes.get_count(); i++)
+            {
+                PBR::ReflectionProbe probe = reflection_probes.get_probe(i);
+                ImGui::PushID(static_cast<int>(i));
+                bool moved = ImGui::DragFloat3("Probe Position", glm::value_ptr(probe.position), 0.05f);
+                bool released = ImGui::IsItemDeactivatedAfterEdit();
+                moved |= ImGui::DragFloat3("Probe Box Min", glm::value_ptr(probe.box_min), 0.05f);
+                released |= ImGui::IsItemDeactivatedAfterEdit();
+                moved |= ImGui::DragFloat3("Probe Box Max", glm::value_ptr(probe.box_max), 0.05f);
+                released |= ImGui::IsItemDeactivatedAfterEdit();
+                ImGui::PopID();
+                if (moved || released)
+                {
+                    reflection_probes.set_probe(i, probe, released);
+                    scene->second->probes[i] = probe;
+                }
+            }
+        }
+
+        if (ImGui::Checkbox("Dynamic Resolution", &dynamic_resolution) && dynamic_resolution)
+            resolution_controller.set_scale(render_scale);
+        if (dynamic_resolution)
+        {
+            float budget = resolution_controller.get_budget();
+            if (ImGui::SliderFloat("GPU Budget (ms)", &budget, 4.0f, 33.3f))
+                resolution_controller.set_budget(budget);
+            float min_scale = resolution_controller.get_min_scale();
+            if (ImGui::SliderFloat("Min Scale", &min_scale, 0.25f, 1.0f))
+                resolution_controller.set_limits(min_scale, 1.0f);
+        }
+        else
+        {
+            ImGui::SliderFloat("Render Scale", &render_scale, 0.25f, 1.0f);
+        }
+        if (ImGui::Checkbox("Temporal Upsampling", &temporal_upsampling) && temporal_upsampling)
+            temporal_upsampler.invalidate();
+        if (temporal_upsampling)
+        {
+            float feedback = temporal_upsampler.get_feedback();
+            if (ImGui::SliderFloat("Temporal Feedback", &feedback, 0.02f, 0.5f))
+                temporal_upsampler.set_feedback(feedback);
+            ImGui::Text("Jitter Phases: %d, Resolve GPU Time: %.3f ms", temporal_upsampler.get_phase_count(), temporal_timer.get_milliseconds());
+        }
+        else
+        {
+            const char* upscale_filters[] = { "Bilinear", "Catmull-Rom" };
+            ImGui::Combo("Upscale Filter", &upscale_filter, upscale_filters, IM_ARRAYSIZE(upscale_filters));
+        }
+        ImGui::Text("Render: %.0fx%.0f (%.0f%%), GPU Time: %.3f ms, Smoothed: %.3f ms", framebuffer_size.x, framebuffer_size.y, render_scale * 100.0f,
+            frame_timer.get_milliseconds(), resolution_controller.get_smoothed_ms());
         
         ImGui::Spacing();
         ImGui::Spacing();
@@ -482,26 +1187,178 @@ inline void PbrRenderer::run()
             for (int n = 0; n < IM_ARRAYSIZE(items); n++) {
                 bool is_selected = (current_item == n);
                 if (ImGui::Selectable(items[n], is_selected))
+                {
+                    // Nothing of the old scene is worth keeping in the history
+                    if (current_item != n)
+                        temporal_upsampler.invalidate();
                     current_item = n;
+                }
                 if (is_selected)
                     ImGui::SetItemDefaultFocus();
             }
             ImGui::EndCombo();
         }
+        if(current_item == 6)
+        {
+            ImGui::Spacing();
+            ImGui::Spacing();
+            if (crowd)
+            {
+                const PBR::VertexAnimationTexture& animation = crowd->animation;
+                ImGui::Text("Crowd: %u instances of %s", crowd->instance_count, crowd->material.model.get_name().c_str());
+                ImGui::Text("Animation Texture: %u vertices, %u frames, %.1f KiB", animation.vertex_count, animation.frame_count, animation.gpu_bytes() / 1024.0f);
+            }
+            else
+            {
+                ImGui::Text("Crowd: no animated model was loaded");
+            }
+        }
         if(current_item == 4)
         {
             ImGui::Spacing();
             ImGui::Spacing();
             ImGui::Text("Positions");
-            ImGui::DragFloat3("rat_position", glm::value_ptr(rat_position), 0.1f);
-            ImGui::DragFloat3("chair_position", glm::value_ptr(chair_position), 0.1f);
-            ImGui::DragFloat3("boulder1_position", glm::value_ptr(boulder1_position), 0.1f);
-            ImGui::DragFloat3("boulder2_position", glm::value_ptr(boulder2_position), 0.1f);
-            ImGui::DragFloat3("bust_position", glm::value_ptr(bust_position), 0.1f);
+            // Only the edited entity is marked dirty
+            if (ImGui::DragFloat3("rat_position", glm::value_ptr(rat_position), 0.1f))
+                rat_entity.transform.setLocalPosition(rat_position * 5.0f);
+            if (ImGui::DragFloat3("chair_position", glm::value_ptr(chair_position), 0.1f))
+                chair_entity.transform.setLocalPosition(chair_position * 5.0f);
+            if (ImGui::DragFloat3("boulder1_position", glm::value_ptr(boulder1_position), 0.1f))
+                boulder1_entity.transform.setLocalPosition(boulder1_position * 3.0f);
+            if (ImGui::DragFloat3("boulder2_position", glm::value_ptr(boulder2_position), 0.1f))
+                boulder2_entity.transform.setLocalPosition(boulder2_position * 3.0f);
+            if (ImGui::DragFloat3("bust_position", glm::value_ptr(bust_position), 0.1f))
+                bust_entity.transform.setLocalPosition(bust_position * 5.0f);
+
+            ImGui::Spacing();
+            ImGui::Spacing();
+            ImGui::Text("Clustered Lighting (%u x %u x %u clusters)", PBR::LightClusters::TILES_X, PBR::LightClusters::TILES_Y, PBR::LightClusters::SLICES);
+            if (ImGui::SliderInt("Lights", &clustered_light_count, 0, 4096))
+                _scatter_lights(*scene->second, clustered_light_count);
+            ImGui::Text("Lights per Cluster: %.2f", static_cast<double>(light_clusters.get_indices().size()) / PBR::LightClusters::CLUSTER_COUNT);
+        }
+
+        if (scene != scenes.end())
+        {
+            ImGui::Spacing();
+            ImGui::Spacing();
+            ImGui::Text("Frustum Culling (%s)", PBR::simd::NAME);
+            ImGui::Text("Visible Entities: %u / %u", culling_stats.visibleEntities, culling_stats.totalEntities);
+            ImGui::Text("Visible Meshes: %u / %u", culling_stats.visibleMeshes, culling_stats.totalMeshes);
+
+            ImGui::Text("Render Path");
+            if (ImGui::RadioButton("Forward", render_path == RenderPath::Forward))
+                render_path = RenderPath::Forward;
+            ImGui::SameLine();
+            if (ImGui::RadioButton("Deferred", render_path == RenderPath::Deferred))
+                render_path = RenderPath::Deferred;
+            if (render_path == RenderPath::Deferred)
+                ImGui::Text("Lighting GPU Time: %.3f ms", lighting_timer.get_milliseconds());
+
+            ImGui::Checkbox("Depth Prepass", &scene->second->depth_prepass);
+
+            ImGui::Checkbox("Shadows", &shadows);
+            if (shadows)
+            {
+                ImGui::SliderFloat("Shadow Distance", &shadow_distance, 5.0f, 100.0f);
+                ImGui::Text("Shadow Light: Light Direction%s", shadow_light == 0 ? "" : std::to_string(shadow_light).c_str());
+                for (int i = 0; i < PBR::CascadedShadowMap::CASCADES; i++)
+                {
+                    const PBR::CascadedShadowMap::Cascade& cascade = shadow_map.get_cascade(i);
+                    ImGui::Text("Cascade %d (%.1f): %.3f ms, %u static%s, %u dynamic, %u rebuilds", i, cascade.split, cascade.timer.get_milliseconds(),
+                        cascade.static_casters, cascade.static_rendered ? " rebuilt" : " cached", cascade.dynamic_casters, cascade.static_renders);
+                }
+            }
+            ImGui::Text("Animated Entities: %zu", scene->second->animations.get_instance_count());
+            ImGui::Checkbox("Dual Quaternion Skinning", &dual_quaternion_skinning);
+            ImGui::Checkbox("Compute Skinning", &compute_skinning);
+            ImGui::Text("Skinning GPU Time: %.3f ms (%zu meshes, %zu vertices)", compute_skinning ? skinning_timer.get_milliseconds() : 0.0, skinning_pass.get_mesh_count(), skinning_pass.get_vertex_count());
+            ImGui::Text("Scene GPU Time: %.3f ms", scene_timer.get_milliseconds());
+
+            ImGui::Checkbox("Cull With BVH", &culling_settings.use_bvh);
+            ImGui::Text("Update: %.4f ms, Cull: %.4f ms", culling_stats.updateTime, culling_stats.cullTime);
+
+            ImGui::Checkbox("Occlusion Culling", &culling_settings.occlusion);
+            ImGui::Text("Occluded Entities: %u, Occluder Triangles: %zu", culling_stats.occludedEntities, culling_stats.occluderTriangles);
+            ImGui::Text("Occlusion Raster: %.4f ms (%u threads)", culling_stats.rasterTime, thread_pool.get_thread_count());
+
+            const PBR::DynamicBVH& bvh = scene->second->bvh;
+            ImGui::Text("BVH Nodes: %zu, Height: %d", bvh.get_node_count(), bvh.get_height());
+            if (ImGui::Button("Rebuild BVH (SAH)"))
+                scene->second->bvh.rebuild_sah();
+
+            const Entity* selected = scene->second->selected;
+            ImGui::Text("Picking (free the cursor and left click): %.4f ms", pick_time);
+            ImGui::Text("Selected: %s", selected ? (selected->pModel ? selected->pModel->get_name().c_str() : "Sphere") : "None");
+
+            // Material of the selected entity, shared with every entity using the same context
+            if (selected)
+            {
+                SceneGraph& graph = *scene->second;
+                BlendMode* blend_mode;
+                float* opacity;
+                float* alpha_cutoff;
+                if (selected->pModel)
+                {
+                    DrawModelContext& material = graph.model_contexts[selected->materialIndex];
+                    blend_mode = &material.blend_mode;
+                    opacity = &material.opacity;
+                    alpha_cutoff = &material.alpha_cutoff;
+                }
+                else
+                {
+                    MaterialContext& material = graph.sphere_contexts[selected->materialIndex].material;
+                    blend_mode = &material.blend_mode;
+                    opacity = &material.opacity;
+                    alpha_cutoff = &material.alpha_cutoff;
+                }
+
+                const char* blend_modes[] = { "Opaque", "Masked", "Blended" };
+                int mode = static_cast<int>(*blend_mode);
+                if (ImGui::Combo("Blend Mode", &mode, blend_modes, IM_ARRAYSIZE(blend_modes)))
+                    *blend_mode = static_cast<BlendMode>(mode);
+                ImGui::SliderFloat("Opacity", opacity, 0.0f, 1.0f);
+                ImGui::SliderFloat("Alpha Cutoff", alpha_cutoff, 0.0f, 1.0f);
+            }
+            ImGui::Text("Opaque: %zu, Masked: %zu, Blended: %zu", opaque_queue.size(), masked_queue.size(), transparent_queue.size());
+        }
+
+        ImGui::Spacing();
+        ImGui::Spacing();
+        ImGui::Text("Geometry Memory (CPU / GPU)");
+        for (const Model* loaded_model : { &rat, &chair, &bust, &boulder, &gnome })
+        {
+            ImGui::Text("%s: %.1f KiB / %.1f KiB", loaded_model->get_name().c_str(), loaded_model->cpu_bytes() / 1024.0f, loaded_model->gpu_bytes() / 1024.0f);
         }
 
         ImGui::End();
 
+        if (temporal_upsampling)
+        {
+            temporal_timer.begin();
+            temporal_upsampler.resolve(temporal_upsample_shader, quadVAO, hdr_target.get_color(), hdr_target.get_velocity(),
+                framebuffer_size / glm::vec2{ hdr_target.get_width(), hdr_target.get_height() });
+            temporal_timer.end();
+        }
+
+        frame_timer.end();
+
+        // After the frame, the captures draw with the scene shaders. Static changes restart the bakes, a new
+        // environment only once it has faded in, the captures would otherwise mix in the old one
+        if (probe_scene && reflection_probes.get_count() > 0 && environments.get_blend() >= 1.0f)
+        {
+            const uint64_t signature = probe_signature(*probe_scene);
+            if (signature != reflection_probes.get_signature())
+                reflection_probes.invalidate(signature);
+            reflection_probes.update(capture_probe, shaders["prefilter_shader"], skyBoxVAO);
+        }
+
+        // Last, the UI is drawn over the display image
+        if (temporal_upsampling)
+            _resolve_hdr(quadVAO, post_process_shader, temporal_upsampler.get_output(), glm::vec2{ 1.0f });
+        else
+            _resolve_hdr(quadVAO, post_process_shader, hdr_target.get_color(), framebuffer_size / glm::vec2{ hdr_target.get_width(), hdr_target.get_height() });
+
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
@@ -586,7 +1443,7 @@ inline void PbrRenderer::_init_IMGUI()
 inline void PbrRenderer::_set_GL_options()
 {
     glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
+    // Blending stays off, only the transparent pass turns it on
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     glEnable(GL_DEBUG_OUTPUT);
@@ -626,6 +1483,29 @@ inline void PbrRenderer::_clear_GL_resources()
 
     // Delete buffer
     glDeleteBuffers(buffers.size(), buffers.data());
+
+    for (auto &&i : scenes)
+    {
+        i.second->animations.release();
+    }
+
+    light_clusters.release();
+    gbuffer.release();
+
+    if (crowd)
+        crowd->animation.release();
+
+    scene_timer.release();
+    skinning_timer.release();
+    lighting_timer.release();
+    shadow_map.release();
+    hdr_target.release();
+    frame_timer.release();
+    temporal_upsampler.release();
+    temporal_timer.release();
+    environments.release();
+    reflection_probes.release();
+    skinning_pass.release();
     
 }
 
@@ -644,6 +1524,8 @@ inline void PbrRenderer::_gen_GL_resourcess()
     PBR::Shader prefilter_shader{ "shaders/prefilter.shader" };
     PBR::Shader brdf_shader{ "shaders/brdf.shader" };
     PBR::Shader texture_maps_shader{ "shaders/texture_maps.shader" };
+    PBR::Shader outline_shader{ "shaders/outline.shader" };
+    PBR::Shader depth_prepass_shader{ "shaders/depth_prepass.shader" };
 
     shaders.insert({"sphere_shader", sphere_shader});
     shaders.insert({"e_map_to_cube_map_shader", e_map_to_cube_map_shader});
@@ -654,6 +1536,38 @@ inline void PbrRenderer::_gen_GL_resourcess()
     shaders.insert({"prefilter_shader", prefilter_shader});
     shaders.insert({"brdf_shader", brdf_shader});
     shaders.insert({"texture_maps_shader", texture_maps_shader});
+    shaders.insert({"outline_shader", outline_shader});
+    shaders.insert({"depth_prepass_shader", depth_prepass_shader});
+
+    // Alpha tested and alpha blended variants, the opaque programs stay free of discard
+    shaders.insert({"pbr_model_masked_shader", PBR::Shader{ "shaders/pbr_model.shader", { "ALPHA_MASKED" } }});
+    shaders.insert({"pbr_model_blended_shader", PBR::Shader{ "shaders/pbr_model.shader", { "ALPHA_BLENDED" } }});
+    shaders.insert({"pbr_masked_shader", PBR::Shader{ "shaders/pbr.shader", { "ALPHA_MASKED" } }});
+    shaders.insert({"pbr_blended_shader", PBR::Shader{ "shaders/pbr.shader", { "ALPHA_BLENDED" } }});
+    shaders.insert({"pbr_model_skinned_shader", PBR::Shader{ "shaders/pbr_model.shader", { "SKINNED" } }});
+    shaders.insert({"pbr_model_skinned_masked_shader", PBR::Shader{ "shaders/pbr_model.shader", { "SKINNED", "ALPHA_MASKED" } }});
+    shaders.insert({"pbr_model_skinned_blended_shader", PBR::Shader{ "shaders/pbr_model.shader", { "SKINNED", "ALPHA_BLENDED" } }});
+    shaders.insert({"depth_prepass_skinned_shader", PBR::Shader{ "shaders/depth_prepass.shader", { "SKINNED" } }});
+    shaders.insert({"outline_skinned_shader", PBR::Shader{ "shaders/outline.shader", { "SKINNED" } }});
+    shaders.insert({"skinning_shader", PBR::Shader{ "shaders/skinning.shader" }});
+    shaders.insert({"pbr_model_crowd_shader", PBR::Shader{ "shaders/pbr_model.shader", { "VERTEX_ANIMATION" } }});
+
+    // Deferred path, the G-buffer variants share the vertex stage and alpha test with the forward ones
+    shaders.insert({"pbr_model_gbuffer_shader", PBR::Shader{ "shaders/pbr_model.shader", { "GBUFFER" } }});
+    shaders.insert({"pbr_model_gbuffer_masked_shader", PBR::Shader{ "shaders/pbr_model.shader", { "GBUFFER", "ALPHA_MASKED" } }});
+    shaders.insert({"pbr_model_skinned_gbuffer_shader", PBR::Shader{ "shaders/pbr_model.shader", { "SKINNED", "GBUFFER" } }});
+    shaders.insert({"pbr_model_skinned_gbuffer_masked_shader", PBR::Shader{ "shaders/pbr_model.shader", { "SKINNED", "GBUFFER", "ALPHA_MASKED" } }});
+    shaders.insert({"pbr_gbuffer_shader", PBR::Shader{ "shaders/pbr.shader", { "GBUFFER" } }});
+    shaders.insert({"pbr_gbuffer_masked_shader", PBR::Shader{ "shaders/pbr.shader", { "GBUFFER", "ALPHA_MASKED" } }});
+    shaders.insert({"deferred_lighting_shader", PBR::Shader{ "shaders/deferred_lighting.shader" }});
+    shaders.insert({"post_process_shader", PBR::Shader{ "shaders/post_process.shader" }});
+    shaders.insert({"temporal_upsample_shader", PBR::Shader{ "shaders/temporal_upsample.shader" }});
+
+    // Shadow casters, separate programs so the camera matrices of the prepass ones stay untouched
+    shaders.insert({"shadow_depth_shader", PBR::Shader{ "shaders/depth_prepass.shader" }});
+    shaders.insert({"shadow_depth_skinned_shader", PBR::Shader{ "shaders/depth_prepass.shader", { "SKINNED" } }});
+    shaders.insert({"shadow_depth_masked_shader", PBR::Shader{ "shaders/depth_prepass.shader", { "ALPHA_MASKED" } }});
+    shaders.insert({"shadow_depth_masked_skinned_shader", PBR::Shader{ "shaders/depth_prepass.shader", { "SKINNED", "ALPHA_MASKED" } }});
 
     // ---------- Vertex Attribute Arrays ----------
     unsigned int cubeVAO = createCube();
@@ -731,13 +1645,10 @@ inline void PbrRenderer::_load_GL_textures()
 inline void PbrRenderer::_load_GL_cubemaps()
 {
     // ---------- Cube Map Textures ----------  
-    unsigned int hdr_texture = hdr_texture_from_file("resources/textures/hdr/newport_loft.hdr");
-    unsigned int golden_bay_hdr_texture = hdr_texture_from_file("resources/textures/hdr/golden_bay.hdr");
-    unsigned int satara_night_hdr_texture = hdr_texture_from_file("resources/textures/hdr/satara_night.hdr");
-
-    textures.insert({"hdr_texture", hdr_texture});
-    textures.insert({"golden_bay/hdr_texture", golden_bay_hdr_texture});
-    textures.insert({"satara_night/hdr_texture", golden_bay_hdr_texture});
+    // Only registered, each one is baked the first time it is selected
+    environments.add("Newport Loft", "resources/textures/hdr/newport_loft.hdr");
+    environments.add("Golden Bay", "resources/textures/hdr/golden_bay.hdr");
+    environments.add("Satara Night", "resources/textures/hdr/satara_night.hdr");
 
     
     // _generate_brdfLUT_texture("brdfLUT");
@@ -746,16 +1657,13 @@ inline void PbrRenderer::_load_GL_cubemaps()
 
     _load_cubemap();
 
-    unsigned int hdr_cube_map = _generate_cubemap("hdr_cube_map", hdr_texture);
-    unsigned int golden_bay_hdr_cube_map = _generate_cubemap("golden_bay/hdr_cube_map", golden_bay_hdr_texture);
-    unsigned int satara_night_hdr_cube_map = _generate_cubemap("satara_night/hdr_cube_map", satara_night_hdr_texture);
+    // The first frame already needs one
+    environments.bake_now(0, _environment_bake_shaders());
+}
 
-    _generate_irradiance_map("golden_bay/irradiance_map", golden_bay_hdr_cube_map);
-    _generate_prefilter_map("golden_bay/prefilter_map", golden_bay_hdr_cube_map);
-    _generate_irradiance_map("satara_night/irradiance_map", satara_night_hdr_cube_map);
-    _generate_prefilter_map("satara_night/prefilter_map", satara_night_hdr_cube_map);
-    _generate_irradiance_map("irradiance_map", hdr_cube_map);
-    _generate_prefilter_map("prefilter_map", hdr_cube_map);
+inline PBR::EnvironmentBakeShaders PbrRenderer::_environment_bake_shaders()
+{
+    return { shaders["e_map_to_cube_map_shader"], shaders["irradiance_shader"], shaders["prefilter_shader"], VAO["skyBoxVAO"] };
 }
 
 inline void PbrRenderer::_load_GL_material(const std::string& material_name){
@@ -846,232 +1754,31 @@ inline void PbrRenderer::_process_input()
         camera.Position -= (glm::vec3(0.0, 1.0, 0.0f) * (2 * deltaTime)); 
 }
 
-inline unsigned int PbrRenderer::_generate_cubemap(std::string_view name, unsigned int texture)
+inline void PbrRenderer::_generate_brdfLUT_texture(std::string_view name)
 {
 
-    std::cout << "Generating Cube Map Texture: " << name << std::endl;
+    std::cout << "Generating BRDF LUT Texture: " << name << std::endl;
 
     unsigned int captureFBO,captureRBO;
     glGenFramebuffers(1, &captureFBO);
     glGenRenderbuffers(1, &captureRBO);
-    
 
     glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
     glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
 
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 1024, 1024);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 128, 128);
 
-    unsigned int envCubemap;
-    glGenTextures(1, &envCubemap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    unsigned int brdfLUT_texture;
+    glGenTextures(1, &brdfLUT_texture);
 
+    glBindTexture(GL_TEXTURE_2D, brdfLUT_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
 
-
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        // note that we store each face with 16 bit floating point values
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 1024, 1024, 0, GL_RGB, GL_FLOAT, nullptr);
-    }
-
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    PBR::Shader e_map_to_cube_map_shader = shaders["e_map_to_cube_map_shader"];
-    unsigned int skyBoxVAO = VAO["skyBoxVAO"];
-
-    // convert HDR equirectangular environment map to cubemap equivalent
-    e_map_to_cube_map_shader.use();
-    e_map_to_cube_map_shader.setInt("equirectangularMap", 0);
-    e_map_to_cube_map_shader.setMat4("projection", captureProjection);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    glViewport(0, 0, 1024, 1024); // don’t forget to configure the viewport
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        e_map_to_cube_map_shader.setMat4("view", captureViews[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glBindVertexArray(skyBoxVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-    }
-    glBindVertexArray(0);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    textures.insert({name.data(), envCubemap});
-
-    return envCubemap;
-}
-
-inline void PbrRenderer::_generate_irradiance_map(std::string_view name, unsigned int texture)
-{
-
-    std::cout << "Generating Irradiance Map Texture: " << name << std::endl;
-
-    unsigned int captureFBO,captureRBO;
-    glGenFramebuffers(1, &captureFBO);
-    glGenRenderbuffers(1, &captureRBO);
-    
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
-
-
-    unsigned int irradianceMap;
-    glGenTextures(1, &irradianceMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
-
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 32, 32, 0, GL_RGB, GL_FLOAT, nullptr);
-    }
-
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    PBR::Shader irradiance_shader = shaders["irradiance_shader"];
-    unsigned int skyBoxVAO = VAO["skyBoxVAO"];
-
-    irradiance_shader.use();
-    irradiance_shader.setInt("environmentMap", 0);
-    irradiance_shader.setMat4("projection", captureProjection);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
-
-    
-    glViewport(0, 0, 32, 32); // don't forget to configure the viewport to the capture dimensions.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        irradiance_shader.setMat4("view", captureViews[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glBindVertexArray(skyBoxVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-
-    }
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    textures.insert({name.data(), irradianceMap});
-
-}
-
-inline void PbrRenderer::_generate_prefilter_map(std::string_view name, unsigned int texture)
-{
-
-    std::cout << "Generating Prefilter Map Texture: " << name << std::endl;
-
-    unsigned int captureFBO,captureRBO;
-    glGenFramebuffers(1, &captureFBO);
-    glGenRenderbuffers(1, &captureRBO);
-
-
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 128, 128);
-    
-
-    unsigned int prefilterMap;
-    glGenTextures(1, &prefilterMap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
-
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 128, 128, 0, GL_RGB, GL_FLOAT, nullptr);
-    }
-
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-
-
-    PBR::Shader prefilter_shader = shaders["prefilter_shader"];
-    unsigned int skyBoxVAO = VAO["skyBoxVAO"];
-
-    prefilter_shader.use();
-    prefilter_shader.setInt("environmentMap", 0);
-    prefilter_shader.setMat4("projection", captureProjection);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    unsigned int maxMipLevels = 5;
-    for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
-    {
-        unsigned int mipWidth = static_cast<unsigned int>(128 * std::pow(0.5, mip));
-        unsigned int mipHeight = static_cast<unsigned int>(128 * std::pow(0.5, mip));
-
-        glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-        glViewport(0, 0, mipWidth, mipHeight);
-
-        float roughness = (float)mip / (float)(maxMipLevels - 1);
-        prefilter_shader.setFloat("roughness", roughness);
-        for (size_t i = 0; i < 6; i++)
-        {
-            prefilter_shader.setMat4("view", captureViews[i]);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, 0);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-            glBindVertexArray(skyBoxVAO);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
-        }
-    }
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    textures.insert({name.data(), prefilterMap});
-
-}
-
-inline void PbrRenderer::_generate_brdfLUT_texture(std::string_view name)
-{
-
-    std::cout << "Generating BRDF LUT Texture: " << name << std::endl;
-
-    unsigned int captureFBO,captureRBO;
-    glGenFramebuffers(1, &captureFBO);
-    glGenRenderbuffers(1, &captureRBO);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 128, 128);
-
-    unsigned int brdfLUT_texture;
-    glGenTextures(1, &brdfLUT_texture);
-
-    glBindTexture(GL_TEXTURE_2D, brdfLUT_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
     glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
@@ -1187,7 +1894,7 @@ inline void PbrRenderer::_print_textures()
     
 }
 
-inline void PbrRenderer::_draw_sphere(const DrawSphereContext &context, const PBR::Shader &shader, const glm::mat4& model)
+inline void PbrRenderer::_draw_sphere(const DrawSphereContext &context, const PBR::Shader &shader, const glm::mat4& model, const glm::mat4* previous_model)
 {
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, context.material.albedo_map);
@@ -1212,7 +1919,12 @@ inline void PbrRenderer::_draw_sphere(const DrawSphereContext &context, const PB
     shader.setInt("normal_map", 3);
     shader.setInt("roughness_map", 4);
 
+    // Not present in the opaque variant, the calls are ignored there
+    shader.setFloat("opacity", context.material.opacity);
+    shader.setFloat("alphaCutoff", context.material.alpha_cutoff);
+
     shader.setMat4("model", model);
+    shader.setMat4("previousModel", previous_model ? *previous_model : model);
     
     glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
     shader.setMat3("normalMatrix", normalMatrix);
@@ -1249,6 +1961,7 @@ inline void PbrRenderer::_draw_cube(const DrawCubeContext &context, const PBR::S
     shader.setInt("roughness_map", 4);
 
     shader.setMat4("model", model);
+    shader.setMat4("previousModel", model);
         
     glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
     shader.setMat3("normalMatrix", normalMatrix);
@@ -1284,6 +1997,7 @@ inline void PbrRenderer::_draw_quad(unsigned int quadVAO, const MaterialContext&
     shader.setInt("roughness_map", 4);
 
     shader.setMat4("model", model);
+    shader.setMat4("previousModel", model);
         
     glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
     shader.setMat3("normalMatrix", normalMatrix);
@@ -1295,6 +2009,37 @@ inline void PbrRenderer::_draw_quad(unsigned int quadVAO, const MaterialContext&
 
 
 inline void PbrRenderer::_draw_model(const DrawModelContext &context, const PBR::Shader &shader, const glm::mat4 &model)
+{
+    _set_model_material(context, shader, model);
+
+    context.model.draw(shader);
+}
+
+inline void PbrRenderer::_draw_model(const DrawModelContext &context, const PBR::Shader &shader, const glm::mat4 &model, const Frustum &frustum, CullingStats &stats, const glm::mat4 *previous_model)
+{
+    _set_model_material(context, shader, model, previous_model);
+
+    const std::vector<Mesh>& meshes = context.model.get_meshes();
+    for (size_t mesh = 0; mesh < meshes.size(); mesh++)
+    {
+        if (!_is_mesh_visible(meshes, mesh, model, frustum))
+            continue;
+
+        meshes[mesh].draw(shader);
+        stats.visibleMeshes++;
+    }
+}
+
+inline bool PbrRenderer::_is_mesh_visible(const std::vector<Mesh> &meshes, size_t mesh, const glm::mat4 &model, const Frustum &frustum)
+{
+    if (meshes.size() == 1)
+        return true;
+
+    const Bounds& bounds = meshes[mesh].get_bounds();
+    return transformAABB(bounds.center(), bounds.extents(), model).isOnFrustum(frustum);
+}
+
+inline void PbrRenderer::_set_model_material(const DrawModelContext &context, const PBR::Shader &shader, const glm::mat4 &model, const glm::mat4 *previous_model)
 {
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, context.albedo_map);
@@ -1311,12 +2056,15 @@ inline void PbrRenderer::_draw_model(const DrawModelContext &context, const PBR:
     shader.setInt("arm_map", 1);
     shader.setInt("normal_map", 3);
 
+    // Not present in the opaque variant, the calls are ignored there
+    shader.setFloat("opacity", context.opacity);
+    shader.setFloat("alphaCutoff", context.alpha_cutoff);
+
     shader.setMat4("model", model);
+    shader.setMat4("previousModel", previous_model ? *previous_model : model);
 
     glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
     shader.setMat3("normalMatrix", normalMatrix);
-
-    context.model.draw(shader);
 }
 
 inline void PbrRenderer::_draw_scene(const std::vector<DrawModelContext> &contexts, const PBR::Shader &shader, const std::vector<glm::mat4> models)
@@ -1334,6 +2082,536 @@ inline void PbrRenderer::_draw_scene(const std::vector<DrawSphereContext>& conte
     }
 }
 
+inline CullingStats PbrRenderer::_draw_scene(SceneGraph &scene, const Frustum &frustum, const glm::mat4 &view_projection, const CullingSettings &settings, const MaterialShaders &model_shaders, const MaterialShaders &sphere_shaders)
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    CullingStats stats;
+
+    auto update_start = Clock::now();
+
+    // Clean entities are skipped, so this is free when nothing moved
+    scene.root.updateSelfAndChild();
+
+    scene.drawables.clear();
+    scene.root.collectDrawable(scene.drawables);
+
+    // The graph does not change shape after it is built, so proxies line up with the drawables
+    if (scene.proxies.size() != scene.drawables.size())
+    {
+        scene.bvh.clear();
+        scene.proxies.clear();
+        for (size_t i = 0; i < scene.drawables.size(); i++)
+        {
+            scene.proxies.push_back(scene.bvh.insert(scene.drawables[i]->getGlobalAABB(), static_cast<uint32_t>(i)));
+        }
+    }
+
+    scene.world_bounds.clear();
+    for (size_t i = 0; i < scene.drawables.size(); i++)
+    {
+        const AABB bounds = scene.drawables[i]->getGlobalAABB();
+
+        // Entities that stay inside their fattened box leave the tree untouched
+        scene.bvh.move(scene.proxies[i], bounds);
+        scene.world_bounds.push_back(bounds);
+    }
+
+    // Last frame's matrices become the previous ones, a graph seen for the first time has no motion
+    scene.previous_models.swap(scene.current_models);
+    scene.current_models.clear();
+    for (const Entity* drawable : scene.drawables)
+    {
+        scene.current_models.push_back(drawable->transform.getModelMatrix());
+    }
+    if (scene.previous_models.size() != scene.current_models.size())
+        scene.previous_models = scene.current_models;
+
+    auto cull_start = Clock::now();
+
+    if (settings.use_bvh)
+    {
+        scene.visibility.assign((scene.drawables.size() + 63) / 64, 0);
+        scene.bvh.query(frustum, [&](uint32_t index) {
+            scene.visibility[index >> 6] |= uint64_t{ 1 } << (index & 63);
+        });
+    }
+    else
+    {
+        PBR::cull_aabbs(frustum, scene.world_bounds, scene.visibility);
+    }
+
+    auto cull_end = Clock::now();
+    stats.updateTime = std::chrono::duration<double, std::milli>(cull_start - update_start).count();
+    stats.cullTime = std::chrono::duration<double, std::milli>(cull_end - cull_start).count();
+
+    // Occluders in the frustum fill the software depth buffer, the tiles are rasterized on the thread pool
+    bool occlusion = settings.occlusion && !scene.occluders.empty();
+    if (occlusion)
+    {
+        occlusion_culler.begin_frame(view_projection);
+        for (const SceneGraph::Occluder& occluder : scene.occluders)
+        {
+            if (occluder.entity->getGlobalAABB().isOnFrustum(frustum))
+                occlusion_culler.add_occluder(*occluder.mesh, occluder.entity->transform.getModelMatrix());
+        }
+        occlusion_culler.rasterize(thread_pool);
+
+        stats.occluderTriangles = occlusion_culler.get_triangle_count();
+        stats.rasterTime = occlusion_culler.get_raster_time();
+    }
+
+    opaque_queue.clear();
+    masked_queue.clear();
+    transparent_queue.clear();
+
+    const glm::vec3 camera_position = camera.Position;
+    const glm::vec3 camera_front = camera.Front;
+
+    for (size_t i = 0; i < scene.drawables.size(); i++)
+    {
+        const Entity* entity = scene.drawables[i];
+        stats.totalEntities++;
+        stats.totalMeshes += entity->pModel ? static_cast<unsigned int>(entity->pModel->get_meshes().size()) : 1;
+
+        if (!PBR::is_visible(scene.visibility, i))
+            continue;
+
+        const glm::vec3 center = scene.world_bounds.get_center(i);
+        if (occlusion)
+        {
+            const glm::vec3 extents = scene.world_bounds.get_extents(i);
+            if (!occlusion_culler.is_visible(center - extents, center + extents))
+            {
+                stats.occludedEntities++;
+                continue;
+            }
+        }
+
+        // View depth of the bounds center is enough to order whole entities
+        const float depth = glm::dot(center - camera_position, camera_front);
+        const uint32_t index = static_cast<uint32_t>(i);
+        switch (scene.get_blend_mode(*entity))
+        {
+        case BlendMode::Masked:
+            masked_queue.push(depth, index);
+            break;
+        case BlendMode::Blended:
+            transparent_queue.push(depth, index);
+            break;
+        default:
+            opaque_queue.push(depth, index);
+            break;
+        }
+        stats.visibleEntities++;
+    }
+
+    opaque_queue.sort_front_to_back();
+    masked_queue.sort_front_to_back();
+    transparent_queue.sort_back_to_front();
+
+    // Timed on its own, time elapsed queries cannot nest
+    skinning_timer.begin();
+    _skin_visible(scene);
+    skinning_timer.end();
+
+    // After skinning, so the casters reuse the skinned meshes
+    if (shadows)
+        _draw_shadows(scene);
+
+    scene_timer.begin();
+
+    // Masked surfaces are left out, the prepass shader does not discard
+    if (scene.depth_prepass)
+    {
+        const PBR::Shader& static_depth_shader = shaders.at("depth_prepass_shader");
+        const PBR::Shader& skinned_depth_shader = shaders.at("depth_prepass_skinned_shader");
+
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        for (const PBR::DrawItem& item : opaque_queue)
+        {
+            _draw_depth(scene, *scene.drawables[item.index], static_depth_shader, skinned_depth_shader, &frustum);
+        }
+        glBindVertexArray(0);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        // Only the closest surface passes, and the depth buffer is already final
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    for (const PBR::DrawItem& item : opaque_queue)
+    {
+        _draw_entity(scene, item.index, model_shaders, sphere_shaders, frustum, stats);
+    }
+
+    if (scene.depth_prepass)
+    {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+
+    for (const PBR::DrawItem& item : masked_queue)
+    {
+        _draw_entity(scene, item.index, model_shaders, sphere_shaders, frustum, stats);
+    }
+
+    scene_timer.end();
+
+    return stats;
+}
+
+inline void PbrRenderer::_skin_visible(SceneGraph &scene)
+{
+    skinning_pass.clear();
+    scene.skinned_slots.assign(scene.animations.get_instance_count(), -1);
+
+    if (!compute_skinning)
+        return;
+
+    for (const PBR::RenderQueue* queue : { &opaque_queue, &masked_queue, &transparent_queue })
+    {
+        for (const PBR::DrawItem& item : *queue)
+        {
+            const Entity& entity = *scene.drawables[item.index];
+            if (!scene.is_skinned(entity))
+                continue;
+
+            const uint32_t palette_offset = scene.animations.get_palette_offset(static_cast<uint32_t>(entity.animationInstance));
+            scene.skinned_slots[entity.animationInstance] = static_cast<int>(skinning_pass.add(*entity.pModel, palette_offset));
+        }
+    }
+
+    skinning_pass.dispatch(shaders.at("skinning_shader"), scene.animations.get_palette_format() == PBR::PaletteFormat::DualQuaternions);
+}
+
+inline void PbrRenderer::_draw_shadows(const SceneGraph &scene)
+{
+    // Everything that is not animated is a static caster, any change to their bounds invalidates the caches
+    bool static_changed = &scene != shadow_scene;
+    size_t static_count = 0;
+    for (size_t i = 0; i < scene.drawables.size(); i++)
+    {
+        if (scene.is_skinned(*scene.drawables[i]))
+            continue;
+
+        const glm::vec3 bounds[2] = { scene.world_bounds.get_center(i), scene.world_bounds.get_extents(i) };
+        if (shadow_static_bounds.size() < static_count + 2)
+        {
+            shadow_static_bounds.resize(static_count + 2);
+            static_changed = true;
+        }
+        for (const glm::vec3& value : bounds)
+        {
+            if (shadow_static_bounds[static_count] != value)
+            {
+                shadow_static_bounds[static_count] = value;
+                static_changed = true;
+            }
+            static_count++;
+        }
+    }
+    if (shadow_static_bounds.size() != static_count)
+    {
+        shadow_static_bounds.resize(static_count);
+        static_changed = true;
+    }
+    shadow_scene = &scene;
+
+    if (static_changed)
+        shadow_map.invalidate_static();
+
+    int framebuffer;
+    int viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    const PBR::Shader& static_shader = shaders.at("shadow_depth_shader");
+    const PBR::Shader& skinned_shader = shaders.at("shadow_depth_skinned_shader");
+    const PBR::Shader& masked_shader = shaders.at("shadow_depth_masked_shader");
+    const PBR::Shader& masked_skinned_shader = shaders.at("shadow_depth_masked_skinned_shader");
+
+    for (int i = 0; i < PBR::CascadedShadowMap::CASCADES; i++)
+    {
+        const PBR::CascadedShadowMap::Cascade& cascade = shadow_map.get_cascade(i);
+
+        // Casters in the light box or between it and the light
+        PBR::cull_aabbs(cascade.bounds, scene.world_bounds, shadow_visibility);
+        shadow_static_casters.clear();
+        shadow_dynamic_casters.clear();
+        for (size_t drawable = 0; drawable < scene.drawables.size(); drawable++)
+        {
+            const Entity* entity = scene.drawables[drawable];
+            if (!PBR::is_visible(shadow_visibility, drawable) || scene.get_blend_mode(*entity) == BlendMode::Blended)
+                continue;
+
+            (scene.is_skinned(*entity) ? shadow_dynamic_casters : shadow_static_casters).push_back(entity);
+        }
+
+        auto draw_casters = [&](const std::vector<const Entity*>& casters) {
+            for (const PBR::Shader* shader : { &static_shader, &skinned_shader, &masked_shader, &masked_skinned_shader })
+            {
+                shader->use();
+                shader->setMat4("view", cascade.view);
+                shader->setMat4("projection", cascade.projection);
+            }
+            for (const Entity* entity : casters)
+            {
+                // Masked casters discard like their color pass, or foliage would cast solid cards
+                if (scene.get_blend_mode(*entity) == BlendMode::Masked)
+                    _draw_depth(scene, *entity, masked_shader, masked_skinned_shader, nullptr, true);
+                else
+                    _draw_depth(scene, *entity, static_shader, skinned_shader);
+            }
+            glBindVertexArray(0);
+        };
+
+        shadow_map.render(i, static_cast<unsigned int>(shadow_static_casters.size()), static_cast<unsigned int>(shadow_dynamic_casters.size()),
+            [&] { draw_casters(shadow_static_casters); },
+            [&] { draw_casters(shadow_dynamic_casters); });
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    glActiveTexture(GL_TEXTURE0 + 14);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map.get_texture());
+}
+
+inline void PbrRenderer::_draw_depth(const SceneGraph &scene, const Entity &entity, const PBR::Shader &static_shader, const PBR::Shader &skinned_shader, const Frustum *frustum, bool alpha_tested)
+{
+    const glm::mat4& model = entity.transform.getModelMatrix();
+    const int skinned_slot = scene.get_skinned_slot(entity);
+    const PBR::Shader& depth_shader = scene.is_skinned(entity) && skinned_slot < 0 ? skinned_shader : static_shader;
+    depth_shader.use();
+    depth_shader.setMat4("model", model);
+    _set_skinning(scene, entity, depth_shader);
+
+    if (alpha_tested)
+    {
+        unsigned int albedo_map;
+        float opacity, alpha_cutoff;
+        if (entity.pModel)
+        {
+            const DrawModelContext& context = scene.model_contexts[entity.materialIndex];
+            albedo_map = context.albedo_map;
+            opacity = context.opacity;
+            alpha_cutoff = context.alpha_cutoff;
+        }
+        else
+        {
+            const MaterialContext& material = scene.sphere_contexts[entity.materialIndex].material;
+            albedo_map = material.albedo_map;
+            opacity = material.opacity;
+            alpha_cutoff = material.alpha_cutoff;
+        }
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, albedo_map);
+        depth_shader.setInt("albedo_map", 0);
+        depth_shader.setFloat("opacity", opacity);
+        depth_shader.setFloat("alphaCutoff", alpha_cutoff);
+    }
+
+    if (entity.pModel)
+    {
+        const std::vector<Mesh>& meshes = entity.pModel->get_meshes();
+        for (size_t mesh = 0; mesh < meshes.size(); mesh++)
+        {
+            if (frustum && !_is_mesh_visible(meshes, mesh, model, *frustum))
+                continue;
+
+            // The skinned and the full vertex streams have the texture coordinates, the position only one not
+            if (skinned_slot >= 0)
+                skinning_pass.draw(static_cast<uint32_t>(skinned_slot + mesh), depth_shader);
+            else if (alpha_tested)
+                meshes[mesh].draw(depth_shader);
+            else
+                meshes[mesh].draw_depth();
+        }
+    }
+    else
+    {
+        const Sphere& sphere = scene.sphere_contexts[entity.materialIndex].sphere_info;
+        glBindVertexArray(alpha_tested ? sphere.VAO : sphere.depthVAO);
+        glDrawElements(GL_TRIANGLE_STRIP, sphere.indexCount, GL_UNSIGNED_INT, nullptr);
+    }
+}
+
+inline void PbrRenderer::_draw_entity(const SceneGraph &scene, size_t drawable, const MaterialShaders &model_shaders, const MaterialShaders &sphere_shaders, const Frustum &frustum, CullingStats &stats)
+{
+    const Entity& entity = *scene.drawables[drawable];
+    const glm::mat4& model = entity.transform.getModelMatrix();
+    const glm::mat4* previous_model = &scene.previous_models[drawable];
+
+    if (entity.pModel)
+    {
+        const DrawModelContext& context = scene.model_contexts[entity.materialIndex];
+
+        // Already skinned this frame, drawn like a static model with the same per mesh test
+        const int skinned_slot = scene.get_skinned_slot(entity);
+        if (skinned_slot >= 0)
+        {
+            const PBR::Shader& shader = model_shaders.get(context.blend_mode);
+            _set_probes(shader, scene.world_bounds.get_center(drawable));
+            _set_model_material(context, shader, model, previous_model);
+            const std::vector<Mesh>& meshes = entity.pModel->get_meshes();
+            for (size_t mesh = 0; mesh < meshes.size(); mesh++)
+            {
+                if (!_is_mesh_visible(meshes, mesh, model, frustum))
+                    continue;
+
+                skinning_pass.draw(static_cast<uint32_t>(skinned_slot + mesh), shader);
+                stats.visibleMeshes++;
+            }
+            return;
+        }
+
+        const PBR::Shader& shader = model_shaders.get(context.blend_mode, scene.is_skinned(entity));
+        _set_probes(shader, scene.world_bounds.get_center(drawable));
+        _set_skinning(scene, entity, shader);
+        _draw_model(context, shader, model, frustum, stats, previous_model);
+    }
+    else
+    {
+        const DrawSphereContext& context = scene.sphere_contexts[entity.materialIndex];
+        const PBR::Shader& shader = sphere_shaders.get(context.material.blend_mode);
+        _set_probes(shader, scene.world_bounds.get_center(drawable));
+        _draw_sphere(context, shader, model, previous_model);
+        stats.visibleMeshes++;
+    }
+}
+
+inline void PbrRenderer::_draw_transparent(const SceneGraph &scene, const Frustum &frustum, const MaterialShaders &model_shaders, const MaterialShaders &sphere_shaders, CullingStats &stats)
+{
+    if (transparent_queue.empty())
+        return;
+
+    // Blended surfaces are tested against the opaque depth but never hide each other,
+    // and leave the motion of what is behind them
+    glEnable(GL_BLEND);
+    glDepthMask(GL_FALSE);
+    glColorMaski(1, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    for (const PBR::DrawItem& item : transparent_queue)
+    {
+        _draw_entity(scene, item.index, model_shaders, sphere_shaders, frustum, stats);
+    }
+
+    glColorMaski(1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+}
+
+inline void PbrRenderer::_set_skinning(const SceneGraph &scene, const Entity &entity, const PBR::Shader &shader)
+{
+    if (!scene.is_skinned(entity))
+        return;
+
+    // The shader must be in use
+    shader.setUint("paletteOffset", scene.animations.get_palette_offset(static_cast<uint32_t>(entity.animationInstance)));
+    shader.setBool("dualQuaternions", scene.animations.get_palette_format() == PBR::PaletteFormat::DualQuaternions);
+}
+
+inline void PbrRenderer::_draw_outline(const SceneGraph &scene, const Entity &entity, const PBR::Shader &shader)
+{
+    const glm::mat4& model = entity.transform.getModelMatrix();
+
+    // Grow the object around the center of its bounds so the outline does not drift for off center pivots
+    const glm::vec3 center = entity.boundingVolume->center;
+    const glm::mat4 outline_model = model * glm::translate(glm::mat4{ 1.0f }, center) * glm::scale(glm::mat4{ 1.0f }, glm::vec3{ 1.04f }) * glm::translate(glm::mat4{ 1.0f }, -center);
+
+    auto draw_geometry = [&](const glm::mat4& matrix) {
+        shader.setMat4("model", matrix);
+        if (entity.pModel)
+        {
+            for (const Mesh& mesh : entity.pModel->get_meshes())
+            {
+                mesh.draw(shader);
+            }
+        }
+        else
+        {
+            const Sphere& sphere = scene.sphere_contexts[entity.materialIndex].sphere_info;
+            glBindVertexArray(sphere.VAO);
+            glDrawElements(GL_TRIANGLE_STRIP, sphere.indexCount, GL_UNSIGNED_INT, nullptr);
+            glBindVertexArray(0);
+        }
+    };
+
+    shader.use();
+    shader.setVec3("outlineColor", glm::vec3{ 1.0f, 0.6f, 0.1f });
+
+    // Mark the visible pixels of the object in the stencil buffer without touching the color
+    glStencilFunc(GL_ALWAYS, 1, 0xFF);
+    glStencilMask(0xFF);
+    glDepthFunc(GL_LEQUAL);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    draw_geometry(model);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    // Draw the grown object only where the object itself was not drawn
+    glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
+    glStencilMask(0x00);
+    glDisable(GL_DEPTH_TEST);
+    draw_geometry(outline_model);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glStencilMask(0xFF);
+    glStencilFunc(GL_ALWAYS, 0, 0xFF);
+}
+
+inline PBR::Ray PbrRenderer::_cursor_ray()
+{
+    double x, y;
+    glfwGetCursorPos(window, &x, &y);
+
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+
+    const glm::vec2 ndc{ 2.0f * static_cast<float>(x) / width - 1.0f, 1.0f - 2.0f * static_cast<float>(y) / height };
+
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), aspect_ratio, 0.1f, 100.0f);
+    glm::mat4 inverse_view_projection = glm::inverse(projection * camera.GetViewMatrix());
+
+    // Unproject the cursor on the near and far planes
+    glm::vec4 near = inverse_view_projection * glm::vec4{ ndc, -1.0f, 1.0f };
+    glm::vec4 far = inverse_view_projection * glm::vec4{ ndc, 1.0f, 1.0f };
+    glm::vec3 origin = glm::vec3{ near } / near.w;
+    glm::vec3 target = glm::vec3{ far } / far.w;
+
+    return { origin, glm::normalize(target - origin) };
+}
+
+inline const Entity* PbrRenderer::_pick_entity(const SceneGraph &scene, const PBR::Ray &ray)
+{
+    const Entity* closest = nullptr;
+    float closest_distance = std::numeric_limits<float>::max();
+
+    // The tree only returns candidates, the ray is then tested against the tight box in object space
+    scene.bvh.raycast(ray, closest_distance, [&](uint32_t index, float) {
+        const Entity* entity = scene.drawables[index];
+        const glm::mat4 inverse_model = glm::inverse(entity->transform.getModelMatrix());
+
+        // Affine transforms keep the ray parameter, so distances stay in world units
+        const glm::vec3 origin{ inverse_model * glm::vec4{ ray.origin, 1.0f } };
+        const glm::vec3 direction{ inverse_model * glm::vec4{ ray.direction, 0.0f } };
+
+        const AABB& bounds = *entity->boundingVolume;
+
+        float distance;
+        if (PBR::intersect_ray_aabb(origin, 1.0f / direction, bounds.center - bounds.extents, bounds.center + bounds.extents, closest_distance, distance))
+        {
+            closest = entity;
+            closest_distance = distance;
+        }
+        return closest_distance;
+    });
+
+    return closest;
+}
+
 inline void PbrRenderer::_draw_spheres(const Sphere& sphere, const PBR::Shader &shader)
 {
     for (size_t i = 0; i < 7; i++)
@@ -1366,22 +2644,248 @@ inline void PbrRenderer::_draw_spheres(const Sphere& sphere, const PBR::Shader &
     
 }
 
-inline void PbrRenderer::_set_environment(const EnvironmentContext &context, const PBR::Shader &shader)
+inline void PbrRenderer::_create_crowd(Model& model)
 {
-    glActiveTexture(GL_TEXTURE0 + 5);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, context.cube_map);
+    PBR::VertexAnimationTexture animation;
+    try
+    {
+        animation = PBR::bake_vertex_animation(model);
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << "Crowd: " << e.what() << '\n';
+        return;
+    }
 
-    glActiveTexture(GL_TEXTURE0 + 6);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, context.irradiance_map);
+    struct CrowdInstance{
+        glm::mat4 model;
+        glm::vec4 animation;
+    };
 
-    glActiveTexture(GL_TEXTURE0 + 7);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, context.prefilter_map);
+    // A grid of models about one unit tall, each turned and started at random
+    const Bounds& bounds = model.get_bounds();
+    const float scale = 1.0f / std::max(glm::length(bounds.max - bounds.min), 1e-4f);
+    const float spacing = 1.5f;
+
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+    std::uniform_real_distribution<float> offset(0.0f, animation.get_duration());
+    std::uniform_real_distribution<float> speed(0.8f, 1.2f);
+
+    std::vector<CrowdInstance> instances;
+    instances.reserve(CROWD_SIZE * CROWD_SIZE);
+    for (uint32_t z = 0; z < CROWD_SIZE; z++)
+    {
+        for (uint32_t x = 0; x < CROWD_SIZE; x++)
+        {
+            glm::mat4 matrix = glm::translate(glm::mat4{ 1.0f }, glm::vec3{ (x - CROWD_SIZE * 0.5f) * spacing, -1.0f, -(z * spacing) - 3.0f });
+            matrix = glm::rotate(matrix, glm::radians(angle(random)), glm::vec3{ 0.0f, 1.0f, 0.0f });
+            matrix = glm::rotate(matrix, glm::radians(-90.0f), glm::vec3{ 1.0f, 0.0f, 0.0f });
+            matrix = glm::scale(matrix, glm::vec3{ scale });
+            instances.push_back({ matrix, glm::vec4{ offset(random), speed(random), 0.0f, 0.0f } });
+        }
+    }
+
+    unsigned int instance_buffer;
+    glGenBuffers(1, &instance_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, instance_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof(CrowdInstance), instances.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    buffers.push_back(instance_buffer);
+
+    const std::string& name = model.get_name();
+    DrawModelContext material{ model, textures[name + "/albedo_map"], textures[name + "/arm_map"], textures[name + "/normal_map"] };
+    crowd = std::make_unique<Crowd>(Crowd{ material, std::move(animation), instance_buffer, static_cast<uint32_t>(instances.size()) });
+}
+
+inline void PbrRenderer::_draw_crowd(const Crowd &crowd, const PBR::Shader &shader, float time)
+{
+    _set_model_material(crowd.material, shader, glm::mat4{ 1.0f });
+
+    const PBR::VertexAnimationTexture& animation = crowd.animation;
+
+    glActiveTexture(GL_TEXTURE0 + 8);
+    glBindTexture(GL_TEXTURE_2D, animation.positions);
+
+    glActiveTexture(GL_TEXTURE0 + 9);
+    glBindTexture(GL_TEXTURE_2D, animation.normals);
+
+    shader.setInt("vatPositions", 8);
+    shader.setInt("vatNormals", 9);
+    shader.setInt("vatWidth", static_cast<int>(animation.width));
+    shader.setInt("vatRowsPerFrame", static_cast<int>(animation.rows_per_frame));
+    shader.setInt("vatFrameCount", static_cast<int>(animation.frame_count));
+    shader.setFloat("vatFrameRate", animation.frame_rate);
+    shader.setFloat("time", time);
+    shader.setFloat("previousTime", time - deltaTime);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CROWD_INSTANCE_BINDING, crowd.instance_buffer);
+
+    // One instanced draw per mesh, the whole crowd costs as many draw calls as a single model
+    const std::vector<Mesh>& meshes = crowd.material.model.get_meshes();
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        shader.setInt("vatMeshBase", static_cast<int>(animation.get_mesh_base(i)));
+        meshes[i].draw_instanced(crowd.instance_count);
+    }
+}
+
+inline void PbrRenderer::_scatter_lights(SceneGraph& scene, int count)
+{
+    // Same seed every time, so moving the slider back gives the same lights
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> horizontal(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> height(0.2f, 4.0f);
+    std::uniform_real_distribution<float> color(0.2f, 1.0f);
+    std::uniform_real_distribution<float> direction(-0.5f, 0.5f);
+
+    // Short falloff, each light covers a few units around it
+    const glm::vec3 attenuation{ 1.0f, 2.0f, 10.0f };
+
+    scene.lights.clear();
+    scene.lights.reserve(count);
+    for (int i = 0; i < count; i++)
+    {
+        const glm::vec3 position{ horizontal(random), height(random), horizontal(random) };
+        const glm::vec3 radiance = glm::vec3{ color(random), color(random), color(random) } * 4.0f;
+
+        // Every fourth light is a spot pointing down
+        if (i % 4 == 3)
+        {
+            PBR::SpotLight spot{ position, glm::vec3{ direction(random), -1.0f, direction(random) }, std::cos(glm::radians(25.0f)), std::cos(glm::radians(35.0f)), glm::vec3{ 0.0f }, radiance, radiance, attenuation };
+            scene.lights.push_back(PBR::pack_light(spot));
+        }
+        else
+        {
+            PBR::PointLight point{ position, glm::vec3{ 0.0f }, radiance, radiance, attenuation };
+            scene.lights.push_back(PBR::pack_light(point));
+        }
+    }
+}
+
+inline void PbrRenderer::_shade_gbuffer(unsigned int quadVAO, const PBR::Shader &shader, const glm::mat4 &view_projection, const glm::vec2 &render_size)
+{
+    lighting_timer.begin();
+
+    // Depth first, the sky box and the forward passes after this test against it
+    gbuffer.blit_depth(hdr_target.get_framebuffer());
+    gbuffer.blit_velocity(hdr_target.get_framebuffer(), GL_COLOR_ATTACHMENT1);
+
+    gbuffer.bind_textures(10);
 
+    shader.use();
+    shader.setInt("gAlbedo", 10);
+    shader.setInt("gMaterial", 11);
+    shader.setInt("gNormal", 12);
+    shader.setInt("gDepth", 13);
+    shader.setMat4("inverseViewProjection", glm::inverse(view_projection));
+    shader.setVec2("gbufferScale", render_size / glm::vec2{ gbuffer.get_width(), gbuffer.get_height() });
+
+    // Every covered pixel is shaded exactly once, the background is discarded
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glColorMaski(1, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glBindVertexArray(quadVAO);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+    glColorMaski(1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+
+    lighting_timer.end();
+}
+
+inline void PbrRenderer::_resolve_hdr(unsigned int quadVAO, const PBR::Shader &shader, unsigned int color, const glm::vec2 &render_scale)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, hdr_target.get_width(), hdr_target.get_height());
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, color);
+
+    shader.use();
+    shader.setInt("hdrBuffer", 0);
+    shader.setVec2("renderScale", render_scale);
+    shader.setInt("upscaleFilter", upscale_filter);
+    shader.setFloat("exposure", exposure);
+    shader.setInt("tonemapper", tonemapper);
+
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(quadVAO);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+}
+
+inline void PbrRenderer::_set_environment(const PBR::Shader &shader)
+{
     shader.use();
 
     shader.setInt("cube_map", 5);
     shader.setInt("irradiance_map", 6);
     shader.setInt("prefilter_map", 7);
+    shader.setInt("previous_irradiance_map", 16);
+    shader.setInt("previous_prefilter_map", 17);
+    shader.setFloat("environmentBlend", 1.0f);
+
+    shader.setInt("probe_maps", REFLECTION_PROBE_UNIT);
+    shader.setInt("probeFirst", -1);
+    shader.setInt("probeSecond", -1);
+    shader.setFloat("probeWeight", 1.0f);
+}
+
+inline void PbrRenderer::_set_probes(const PBR::Shader &shader, const glm::vec3 &position)
+{
+    int first, second;
+    float weight;
+    reflection_probes.select(position, first, second, weight);
+
+    shader.use();
+    shader.setInt("probeFirst", first);
+    shader.setInt("probeSecond", second);
+    shader.setFloat("probeWeight", weight);
+}
+
+inline void PbrRenderer::_draw_probe_capture(const SceneGraph &scene, const MaterialShaders &model_shaders, const MaterialShaders &sphere_shaders)
+{
+    for (const Entity* entity : scene.drawables)
+    {
+        const BlendMode mode = scene.get_blend_mode(*entity);
+        if (scene.is_skinned(*entity) || mode == BlendMode::Blended)
+            continue;
+
+        const glm::mat4& model = entity->transform.getModelMatrix();
+        if (entity->pModel)
+            _draw_model(scene.model_contexts[entity->materialIndex], model_shaders.get(mode), model);
+        else
+            _draw_sphere(scene.sphere_contexts[entity->materialIndex], sphere_shaders.get(mode), model);
+    }
+}
+
+inline void PbrRenderer::_bind_environment()
+{
+    const PBR::EnvironmentLibrary::Maps& current = environments.get_current();
+    const PBR::EnvironmentLibrary::Maps& previous = environments.get_previous();
+
+    glActiveTexture(GL_TEXTURE0 + 5);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, current.cube_map);
+
+    glActiveTexture(GL_TEXTURE0 + 6);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, current.irradiance_map);
+
+    glActiveTexture(GL_TEXTURE0 + 7);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, current.prefilter_map);
+
+    glActiveTexture(GL_TEXTURE0 + 15);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, previous.cube_map);
+
+    glActiveTexture(GL_TEXTURE0 + 16);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, previous.irradiance_map);
+
+    glActiveTexture(GL_TEXTURE0 + 17);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, previous.prefilter_map);
+
+    glActiveTexture(GL_TEXTURE0);
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -1524,7 +3028,24 @@ static Sphere createSphere()
 
     glBindVertexArray(0);
 
-    return {sphereVAO, indexCount};
+    // Packed positions sharing the index buffer, used by the depth prepass
+    unsigned int depthVAO, positionVBO;
+    glGenVertexArrays(1, &depthVAO);
+    glGenBuffers(1, &positionVBO);
+
+    glBindVertexArray(depthVAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+    glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+    glBindVertexArray(0);
+
+    return {sphereVAO, indexCount, depthVAO};
 }
 
 static unsigned int createCube(){
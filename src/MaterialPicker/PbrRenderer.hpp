@@ -2,19 +2,12 @@
 
 #include <map>
 #include "Model.hpp"
+#include "HdrTarget.hpp"
+#include "EnvironmentLibrary.hpp"
 
 #include <future>
 
 static glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
-static glm::mat4 captureViews[] =
-{
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)),
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f))
-};
 
 struct Sphere{
     unsigned int VAO;
@@ -95,6 +88,11 @@ private:
     std::map<std::string, PBR::Shader> shaders;
     std::vector<unsigned int> buffers;
 
+    // The sphere and the sky box are lit into the HDR target, one pass tonemaps it into the window
+    PBR::HdrTarget hdr_target;
+    float exposure{ 1.0f };
+    // 0: Reinhard, 1: ACES fit, the order of the shader
+    int tonemapper{ 0 };
 
     float deltaTime{ 0.0f };
     float lastFrame{ 0.0f };
@@ -141,6 +139,8 @@ private:
 
 
     void _set_environment(const EnvironmentContext& context, const PBR::Shader& shader);
+    // Exposure, tonemapping and sRGB encoding of the HDR target into the default framebuffer
+    void _resolve_hdr(unsigned int quadVAO, const PBR::Shader& shader);
 
 };
 
@@ -197,6 +197,8 @@ inline void PbrRenderer::run()
     PBR::Shader background_shader = shaders["background_shader"];
     PBR::Shader pbr_shader = shaders["pbr_shader"];
     PBR::Shader texture_maps_shader = shaders["texture_maps_shader"];
+    PBR::Shader post_process_shader = shaders["post_process_shader"];
+    unsigned int quadVAO = VAO["quadVAO"];
 
     Sphere sphere = createSphere();
     buffers.emplace_back(sphere.VAO);
@@ -283,6 +285,9 @@ inline void PbrRenderer::run()
 
     background_shader.use();
     background_shader.setInt("environmentMap", 5);
+    // A single environment, nothing to fade from
+    background_shader.setInt("previousEnvironmentMap", 15);
+    background_shader.setFloat("environmentBlend", 1.0f);
 
     int material_index = 0;
     int texture_index = 0;
@@ -306,6 +311,12 @@ inline void PbrRenderer::run()
         
         _process_input();
 
+        // Resized only together with the window
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        hdr_target.resize(std::max(width, 1), std::max(height, 1));
+        hdr_target.bind();
+
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -325,8 +336,17 @@ inline void PbrRenderer::run()
         {
             _draw_sphere(context, pbr_shader);
         }
-        else
+
+        // Draw the cube map
+        draw_cubemap();
+
+        _resolve_hdr(quadVAO, post_process_shader);
+
+        // The maps are data, shown as they are after tonemapping over the display image
+        if(show_texture_maps)
         {
+            glClear(GL_DEPTH_BUFFER_BIT);
+
             glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
             glm::mat4 view = camera.GetViewMatrix();
 
@@ -366,9 +386,6 @@ inline void PbrRenderer::run()
             glBindVertexArray(0);
         }
 
-        // Draw the cube map
-        draw_cubemap();
-
 
         // Boiler Plate code 
         ImGui::Begin("Debug Console");
@@ -382,6 +399,10 @@ inline void PbrRenderer::run()
         ImGui::ColorEdit3("Light Diffuse", glm::value_ptr(diffuse));
         ImGui::ColorEdit3("Light Specular", glm::value_ptr(specular));
 
+        ImGui::SliderFloat("Exposure", &exposure, 0.1f, 8.0f);
+        const char* tonemappers[] = { "Reinhard", "ACES Fit" };
+        ImGui::Combo("Tonemapper", &tonemapper, tonemappers, IM_ARRAYSIZE(tonemappers));
+
         ImGui::Text("Materials");
 
         if (ImGui::BeginCombo("##1", materials[material_index])) {
@@ -542,7 +563,8 @@ inline void PbrRenderer::_clear_GL_resources()
 
     // Delete buffer
     glDeleteBuffers(buffers.size(), buffers.data());
-    
+
+    hdr_target.release();
 }
 
 inline void PbrRenderer::_gen_GL_resourcess()
@@ -570,6 +592,7 @@ inline void PbrRenderer::_gen_GL_resourcess()
     shaders.insert({"prefilter_shader", prefilter_shader});
     shaders.insert({"brdf_shader", brdf_shader});
     shaders.insert({"texture_maps_shader", texture_maps_shader});
+    shaders.insert({"post_process_shader", PBR::Shader{ "shaders/post_process.shader" }});
 
     // ---------- Vertex Attribute Arrays ----------
     unsigned int cubeVAO = createCube();
@@ -596,13 +619,10 @@ inline void PbrRenderer::_load_GL_textures()
 inline void PbrRenderer::_load_GL_cubemaps()
 {
     // ---------- Cube Map Textures ----------  
+    // Only the environment the picker shows, the others are baked by the main renderer on demand
     unsigned int hdr_texture = hdr_texture_from_file("resources/textures/hdr/newport_loft.hdr");
-    unsigned int golden_bay_hdr_texture = hdr_texture_from_file("resources/textures/hdr/golden_bay.hdr");
-    unsigned int satara_night_hdr_texture = hdr_texture_from_file("resources/textures/hdr/satara_night.hdr");
 
     textures.insert({"hdr_texture", hdr_texture});
-    textures.insert({"golden_bay/hdr_texture", golden_bay_hdr_texture});
-    textures.insert({"satara_night/hdr_texture", golden_bay_hdr_texture});
 
     
     // _generate_brdfLUT_texture("brdfLUT");
@@ -612,13 +632,7 @@ inline void PbrRenderer::_load_GL_cubemaps()
     _load_cubemap();
 
     unsigned int hdr_cube_map = _generate_cubemap("hdr_cube_map", hdr_texture);
-    unsigned int golden_bay_hdr_cube_map = _generate_cubemap("golden_bay/hdr_cube_map", golden_bay_hdr_texture);
-    unsigned int satara_night_hdr_cube_map = _generate_cubemap("satara_night/hdr_cube_map", satara_night_hdr_texture);
 
-    _generate_irradiance_map("golden_bay/irradiance_map", golden_bay_hdr_cube_map);
-    _generate_prefilter_map("golden_bay/prefilter_map", golden_bay_hdr_cube_map);
-    _generate_irradiance_map("satara_night/irradiance_map", satara_night_hdr_cube_map);
-    _generate_prefilter_map("satara_night/prefilter_map", satara_night_hdr_cube_map);
     _generate_irradiance_map("irradiance_map", hdr_cube_map);
     _generate_prefilter_map("prefilter_map", hdr_cube_map);
 }
@@ -716,16 +730,9 @@ inline unsigned int PbrRenderer::_generate_cubemap(std::string_view name, unsign
 
     std::cout << "Generating Cube Map Texture: " << name << std::endl;
 
-    unsigned int captureFBO,captureRBO;
+    // No depth attachment, a layered framebuffer needs every attachment layered and the inside of the cube is all there is
+    unsigned int captureFBO;
     glGenFramebuffers(1, &captureFBO);
-    glGenRenderbuffers(1, &captureRBO);
-    
-
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 1024, 1024);
 
     unsigned int envCubemap;
     glGenTextures(1, &envCubemap);
@@ -742,34 +749,35 @@ inline unsigned int PbrRenderer::_generate_cubemap(std::string_view name, unsign
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    // The prefilter reads the mips
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     PBR::Shader e_map_to_cube_map_shader = shaders["e_map_to_cube_map_shader"];
     unsigned int skyBoxVAO = VAO["skyBoxVAO"];
 
     // convert HDR equirectangular environment map to cubemap equivalent
-    e_map_to_cube_map_shader.use();
+    PBR::EnvironmentLibrary::set_capture_uniforms(e_map_to_cube_map_shader, captureProjection);
     e_map_to_cube_map_shader.setInt("equirectangularMap", 0);
-    e_map_to_cube_map_shader.setMat4("projection", captureProjection);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture);
 
     glViewport(0, 0, 1024, 1024); // don’t forget to configure the viewport
     glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
 
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        e_map_to_cube_map_shader.setMat4("view", captureViews[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // All six faces in one draw, the geometry shader picks the layer
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, envCubemap, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-        glBindVertexArray(skyBoxVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-    }
+    glBindVertexArray(skyBoxVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
     glBindVertexArray(0);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &captureFBO);
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
     textures.insert({name.data(), envCubemap});
 
@@ -781,15 +789,8 @@ inline void PbrRenderer::_generate_irradiance_map(std::string_view name, unsigne
 
     std::cout << "Generating Irradiance Map Texture: " << name << std::endl;
 
-    unsigned int captureFBO,captureRBO;
+    unsigned int captureFBO;
     glGenFramebuffers(1, &captureFBO);
-    glGenRenderbuffers(1, &captureRBO);
-    
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
 
 
     unsigned int irradianceMap;
@@ -810,9 +811,8 @@ inline void PbrRenderer::_generate_irradiance_map(std::string_view name, unsigne
     PBR::Shader irradiance_shader = shaders["irradiance_shader"];
     unsigned int skyBoxVAO = VAO["skyBoxVAO"];
 
-    irradiance_shader.use();
+    PBR::EnvironmentLibrary::set_capture_uniforms(irradiance_shader, captureProjection);
     irradiance_shader.setInt("environmentMap", 0);
-    irradiance_shader.setMat4("projection", captureProjection);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
@@ -820,18 +820,15 @@ inline void PbrRenderer::_generate_irradiance_map(std::string_view name, unsigne
     
     glViewport(0, 0, 32, 32); // don't forget to configure the viewport to the capture dimensions.
     glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        irradiance_shader.setMat4("view", captureViews[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glBindVertexArray(skyBoxVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, irradianceMap, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-    }
+    glBindVertexArray(skyBoxVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glBindVertexArray(0);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &captureFBO);
 
     textures.insert({name.data(), irradianceMap});
 
@@ -842,17 +839,8 @@ inline void PbrRenderer::_generate_prefilter_map(std::string_view name, unsigned
 
     std::cout << "Generating Prefilter Map Texture: " << name << std::endl;
 
-    unsigned int captureFBO,captureRBO;
+    unsigned int captureFBO;
     glGenFramebuffers(1, &captureFBO);
-    glGenRenderbuffers(1, &captureRBO);
-
-
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 128, 128);
-    
 
     unsigned int prefilterMap;
     glGenTextures(1, &prefilterMap);
@@ -866,7 +854,8 @@ inline void PbrRenderer::_generate_prefilter_map(std::string_view name, unsigned
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    // The roughness picks the mip
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
@@ -875,10 +864,6 @@ inline void PbrRenderer::_generate_prefilter_map(std::string_view name, unsigned
     PBR::Shader prefilter_shader = shaders["prefilter_shader"];
     unsigned int skyBoxVAO = VAO["skyBoxVAO"];
 
-    prefilter_shader.use();
-    prefilter_shader.setInt("environmentMap", 0);
-    prefilter_shader.setMat4("projection", captureProjection);
-
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
 
@@ -889,24 +874,24 @@ inline void PbrRenderer::_generate_prefilter_map(std::string_view name, unsigned
         unsigned int mipWidth = static_cast<unsigned int>(128 * std::pow(0.5, mip));
         unsigned int mipHeight = static_cast<unsigned int>(128 * std::pow(0.5, mip));
 
-        glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
         glViewport(0, 0, mipWidth, mipHeight);
 
-        float roughness = (float)mip / (float)(maxMipLevels - 1);
-        prefilter_shader.setFloat("roughness", roughness);
-        for (size_t i = 0; i < 6; i++)
-        {
-            prefilter_shader.setMat4("view", captureViews[i]);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, 0);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Same sample counts as the main renderer's bake, the source is the 1024 environment
+        PBR::EnvironmentLibrary::set_prefilter_uniforms(prefilter_shader, mip, maxMipLevels, 1024, mipWidth,
+            PBR::EnvironmentLibrary::DEFAULT_PREFILTER_SAMPLES[mip]);
+        PBR::EnvironmentLibrary::set_capture_uniforms(prefilter_shader, captureProjection);
 
-            glBindVertexArray(skyBoxVAO);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
-        }
+        // One draw per mip, every face of it
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, prefilterMap, mip);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        glBindVertexArray(skyBoxVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
     }
+    glBindVertexArray(0);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &captureFBO);
 
     textures.insert({name.data(), prefilterMap});
 
@@ -1195,6 +1180,27 @@ inline void PbrRenderer::_draw_spheres(const Sphere& sphere, const PBR::Shader &
     
 }
 
+inline void PbrRenderer::_resolve_hdr(unsigned int quadVAO, const PBR::Shader &shader)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    hdr_target.bind_color(0);
+
+    shader.use();
+    shader.setInt("hdrBuffer", 0);
+    // Always rendered at the window size
+    shader.setVec2("renderScale", glm::vec2{ 1.0f });
+    shader.setInt("upscaleFilter", 0);
+    shader.setFloat("exposure", exposure);
+    shader.setInt("tonemapper", tonemapper);
+
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(quadVAO);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+}
+
 inline void PbrRenderer::_set_environment(const EnvironmentContext &context, const PBR::Shader &shader)
 {
     glActiveTexture(GL_TEXTURE0 + 5);
@@ -1206,11 +1212,30 @@ inline void PbrRenderer::_set_environment(const EnvironmentContext &context, con
     glActiveTexture(GL_TEXTURE0 + 7);
     glBindTexture(GL_TEXTURE_CUBE_MAP, context.prefilter_map);
 
+    // The shaders can fade between two environments, the picker has one so both are the same
+    glActiveTexture(GL_TEXTURE0 + 15);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, context.cube_map);
+
+    glActiveTexture(GL_TEXTURE0 + 16);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, context.irradiance_map);
+
+    glActiveTexture(GL_TEXTURE0 + 17);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, context.prefilter_map);
+
     shader.use();
 
     shader.setInt("cube_map", 5);
     shader.setInt("irradiance_map", 6);
     shader.setInt("prefilter_map", 7);
+    shader.setInt("previous_irradiance_map", 16);
+    shader.setInt("previous_prefilter_map", 17);
+    shader.setFloat("environmentBlend", 1.0f);
+
+    // No reflection probes, the sampler still needs a unit of its own
+    shader.setInt("probe_maps", 18);
+    shader.setInt("probeFirst", -1);
+    shader.setInt("probeSecond", -1);
+    shader.setFloat("probeWeight", 1.0f);
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)